@@ -30,6 +30,7 @@
  */
 
 #include "buffer.h"
+#include "cache_ram.h"
 #include "ffmpegfs.h"
 #include "logging.h"
 
@@ -37,11 +38,47 @@
 #include <sys/mman.h>
 #include <libgen.h>
 #include <cstring>
+#include <thread>
+#include <chrono>
+#include <fcntl.h>
+
+static std::mutex   idle_mutex;     /**< @brief Protects idle_files and idle_bytes */
+static uint32_t     idle_files;     /**< @brief Number of idle segments kept mapped by all buffers */
+static size_t       idle_bytes;     /**< @brief Size of idle segments kept mapped by all buffers */
+
+/**
+ * @brief Add the hash of a chunk to a file checksum.
+ * @param[in] hash - Current hash of the file.
+ * @param[in] chunk_hash - hash64 of the next chunk.
+ * @return Returns the new hash, finish with hash64_final().
+ */
+static uint64_t add_chunk_hash(uint64_t hash, uint64_t chunk_hash)
+{
+    return hash64_update(hash, reinterpret_cast<const uint8_t *>(&chunk_hash), sizeof(chunk_hash));
+}
 
 // Initially Buffer is empty. It will be allocated as needed.
 Buffer::Buffer()
     : m_cur_ci(nullptr)
     , m_cur_open(0)
+    , m_map_seq(0)
+    , m_readers(0)
+    , m_remap_depth(0)
+    , m_frame_map_frames(0)
+    , m_lockfree_reads(0)
+    , m_locked_reads(0)
+    , m_remap_waits(0)
+    , m_resume{0, 0, 0, 0}
+    , m_fragments(0)
+    , m_wb_pos(0)
+    , m_wb_done(0)
+    , m_wb_dropped(0)
+    , m_wb_written(0)
+    , m_wb_max_dirty(0)
+    , m_wb_max_backlog(0)
+    , m_wb_waits(0)
+    , m_wb_wait_time(0)
+    , m_wb_drop_allowed(true)
 {
 }
 
@@ -51,6 +88,42 @@ Buffer::~Buffer()
     release();
 }
 
+Buffer::Remap_Guard::Remap_Guard(Buffer *buffer)
+    : m_lock(buffer->m_mutex)
+    , m_buffer(buffer)
+{
+    if (m_buffer->m_remap_depth++)
+    {
+        // Nested section, readers are already locked out
+        return;
+    }
+
+    // Make generation odd: new readers will take the locked path
+    m_buffer->m_map_seq.fetch_add(1);
+
+    // Wait for readers already copying from the old mapping
+    if (m_buffer->m_readers.load())
+    {
+        ++m_buffer->m_remap_waits;
+
+        while (m_buffer->m_readers.load())
+        {
+            std::this_thread::yield();
+        }
+    }
+}
+
+Buffer::Remap_Guard::~Remap_Guard()
+{
+    if (--m_buffer->m_remap_depth)
+    {
+        return;
+    }
+
+    // Make generation even again: mapping is stable
+    m_buffer->m_map_seq.fetch_add(1);
+}
+
 VIRTUALTYPE Buffer::type() const
 {
     return VIRTUALTYPE::BUFFER;
@@ -86,12 +159,26 @@ bool Buffer::open_file(uint32_t segment_no, uint32_t flags, size_t defaultsize)
 
     CACHEINFO & ci = m_ci[index];
 
+    if (remove_idle(index) && (flags & CACHE_FLAG_RW))
+    {
+        // Nobody reads it, will be rewritten: start over
+        if (!unmap_segment(index))
+        {
+            return false;
+        }
+    }
+
     ci.m_flags |= flags;
 
     if (ci.m_fd != -1)
     {
         Logging::trace(ci.m_cachefile, "Cache file is already open.");
 
+        if (flags & CACHE_FLAG_RW)
+        {
+            ci.m_writable = true;
+        }
+
         if (defaultsize)
         {
             // Make sure the requested size is available
@@ -104,6 +191,12 @@ bool Buffer::open_file(uint32_t segment_no, uint32_t flags, size_t defaultsize)
     if (flags & CACHE_FLAG_RW)
     {
         Logging::debug(ci.m_cachefile, "Writing to cache file.");
+
+        if (ram_cache != nullptr)
+        {
+            // File will be rewritten, memory copy is stale
+            ram_cache->remove(ci.m_cachefile);
+        }
     }
     else
     {
@@ -114,6 +207,8 @@ bool Buffer::open_file(uint32_t segment_no, uint32_t flags, size_t defaultsize)
     bool isdefaultsize  = false;
     uint8_t *p          = nullptr;
 
+    Remap_Guard remap_guard(this);
+
     if (!map_file(ci.m_cachefile, &ci.m_fd, &p, &filesize, &isdefaultsize, defaultsize, (flags & CACHE_FLAG_RW) ? true : false))
     {
         return false;
@@ -126,8 +221,10 @@ bool Buffer::open_file(uint32_t segment_no, uint32_t flags, size_t defaultsize)
 
     ci.m_buffer_size        = filesize;
     ci.m_buffer             = static_cast<uint8_t*>(p);
+    ci.m_writable           = (flags & CACHE_FLAG_RW) ? true : false;
     ci.m_buffer_write_size  = 0;
     ci.m_buffer_writes      = 0;
+    ci.publish();
 
     ++m_cur_open;   // track open files
 
@@ -161,12 +258,31 @@ bool Buffer::close_file(uint32_t segment_no, uint32_t flags)
         return true;
     }
 
+    remove_idle(index);
+
+    if (flags == CACHE_FLAG_RO && keep_idle(index))
+    {
+        // The last reader is done. Keep the mapping for the next one.
+        return true;
+    }
+
     Logging::trace(ci.m_cachefile, "Closing cache file.");
 
+    return unmap_segment(index);
+}
+
+bool Buffer::unmap_segment(uint32_t index)
+{
+    CACHEINFO & ci = m_ci[index];
+
+    Remap_Guard remap_guard(this);
+
     bool success = unmap_file(ci.m_cachefile, &ci.m_fd, &ci.m_buffer, ci.m_buffer_size, &ci.m_buffer_watermark);
 
     ci.m_buffer_pos    = 0;
     ci.m_buffer_size   = 0;
+    ci.m_writable      = false;
+    ci.publish();
 
     if (success && m_cur_open > 0)
     {
@@ -176,6 +292,73 @@ bool Buffer::close_file(uint32_t segment_no, uint32_t flags)
     return success;
 }
 
+bool Buffer::keep_idle(uint32_t index)
+{
+    CACHEINFO & ci = m_ci[index];
+
+    if (ci.m_writable || !params.m_hls_mapped_files || ci.m_buffer_size > params.m_hls_mapped_size)
+    {
+        return false;
+    }
+
+    for (;;)
+    {
+        {
+            std::lock_guard<std::mutex> lock_idle_mutex(idle_mutex);
+
+            if (idle_files < params.m_hls_mapped_files && idle_bytes + ci.m_buffer_size <= params.m_hls_mapped_size)
+            {
+                idle_files++;
+                idle_bytes += ci.m_buffer_size;
+                break;
+            }
+        }
+
+        if (m_idle.empty())
+        {
+            // Idle segments of other files use up the limits
+            return false;
+        }
+
+        // Make room by dropping our least recently used segment
+        uint32_t oldest = m_idle.back();
+
+        remove_idle(oldest);
+        unmap_segment(oldest);
+    }
+
+    Logging::trace(ci.m_cachefile, "Keeping idle cache file mapped.");
+
+    m_idle.push_front(index);
+
+    return true;
+}
+
+bool Buffer::remove_idle(uint32_t index)
+{
+    for (std::list<uint32_t>::iterator it = m_idle.begin(); it != m_idle.end(); ++it)
+    {
+        if (*it == index)
+        {
+            m_idle.erase(it);
+
+            std::lock_guard<std::mutex> lock_idle_mutex(idle_mutex);
+
+            idle_files--;
+            idle_bytes -= m_ci[index].m_buffer_size;
+            return true;
+        }
+    }
+    return false;
+}
+
+void Buffer::set_cache_root(const std::string & cache_root)
+{
+    std::lock_guard<std::recursive_mutex> lock_mutex(m_mutex);
+
+    m_cache_root = cache_root;
+}
+
 bool Buffer::init(bool erase_cache)
 {
     std::lock_guard<std::recursive_mutex> lock_mutex(m_mutex);
@@ -185,6 +368,9 @@ bool Buffer::init(bool erase_cache)
         return true;
     }
 
+    // The segment layout changes, keep lock-free readers out
+    Remap_Guard remap_guard(this);
+
     bool success = true;
 
     try
@@ -198,7 +384,7 @@ bool Buffer::init(bool erase_cache)
 
                 for (uint32_t segment_no = 1; segment_no <= virtualfile()->get_segment_count(); segment_no++)
                 {
-                    make_cachefile_name(&m_ci[segment_no - 1].m_cachefile, filename() + "." + make_filename(segment_no, params.current_format(virtualfile())->fileext()), params.current_format(virtualfile())->fileext(), false);
+                    make_cachefile_name(&m_ci[segment_no - 1].m_cachefile, filename() + "." + make_filename(segment_no, params.current_format(virtualfile())->fileext()), params.current_format(virtualfile())->fileext(), false, m_cache_root);
                 }
             }
             else
@@ -213,11 +399,11 @@ bool Buffer::init(bool erase_cache)
             // All other formats: create just a single segment.
             m_ci.resize(1);
 
-            make_cachefile_name(&m_ci[0].m_cachefile, filename(), params.current_format(virtualfile())->fileext(), false);
+            make_cachefile_name(&m_ci[0].m_cachefile, filename(), params.current_format(virtualfile())->fileext(), false, m_cache_root);
             if ((virtualfile()->m_flags & VIRTUALFLAG_FRAME))
             {
                 // Create extra index cash for frame sets only
-                make_cachefile_name(&m_ci[0].m_cachefile_idx, filename(), params.current_format(virtualfile())->fileext(), true);
+                make_cachefile_name(&m_ci[0].m_cachefile_idx, filename(), params.current_format(virtualfile())->fileext(), true, m_cache_root);
             }
         }
 
@@ -282,6 +468,8 @@ bool Buffer::init(bool erase_cache)
 
             m_ci[0].m_buffer_size_idx     = filesize;
             m_ci[0].m_buffer_idx          = static_cast<uint8_t*>(p);
+
+            build_frame_map();
         }
     }
     catch (bool _success)
@@ -310,6 +498,9 @@ bool Buffer::set_segment(uint32_t segment_no, size_t size)
         return false;
     }
 
+    // m_cur_ci changes, keep lock-free readers out
+    Remap_Guard remap_guard(this);
+
     if (!close_file(current_segment_no(), CACHE_FLAG_RW))
     {
         return false;
@@ -322,6 +513,8 @@ bool Buffer::set_segment(uint32_t segment_no, size_t size)
 
     m_cur_ci = &m_ci[segment_no - 1];
 
+    writeback_reset();
+
     // Reserve enough buffer space for segment to avoid frequent resizes
     return reserve(size);
 }
@@ -372,7 +565,7 @@ bool Buffer::cachefile_valid(uint32_t segment_no)
 {
     std::lock_guard<std::recursive_mutex> lock_mutex(m_mutex);
 
-    LPCCACHEINFO ci = const_cacheinfo(segment_no);
+    LPCACHEINFO ci = cacheinfo(segment_no);
 
     if (ci == nullptr)
     {
@@ -380,28 +573,323 @@ bool Buffer::cachefile_valid(uint32_t segment_no)
         return false;
     }
 
+    if (ci->m_valid && ci->m_fd != -1)
+    {
+        // Found valid before and still mapped by us: the mapping stays
+        // intact even if the file is replaced on disk, no need to check.
+        errno = 0;
+        return true;
+    }
+
     struct stat sb;
     if (stat(ci->m_cachefile.c_str(), &sb) == -1)
     {
+        ci->m_valid = false;
         return false;
     }
 
     if (!S_ISREG(sb.st_mode))
     {
+        ci->m_valid = false;
         errno = EINVAL;
         return false;
     }
 
     if (sb.st_size <= 0)
     {
+        ci->m_valid = false;
         errno = ENODATA;
         return false;
     }
 
+    if (ci->m_valid &&
+            sb.st_mtim.tv_sec == ci->m_valid_mtime.tv_sec &&
+            sb.st_mtim.tv_nsec == ci->m_valid_mtime.tv_nsec &&
+            sb.st_size == ci->m_valid_size)
+    {
+        // Unchanged since last check
+        errno = 0;
+        return true;
+    }
+
+    // First check or file has changed. While we have the file open it may
+    // still be larger than its contents, otherwise the size must match the
+    // size recorded with the checksum. Contents are verified by the scrubber.
+    if (ci->m_checksum_size && ci->m_fd == -1 && static_cast<uint64_t>(sb.st_size) != ci->m_checksum_size)
+    {
+        Logging::warning(ci->m_cachefile, "Cache file size %1 does not match recorded size %2.", static_cast<uint64_t>(sb.st_size), ci->m_checksum_size);
+        ci->m_valid = false;
+        errno = EIO;
+        return false;
+    }
+
+    ci->m_valid         = true;
+    ci->m_valid_mtime   = sb.st_mtim;
+    ci->m_valid_size    = sb.st_size;
+
     errno = 0;
     return true;
 }
 
+void Buffer::get_checksums(CHECKSUM_VEC *checksums)
+{
+    std::lock_guard<std::recursive_mutex> lock_mutex(m_mutex);
+
+    if (!segment_count())
+    {
+        return;
+    }
+
+    checksums->resize(m_ci.size());
+
+    for (size_t n = 0; n < m_ci.size(); n++)
+    {
+        (*checksums)[n].m_size      = m_ci[n].m_checksum_size;
+        (*checksums)[n].m_checksum  = m_ci[n].m_checksum;
+    }
+}
+
+void Buffer::set_checksums(const CHECKSUM_VEC & checksums)
+{
+    std::lock_guard<std::recursive_mutex> lock_mutex(m_mutex);
+
+    for (size_t n = 0; n < m_ci.size(); n++)
+    {
+        if (n < checksums.size())
+        {
+            m_ci[n].m_checksum_size = checksums[n].m_size;
+            m_ci[n].m_checksum      = checksums[n].m_checksum;
+        }
+        else
+        {
+            m_ci[n].m_checksum_size = 0;
+            m_ci[n].m_checksum      = 0;
+        }
+        m_ci[n].m_valid = false;
+    }
+}
+
+bool Buffer::open_resume(size_t offset, size_t defaultsize)
+{
+    std::lock_guard<std::recursive_mutex> lock_mutex(m_mutex);
+
+    if (m_ci.size() != 1 || !offset)
+    {
+        errno = EINVAL;
+        return false;
+    }
+
+    CACHEINFO & ci = m_ci[0];
+
+    remove_idle(0);
+
+    // The mapping and write position change, keep lock-free readers out
+    Remap_Guard remap_guard(this);
+
+    if (ci.m_fd == -1)
+    {
+        size_t filesize     = 0;
+        bool isdefaultsize  = false;
+        uint8_t *p          = nullptr;
+
+        if (!map_file(ci.m_cachefile, &ci.m_fd, &p, &filesize, &isdefaultsize, 0, false))
+        {
+            return false;
+        }
+
+        ci.m_buffer_size        = isdefaultsize ? 0 : filesize;
+        ci.m_buffer             = static_cast<uint8_t*>(p);
+        ci.m_buffer_write_size  = 0;
+        ci.m_buffer_writes      = 0;
+
+        if (ci.m_buffer_size < offset)
+        {
+            // Not what the index says, cannot resume
+            ci.m_buffer_size = filesize;
+            ci.m_buffer_watermark = 0;
+            unmap_segment(0);
+            errno = EINVAL;
+            return false;
+        }
+
+        ++m_cur_open;   // track open files
+    }
+    else if (ci.m_buffer_size < offset)
+    {
+        errno = EINVAL;
+        return false;
+    }
+
+    if (ram_cache != nullptr)
+    {
+        // File will be rewritten, memory copy is stale
+        ram_cache->remove(ci.m_cachefile);
+    }
+
+    Logging::debug(ci.m_cachefile, "Resuming to write cache file at offset %1.", offset);
+
+    // The header will be written again, anything after the resume point is incomplete.
+    ci.m_flags              |= CACHE_FLAG_RW;
+    ci.m_writable           = true;
+    ci.m_buffer_pos         = 0;
+    ci.m_buffer_watermark   = offset;
+    ci.m_seg_finished       = false;
+    ci.m_chunk_hash.clear();
+    ci.m_chunk_stale.clear();
+    ci.publish();
+
+    m_cur_ci = &ci;
+
+    writeback_reset();
+
+    if (defaultsize)
+    {
+        // Make sure the requested size is available
+        return reserve(defaultsize);
+    }
+
+    return true;
+}
+
+void Buffer::truncate_at_pos()
+{
+    std::lock_guard<std::recursive_mutex> lock_mutex(m_mutex);
+
+    if (m_cur_ci == nullptr)
+    {
+        return;
+    }
+
+    m_cur_ci->m_buffer_watermark = m_cur_ci->m_buffer_pos;
+    m_cur_ci->publish();
+}
+
+void Buffer::set_resume_point(const RESUME_POINT & resume_point)
+{
+    std::lock_guard<std::recursive_mutex> lock_mutex(m_mutex);
+
+    m_resume    = resume_point;
+    m_fragments = resume_point.m_fragment;
+}
+
+Buffer::RESUME_POINT Buffer::resume_point() const
+{
+    return m_resume;
+}
+
+void Buffer::start_fragment(int64_t time, bool sync_point)
+{
+    std::lock_guard<std::recursive_mutex> lock_mutex(m_mutex);
+
+    if (sync_point && time != AV_NOPTS_VALUE && time != m_resume.m_time && m_cur_ci != nullptr)
+    {
+        // Everything before this fragment is complete
+        m_resume.m_offset   = m_cur_ci->m_buffer_pos;
+        m_resume.m_time     = time;
+        m_resume.m_fragment = m_fragments;
+    }
+
+    m_fragments++;
+}
+
+int Buffer::verify_checksum(const std::string & cachefile, const CHECKSUM & checksum, size_t max_rate, const std::atomic_bool *cancel)
+{
+    if (!checksum.m_size)
+    {
+        errno = ENODATA;
+        return -1;
+    }
+
+    int fd = ::open(cachefile.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+    {
+        return -1;
+    }
+
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    std::vector<uint8_t> data(CHECKSUM_CHUNK_SIZE);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    uint64_t hash   = 0;
+    uint64_t total  = 0;
+    int result      = -1;
+    int _errno      = 0;
+
+    for (;;)
+    {
+        if (cancel != nullptr && *cancel)
+        {
+            _errno = ECANCELED;
+            break;
+        }
+
+        // Fill the whole chunk, the checksum is made up of the hashes of the chunks
+        size_t bytes = 0;
+        while (bytes < data.size())
+        {
+            ssize_t n = ::read(fd, data.data() + bytes, data.size() - bytes);
+            if (n == -1)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                _errno = errno;
+                break;
+            }
+            if (!n)
+            {
+                break;
+            }
+            bytes += static_cast<size_t>(n);
+        }
+
+        if (_errno)
+        {
+            break;
+        }
+
+        if (bytes)
+        {
+            hash = add_chunk_hash(hash, hash64_update(0, data.data(), bytes));
+        }
+        total += bytes;
+
+        if (bytes < data.size())
+        {
+            // End of file
+            result = (total == checksum.m_size && hash64_final(hash, total) == checksum.m_checksum) ? 1 : 0;
+            break;
+        }
+
+        if (total > checksum.m_size)
+        {
+            // File has grown, no need to read on
+            result = 0;
+            break;
+        }
+
+        if (max_rate)
+        {
+            // Throttle to max_rate bytes per second
+            std::chrono::microseconds due(static_cast<int64_t>(total * 1000000 / max_rate));
+            std::chrono::microseconds elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+            if (due > elapsed)
+            {
+                std::this_thread::sleep_for(due - elapsed);
+            }
+        }
+    }
+
+    // Do not let verification push hot files out of the page cache
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+
+    ::close(fd);
+
+    errno = _errno;
+    return result;
+}
+
 bool Buffer::invalidate_segment(uint32_t segment_no)
 {
     std::lock_guard<std::recursive_mutex> lock_mutex(m_mutex);
@@ -416,12 +904,21 @@ bool Buffer::invalidate_segment(uint32_t segment_no)
 
     bool success = true;
 
+    Remap_Guard remap_guard(this);
+
     ci->m_seg_finished      = false;
     ci->m_buffer_pos        = 0;
     ci->m_buffer_watermark  = 0;
     ci->m_buffer_write_size = 0;
     ci->m_buffer_writes     = 0;
     ci->m_flags             = 0;
+    ci->m_checksum_size     = 0;
+    ci->m_checksum          = 0;
+    ci->m_chunk_hash.clear();
+    ci->m_chunk_stale.clear();
+    ci->m_valid             = false;
+
+    remove_idle(segment_no ? segment_no - 1 : static_cast<uint32_t>(ci - m_ci.data()));
 
     if (ci->m_fd != -1 || ci->m_buffer != nullptr)
     {
@@ -439,6 +936,7 @@ bool Buffer::invalidate_segment(uint32_t segment_no)
     ci->m_buffer_pos        = 0;
     ci->m_buffer_watermark  = 0;
     ci->m_buffer_size       = 0;
+    ci->publish();
 
     if (!remove_file(ci->m_cachefile))
     {
@@ -448,6 +946,7 @@ bool Buffer::invalidate_segment(uint32_t segment_no)
     if (segment_no == 0 && ci->m_buffer_idx != nullptr && ci->m_buffer_size_idx)
     {
         std::memset(ci->m_buffer_idx, 0, ci->m_buffer_size_idx);
+        clear_frame_map();
     }
 
     return success;
@@ -606,6 +1105,19 @@ bool Buffer::release(int flags /*= CACHE_CLOSE_NOOPT*/)
         return true;
     }
 
+    uint64_t lockfree_reads = m_lockfree_reads.load();
+    uint64_t locked_reads   = m_locked_reads.load();
+
+    if (lockfree_reads || locked_reads)
+    {
+        Logging::debug(filename(), "Buffer reads: %1 lock-free, %2 locked. Remaps waiting for readers: %3.", lockfree_reads, locked_reads, m_remap_waits.load());
+    }
+
+    if (m_wb_written.load())
+    {
+        Logging::debug(filename(), "Writeback: %1 written back, max. %2 dirty and %3 in writeback. Writer waited %4 times for %5.", format_size(m_wb_written.load()).c_str(), format_size(m_wb_max_dirty.load()).c_str(), format_size(m_wb_max_backlog.load()).c_str(), m_wb_waits.load(), format_duration(static_cast<int64_t>(m_wb_wait_time.load())).c_str());
+    }
+
     // Write active cache to disk
     flush();
 
@@ -627,6 +1139,11 @@ bool Buffer::release(int flags /*= CACHE_CLOSE_NOOPT*/)
     // Remove index for frame sets. There is only one.
     if (!m_ci[0].m_cachefile_idx.empty())
     {
+        Remap_Guard remap_guard(this);
+
+        m_frame_map.reset();
+        m_frame_map_frames = 0;
+
         if (!unmap_file(m_ci[0].m_cachefile_idx, &m_ci[0].m_fd_idx, &m_ci[0].m_buffer_idx, m_ci[0].m_buffer_size_idx, &m_ci[0].m_buffer_size_idx))
         {
             success = false;
@@ -651,7 +1168,7 @@ bool Buffer::remove_cachefile(uint32_t segment_no) const
     return success;
 }
 
-bool Buffer::flush()
+bool Buffer::flush(bool durable /*= false*/)
 {
     std::lock_guard<std::recursive_mutex> lock_mutex(m_mutex);
 
@@ -661,6 +1178,44 @@ bool Buffer::flush()
         return false;
     }
 
+    if (durable)
+    {
+        // Unlike sync_file_range(), fdatasync() also writes the file size
+        if (fdatasync(m_cur_ci->m_fd) == -1)
+        {
+            Logging::error(m_cur_ci->m_cachefile, "Could not sync to disk: (%1) %2", errno, strerror(errno));
+            return false;
+        }
+
+        if (m_cur_ci->m_fd_idx != -1 && fdatasync(m_cur_ci->m_fd_idx) == -1)
+        {
+            Logging::error(m_cur_ci->m_cachefile_idx, "Could not sync to disk: (%1) %2", errno, strerror(errno));
+            return false;
+        }
+
+        if (params.m_writeback_chunk)
+        {
+            // Everything is on disk now
+            m_wb_pos = m_wb_done = std::max(m_wb_pos, m_cur_ci->m_buffer_watermark);
+        }
+
+        return true;
+    }
+
+    if (params.m_writeback_chunk)
+    {
+        // Let the kernel write the rest in the background instead of waiting for it
+        writeback(true);
+
+        if (m_cur_ci->m_fd_idx != -1 && sync_file_range(m_cur_ci->m_fd_idx, 0, 0, SYNC_FILE_RANGE_WRITE) == -1)
+        {
+            Logging::error(m_cur_ci->m_cachefile_idx, "Could not start writeback: (%1) %2", errno, strerror(errno));
+            return false;
+        }
+
+        return true;
+    }
+
     if (msync(m_cur_ci->m_buffer, m_cur_ci->m_buffer_size, MS_SYNC) == -1)
     {
         Logging::error(m_cur_ci->m_cachefile, "Could not sync to disk: (%1) %2", errno, strerror(errno));
@@ -681,21 +1236,45 @@ bool Buffer::flush()
 
 bool Buffer::clear()
 {
-    std::lock_guard<std::recursive_mutex> lock_mutex(m_mutex);
+    // Files will be truncated, keep lock-free readers out
+    Remap_Guard remap_guard(this);
 
     bool success = true;
 
+    m_resume    = RESUME_POINT();
+    m_fragments = 0;
+
     for (CACHEINFO & ci : m_ci)
     {
+        uint32_t index = static_cast<uint32_t>(&ci - m_ci.data());
+
+        if (remove_idle(index))
+        {
+            // Nobody reads it. Drop it from the idle accounting before its size is
+            // reset, and unmap it: the read-only mapping cannot be written to.
+            unmap_segment(index);
+        }
+
         ci.m_buffer_pos        = 0;
         ci.m_buffer_watermark  = 0;
         ci.m_buffer_size       = 0;
         ci.m_seg_finished      = false;
         ci.m_buffer_write_size = 0;
         ci.m_buffer_writes     = 0;
+        ci.m_checksum_size     = 0;
+        ci.m_checksum          = 0;
+        ci.m_chunk_hash.clear();
+        ci.m_chunk_stale.clear();
+        ci.m_valid             = false;
+        ci.publish();
 
         if (ci.m_fd != -1)
         {
+            if (ram_cache != nullptr)
+            {
+                ram_cache->remove(ci.m_cachefile);
+            }
+
             // If empty set file size to 1 page
             long filesize = sysconf(_SC_PAGESIZE);
 
@@ -713,6 +1292,7 @@ bool Buffer::clear()
         if (ci.m_fd_idx != -1)
         {
             std::memset(ci.m_buffer_idx, 0, ci.m_buffer_size_idx);
+            clear_frame_map();
         }
     }
 
@@ -743,16 +1323,21 @@ bool Buffer::reserve(size_t size)
         return true;
     }
 
+    // The mapping may move, keep lock-free readers out
+    Remap_Guard remap_guard(this);
+
     m_cur_ci->m_buffer = static_cast<uint8_t*>(mremap(m_cur_ci->m_buffer, m_cur_ci->m_buffer_size, size, MREMAP_MAYMOVE));
     if (m_cur_ci->m_buffer == MAP_FAILED)
     {
         Logging::error(m_cur_ci->m_cachefile, "Error calling mremap() to resize the file: (%1) %2 (fd = %3) Old size: %4 New: %5", errno, strerror(errno), m_cur_ci->m_fd, m_cur_ci->m_buffer_size, size);
         m_cur_ci->m_buffer = nullptr;
+        m_cur_ci->publish();
         return false;
     }
 
     // Save size
     m_cur_ci->m_buffer_size = size;
+    m_cur_ci->publish();
 
     if (ftruncate(m_cur_ci->m_fd, static_cast<off_t>(m_cur_ci->m_buffer_size)) == -1)
     {
@@ -784,7 +1369,13 @@ size_t Buffer::writeio(const uint8_t* data, size_t length)
         m_cur_ci->m_buffer_writes++;
 
         std::memcpy(write_ptr, data, length);
+        hash_written(m_cur_ci->m_buffer_pos, length);
         increment_pos(length);
+
+        // Data is in place, make it visible to lock-free readers
+        m_cur_ci->publish();
+
+        writeback(false);
     }
 
     return length;
@@ -808,6 +1399,11 @@ size_t Buffer::write_frame(const uint8_t *data, size_t length, uint32_t frame_no
 
     old_image_frame = reinterpret_cast<LPIMAGE_FRAME>(m_cur_ci->m_buffer_idx + start);
 
+    if (ram_cache != nullptr)
+    {
+        ram_cache->remove(Cache_Ram::frame_key(m_cur_ci->m_cachefile, frame_no));
+    }
+
     if (old_image_frame->m_frame_no && (old_image_frame->m_size <= static_cast<uint32_t>(length)))
     {
         // Frame already exists and has enough space
@@ -841,6 +1437,12 @@ size_t Buffer::write_frame(const uint8_t *data, size_t length, uint32_t frame_no
         std::memcpy(reinterpret_cast<void *>(m_cur_ci->m_buffer_idx + start), &new_image_frame, sizeof(IMAGE_FRAME));
     }
 
+    // Publish the frame only after its image and index entry have been written
+    if (m_frame_map != nullptr && frame_no <= m_frame_map_frames)
+    {
+        m_frame_map[(frame_no - 1) / 64].fetch_or(1ULL << ((frame_no - 1) % 64), std::memory_order_release);
+    }
+
     return bytes_written;
 }
 
@@ -910,6 +1512,7 @@ int Buffer::seek(int64_t offset, int whence, uint32_t segment_no)
     if (seek_pos > static_cast<off_t>(size(segment_no)))
     {
         ci->m_buffer_pos = size(segment_no);  // Cannot go beyond EOF. Set position to end, leave errno untouched.
+        ci->m_pub_pos.store(ci->m_buffer_pos, std::memory_order_release);
         return 0;
     }
 
@@ -920,6 +1523,7 @@ int Buffer::seek(int64_t offset, int whence, uint32_t segment_no)
     }
 
     ci->m_buffer_pos = static_cast<size_t>(seek_pos);
+    ci->m_pub_pos.store(ci->m_buffer_pos, std::memory_order_release);
     return 0;
 }
 
@@ -938,7 +1542,7 @@ size_t Buffer::tell(uint32_t segment_no) const
         return 0;
     }
 
-    return ci->m_buffer_pos;
+    return ci->m_pub_pos.load(std::memory_order_acquire);
 }
 
 int64_t Buffer::duration() const
@@ -974,7 +1578,7 @@ size_t Buffer::buffer_watermark(uint32_t segment_no) const
         return 0;
     }
 
-    return ci->m_buffer_watermark;
+    return ci->m_pub_watermark.load(std::memory_order_acquire);
 }
 
 bool Buffer::copy(std::vector<uint8_t> * out_data, size_t offset, uint32_t segment_no)
@@ -984,6 +1588,15 @@ bool Buffer::copy(std::vector<uint8_t> * out_data, size_t offset, uint32_t segme
 
 bool Buffer::copy(uint8_t* out_data, size_t offset, size_t bufsize, uint32_t segment_no)
 {
+    if (copy_lockfree(out_data, offset, bufsize, segment_no))
+    {
+        ++m_lockfree_reads;
+        return true;
+    }
+
+    // Remap in progress or range not mapped: take the slow path, which also reports errors
+    ++m_locked_reads;
+
     std::lock_guard<std::recursive_mutex> lock_mutex(m_mutex);
 
     LPCCACHEINFO ci = const_cacheinfo(segment_no);
@@ -1028,6 +1641,180 @@ bool Buffer::copy(uint8_t* out_data, size_t offset, size_t bufsize, uint32_t seg
     }
 }
 
+bool Buffer::copy_lockfree(uint8_t* out_data, size_t offset, size_t bufsize, uint32_t segment_no)
+{
+    bool success = false;
+
+    // Register as reader before checking the generation, so a remapper either
+    // sees us and waits, or we see its odd generation and back off.
+    m_readers.fetch_add(1);
+
+    if (!(m_map_seq.load() & 1))
+    {
+        LPCCACHEINFO ci = const_cacheinfo(segment_no);
+
+        if (ci != nullptr)
+        {
+            const uint8_t * buffer  = ci->m_pub_buffer.load(std::memory_order_acquire);
+            size_t segment_size     = ci->m_pub_size.load(std::memory_order_acquire);
+
+            if (buffer != nullptr && segment_size > offset)
+            {
+                if (segment_size < offset + bufsize)
+                {
+                    bufsize = segment_size - offset - 1;
+                }
+
+                std::memcpy(out_data, buffer + offset, bufsize);
+
+                success = true;
+            }
+        }
+    }
+
+    m_readers.fetch_sub(1);
+
+    return success;
+}
+
+void Buffer::read_stats(uint64_t *lockfree_reads, uint64_t *locked_reads, uint64_t *remap_waits) const
+{
+    *lockfree_reads = m_lockfree_reads.load();
+    *locked_reads   = m_locked_reads.load();
+    *remap_waits    = m_remap_waits.load();
+}
+
+void Buffer::writeback_stats(uint64_t *written, uint64_t *max_dirty, uint64_t *max_backlog, uint64_t *waits, uint64_t *wait_time) const
+{
+    *written        = m_wb_written.load();
+    *max_dirty      = m_wb_max_dirty.load();
+    *max_backlog    = m_wb_max_backlog.load();
+    *waits          = m_wb_waits.load();
+    *wait_time      = m_wb_wait_time.load();
+}
+
+void Buffer::writeback(bool finish)
+{
+    if (!params.m_writeback_chunk || m_cur_ci == nullptr || m_cur_ci->m_fd == -1)
+    {
+        return;
+    }
+
+    const size_t head = m_cur_ci->m_buffer_watermark;
+
+    if (head < m_wb_pos)
+    {
+        // File has been cleared and is written anew
+        writeback_reset();
+    }
+
+    size_t dirty = head - m_wb_pos;
+
+    if (dirty > m_wb_max_dirty.load())
+    {
+        m_wb_max_dirty.store(dirty);
+    }
+
+    if (!finish && dirty < params.m_writeback_chunk)
+    {
+        return;
+    }
+
+    // Hand full chunks to the kernel, the tail is still being written to
+    size_t length = finish ? dirty : dirty - dirty % params.m_writeback_chunk;
+
+    if (length)
+    {
+        if (sync_file_range(m_cur_ci->m_fd, static_cast<off_t>(m_wb_pos), static_cast<off_t>(length), SYNC_FILE_RANGE_WRITE) == -1)
+        {
+            Logging::warning(m_cur_ci->m_cachefile, "Could not start writeback: (%1) %2", errno, strerror(errno));
+            return;
+        }
+
+        m_wb_pos        += length;
+        m_wb_written    += length;
+    }
+
+    size_t backlog = m_wb_pos - m_wb_done;
+
+    if (backlog > m_wb_max_backlog.load())
+    {
+        m_wb_max_backlog.store(backlog);
+    }
+
+    if (!finish && backlog > params.m_writeback_max_dirty)
+    {
+        // Too much pending: wait for all but the latest chunk to reach the disk
+        size_t end = m_wb_pos - std::min(length, m_wb_pos - m_wb_done);
+        auto start_time = std::chrono::steady_clock::now();
+
+        if (end > m_wb_done)
+        {
+            if (sync_file_range(m_cur_ci->m_fd, static_cast<off_t>(m_wb_done), static_cast<off_t>(end - m_wb_done), SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER) == -1)
+            {
+                Logging::warning(m_cur_ci->m_cachefile, "Could not wait for writeback: (%1) %2", errno, strerror(errno));
+                return;
+            }
+
+            m_wb_done = end;
+            m_wb_waits++;
+            m_wb_wait_time += static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start_time).count());
+        }
+    }
+
+    if (params.m_writeback_drop_behind && m_wb_drop_allowed && head > params.m_writeback_drop_behind)
+    {
+        // Pages on disk and far enough behind the write head are cold: free the page cache
+        const size_t pagesize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        size_t end = std::min(m_wb_done, head - params.m_writeback_drop_behind);
+
+        end -= end % pagesize;
+
+        if (end > m_wb_dropped + params.m_writeback_chunk)
+        {
+            madvise(m_cur_ci->m_buffer + m_wb_dropped, end - m_wb_dropped, MADV_DONTNEED);
+            posix_fadvise(m_cur_ci->m_fd, static_cast<off_t>(m_wb_dropped), static_cast<off_t>(end - m_wb_dropped), POSIX_FADV_DONTNEED);
+            m_wb_dropped = end;
+        }
+    }
+}
+
+void Buffer::hash_written(size_t offset, size_t length)
+{
+    std::vector<uint64_t> & chunk_hash  = m_cur_ci->m_chunk_hash;
+    std::vector<bool> & chunk_stale     = m_cur_ci->m_chunk_stale;
+    const size_t hashed                 = chunk_hash.size() * CHECKSUM_CHUNK_SIZE;
+
+    if (length && offset < hashed)
+    {
+        // Rewritten, e.g. a header updated at the end: hash again when finished
+        const size_t last = std::min(offset + length, hashed) - 1;
+
+        for (size_t n = offset / CHECKSUM_CHUNK_SIZE; n <= last / CHECKSUM_CHUNK_SIZE; n++)
+        {
+            chunk_stale[n] = true;
+        }
+    }
+
+    while ((chunk_hash.size() + 1) * CHECKSUM_CHUNK_SIZE <= m_cur_ci->m_buffer_watermark)
+    {
+        chunk_hash.push_back(hash64_update(0, m_cur_ci->m_buffer + chunk_hash.size() * CHECKSUM_CHUNK_SIZE, CHECKSUM_CHUNK_SIZE));
+        chunk_stale.push_back(false);
+    }
+}
+
+void Buffer::allow_drop_behind(bool allow)
+{
+    m_wb_drop_allowed = allow;
+}
+
+void Buffer::writeback_reset()
+{
+    m_wb_pos        = 0;
+    m_wb_done       = 0;
+    m_wb_dropped    = 0;
+}
+
 bool Buffer::reallocate(size_t newsize)
 {
     if (newsize > size())
@@ -1070,9 +1857,16 @@ const std::string & Buffer::cachefile(uint32_t segment_no) const
     return ci->m_cachefile;
 }
 
-const std::string & Buffer::make_cachefile_name(std::string * cachefile, const std::string & filename, const std::string & fileext, bool is_idx)
+const std::string & Buffer::make_cachefile_name(std::string * cachefile, const std::string & filename, const std::string & fileext, bool is_idx, const std::string & cache_root)
 {
-    transcoder_cache_path(cachefile);
+    if (cache_root.empty())
+    {
+        transcoder_cache_path(cachefile);
+    }
+    else
+    {
+        *cachefile = cache_root;
+    }
 
     *cachefile += params.m_mountpath;
     *cachefile += filename;
@@ -1092,6 +1886,11 @@ const std::string & Buffer::make_cachefile_name(std::string * cachefile, const s
 
 bool Buffer::remove_file(const std::string & filename)
 {
+    if (ram_cache != nullptr)
+    {
+        ram_cache->remove(filename);
+    }
+
     if (unlink(filename.c_str()) && errno != ENOENT)
     {
         Logging::warning(filename, "Cannot unlink the file: (%1) %2", errno, strerror(errno));
@@ -1160,21 +1959,170 @@ void Buffer::closeio()
 
 bool Buffer::have_frame(uint32_t frame_no)
 {
-    std::lock_guard<std::recursive_mutex> lock_mutex(m_mutex);
+    int present = -1;
+
+    // Same protocol as copy_lockfree(): the frame map is only replaced inside remap sections
+    m_readers.fetch_add(1);
+
+    if (!(m_map_seq.load() & 1))
+    {
+        present = test_frame(frame_no);
+    }
+
+    m_readers.fetch_sub(1);
+
+    if (present < 0)
+    {
+        std::lock_guard<std::recursive_mutex> lock_mutex(m_mutex);
 
-    if (m_cur_ci->m_buffer_idx == nullptr || frame_no < 1 || frame_no > virtualfile()->m_video_frame_count)
+        present = test_frame(frame_no);
+    }
+
+    if (present < 0)
     {
         // Invalid parameter
         errno = EINVAL;
         return false;
     }
 
-    LPCIMAGE_FRAME image_frame;
-    size_t start = static_cast<size_t>(frame_no - 1) * sizeof(IMAGE_FRAME);
+    return (present ? true : false);
+}
 
-    image_frame = reinterpret_cast<LPCIMAGE_FRAME>(m_cur_ci->m_buffer_idx + start);
+uint32_t Buffer::next_missing_frame(uint32_t frame_no)
+{
+    uint32_t missing_frame_no = 0;
+
+    m_readers.fetch_add(1);
+
+    if (!(m_map_seq.load() & 1))
+    {
+        missing_frame_no = find_missing_frame(frame_no);
+    }
+
+    m_readers.fetch_sub(1);
+
+    if (!missing_frame_no)
+    {
+        std::lock_guard<std::recursive_mutex> lock_mutex(m_mutex);
+
+        missing_frame_no = find_missing_frame(frame_no);
+    }
 
-    return (image_frame->m_frame_no ? true : false);
+    if (!missing_frame_no)
+    {
+        // Invalid parameter
+        errno = EINVAL;
+    }
+
+    return missing_frame_no;
+}
+
+void Buffer::build_frame_map()
+{
+    uint32_t frames = virtualfile()->m_video_frame_count;
+    size_t words    = (static_cast<size_t>(frames) + 63) / 64;
+    uint32_t found  = 0;
+
+    m_frame_map.reset(new (std::nothrow) std::atomic_uint64_t[words]);
+    m_frame_map_frames = 0;
+
+    if (m_frame_map == nullptr)
+    {
+        // Not fatal, have_frame() will report all frames missing
+        Logging::error(m_ci[0].m_cachefile_idx, "Out of memory allocating the frame map.");
+        return;
+    }
+
+    // The index is the persistent copy of the map: frames that have been written have a frame number.
+    for (size_t word = 0; word < words; word++)
+    {
+        uint64_t bits = 0;
+
+        for (size_t bit = 0; bit < 64; bit++)
+        {
+            size_t start = (word * 64 + bit) * sizeof(IMAGE_FRAME);
+
+            if (word * 64 + bit >= frames || start + sizeof(IMAGE_FRAME) > m_ci[0].m_buffer_size_idx)
+            {
+                break;
+            }
+
+            LPCIMAGE_FRAME image_frame = reinterpret_cast<LPCIMAGE_FRAME>(m_ci[0].m_buffer_idx + start);
+
+            if (image_frame->m_frame_no)
+            {
+                bits |= 1ULL << bit;
+                found++;
+            }
+        }
+
+        m_frame_map[word].store(bits, std::memory_order_relaxed);
+    }
+
+    m_frame_map_frames = frames;
+
+    Logging::trace(m_ci[0].m_cachefile_idx, "Rebuilt frame map: %1 of %2 frames in cache.", found, frames);
+}
+
+void Buffer::clear_frame_map()
+{
+    size_t words = (static_cast<size_t>(m_frame_map_frames) + 63) / 64;
+
+    for (size_t word = 0; m_frame_map != nullptr && word < words; word++)
+    {
+        m_frame_map[word].store(0, std::memory_order_release);
+    }
+}
+
+int Buffer::test_frame(uint32_t frame_no) const
+{
+    if (m_frame_map == nullptr || frame_no < 1 || frame_no > m_frame_map_frames)
+    {
+        return -1;
+    }
+
+    uint64_t bits = m_frame_map[(frame_no - 1) / 64].load(std::memory_order_acquire);
+
+    return ((bits >> ((frame_no - 1) % 64)) & 1) ? 1 : 0;
+}
+
+uint32_t Buffer::find_missing_frame(uint32_t frame_no) const
+{
+    if (m_frame_map == nullptr || frame_no < 1)
+    {
+        return 0;
+    }
+
+    if (frame_no > m_frame_map_frames)
+    {
+        return m_frame_map_frames + 1;
+    }
+
+    size_t bit      = frame_no - 1;
+    size_t word     = bit / 64;
+    size_t words    = (static_cast<size_t>(m_frame_map_frames) + 63) / 64;
+    // Invert, so missing frames are set bits. Mask off frames before the start.
+    uint64_t missing = ~m_frame_map[word].load(std::memory_order_acquire) & (~0ULL << (bit % 64));
+
+    while (!missing)
+    {
+        if (++word >= words)
+        {
+            return m_frame_map_frames + 1;
+        }
+
+        missing = ~m_frame_map[word].load(std::memory_order_acquire);
+    }
+
+    size_t found = word * 64 + static_cast<size_t>(__builtin_ctzll(missing));
+
+    // Unused bits in the last word always read as missing
+    if (found >= m_frame_map_frames)
+    {
+        return m_frame_map_frames + 1;
+    }
+
+    return static_cast<uint32_t>(found + 1);
 }
 
 bool Buffer::is_open()
@@ -1201,6 +2149,43 @@ void Buffer::finished_segment()
 
     m_cur_ci->m_seg_finished = true;
 
+    if (m_cur_ci->m_buffer != nullptr && m_cur_ci->m_buffer_watermark)
+    {
+        // Most chunks have been hashed while writing, only the tail and rewritten chunks are left
+        const size_t size   = m_cur_ci->m_buffer_watermark;
+        const size_t chunks = size / CHECKSUM_CHUNK_SIZE;
+        uint64_t hash       = 0;
+
+        hash_written(size, 0);
+
+        if (m_cur_ci->m_chunk_hash.size() > chunks)
+        {
+            // File has been truncated
+            m_cur_ci->m_chunk_hash.resize(chunks);
+            m_cur_ci->m_chunk_stale.resize(chunks);
+        }
+
+        for (size_t n = 0; n < chunks; n++)
+        {
+            if (m_cur_ci->m_chunk_stale[n])
+            {
+                m_cur_ci->m_chunk_hash[n]   = hash64_update(0, m_cur_ci->m_buffer + n * CHECKSUM_CHUNK_SIZE, CHECKSUM_CHUNK_SIZE);
+                m_cur_ci->m_chunk_stale[n]  = false;
+            }
+            hash = add_chunk_hash(hash, m_cur_ci->m_chunk_hash[n]);
+        }
+
+        if (size % CHECKSUM_CHUNK_SIZE)
+        {
+            hash = add_chunk_hash(hash, hash64_update(0, m_cur_ci->m_buffer + chunks * CHECKSUM_CHUNK_SIZE, size % CHECKSUM_CHUNK_SIZE));
+        }
+
+        // Reads only compare sizes, the checksum is verified by the scrubber
+        m_cur_ci->m_checksum_size   = size;
+        m_cur_ci->m_checksum        = hash64_final(hash, size);
+    }
+    m_cur_ci->m_valid = false;
+
     flush();
 }
 
@@ -38,6 +38,8 @@
 
 #include <mutex>
 #include <vector>
+#include <list>
+#include <atomic>
 #include <stddef.h>
 
 #define CACHE_CHECK_BIT(mask, var)  ((mask) == (mask & (var)))  /**< @brief Check bit in bitmask */
@@ -62,7 +64,33 @@ class Buffer : public FileIO
      * it is invoked.
      */
     static constexpr int PREALLOC_FACTOR = 5;
+    /**
+     * @brief Chunk size checksums are computed in. Each chunk is hashed separately, so
+     * the checksum can be computed while the file is written. Must be a multiple of 8.
+     */
+    static constexpr size_t CHECKSUM_CHUNK_SIZE = 1024 * 1024;
 public:
+    /**
+     * @brief Checksum of a finished cache file or HLS segment
+     */
+    typedef struct CHECKSUM
+    {
+        uint64_t                m_size;                         /**< @brief Size of the file, 0 if no checksum recorded */
+        uint64_t                m_checksum;                     /**< @brief hash64 checksum of the file contents */
+    } CHECKSUM;
+    typedef std::vector<CHECKSUM> CHECKSUM_VEC;                 /**< @brief Checksums, one per file or segment */
+
+    /**
+     * @brief Point at which an interrupted transcode can be resumed
+     */
+    typedef struct RESUME_POINT
+    {
+        uint64_t                m_offset;                       /**< @brief Offset of the first fragment not yet complete, 0 if the transcode cannot be resumed */
+        int64_t                 m_time;                         /**< @brief Start time of the fragment at m_offset relative to the start of the file, in AV_TIME_BASE units */
+        uint32_t                m_fragment;                     /**< @brief Number of fragments before m_offset */
+        uint64_t                m_header_size;                  /**< @brief Size of the file header */
+    } RESUME_POINT;
+
     /**
      * @brief Structure to hold current cache state
      */
@@ -76,13 +104,70 @@ public:
             , m_buffer_watermark(0)
             , m_buffer_size(0)
             , m_seg_finished(false)
+            , m_writable(false)
             , m_fd_idx(-1)
             , m_buffer_idx(nullptr)
             , m_buffer_size_idx(0)
             , m_flags(0)
             , m_buffer_write_size(0)
             , m_buffer_writes(0)
+            , m_checksum_size(0)
+            , m_checksum(0)
+            , m_valid(false)
+            , m_valid_mtime{0, 0}
+            , m_valid_size(0)
+            , m_pub_buffer(nullptr)
+            , m_pub_size(0)
+            , m_pub_pos(0)
+            , m_pub_watermark(0)
+        {
+        }
+
+        /**
+         * @brief Copy constructor, required because of the atomic members.
+         * @param[in] ci - CACHEINFO object to copy from.
+         */
+        _tagCACHEINFO(const _tagCACHEINFO & ci)
+            : _tagCACHEINFO()
         {
+            *this = ci;
+        }
+
+        /**
+         * @brief Assignment operator, required because of the atomic members.
+         * @param[in] ci - CACHEINFO object to copy from.
+         * @return Reference to this object.
+         */
+        _tagCACHEINFO & operator=(const _tagCACHEINFO & ci)
+        {
+            if (this != &ci)
+            {
+                m_cachefile         = ci.m_cachefile;
+                m_fd                = ci.m_fd;
+                m_buffer            = ci.m_buffer;
+                m_buffer_pos        = ci.m_buffer_pos;
+                m_buffer_watermark  = ci.m_buffer_watermark;
+                m_buffer_size       = ci.m_buffer_size;
+                m_seg_finished      = ci.m_seg_finished;
+                m_writable          = ci.m_writable;
+                m_cachefile_idx     = ci.m_cachefile_idx;
+                m_fd_idx            = ci.m_fd_idx;
+                m_buffer_idx        = ci.m_buffer_idx;
+                m_buffer_size_idx   = ci.m_buffer_size_idx;
+                m_flags             = ci.m_flags;
+                m_buffer_write_size = ci.m_buffer_write_size;
+                m_buffer_writes     = ci.m_buffer_writes;
+                m_checksum_size     = ci.m_checksum_size;
+                m_checksum          = ci.m_checksum;
+                m_chunk_hash        = ci.m_chunk_hash;
+                m_chunk_stale       = ci.m_chunk_stale;
+                m_valid             = ci.m_valid;
+                m_valid_mtime       = ci.m_valid_mtime;
+                m_valid_size        = ci.m_valid_size;
+
+                publish();
+            }
+            return *this;
         }
 
         /**
@@ -95,8 +180,31 @@ public:
             m_buffer_pos        = 0;
             m_buffer_watermark  = 0;
             m_buffer_size       = 0;
+            m_writable          = false;
             m_buffer_write_size = 0;
             m_buffer_writes     = 0;
+            m_checksum_size     = 0;
+            m_checksum          = 0;
+            m_chunk_hash.clear();
+            m_chunk_stale.clear();
+            m_valid             = false;
+
+            publish();
+        }
+
+        /**
+         * @brief Publish buffer pointer, size, position and watermark for lock-free readers.
+         *
+         * Must be called by the writer after the data up to the watermark has been
+         * written. Changes to the buffer pointer or size must be done inside a
+         * Remap_Guard section.
+         */
+        void publish()
+        {
+            m_pub_buffer.store(m_buffer, std::memory_order_release);
+            m_pub_size.store(m_buffer_size, std::memory_order_release);
+            m_pub_pos.store(m_buffer_pos, std::memory_order_release);
+            m_pub_watermark.store(m_buffer_watermark, std::memory_order_release);
         }
 
         // Main cache
@@ -107,6 +215,7 @@ public:
         size_t                  m_buffer_watermark;             /**< @brief Number of bytes in buffer */
         size_t                  m_buffer_size;                  /**< @brief Current buffer size */
         bool                    m_seg_finished;                 /**< @brief True if segment completely decoded */
+        bool                    m_writable;                     /**< @brief True if mapped for writing. Such mappings are never kept idle. */
         // Index for frame sets
         std::string             m_cachefile_idx;                /**< @brief Index file name */
         int                     m_fd_idx;                       /**< @brief File handle for index */
@@ -117,6 +226,19 @@ public:
         // Statistics
         size_t                  m_buffer_write_size;            /**< @brief Sum of bytes written to the buffer */
         unsigned int            m_buffer_writes;                /**< @brief Total number of writes to the buffer */
+        // Validity
+        uint64_t                m_checksum_size;                /**< @brief Size recorded with the checksum, 0 if none */
+        uint64_t                m_checksum;                     /**< @brief Checksum recorded when the file was finished */
+        std::vector<uint64_t>   m_chunk_hash;                   /**< @brief hash64 of each complete chunk written so far */
+        std::vector<bool>       m_chunk_stale;                  /**< @brief true if the chunk has been overwritten after it was hashed */
+        bool                    m_valid;                        /**< @brief true if the file has been found valid */
+        struct timespec         m_valid_mtime;                  /**< @brief Modification time of the file when found valid */
+        off_t                   m_valid_size;                   /**< @brief Size of the file when found valid */
+        // Published for lock-free readers
+        std::atomic<uint8_t *>  m_pub_buffer;                   /**< @brief Published pointer to buffer memory */
+        std::atomic_size_t      m_pub_size;                     /**< @brief Published buffer size */
+        std::atomic_size_t      m_pub_pos;                      /**< @brief Published read/write position */
+        std::atomic_size_t      m_pub_watermark;                /**< @brief Published number of bytes in buffer */
     } CACHEINFO, *LPCACHEINFO;                                  /**< @brief Pointer version of CACHEINFO */
     typedef CACHEINFO const * LPCCACHEINFO;                     /**< @brief Pointer to const version of CACHEINFO */
 
@@ -142,6 +264,11 @@ public:
      * @return Returns true on success; false on error.
      */
     bool                    init(bool erase_cache);
+    /**
+     * @brief Set the cache root to create the cache files in. Must be called before init().
+     * @param[in] cache_root - Cache root directory, or an empty string for the primary cache path.
+     */
+    void                    set_cache_root(const std::string & cache_root);
     /**
      * @brief Set the current segment.
      * @param[in] segment_no - [1..n] HLS segment file number.
@@ -172,10 +299,65 @@ public:
      * cache state.  It is used by the read paths to detect stale cache index
      * entries after manual cache file deletion or aborted writes.
      *
+     * The result is remembered: while the file stays mapped, or its mtime and
+     * size are unchanged, no system call is made. If a checksum has been
+     * recorded, the file size must match it. File contents are not hashed
+     * here, see verify_checksum().
+     *
      * @param[in] segment_no - [1..n] HLS segment file number or 0 for the current/single cache file.
      * @return Returns true if the cache file exists, is a regular file, and has a non-zero size.
      */
     bool                    cachefile_valid(uint32_t segment_no);
+    /**
+     * @brief Get the checksums of all finished files or segments.
+     * @param[inout] checksums - Receives one checksum per file or segment. Left untouched if the buffer has not been initialised.
+     */
+    void                    get_checksums(CHECKSUM_VEC *checksums);
+    /**
+     * @brief Set the checksums recorded in the cache index. Must be called after init().
+     * @param[in] checksums - One checksum per file or segment.
+     */
+    void                    set_checksums(const CHECKSUM_VEC & checksums);
+    /**
+     * @brief Open the single cache file for writing, keeping what has been written up to a resume point.
+     * @param[in] offset - Offset to resume at. Data after it is discarded.
+     * @param[in] defaultsize - If nonzero, reserve this much buffer space.
+     * @return Returns true on success; false if the file is shorter than offset or could not be opened.
+     */
+    bool                    open_resume(size_t offset, size_t defaultsize);
+    /**
+     * @brief Discard everything after the current write position.
+     */
+    void                    truncate_at_pos();
+    /**
+     * @brief Set the point the current transcode can be resumed at.
+     * @param[in] resume_point - Resume point. Fragments are counted on from resume_point.m_fragment.
+     */
+    void                    set_resume_point(const RESUME_POINT & resume_point);
+    /**
+     * @brief Get the point the current transcode can be resumed at.
+     * @return Returns the resume point, m_offset is 0 if there is none yet.
+     */
+    RESUME_POINT            resume_point() const;
+    /**
+     * @brief Record the start of a new fragment at the current write position.
+     * @param[in] time - Start time of the fragment in AV_TIME_BASE units, AV_NOPTS_VALUE if unknown.
+     * @param[in] sync_point - true if the fragment can be decoded on its own, i.e. it starts with a key frame.
+     */
+    void                    start_fragment(int64_t time, bool sync_point);
+    /**
+     * @brief Verify a cache file against its checksum.
+     *
+     * Reads the file from disk, bypassing the mapping, and drops it from the
+     * page cache afterwards.
+     *
+     * @param[in] cachefile - Name of cache file.
+     * @param[in] checksum - Recorded checksum.
+     * @param[in] max_rate - Max. bytes per second to read, 0 for unlimited.
+     * @param[in] cancel - If not nullptr, verification stops when this becomes true.
+     * @return Returns 1 if the file matches, 0 if it does not, -1 on error or if cancelled; check errno for details.
+     */
+    static int              verify_checksum(const std::string & cachefile, const CHECKSUM & checksum, size_t max_rate = 0, const std::atomic_bool *cancel = nullptr);
     /**
      * @brief Invalidate the requested cache segment/file.
      *
@@ -317,9 +499,11 @@ public:
     size_t                  write_frame(const uint8_t* data, size_t length, uint32_t frame_no);
     /**
      * @brief Flush buffer to disk
+     * @param[in] durable - If true, wait until the data and the file size are on disk,
+     * e.g. before recording a resume point. Otherwise writeback may only be started.
      * @return Returns true on success; false on error. Check errno for details.
      */
-    bool                    flush();
+    bool                    flush(bool durable = false);
     /**
      * @brief Clear (delete) buffer.
      * @return Returns true on success; false on error. Check errno for details.
@@ -370,9 +554,10 @@ public:
      * @param[in] filename - Source file name.
      * @param[in] fileext - File extension (MP4, WEBM etc.).
      * @param[in] is_idx - If true, create an index file; otherwise, create a cache.
+     * @param[in] cache_root - Cache root directory, or an empty string for the primary cache path.
      * @return Returns the name of the cache/index file.
      */
-    static const std::string & make_cachefile_name(std::string *cachefile, const std::string & filename, const std::string &fileext, bool is_idx);
+    static const std::string & make_cachefile_name(std::string *cachefile, const std::string & filename, const std::string &fileext, bool is_idx, const std::string & cache_root = std::string());
     /**
      * @brief Remove (unlink) the file.
      * @param[in] filename - Name of the file to remove.
@@ -386,7 +571,14 @@ public:
      */
     bool                    have_frame(uint32_t frame_no);
     /**
-     * @brief Complete the segment decoding.
+     * @brief Find the first frame not yet in the cache. Works only when processing a frame set.
+     * @param[in] frame_no - 1...frames, frame number to start searching at.
+     * @return Returns the number of the first missing frame at or after frame_no, or frames + 1
+     * if all of them are present. On error, returns 0 and sets errno.
+     */
+    uint32_t                next_missing_frame(uint32_t frame_no);
+    /**
+     * @brief Complete the segment decoding and record its checksum.
      */
     void                    finished_segment();
     /**
@@ -410,6 +602,30 @@ public:
      * @return Returns true if the operation was successful or the file was already closed; false otherwise.
      */
     bool                    close_file(uint32_t segment_no, uint32_t flags);
+    /**
+     * @brief Get reader statistics.
+     * @param[out] lockfree_reads - Number of copy() calls served without taking the buffer mutex.
+     * @param[out] locked_reads - Number of copy() calls that had to fall back to the buffer mutex.
+     * @param[out] remap_waits - Number of remaps that had to wait for lock-free readers to finish.
+     */
+    void                    read_stats(uint64_t *lockfree_reads, uint64_t *locked_reads, uint64_t *remap_waits) const;
+    /**
+     * @brief Get writeback statistics.
+     * @param[out] written - Number of bytes writeback has been started for.
+     * @param[out] max_dirty - Max. number of bytes written but not yet handed to writeback.
+     * @param[out] max_backlog - Max. number of bytes handed to writeback but not yet known to be on disk.
+     * @param[out] waits - Number of times the writer had to wait for writeback to complete.
+     * @param[out] wait_time - Total time in microseconds the writer waited for writeback.
+     */
+    void                    writeback_stats(uint64_t *written, uint64_t *max_dirty, uint64_t *max_backlog, uint64_t *waits, uint64_t *wait_time) const;
+    /**
+     * @brief Allow or prevent dropping written data from the page cache.
+     *
+     * Should be prevented while others are reading the file, they would
+     * have to read it back from disk.
+     * @param[in] allow - If true, --writeback_drop_behind applies.
+     */
+    void                    allow_drop_behind(bool allow);
 
 protected:
     /**
@@ -425,6 +641,68 @@ protected:
     bool                    is_open();
 
 private:
+    /**
+     * @brief Scoped remap section.
+     *
+     * Takes the buffer mutex, marks the mapping generation as odd so that new
+     * lock-free readers fall back to the mutex, and waits for readers already
+     * copying to finish. Any change to a mapping (buffer pointer, size or file
+     * size) or to the segment layout must be made inside such a section.
+     * Sections may be nested; only the outermost one bumps the generation.
+     */
+    class Remap_Guard
+    {
+    public:
+        /**
+         * @brief Enter remap section.
+         * @param[in] buffer - Buffer object to remap.
+         */
+        explicit Remap_Guard(Buffer *buffer);
+        /**
+         * @brief Leave remap section, lock-free readers may proceed again.
+         */
+        ~Remap_Guard();
+
+    private:
+        std::lock_guard<std::recursive_mutex> m_lock;           /**< @brief Holds the buffer mutex for the duration of the section */
+        Buffer *                m_buffer;                       /**< @brief Buffer being remapped */
+    };
+
+    /**
+     * @brief Copy buffered data without taking the buffer mutex.
+     *
+     * Succeeds only if no remap is in progress and the requested range is mapped,
+     * otherwise the caller must fall back to the locked path.
+     * @param[in] out_data - Buffer to copy data to.
+     * @param[in] offset - Offset in buffer to copy data from.
+     * @param[in] bufsize - Size of out_data buffer.
+     * @param[in] segment_no - [1..n] HLS segment file number or 0 for the current segment.
+     * @return Returns true if the data was copied; false if the locked path must be taken.
+     */
+    bool                    copy_lockfree(uint8_t* out_data, size_t offset, size_t bufsize, uint32_t segment_no);
+    /**
+     * @brief Rebuild the frame presence map from the frame set index.
+     * Must be called inside a remap section.
+     */
+    void                    build_frame_map();
+    /**
+     * @brief Mark all frames as missing.
+     */
+    void                    clear_frame_map();
+    /**
+     * @brief Test frame presence bit. The frame map must be stable, either
+     * registered as lock-free reader or holding the mutex.
+     * @param[in] frame_no - 1...frames
+     * @return Returns 1 if present, 0 if missing, -1 if there is no frame map or frame_no is out of range.
+     */
+    int                     test_frame(uint32_t frame_no) const;
+    /**
+     * @brief Search the frame map word by word for the next missing frame.
+     * The frame map must be stable, either registered as lock-free reader or holding the mutex.
+     * @param[in] frame_no - 1...frames, frame number to start searching at.
+     * @return Returns the first missing frame, frames + 1 if all are present, or 0 if there is no frame map.
+     */
+    uint32_t                find_missing_frame(uint32_t frame_no) const;
     /**
      * @brief Prepare for the writing operation.
      *
@@ -479,6 +757,50 @@ private:
      * @return Returns true on success; false on error.
      */
     bool                    unmap_file(const std::string & filename, volatile int *fd, uint8_t **p, size_t len, size_t *filesize) const;
+    /**
+     * @brief Unmap a cache file and mark it closed.
+     * @param[in] index - [0..n-1] Index of segment file number.
+     * @return Returns true on success; false on error.
+     */
+    bool                    unmap_segment(uint32_t index);
+    /**
+     * @brief Keep a segment that nobody reads anymore mapped for later use.
+     *
+     * Least recently used idle segments of this buffer are unmapped to make room
+     * if the global limits set by --hls_mapped_files and --hls_mapped_size are exceeded.
+     * @param[in] index - [0..n-1] Index of segment file number.
+     * @return Returns true if the segment has been kept; false if it should be unmapped.
+     */
+    bool                    keep_idle(uint32_t index);
+    /**
+     * @brief Remove a segment from the idle list if it is there.
+     * @param[in] index - [0..n-1] Index of segment file number.
+     * @return Returns true if the segment was idle; false if not.
+     */
+    bool                    remove_idle(uint32_t index);
+    /**
+     * @brief Write back data of the current cache file behind the write head.
+     *
+     * Starts writeback in chunks of --writeback_chunk, waits for older writeback to
+     * complete if more than --writeback_max_dirty bytes are pending, and drops pages
+     * that are on disk and more than --writeback_drop_behind bytes behind the write
+     * head from the page cache. Does nothing if --writeback_chunk is 0.
+     * @param[in] finish - If true, start writeback of all remaining data without waiting.
+     */
+    void                    writeback(bool finish);
+    /**
+     * @brief Reset writeback state, e.g. after the current cache file changed.
+     */
+    void                    writeback_reset();
+    /**
+     * @brief Update the chunk hashes of the current cache file after a write.
+     *
+     * Chunks overwritten after being hashed are marked stale, complete chunks
+     * below the watermark are hashed while they are still in memory.
+     * @param[in] offset - Offset the data has been written to.
+     * @param[in] length - Number of bytes written.
+     */
+    void                    hash_written(size_t offset, size_t length);
 
     /**
      * @brief Get cache information.
@@ -499,6 +821,32 @@ private:
     uint32_t                m_cur_open;                         /**< @brief Number of open files */
 
     std::vector<CACHEINFO>  m_ci;                               /**< @brief Cache info */
+    std::list<uint32_t>     m_idle;                             /**< @brief Indexes of segments kept mapped while nobody reads them, most recently used first */
+    std::string             m_cache_root;                       /**< @brief Cache root the files are kept in, empty for the primary cache path */
+
+    // Lock-free read path
+    std::atomic_uint64_t    m_map_seq;                          /**< @brief Mapping generation, odd while a remap is in progress */
+    std::atomic_uint32_t    m_readers;                          /**< @brief Number of lock-free readers currently copying */
+    unsigned int            m_remap_depth;                      /**< @brief Nesting depth of Remap_Guard sections, protected by m_mutex */
+    // Frame sets
+    std::unique_ptr<std::atomic_uint64_t[]> m_frame_map;        /**< @brief One bit per frame, set if the frame is in the cache. Allocated and freed inside remap sections only. */
+    uint32_t                m_frame_map_frames;                 /**< @brief Number of frames in m_frame_map */
+    // Statistics
+    std::atomic_uint64_t    m_lockfree_reads;                   /**< @brief Reads served without the buffer mutex */
+    std::atomic_uint64_t    m_locked_reads;                     /**< @brief Reads that fell back to the buffer mutex */
+    std::atomic_uint64_t    m_remap_waits;                      /**< @brief Remaps that had to wait for readers to drain */
+    // Writeback of the current cache file, protected by m_mutex
+    RESUME_POINT            m_resume;                           /**< @brief Last point the transcode can be resumed at */
+    uint32_t                m_fragments;                        /**< @brief Number of fragments written so far */
+    size_t                  m_wb_pos;                           /**< @brief Offset up to which writeback has been started */
+    size_t                  m_wb_done;                          /**< @brief Offset up to which writeback is known to be complete */
+    size_t                  m_wb_dropped;                       /**< @brief Offset up to which pages have been dropped from the page cache */
+    std::atomic_uint64_t    m_wb_written;                       /**< @brief Bytes writeback has been started for */
+    std::atomic_uint64_t    m_wb_max_dirty;                     /**< @brief Max. bytes written but not yet handed to writeback */
+    std::atomic_uint64_t    m_wb_max_backlog;                   /**< @brief Max. bytes handed to writeback but not yet known to be on disk */
+    std::atomic_uint64_t    m_wb_waits;                         /**< @brief Number of times the writer waited for writeback */
+    std::atomic_uint64_t    m_wb_wait_time;                     /**< @brief Time in microseconds the writer waited for writeback */
+    std::atomic_bool        m_wb_drop_allowed;                  /**< @brief true if pages may be dropped behind the write head */
 };
 
 #endif
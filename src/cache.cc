@@ -31,12 +31,21 @@
 
 #include "cache.h"
 #include "cache_entry.h"
+#include "cache_maintenance.h"
+#include "cache_trace.h"
 #include "ffmpegfs.h"
 #include "logging.h"
 
 #include <vector>
+#include <algorithm>
 #include <cassert>
+#include <cmath>
+#include <cstring>
+#include <chrono>
 #include <sqlite3.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
 
 #ifndef HAVE_SQLITE_ERRSTR
 #define sqlite3_errstr(rc)  ""              /**< @brief If our version of SQLite hasn't go this function */
@@ -69,7 +78,6 @@ Cache::sqlite_t::~sqlite_t()
 
         sqlite3_close(m_db_handle);
     }
-    sqlite3_shutdown();
 }
 
 const Cache::TABLE_DEF Cache::m_table_cache_entry =
@@ -116,7 +124,28 @@ const Cache::TABLECOLUMNS_VEC Cache::m_columns_cache_entry =
     { "creation_time",      "DATETIME NOT NULL" },
     { "access_time",        "DATETIME NOT NULL" },
     { "file_time",          "DATETIME NOT NULL" },
-    { "file_size",          "UNSIGNED BIG INT NOT NULL" }
+    { "file_size",          "UNSIGNED BIG INT NOT NULL" },
+    //
+    // Cache root
+    //
+    { "cache_root",         "TEXT NOT NULL DEFAULT ''" },
+    //
+    // Checksums of finished files/segments
+    //
+    { "checksums",          "BLOB" },
+    //
+    // Resume point of interrupted transcodes
+    //
+    { "resume_offset",      "UNSIGNED BIG INT NOT NULL DEFAULT 0" },
+    { "resume_time",        "BIG INT NOT NULL DEFAULT 0" },
+    { "resume_fragment",    "UNSIGNED INT NOT NULL DEFAULT 0" },
+    { "header_size",        "UNSIGNED BIG INT NOT NULL DEFAULT 0" },
+    //
+    // HLS segmentation
+    //
+    { "segment_duration",   "BIG INT NOT NULL DEFAULT 0" },
+    { "keyframe_segments",  "BOOLEAN NOT NULL DEFAULT 0" },
+    { "segment_starts",     "BLOB" }
 };
 
 const Cache::TABLE_DEF Cache::m_table_version =
@@ -135,19 +164,63 @@ const Cache::TABLECOLUMNS_VEC Cache::m_columns_version =
     { "db_version_minor",   "INTEGER NOT NULL" }
 };
 
+const Cache::TABLE_DEF Cache::m_table_keyframe_index =
+{
+    //
+    // Table name
+    //
+    "keyframe_index",
+    //
+    // Primary key
+    //
+    "PRIMARY KEY(`filename`)"
+};
+
+const Cache::TABLECOLUMNS_VEC Cache::m_columns_keyframe_index =
+{
+    //
+    // Primary key: source file name
+    //
+    { "filename",           "TEXT NOT NULL" },
+    //
+    // Source file the index was built from
+    //
+    { "file_time",          "DATETIME NOT NULL" },
+    { "file_size",          "UNSIGNED BIG INT NOT NULL" },
+    //
+    // Video stream and its key frames
+    //
+    { "stream_idx",         "INT NOT NULL" },
+    { "keyframes",          "BLOB" }
+};
+
 Cache::Cache()
+    : m_readers_failed(false)
+    , m_scrubber_stop(false)
+    , m_sweep_stop(false)
+    , m_sweep_rowid(0)
+    , m_sweep_running(0)
+    , m_sweep_checked(0)
+    , m_sweep_repaired(0)
+    , m_sweep_started(0)
 {
 }
 
 Cache::~Cache()
 {
+    stop_sweep();
+    stop_scrubber();
+
     // Clean up memory
-    for (auto& [key, value] : m_cache)
+    for (CACHE_SHARD & shard : m_shards)
     {
-        value->destroy();
-    }
+        for (auto& [key, value] : shard.m_entries)
+        {
+            value->destroy();
+        }
 
-    m_cache.clear();
+        shard.m_entries.clear();
+    }
 
     close_index();
 }
@@ -158,8 +231,8 @@ bool Cache::prepare_stmts()
     const char * sql;
 
     sql =   "INSERT OR REPLACE INTO cache_entry\n"
-            "(filename, desttype, enable_ismv, audiobitrate, audiosamplerate, videobitrate, videowidth, videoheight, deinterlace, duration, predicted_filesize, encoded_filesize, video_frame_count, segment_count, finished, error, errno, averror, creation_time, access_time, file_time, file_size) VALUES\n"
-            "(?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, datetime(?, 'unixepoch'), datetime(?, 'unixepoch'), datetime(?, 'unixepoch'), ?);\n";
+            "(filename, desttype, enable_ismv, audiobitrate, audiosamplerate, videobitrate, videowidth, videoheight, deinterlace, duration, predicted_filesize, encoded_filesize, video_frame_count, segment_count, finished, error, errno, averror, creation_time, access_time, file_time, file_size, cache_root, checksums, resume_offset, resume_time, resume_fragment, header_size, segment_duration, keyframe_segments, segment_starts) VALUES\n"
+            "(?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, datetime(?, 'unixepoch'), datetime(?, 'unixepoch'), datetime(?, 'unixepoch'), ?, ?, ?, ?, ?, ?, ?, ?, ?, ?);\n";
 
     if (SQLITE_OK != (ret = sqlite3_prepare_v2(*m_cacheidx_db, sql, -1, &m_cacheidx_db->m_insert_stmt, nullptr)))
     {
@@ -167,11 +240,8 @@ bool Cache::prepare_stmts()
         return false;
     }
 
-    sql =   "SELECT desttype, enable_ismv, audiobitrate, audiosamplerate, videobitrate, videowidth, videoheight, deinterlace, duration, predicted_filesize, encoded_filesize, video_frame_count, segment_count, finished, error, errno, averror, strftime('%s', creation_time), strftime('%s', access_time), strftime('%s', file_time), file_size FROM cache_entry WHERE filename = ? AND desttype = ?;\n";
-
-    if (SQLITE_OK != (ret = sqlite3_prepare_v2(*m_cacheidx_db, sql, -1, &m_cacheidx_db->m_select_stmt, nullptr)))
+    if (!prepare_select(m_cacheidx_db.get()))
     {
-        Logging::error(m_cacheidx_db->filename(), "Failed to prepare select: (%1) %2\n%3", ret, sqlite3_errmsg(*m_cacheidx_db), sql);
         return false;
     }
 
@@ -186,6 +256,100 @@ bool Cache::prepare_stmts()
     return true;
 }
 
+bool Cache::prepare_select(sqlite_t *db)
+{
+    int ret;
+    const char * sql;
+
+    sql =   "SELECT desttype, enable_ismv, audiobitrate, audiosamplerate, videobitrate, videowidth, videoheight, deinterlace, duration, predicted_filesize, encoded_filesize, video_frame_count, segment_count, finished, error, errno, averror, strftime('%s', creation_time), strftime('%s', access_time), strftime('%s', file_time), file_size, cache_root, checksums, resume_offset, resume_time, resume_fragment, header_size, segment_duration, keyframe_segments, segment_starts FROM cache_entry WHERE filename = ? AND desttype = ?;\n";
+
+    if (SQLITE_OK != (ret = sqlite3_prepare_v2(*db, sql, -1, &db->m_select_stmt, nullptr)))
+    {
+        Logging::error(db->filename(), "Failed to prepare select: (%1) %2\n%3", ret, sqlite3_errmsg(*db), sql);
+        return false;
+    }
+
+    return true;
+}
+
+Cache::sqlite_t * Cache::acquire_reader()
+{
+    std::lock_guard<std::mutex> lock_readers(m_readers_mutex);
+
+    if (!m_idle_readers.empty())
+    {
+        sqlite_t * reader = m_idle_readers.back();
+        m_idle_readers.pop_back();
+        return reader;
+    }
+
+    if (m_readers_failed || m_readers.size() >= MAX_READERS || m_cacheidx_db == nullptr)
+    {
+        return nullptr;
+    }
+
+    // Used by one thread at a time only, no need for SQLite to serialise access
+    std::unique_ptr<sqlite_t> reader = std::make_unique<sqlite_t>(m_cacheidx_db->filename(), SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX);
+    int ret;
+
+    try
+    {
+        if (SQLITE_OK != (ret = reader->ret()))
+        {
+            Logging::error(reader->filename(), "Failed to open read-only SQLite3 connection: (%1) %2", ret, sqlite3_errstr(ret));
+            throw false;
+        }
+
+        if (SQLITE_OK != (ret = sqlite3_busy_timeout(*reader, 1000)))
+        {
+            Logging::error(reader->filename(), "Failed to set SQLite3 busy timeout: (%1) %2", ret, sqlite3_errmsg(*reader));
+            throw false;
+        }
+
+        if (SQLITE_OK != (ret = sqlite3_exec(*reader, "PRAGMA case_sensitive_like = 1;", nullptr, nullptr, nullptr)))
+        {
+            Logging::error(reader->filename(), "Failed to set SQLite3 case_sensitive_like = 1: (%1) %2", ret, sqlite3_errmsg(*reader));
+            throw false;
+        }
+
+        // Not fatal, reads simply go through the page cache then
+        std::string sql = "PRAGMA mmap_size = " + std::to_string(READER_MMAP_SIZE) + ";";
+        if (SQLITE_OK != (ret = sqlite3_exec(*reader, sql.c_str(), nullptr, nullptr, nullptr)))
+        {
+            Logging::debug(reader->filename(), "Unable to enable SQLite3 memory mapped I/O: (%1) %2", ret, sqlite3_errmsg(*reader));
+        }
+
+        if (!prepare_select(reader.get()))
+        {
+            throw false;
+        }
+    }
+    catch (bool)
+    {
+        Logging::warning(reader->filename(), "Looking up the cache index from one connection only.");
+        m_readers_failed = true;
+        return nullptr;
+    }
+
+    Logging::trace(reader->filename(), "Opened read-only connection #%1 to the cache index.", m_readers.size() + 1);
+
+    m_readers.push_back(std::move(reader));
+
+    return m_readers.back().get();
+}
+
+void Cache::release_reader(sqlite_t *reader)
+{
+    if (reader == nullptr || reader == m_cacheidx_db.get())
+    {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock_readers(m_readers_mutex);
+
+    m_idle_readers.push_back(reader);
+}
+
 bool Cache::table_exists(const char *table)
 {
     std::string sql;
@@ -390,6 +554,8 @@ bool Cache::create_table_cache_entry(LPCTABLE_DEF table, const TABLECOLUMNS_VEC
 
 bool Cache::upgrade_db(int *db_version_major, int *db_version_minor)
 {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
     if (!column_exists("cache_entry", "video_frame_count"))
     {
         // If video_frame_count is missing, this db is definetly old
@@ -465,10 +631,7 @@ bool Cache::upgrade_db(int *db_version_major, int *db_version_minor)
 
         // Step 3
         {
-            char *errmsg = nullptr;
-            std::string sql;
             std::string columns;
-            int ret;
 
             for (const TABLE_COLUMNS & col : m_columns_cache_entry)
             {
@@ -481,20 +644,8 @@ bool Cache::upgrade_db(int *db_version_major, int *db_version_minor)
                 columns += "`";
             }
 
-            sql = "INSERT INTO `";
-            sql += m_table_cache_entry.name;
-            sql += "` (";
-            sql += columns;
-            sql += ")\nSELECT ";
-            sql += columns;
-            sql += " FROM `";
-            sql += m_table_cache_entry.name;
-            sql += "_old`;";
-
-            if (SQLITE_OK != (ret = sqlite3_exec(*m_cacheidx_db, sql.c_str(), nullptr, nullptr, &errmsg)))
+            if (!upgrade_copy_rows(columns))
             {
-                Logging::error(m_cacheidx_db->filename(), "SQLite3 exec error: (%1) %2\n%3", ret, errmsg, sql.c_str());
-                sqlite3_free(errmsg);
                 return false;
             }
         }
@@ -583,6 +734,41 @@ bool Cache::upgrade_db(int *db_version_major, int *db_version_minor)
         }
     }
 
+    // Version 1.98 adds the cache root, checksums, resume point and HLS
+    // segmentation columns, all from `cache_root` on. They all have defaults
+    // or may be NULL, so existing entries stay valid.
+    {
+        TABLECOLUMNS_VEC::const_iterator it = std::find_if(m_columns_cache_entry.cbegin(), m_columns_cache_entry.cend(), [](const TABLE_COLUMNS & col) { return !strcmp(col.name, "cache_root"); });
+
+        for (; it != m_columns_cache_entry.cend(); ++it)
+        {
+            char *errmsg = nullptr;
+            std::string sql;
+            int ret;
+
+            if (column_exists("cache_entry", it->name))
+            {
+                continue;
+            }
+
+            Logging::debug(m_cacheidx_db->filename(), "Adding `%1` column.", it->name);
+
+            sql = "ALTER TABLE `";
+            sql += m_table_cache_entry.name;
+            sql += "` ADD COLUMN `";
+            sql += it->name;
+            sql += "` ";
+            sql += it->type;
+            sql += ";\n";
+            if (SQLITE_OK != (ret = sqlite3_exec(*m_cacheidx_db, sql.c_str(), nullptr, nullptr, &errmsg)))
+            {
+                Logging::error(m_cacheidx_db->filename(), "SQLite3 exec error adding column `%1`: (%2) %3\n%4", it->name, ret, errmsg, sql.c_str());
+                sqlite3_free(errmsg);
+                return false;
+            }
+        }
+    }
+
     // Update DB version
     Logging::debug(m_cacheidx_db->filename(), "Updating version table to V%1.%2.", DB_VERSION_MAJOR, DB_VERSION_MINOR);
 
@@ -603,11 +789,92 @@ bool Cache::upgrade_db(int *db_version_major, int *db_version_minor)
         *db_version_minor = DB_VERSION_MINOR;
     }
 
-    Logging::info(m_cacheidx_db->filename(), "Database successfully upgraded to V%1.%2.", *db_version_major, *db_version_minor);
+    Logging::info(m_cacheidx_db->filename(), "Database successfully upgraded to V%1.%2 in %3.", *db_version_major, *db_version_minor,
+                  format_time(static_cast<time_t>(std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now() - start).count())).c_str());
 
     return true;
 }
 
+bool Cache::upgrade_copy_rows(const std::string & columns)
+{
+    sqlite3_stmt * stmt = nullptr;
+    std::string sql;
+    int64_t total = 0;
+    int64_t max_rowid = 0;
+    int64_t copied = 0;
+    int ret;
+
+    sql = "SELECT COUNT(*), MAX(rowid) FROM `";
+    sql += m_table_cache_entry.name;
+    sql += "_old`;\n";
+
+    if (SQLITE_OK != (ret = sqlite3_prepare_v2(*m_cacheidx_db, sql.c_str(), -1, &stmt, nullptr)))
+    {
+        Logging::error(m_cacheidx_db->filename(), "SQLite3 prepare error: (%1) %2\n%3", ret, sqlite3_errmsg(*m_cacheidx_db), sql.c_str());
+        return false;
+    }
+
+    if (sqlite3_step(stmt) == SQLITE_ROW)
+    {
+        total       = sqlite3_column_int64(stmt, 0);
+        max_rowid   = sqlite3_column_int64(stmt, 1);
+    }
+
+    sqlite3_finalize(stmt);
+    stmt = nullptr;
+
+    Logging::info(m_cacheidx_db->filename(), "Copying %1 entries to the new table.", total);
+
+    sql = "INSERT INTO `";
+    sql += m_table_cache_entry.name;
+    sql += "` (";
+    sql += columns;
+    sql += ")\nSELECT ";
+    sql += columns;
+    sql += " FROM `";
+    sql += m_table_cache_entry.name;
+    sql += "_old` WHERE rowid > ? AND rowid <= ?;\n";
+
+    if (SQLITE_OK != (ret = sqlite3_prepare_v2(*m_cacheidx_db, sql.c_str(), -1, &stmt, nullptr)))
+    {
+        Logging::error(m_cacheidx_db->filename(), "SQLite3 prepare error: (%1) %2\n%3", ret, sqlite3_errmsg(*m_cacheidx_db), sql.c_str());
+        return false;
+    }
+
+    std::chrono::steady_clock::time_point last_report = std::chrono::steady_clock::now();
+    bool success = true;
+
+    for (int64_t rowid = 0; rowid < max_rowid; rowid += UPGRADE_BATCH)
+    {
+        sqlite3_bind_int64(stmt, 1, rowid);
+        sqlite3_bind_int64(stmt, 2, rowid + UPGRADE_BATCH);
+
+        ret = sqlite3_step(stmt);
+
+        if (ret != SQLITE_DONE)
+        {
+            Logging::error(m_cacheidx_db->filename(), "SQLite3 exec error: (%1) %2\n%3", ret, sqlite3_errmsg(*m_cacheidx_db), expanded_sql(stmt).c_str());
+            success = false;
+            break;
+        }
+
+        copied += sqlite3_changes(*m_cacheidx_db);
+
+        sqlite3_reset(stmt);
+
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        if (now - last_report >= std::chrono::seconds(UPGRADE_REPORT_INTERVAL))
+        {
+            last_report = now;
+            Logging::info(m_cacheidx_db->filename(), "Upgrading database: %1 of %2 entries copied (%3%).", copied, total, total ? copied * 100 / total : 100);
+        }
+    }
+
+    sqlite3_finalize(stmt);
+
+    return success;
+}
+
 bool Cache::load_index()
 {
     bool success = true;
@@ -630,6 +897,19 @@ bool Cache::load_index()
 
         append_filename(&filename, "cacheidx.sqlite");
 
+        {
+            const CACHEROOT_VEC & roots = transcoder_cache_roots();
+
+            for (size_t n = 1; n < roots.size(); n++)
+            {
+                if (mktree(roots[n].m_path, S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH) && errno != EEXIST)
+                {
+                    // Not fatal, the root will be skipped when placing new entries
+                    Logging::error(roots[n].m_path, "Error creating cache directory: (%1) %2", errno, strerror(errno));
+                }
+            }
+        }
+
         // initialise engine
         if (SQLITE_OK != (ret = sqlite3_initialize()))
         {
@@ -724,6 +1004,18 @@ bool Cache::load_index()
             }
         }
 
+        // Create keyframe_index table if not already existing. Added in 2.51, needs no upgrade.
+        if (!table_exists("keyframe_index"))
+        {
+            Logging::debug(m_cacheidx_db->filename(), "Creating 'keyframe_index' table in database.");
+
+            if (!create_table_cache_entry(&m_table_keyframe_index, m_columns_keyframe_index))
+            {
+                Logging::error(m_cacheidx_db->filename(), "SQLite3 exec error creating 'keyframe_index' table.");
+                throw false;
+            }
+        }
+
         // Check if database needs a structure upgrade
         int db_version_major = DB_BASE_VERSION_MAJOR;   // Old database contains no version table. This is the version of this database.
         int db_version_minor = DB_BASE_VERSION_MINOR;
@@ -798,6 +1090,9 @@ bool Cache::read_info(LPCACHE_INFO cache_info)
     cache_info->m_encoded_filesize      = 0;
     cache_info->m_video_frame_count     = 0;
     cache_info->m_segment_count         = 0;
+    cache_info->m_segment_duration      = 0;
+    cache_info->m_keyframe_segments     = false;
+    cache_info->m_segment_starts.clear();
     cache_info->m_result                = RESULTCODE::NONE;
     cache_info->m_error                 = false;
     cache_info->m_errno                 = 0;
@@ -806,67 +1101,105 @@ bool Cache::read_info(LPCACHE_INFO cache_info)
     cache_info->m_access_time           = 0;
     cache_info->m_file_time             = 0;
     cache_info->m_file_size             = 0;
+    cache_info->m_cache_root.clear();
+    cache_info->m_checksums.clear();
+    cache_info->m_resume                = Buffer::RESUME_POINT();
 
-    if (m_cacheidx_db->m_select_stmt == nullptr)
+    // Look up on a connection of our own, so that lookups from several threads run in parallel
+    sqlite_t * db = acquire_reader();
+    std::unique_lock<std::recursive_mutex> lock_mutex(m_mutex, std::defer_lock);
+
+    if (db == nullptr)
     {
-        Logging::error(m_cacheidx_db->filename(), "SQLite3 select statement not open.");
-        return false;
+        // None available, share the writer connection
+        db = m_cacheidx_db.get();
+        lock_mutex.lock();
     }
 
-    std::lock_guard<std::recursive_mutex> lock_mutex(m_mutex);
+    if (db->m_select_stmt == nullptr)
+    {
+        Logging::error(db->filename(), "SQLite3 select statement not open.");
+        release_reader(db);
+        return false;
+    }
 
     try
     {
         int ret;
 
-        assert(sqlite3_bind_parameter_count(m_cacheidx_db->m_select_stmt) == 2);
+        assert(sqlite3_bind_parameter_count(db->m_select_stmt) == 2);
 
-        if (SQLITE_OK != (ret = sqlite3_bind_text(m_cacheidx_db->m_select_stmt, 1, cache_info->m_destfile.c_str(), -1, nullptr)))
+        if (SQLITE_OK != (ret = sqlite3_bind_text(db->m_select_stmt, 1, cache_info->m_destfile.c_str(), -1, nullptr)))
         {
-            Logging::error(m_cacheidx_db->filename(), "SQLite3 select error binding 'filename': (%1) %2", ret, sqlite3_errstr(ret));
+            Logging::error(db->filename(), "SQLite3 select error binding 'filename': (%1) %2", ret, sqlite3_errstr(ret));
             throw false;
         }
 
-        if (SQLITE_OK != (ret = sqlite3_bind_text(m_cacheidx_db->m_select_stmt, 2, cache_info->m_desttype.data(), -1, nullptr)))
+        if (SQLITE_OK != (ret = sqlite3_bind_text(db->m_select_stmt, 2, cache_info->m_desttype.data(), -1, nullptr)))
         {
-            Logging::error(m_cacheidx_db->filename(), "SQLite3 select error binding 'desttype': (%1) %2", ret, sqlite3_errstr(ret));
+            Logging::error(db->filename(), "SQLite3 select error binding 'desttype': (%1) %2", ret, sqlite3_errstr(ret));
             throw false;
         }
 
-        ret = sqlite3_step(m_cacheidx_db->m_select_stmt);
+        ret = sqlite3_step(db->m_select_stmt);
 
         if (ret == SQLITE_ROW)
         {
-            const char *text                = reinterpret_cast<const char *>(sqlite3_column_text(m_cacheidx_db->m_select_stmt, 0));
+            const char *text                = reinterpret_cast<const char *>(sqlite3_column_text(db->m_select_stmt, 0));
             if (text != nullptr)
             {
                 cache_info->m_desttype[0] = '\0';
                 strncat(cache_info->m_desttype.data(), text, cache_info->m_desttype.size() - 1);
             }
             //cache_info->m_enable_ismv        = sqlite3_column_int(m_cacheidx_db->m_cacheidx_select_stmt, 1);
-            cache_info->m_audiobitrate          = sqlite3_column_int(m_cacheidx_db->m_select_stmt, 2);
-            cache_info->m_audiosamplerate       = sqlite3_column_int(m_cacheidx_db->m_select_stmt, 3);
-            cache_info->m_videobitrate          = sqlite3_column_int(m_cacheidx_db->m_select_stmt, 4);
-            cache_info->m_videowidth            = sqlite3_column_int(m_cacheidx_db->m_select_stmt, 5);
-            cache_info->m_videoheight           = sqlite3_column_int(m_cacheidx_db->m_select_stmt, 6);
-            cache_info->m_deinterlace           = sqlite3_column_int(m_cacheidx_db->m_select_stmt, 7);
-            cache_info->m_duration              = sqlite3_column_int64(m_cacheidx_db->m_select_stmt, 8);
-            cache_info->m_predicted_filesize    = static_cast<size_t>(sqlite3_column_int64(m_cacheidx_db->m_select_stmt, 9));
-            cache_info->m_encoded_filesize      = static_cast<size_t>(sqlite3_column_int64(m_cacheidx_db->m_select_stmt, 10));
-            cache_info->m_video_frame_count     = static_cast<uint32_t>(sqlite3_column_int(m_cacheidx_db->m_select_stmt, 11));
-            cache_info->m_segment_count         = static_cast<uint32_t>(sqlite3_column_int(m_cacheidx_db->m_select_stmt, 12));
-            cache_info->m_result                = static_cast<RESULTCODE>(sqlite3_column_int(m_cacheidx_db->m_select_stmt, 13));
-            cache_info->m_error                 = sqlite3_column_int(m_cacheidx_db->m_select_stmt, 14);
-            cache_info->m_errno                 = sqlite3_column_int(m_cacheidx_db->m_select_stmt, 15);
-            cache_info->m_averror               = sqlite3_column_int(m_cacheidx_db->m_select_stmt, 16);
-            cache_info->m_creation_time         = static_cast<time_t>(sqlite3_column_int64(m_cacheidx_db->m_select_stmt, 17));
-            cache_info->m_access_time           = static_cast<time_t>(sqlite3_column_int64(m_cacheidx_db->m_select_stmt, 18));
-            cache_info->m_file_time             = static_cast<time_t>(sqlite3_column_int64(m_cacheidx_db->m_select_stmt, 19));
-            cache_info->m_file_size             = static_cast<size_t>(sqlite3_column_int64(m_cacheidx_db->m_select_stmt, 20));
+            cache_info->m_audiobitrate          = sqlite3_column_int(db->m_select_stmt, 2);
+            cache_info->m_audiosamplerate       = sqlite3_column_int(db->m_select_stmt, 3);
+            cache_info->m_videobitrate          = sqlite3_column_int(db->m_select_stmt, 4);
+            cache_info->m_videowidth            = sqlite3_column_int(db->m_select_stmt, 5);
+            cache_info->m_videoheight           = sqlite3_column_int(db->m_select_stmt, 6);
+            cache_info->m_deinterlace           = sqlite3_column_int(db->m_select_stmt, 7);
+            cache_info->m_duration              = sqlite3_column_int64(db->m_select_stmt, 8);
+            cache_info->m_predicted_filesize    = static_cast<size_t>(sqlite3_column_int64(db->m_select_stmt, 9));
+            cache_info->m_encoded_filesize      = static_cast<size_t>(sqlite3_column_int64(db->m_select_stmt, 10));
+            cache_info->m_video_frame_count     = static_cast<uint32_t>(sqlite3_column_int(db->m_select_stmt, 11));
+            cache_info->m_segment_count         = static_cast<uint32_t>(sqlite3_column_int(db->m_select_stmt, 12));
+            cache_info->m_result                = static_cast<RESULTCODE>(sqlite3_column_int(db->m_select_stmt, 13));
+            cache_info->m_error                 = sqlite3_column_int(db->m_select_stmt, 14);
+            cache_info->m_errno                 = sqlite3_column_int(db->m_select_stmt, 15);
+            cache_info->m_averror               = sqlite3_column_int(db->m_select_stmt, 16);
+            cache_info->m_creation_time         = static_cast<time_t>(sqlite3_column_int64(db->m_select_stmt, 17));
+            cache_info->m_access_time           = static_cast<time_t>(sqlite3_column_int64(db->m_select_stmt, 18));
+            cache_info->m_file_time             = static_cast<time_t>(sqlite3_column_int64(db->m_select_stmt, 19));
+            cache_info->m_file_size             = static_cast<size_t>(sqlite3_column_int64(db->m_select_stmt, 20));
+            text                                = reinterpret_cast<const char *>(sqlite3_column_text(db->m_select_stmt, 21));
+            if (text != nullptr)
+            {
+                cache_info->m_cache_root        = text;
+            }
+            const void *blob                    = sqlite3_column_blob(db->m_select_stmt, 22);
+            int bytes                           = sqlite3_column_bytes(db->m_select_stmt, 22);
+            if (blob != nullptr && bytes > 0)
+            {
+                cache_info->m_checksums.resize(static_cast<size_t>(bytes) / sizeof(Buffer::CHECKSUM));
+                std::memcpy(cache_info->m_checksums.data(), blob, cache_info->m_checksums.size() * sizeof(Buffer::CHECKSUM));
+            }
+            cache_info->m_resume.m_offset       = static_cast<uint64_t>(sqlite3_column_int64(db->m_select_stmt, 23));
+            cache_info->m_resume.m_time         = sqlite3_column_int64(db->m_select_stmt, 24);
+            cache_info->m_resume.m_fragment     = static_cast<uint32_t>(sqlite3_column_int(db->m_select_stmt, 25));
+            cache_info->m_resume.m_header_size  = static_cast<uint64_t>(sqlite3_column_int64(db->m_select_stmt, 26));
+            cache_info->m_segment_duration      = sqlite3_column_int64(db->m_select_stmt, 27);
+            cache_info->m_keyframe_segments     = sqlite3_column_int(db->m_select_stmt, 28) ? true : false;
+            blob                                = sqlite3_column_blob(db->m_select_stmt, 29);
+            bytes                               = sqlite3_column_bytes(db->m_select_stmt, 29);
+            if (blob != nullptr && bytes > 0)
+            {
+                cache_info->m_segment_starts.resize(static_cast<size_t>(bytes) / sizeof(int64_t));
+                std::memcpy(cache_info->m_segment_starts.data(), blob, cache_info->m_segment_starts.size() * sizeof(int64_t));
+            }
         }
         else if (ret != SQLITE_DONE)
         {
-            Logging::error(m_cacheidx_db->filename(), "Sqlite 3 could not step (execute) select statement: (%1) %2", ret, sqlite3_errstr(ret));
+            Logging::error(db->filename(), "Sqlite 3 could not step (execute) select statement: (%1) %2", ret, sqlite3_errstr(ret));
             throw false;
         }
     }
@@ -875,7 +1208,9 @@ bool Cache::read_info(LPCACHE_INFO cache_info)
         success = _success;
     }
 
-    sqlite3_reset(m_cacheidx_db->m_select_stmt);
+    sqlite3_reset(db->m_select_stmt);
+
+    release_reader(db);
 
     if (success)
     {
@@ -916,7 +1251,7 @@ bool Cache::write_info(LPCCACHE_INFO cache_info)
         int ret;
         bool enable_ismv_dummy = false;
 
-        assert(sqlite3_bind_parameter_count(m_cacheidx_db->m_insert_stmt) == 22);
+        assert(sqlite3_bind_parameter_count(m_cacheidx_db->m_insert_stmt) == 31);
 
         SQLBINDTXT(1, cache_info->m_destfile.c_str());
         SQLBINDTXT(2, cache_info->m_desttype.data());
@@ -941,6 +1276,39 @@ bool Cache::write_info(LPCCACHE_INFO cache_info)
         SQLBINDNUM(sqlite3_bind_int64,  20, cache_info->m_access_time);
         SQLBINDNUM(sqlite3_bind_int64,  21, cache_info->m_file_time);
         SQLBINDNUM(sqlite3_bind_int64,  22, static_cast<sqlite3_int64>(cache_info->m_file_size));
+        SQLBINDTXT(23, cache_info->m_cache_root.c_str());
+        if (!cache_info->m_checksums.empty())
+        {
+            ret = sqlite3_bind_blob(m_cacheidx_db->m_insert_stmt, 24, cache_info->m_checksums.data(), static_cast<int>(cache_info->m_checksums.size() * sizeof(Buffer::CHECKSUM)), SQLITE_TRANSIENT);
+        }
+        else
+        {
+            ret = sqlite3_bind_null(m_cacheidx_db->m_insert_stmt, 24);
+        }
+        if (SQLITE_OK != ret)
+        {
+            Logging::error(m_cacheidx_db->filename(), "SQLite3 select column #%1 error: %2\n%3", 24, ret, sqlite3_errstr(ret));
+            throw false;
+        }
+        SQLBINDNUM(sqlite3_bind_int64,  25, static_cast<sqlite3_int64>(cache_info->m_resume.m_offset));
+        SQLBINDNUM(sqlite3_bind_int64,  26, cache_info->m_resume.m_time);
+        SQLBINDNUM(sqlite3_bind_int,    27, static_cast<int32_t>(cache_info->m_resume.m_fragment));
+        SQLBINDNUM(sqlite3_bind_int64,  28, static_cast<sqlite3_int64>(cache_info->m_resume.m_header_size));
+        SQLBINDNUM(sqlite3_bind_int64,  29, cache_info->m_segment_duration);
+        SQLBINDNUM(sqlite3_bind_int,    30, cache_info->m_keyframe_segments);
+        if (!cache_info->m_segment_starts.empty())
+        {
+            ret = sqlite3_bind_blob(m_cacheidx_db->m_insert_stmt, 31, cache_info->m_segment_starts.data(), static_cast<int>(cache_info->m_segment_starts.size() * sizeof(int64_t)), SQLITE_TRANSIENT);
+        }
+        else
+        {
+            ret = sqlite3_bind_null(m_cacheidx_db->m_insert_stmt, 31);
+        }
+        if (SQLITE_OK != ret)
+        {
+            Logging::error(m_cacheidx_db->filename(), "SQLite3 select column #%1 error: %2\n%3", 31, ret, sqlite3_errstr(ret));
+            throw false;
+        }
 
         ret = sqlite3_step(m_cacheidx_db->m_insert_stmt);
 
@@ -965,6 +1333,53 @@ bool Cache::write_info(LPCCACHE_INFO cache_info)
     return success;
 }
 
+bool Cache::next_info(int64_t *rowid, LPCACHE_INFO cache_info)
+{
+    {
+        std::lock_guard<std::recursive_mutex> lock_mutex(m_mutex);
+
+        sqlite3_stmt * stmt = nullptr;
+        const char * sql = "SELECT rowid, filename, desttype FROM cache_entry WHERE rowid > ? AND finished = ? ORDER BY rowid LIMIT 1;\n";
+        int ret;
+
+        if (SQLITE_OK != (ret = sqlite3_prepare_v2(*m_cacheidx_db, sql, -1, &stmt, nullptr)))
+        {
+            Logging::error(m_cacheidx_db->filename(), "Failed to prepare select: (%1) %2\n%3", ret, sqlite3_errmsg(*m_cacheidx_db), sql);
+            return false;
+        }
+
+        sqlite3_bind_int64(stmt, 1, *rowid);
+        sqlite3_bind_int(stmt, 2, static_cast<int>(RESULTCODE::FINISHED_SUCCESS));
+
+        ret = sqlite3_step(stmt);
+
+        if (ret == SQLITE_ROW)
+        {
+            const char *text;
+
+            *rowid = sqlite3_column_int64(stmt, 0);
+            text = reinterpret_cast<const char *>(sqlite3_column_text(stmt, 1));
+            cache_info->m_destfile = text != nullptr ? text : "";
+            text = reinterpret_cast<const char *>(sqlite3_column_text(stmt, 2));
+            cache_info->m_desttype[0] = '\0';
+            strncat(cache_info->m_desttype.data(), text != nullptr ? text : "", cache_info->m_desttype.size() - 1);
+        }
+        else if (ret != SQLITE_DONE)
+        {
+            Logging::error(m_cacheidx_db->filename(), "Sqlite 3 could not step (execute) select statement: (%1) %2", ret, sqlite3_errstr(ret));
+        }
+
+        sqlite3_finalize(stmt);
+
+        if (ret != SQLITE_ROW)
+        {
+            return false;
+        }
+    }
+
+    return read_info(cache_info);
+}
+
 bool Cache::delete_info(const std::string & filename, const std::string & desttype)
 {
     bool success = true;
@@ -1018,24 +1433,135 @@ bool Cache::delete_info(const std::string & filename, const std::string & destty
     return success;
 }
 
-void Cache::close_index()
+bool Cache::read_keyframe_index(LPCVIRTUALFILE virtualfile, FFmpeg_KeyframeIndex *keyframe_index)
 {
-    m_cacheidx_db.reset();
-}
+    struct stat sb;
 
-Cache_Entry* Cache::create_entry(LPVIRTUALFILE virtualfile, const std::string & desttype)
-{
-    //Cache_Entry* cache_entry = new (std::nothrow) Cache_Entry(this, filename);
-    Cache_Entry* cache_entry = Cache_Entry::create(this, virtualfile);
-    if (cache_entry == nullptr)
+    if (m_cacheidx_db == nullptr || stat(virtualfile->m_origfile.c_str(), &sb) == -1)
     {
-        Logging::error(m_cacheidx_db->filename(), "Out of memory creating cache entry.");
-        return nullptr;
+        return false;
     }
 
-    m_cache.emplace(std::pair<std::string, std::string>{virtualfile->m_destfile, desttype}, cache_entry);
+    // Read on a connection of our own, seeks must not wait for the writer
+    sqlite_t * db = acquire_reader();
+    std::unique_lock<std::recursive_mutex> lock_mutex(m_mutex, std::defer_lock);
 
-    return cache_entry;
+    if (db == nullptr)
+    {
+        // None available, share the writer connection
+        db = m_cacheidx_db.get();
+        lock_mutex.lock();
+    }
+
+    sqlite3_stmt * stmt = nullptr;
+    const char * sql = "SELECT stream_idx, keyframes FROM keyframe_index WHERE filename = ? AND file_time = datetime(?, 'unixepoch') AND file_size = ?;\n";
+    bool found = false;
+    int ret;
+
+    if (SQLITE_OK != (ret = sqlite3_prepare_v2(*db, sql, -1, &stmt, nullptr)))
+    {
+        Logging::error(db->filename(), "Failed to prepare select: (%1) %2\n%3", ret, sqlite3_errmsg(*db), sql);
+        release_reader(db);
+        return false;
+    }
+
+    sqlite3_bind_text(stmt, 1, virtualfile->m_origfile.c_str(), -1, nullptr);
+    sqlite3_bind_int64(stmt, 2, static_cast<sqlite3_int64>(sb.st_mtime));
+    sqlite3_bind_int64(stmt, 3, static_cast<sqlite3_int64>(sb.st_size));
+
+    ret = sqlite3_step(stmt);
+
+    if (ret == SQLITE_ROW)
+    {
+        const void *blob    = sqlite3_column_blob(stmt, 1);
+        int bytes           = sqlite3_column_bytes(stmt, 1);
+
+        found = keyframe_index->assign(sqlite3_column_int(stmt, 0), blob, bytes > 0 ? static_cast<size_t>(bytes) : 0);
+    }
+    else if (ret != SQLITE_DONE)
+    {
+        Logging::error(db->filename(), "Sqlite 3 could not step (execute) select statement: (%1) %2", ret, sqlite3_errstr(ret));
+    }
+
+    sqlite3_finalize(stmt);
+
+    release_reader(db);
+
+    errno = 0; // sqlite3 sometimes sets errno without any reason, better reset any error
+
+    return found;
+}
+
+bool Cache::write_keyframe_index(LPCVIRTUALFILE virtualfile, const FFmpeg_KeyframeIndex & keyframe_index)
+{
+    struct stat sb;
+
+    if (m_cacheidx_db == nullptr || !keyframe_index.complete() || !keyframe_index.size() || stat(virtualfile->m_origfile.c_str(), &sb) == -1)
+    {
+        return false;
+    }
+
+    std::lock_guard<std::recursive_mutex> lock_mutex(m_mutex);
+
+    sqlite3_stmt * stmt = nullptr;
+    const char * sql = "INSERT OR REPLACE INTO keyframe_index (filename, file_time, file_size, stream_idx, keyframes) VALUES (?, datetime(?, 'unixepoch'), ?, ?, ?);\n";
+    int ret;
+
+    if (SQLITE_OK != (ret = sqlite3_prepare_v2(*m_cacheidx_db, sql, -1, &stmt, nullptr)))
+    {
+        Logging::error(m_cacheidx_db->filename(), "Failed to prepare insert: (%1) %2\n%3", ret, sqlite3_errmsg(*m_cacheidx_db), sql);
+        return false;
+    }
+
+    sqlite3_bind_text(stmt, 1, virtualfile->m_origfile.c_str(), -1, nullptr);
+    sqlite3_bind_int64(stmt, 2, static_cast<sqlite3_int64>(sb.st_mtime));
+    sqlite3_bind_int64(stmt, 3, static_cast<sqlite3_int64>(sb.st_size));
+    sqlite3_bind_int(stmt, 4, keyframe_index.stream_idx());
+    sqlite3_bind_blob(stmt, 5, keyframe_index.data(), static_cast<int>(keyframe_index.size() * sizeof(FFmpeg_KeyframeIndex::KEYFRAME)), SQLITE_STATIC);
+
+    ret = sqlite3_step(stmt);
+
+    if (ret != SQLITE_DONE)
+    {
+        Logging::error(m_cacheidx_db->filename(), "Sqlite 3 could not step (execute) insert statement: (%1) %2", ret, sqlite3_errstr(ret));
+    }
+
+    sqlite3_finalize(stmt);
+
+    errno = 0; // sqlite3 sometimes sets errno without any reason, better reset any error
+
+    return (ret == SQLITE_DONE);
+}
+
+void Cache::close_index()
+{
+    {
+        std::lock_guard<std::mutex> lock_readers(m_readers_mutex);
+
+        m_idle_readers.clear();
+        m_readers.clear();
+    }
+
+    m_cacheidx_db.reset();
+
+    sqlite3_shutdown();
+}
+
+Cache_Entry* Cache::create_entry(LPVIRTUALFILE virtualfile, const std::string & desttype)
+{
+    //Cache_Entry* cache_entry = new (std::nothrow) Cache_Entry(this, filename);
+    Cache_Entry* cache_entry = Cache_Entry::create(this, virtualfile);
+    if (cache_entry == nullptr)
+    {
+        Logging::error(m_cacheidx_db->filename(), "Out of memory creating cache entry.");
+        return nullptr;
+    }
+
+    size_t hash = entry_hash(virtualfile->m_destfile, desttype);
+
+    shard(hash).m_entries.emplace(hash, cache_entry);
+
+    return cache_entry;
 }
 
 bool Cache::delete_entry(Cache_Entry ** cache_entry, int flags)
@@ -1052,7 +1578,18 @@ bool Cache::delete_entry(Cache_Entry ** cache_entry, int flags)
         // If CACHE_CLOSE_FREE is set, also free memory
         if (CACHE_CHECK_BIT(CACHE_CLOSE_FREE, flags))
         {
-            m_cache.erase(make_pair((*cache_entry)->m_cache_info.m_destfile, (*cache_entry)->m_cache_info.m_desttype.data()));
+            size_t hash = entry_hash((*cache_entry)->m_cache_info.m_destfile, (*cache_entry)->m_cache_info.m_desttype.data());
+            cache_t & entries = shard(hash).m_entries;
+            auto range = entries.equal_range(hash);
+
+            for (cache_t::iterator p = range.first; p != range.second; ++p)
+            {
+                if (p->second == *cache_entry)
+                {
+                    entries.erase(p);
+                    break;
+                }
+            }
 
             deleted = (*cache_entry)->destroy();
             *cache_entry = nullptr;
@@ -1062,24 +1599,119 @@ bool Cache::delete_entry(Cache_Entry ** cache_entry, int flags)
     return deleted;
 }
 
+size_t Cache::entry_hash(std::string_view filename, std::string_view desttype)
+{
+    size_t hash = std::hash<std::string_view>{}(filename);
+
+    hash ^= std::hash<std::string_view>{}(desttype) + 0x9e3779b97f4a7c15 + (hash << 6) + (hash >> 2);
+
+    return hash;
+}
+
+Cache::CACHE_SHARD & Cache::shard(size_t hash)
+{
+    // The low bits select the bucket inside the shard, use the high bits here
+    return m_shards[(hash >> 32 ^ hash >> 16) % REGISTRY_SHARDS];
+}
+
+std::unique_lock<std::shared_mutex> Cache::lock_shard(std::string_view filename, std::string_view desttype)
+{
+    return std::unique_lock<std::shared_mutex>(shard(entry_hash(filename, desttype)).m_mutex);
+}
+
+Cache_Entry* Cache::find_entry(size_t hash, std::string_view filename, std::string_view desttype)
+{
+    auto range = shard(hash).m_entries.equal_range(hash);
+
+    for (cache_t::const_iterator p = range.first; p != range.second; ++p)
+    {
+        if (p->second->m_cache_info.m_destfile == filename && desttype == p->second->m_cache_info.m_desttype.data())
+        {
+            return p->second;
+        }
+    }
+
+    return nullptr;
+}
+
+bool Cache::entry_in_use(std::string_view filename, std::string_view desttype)
+{
+    size_t hash = entry_hash(filename, desttype);
+    std::shared_lock<std::shared_mutex> lock_shard(shard(hash).m_mutex);
+
+    Cache_Entry* cache_entry = find_entry(hash, filename, desttype);
+
+    return (cache_entry != nullptr && cache_entry->ref_count() > 0);
+}
+
 Cache_Entry *Cache::openio(LPVIRTUALFILE virtualfile)
 {
-    Cache_Entry* cache_entry = nullptr;
-    cache_t::const_iterator p = m_cache.find(make_pair(virtualfile->m_destfile, params.current_format(virtualfile)->desttype()));
-    if (p == m_cache.cend())
+    const std::string & desttype = params.current_format(virtualfile)->desttype();
+    size_t hash = entry_hash(virtualfile->m_destfile, desttype);
+    CACHE_SHARD & entries = shard(hash);
+    Cache_Entry* cache_entry;
+
+    {
+        // Fast path: entry already open. Readers do not block each other.
+        std::shared_lock<std::shared_mutex> lock_shard(entries.m_mutex);
+
+        cache_entry = find_entry(hash, virtualfile->m_destfile, desttype);
+    }
+
+    if (cache_entry != nullptr)
+    {
+        Logging::trace(virtualfile->m_destfile, "Reusing cached transcoder.");
+        trace_open(virtualfile, desttype, cache_entry, true);
+        return cache_entry;
+    }
+
+    std::unique_lock<std::shared_mutex> lock_shard(entries.m_mutex);
+
+    // Someone may have been faster
+    cache_entry = find_entry(hash, virtualfile->m_destfile, desttype);
+    if (cache_entry == nullptr)
     {
         Logging::trace(virtualfile->m_destfile, "Created new transcoder.");
-        cache_entry = create_entry(virtualfile, params.current_format(virtualfile)->desttype());
+        cache_entry = create_entry(virtualfile, desttype);
+        trace_open(virtualfile, desttype, nullptr, false);
     }
     else
     {
         Logging::trace(virtualfile->m_destfile, "Reusing cached transcoder.");
-        cache_entry = p->second;
+        trace_open(virtualfile, desttype, cache_entry, true);
     }
 
     return cache_entry;
 }
 
+void Cache::trace_open(LPCVIRTUALFILE virtualfile, const std::string & desttype, Cache_Entry *cache_entry, bool reused)
+{
+    if (!cache_trace_active())
+    {
+        return;
+    }
+
+    TRACE_RECORD record = {};
+
+    record.m_key        = cache_trace_key(virtualfile->m_destfile, desttype);
+    record.m_event      = TRACE_EVENT::OPEN;
+    if (reused)
+    {
+        record.m_flags |= TRACE_FLAG_OPEN;
+    }
+    if (cache_entry != nullptr)
+    {
+        // Newly created entries have not read their cache info yet
+        record.m_size = cache_entry->m_cache_info.m_encoded_filesize;
+        if (cache_entry->is_finished_success())
+        {
+            record.m_flags |= TRACE_FLAG_HIT;
+        }
+    }
+
+    cache_trace(record);
+}
+
 bool Cache::closeio(Cache_Entry **cache_entry, int flags /*= CACHE_CLOSE_NOOPT*/)
 {
     if (*cache_entry == nullptr)
@@ -1090,6 +1722,8 @@ bool Cache::closeio(Cache_Entry **cache_entry, int flags /*= CACHE_CLOSE_NOOPT*/
     bool deleted;
 
     std::string filename((*cache_entry)->filename());
+    std::unique_lock<std::shared_mutex> lock_entry = lock_shard((*cache_entry)->m_cache_info.m_destfile, (*cache_entry)->m_cache_info.m_desttype.data());
+
     if (delete_entry(cache_entry, flags))
     {
         Logging::trace(filename, "Freed cache entry.");
@@ -1104,317 +1738,1180 @@ bool Cache::closeio(Cache_Entry **cache_entry, int flags /*= CACHE_CLOSE_NOOPT*/
     return deleted;
 }
 
-bool Cache::prune_expired()
+bool Cache::fetch_prune_batch(const std::string & sql, const std::string * cache_root, PRUNE_VEC *batch)
 {
-    if (params.m_expiry_time <= 0)
-    {
-        // There's no limit.
-        return true;
-    }
-
-    std::vector<cache_key_t> keys;
-    sqlite3_stmt * stmt;
-    time_t now = time(nullptr);
-    std::string sql;
-
-    Logging::trace(m_cacheidx_db->filename(), "Pruning expired cache entries older than %1...", format_time(params.m_expiry_time).c_str());
-
-    strsprintf(&sql, "SELECT filename, desttype, strftime('%%s', access_time) FROM cache_entry WHERE strftime('%%s', access_time) + %" FFMPEGFS_FORMAT_TIME_T " < %" FFMPEGFS_FORMAT_TIME_T ";\n", params.m_expiry_time, now);
-
     std::lock_guard<std::recursive_mutex> lock_mutex(m_mutex);
 
-    sqlite3_prepare(*m_cacheidx_db, sql.c_str(), -1, &stmt, nullptr);
-
-    int ret = 0;
-    while ((ret = sqlite3_step(stmt)) == SQLITE_ROW)
-    {
-        const char *filename = reinterpret_cast<const char *>(sqlite3_column_text(stmt, 0));
-        const char *desttype = reinterpret_cast<const char *>(sqlite3_column_text(stmt, 1));
+    sqlite3_stmt * stmt = nullptr;
+    int ret;
 
-        keys.emplace_back(filename, desttype);
+    batch->clear();
 
-        Logging::trace(filename, "Found %1 old entries.", format_time(now - static_cast<time_t>(sqlite3_column_int64(stmt, 2))).c_str());
+    if (SQLITE_OK != (ret = sqlite3_prepare_v2(*m_cacheidx_db, sql.c_str(), -1, &stmt, nullptr)))
+    {
+        Logging::error(m_cacheidx_db->filename(), "Failed to prepare select: (%1) %2\n%3", ret, sqlite3_errmsg(*m_cacheidx_db), sql.c_str());
+        return false;
     }
 
-    Logging::trace(m_cacheidx_db->filename(), "%1 expired cache entries found.", keys.size());
+    int idx = 1;
+    if (cache_root != nullptr)
+    {
+        sqlite3_bind_text(stmt, idx++, cache_root->c_str(), -1, nullptr);
+    }
+    sqlite3_bind_int(stmt, idx, MAINTENANCE_BATCH);
 
-    if (ret == SQLITE_DONE)
+    while ((ret = sqlite3_step(stmt)) == SQLITE_ROW)
     {
-        for (const auto& [key, value] : keys)
-        {
-            Logging::trace(m_cacheidx_db->filename(), "Pruning '%1' - Type: %2", key.c_str(), value.c_str());
+        PRUNE_ITEM item;
+        const char *text;
 
-            cache_t::iterator p = m_cache.find(make_pair(key, value));
-            if (p != m_cache.end())
-            {
-                delete_entry(&p->second, CACHE_CLOSE_DELETE);
-            }
+        text = reinterpret_cast<const char *>(sqlite3_column_text(stmt, 0));
+        item.m_filename     = text != nullptr ? text : "";
+        text = reinterpret_cast<const char *>(sqlite3_column_text(stmt, 1));
+        item.m_desttype     = text != nullptr ? text : "";
+        item.m_size         = static_cast<size_t>(sqlite3_column_int64(stmt, 2));
+        text = reinterpret_cast<const char *>(sqlite3_column_text(stmt, 3));
+        item.m_cache_root   = text != nullptr ? text : "";
 
-            if (delete_info(key, value))
-            {
-                remove_cachefile(key, value);
-            }
-        }
+        batch->push_back(item);
     }
-    else
+
+    if (ret != SQLITE_DONE)
     {
         Logging::error(m_cacheidx_db->filename(), "Failed to execute select. Return code: %1 Error: %2 SQL: %3", ret, sqlite3_errmsg(*m_cacheidx_db), expanded_sql(stmt).c_str());
     }
 
     sqlite3_finalize(stmt);
 
-    return true;
+    return (ret == SQLITE_DONE);
 }
 
-bool Cache::prune_cache_size()
+bool Cache::prune_entry(const PRUNE_ITEM & item)
 {
-    if (!params.m_max_cache_size)
+    // Lock order: registry shard first, then the cache lock
+    std::unique_lock<std::shared_mutex> lock_entry = lock_shard(item.m_filename, item.m_desttype);
+    std::lock_guard<std::recursive_mutex> lock_mutex(m_mutex);
+
+    Logging::trace(m_cacheidx_db->filename(), "Pruning: %1 Type: %2", item.m_filename.c_str(), item.m_desttype.c_str());
+
+    Cache_Entry* cache_entry = find_entry(entry_hash(item.m_filename, item.m_desttype), item.m_filename, item.m_desttype);
+    if (cache_entry != nullptr)
     {
-        // There's no limit.
-        return true;
+        delete_entry(&cache_entry, CACHE_CLOSE_DELETE);
     }
 
-    std::vector<cache_key_t> keys;
-    std::vector<size_t> filesizes;
-    sqlite3_stmt * stmt;
-    const char * sql;
+    if (!delete_info(item.m_filename, item.m_desttype))
+    {
+        return false;
+    }
+
+    remove_cachefile(item.m_filename, item.m_desttype, item.m_cache_root);
 
-    Logging::trace(m_cacheidx_db->filename(), "Pruning oldest cache entries exceeding %1 cache size...", format_size(params.m_max_cache_size).c_str());
+    if (cache_trace_active())
+    {
+        TRACE_RECORD record = {};
 
-    sql = "SELECT filename, desttype, encoded_filesize FROM cache_entry ORDER BY access_time ASC;\n";
+        record.m_key        = cache_trace_key(item.m_filename, item.m_desttype);
+        record.m_size       = item.m_size;
+        record.m_event      = TRACE_EVENT::PRUNE;
 
-    std::lock_guard<std::recursive_mutex> lock_mutex(m_mutex);
+        cache_trace(record);
+    }
 
-    sqlite3_prepare(*m_cacheidx_db, sql, -1, &stmt, nullptr);
+    return true;
+}
 
-    int ret = 0;
-    size_t total_size = 0;
-    while((ret = sqlite3_step(stmt)) == SQLITE_ROW)
+void Cache::maintenance_pause(bool throttled, size_t filesize)
+{
+    if (!throttled)
     {
-        const char *filename = reinterpret_cast<const char *>(sqlite3_column_text(stmt, 0));
-        const char *desttype = reinterpret_cast<const char *>(sqlite3_column_text(stmt, 1));
-        size_t size = static_cast<size_t>(sqlite3_column_int64(stmt, 2));
-
-        keys.emplace_back(filename, desttype);
-        filesizes.push_back(size);
-        total_size += size;
+        return;
     }
 
-    Logging::trace(m_cacheidx_db->filename(), "%1 in cache.", format_size(total_size).c_str());
+    // Give the disk (and the cache lock) to others between two entries
+    std::chrono::milliseconds pause(static_cast<int64_t>(filesize / (MAINTENANCE_MAX_RATE / 1000)));
 
-    if (total_size > params.m_max_cache_size)
+    if (pause < std::chrono::milliseconds(MAINTENANCE_MIN_PAUSE))
     {
-        Logging::trace(m_cacheidx_db->filename(), "Pruning %1 of oldest cache entries to limit cache size.", format_size(total_size - params.m_max_cache_size).c_str());
-        if (ret == SQLITE_DONE)
-        {
-            size_t n = 0;
-            for (const auto& [key, value] : keys)
-            {
-                Logging::trace(m_cacheidx_db->filename(), "Pruning: %1 Type: %2", key.c_str(), value.c_str());
-
-                cache_t::iterator p = m_cache.find(make_pair(key, value));
-                if (p != m_cache.end())
-                {
-                    delete_entry(&p->second, CACHE_CLOSE_DELETE);
-                }
+        pause = std::chrono::milliseconds(MAINTENANCE_MIN_PAUSE);
+    }
 
-                if (delete_info(key, value))
-                {
-                    remove_cachefile(key, value);
-                }
+    std::this_thread::sleep_for(pause);
+}
 
-                total_size -= filesizes[n++];
+size_t Cache::cache_size()
+{
+    std::lock_guard<std::recursive_mutex> lock_mutex(m_mutex);
 
-                if (total_size <= params.m_max_cache_size)
-                {
-                    break;
-                }
-            }
+    sqlite3_stmt * stmt = nullptr;
+    size_t total_size = 0;
+    const char * sql = "SELECT SUM(encoded_filesize) FROM cache_entry;\n";
 
-            Logging::trace(m_cacheidx_db->filename(), "%1 left in cache.", format_size(total_size).c_str());
-        }
-        else
-        {
-            Logging::error(m_cacheidx_db->filename(), "Failed to execute select. Return code: %1 Error: %2 SQL: %3", ret, sqlite3_errmsg(*m_cacheidx_db), expanded_sql(stmt).c_str());
-        }
+    if (SQLITE_OK == sqlite3_prepare_v2(*m_cacheidx_db, sql, -1, &stmt, nullptr) && sqlite3_step(stmt) == SQLITE_ROW)
+    {
+        total_size = static_cast<size_t>(sqlite3_column_int64(stmt, 0));
     }
 
     sqlite3_finalize(stmt);
 
-    return true;
+    return total_size;
 }
 
-bool Cache::prune_disk_space(size_t predicted_filesize)
+bool Cache::prune_expired(bool throttled)
 {
-    std::string cachepath;
+    if (params.m_expiry_time <= 0)
+    {
+        // There's no limit.
+        return true;
+    }
 
-    transcoder_cache_path(&cachepath);
+    time_t now = time(nullptr);
+    std::string sql;
+    size_t pruned = 0;
+    bool success = true;
 
-    size_t free_bytes = get_disk_free(cachepath);
+    Logging::trace(m_cacheidx_db->filename(), "Pruning expired cache entries older than %1...", format_time(params.m_expiry_time).c_str());
 
-    if (!free_bytes && errno)
+    strsprintf(&sql, "SELECT filename, desttype, encoded_filesize, cache_root FROM cache_entry WHERE strftime('%%s', access_time) + %" FFMPEGFS_FORMAT_TIME_T " < %" FFMPEGFS_FORMAT_TIME_T " ORDER BY access_time ASC LIMIT ?;\n", params.m_expiry_time, now);
+
+    for (;;)
     {
-        if (errno == ENOENT)
+        PRUNE_VEC batch;
+        size_t done = 0;
+
+        if (!fetch_prune_batch(sql, nullptr, &batch))
         {
-            // Cache path does not exist. Strange problem, but not error. Ignore silently.
-            return true;
+            success = false;
+            break;
         }
 
-        Logging::error(cachepath, "prune_disk_space() cannot determine free disk space: (%1) %2", errno, strerror(errno));
-        return false;
-    }
+        for (const PRUNE_ITEM & item : batch)
+        {
+            if (prune_entry(item))
+            {
+                done++;
+            }
+            maintenance_pause(throttled, item.m_size);
+        }
 
-    if (free_bytes < predicted_filesize)
-    {
-        Logging::error(cachepath, "prune_disk_space() : Insufficient disk space %1 on cache drive, at least %2 required.", format_size(free_bytes).c_str(), format_size(predicted_filesize).c_str());
-        errno = ENOSPC;
-        return false;
+        pruned += done;
+
+        if (batch.size() < MAINTENANCE_BATCH || !done)
+        {
+            break;
+        }
     }
 
-    std::lock_guard<std::recursive_mutex> lock_mutex(m_mutex);
+    Logging::trace(m_cacheidx_db->filename(), "%1 expired cache entries pruned.", pruned);
 
-    Logging::trace(cachepath, "%1 disk space before prune.", format_size(free_bytes).c_str());
-    if (free_bytes < params.m_min_diskspace + predicted_filesize)
-    {
-        std::vector<cache_key_t> keys;
-        std::vector<size_t> filesizes;
-        sqlite3_stmt * stmt;
-        const char * sql;
+    return success;
+}
 
-        sql = "SELECT filename, desttype, encoded_filesize FROM cache_entry ORDER BY access_time ASC;\n";
+bool Cache::prune_keyframe_index(bool throttled)
+{
+    const char * select_sql = "SELECT rowid, filename, strftime('%s', file_time), file_size FROM keyframe_index WHERE rowid > ? ORDER BY rowid LIMIT ?;\n";
+    const char * delete_sql = "DELETE FROM keyframe_index WHERE filename = ? AND file_time = datetime(?, 'unixepoch') AND file_size = ?;\n";
+    sqlite3_int64 rowid = 0;
+    size_t pruned = 0;
+    bool success = true;
 
-        sqlite3_prepare(*m_cacheidx_db, sql, -1, &stmt, nullptr);
+    Logging::trace(m_cacheidx_db->filename(), "Pruning key frame indexes of deleted or changed source files...");
 
-        int ret = 0;
-        while ((ret = sqlite3_step(stmt)) == SQLITE_ROW)
+    for (;;)
+    {
+        struct KEYFRAME_ITEM
         {
-            const char *filename = reinterpret_cast<const char *>(sqlite3_column_text(stmt, 0));
-            const char *desttype = reinterpret_cast<const char *>(sqlite3_column_text(stmt, 1));
-            size_t size = static_cast<size_t>(sqlite3_column_int64(stmt, 2));
-
-            keys.emplace_back(filename, desttype);
-            filesizes.push_back(size);
-        }
-
-        Logging::trace(cachepath, "Pruning %1 of oldest cache entries to keep disk space above %2 limit...", format_size(params.m_min_diskspace + predicted_filesize - free_bytes).c_str(), format_size(params.m_min_diskspace).c_str());
+            std::string m_filename;
+            time_t      m_file_time;
+            size_t      m_file_size;
+        };
+        std::vector<KEYFRAME_ITEM> batch;
+        sqlite3_stmt * stmt = nullptr;
+        int ret;
 
-        if (ret == SQLITE_DONE)
         {
-            size_t n = 0;
-            for (const auto& [key, value] : keys)
-            {
-                Logging::trace(cachepath, "Pruning: %1 Type: %2", key.c_str(), value.c_str());
+            std::lock_guard<std::recursive_mutex> lock_mutex(m_mutex);
 
-                cache_t::iterator p = m_cache.find(make_pair(key, value));
-                if (p != m_cache.end())
-                {
-                    delete_entry(&p->second, CACHE_CLOSE_DELETE);
-                }
+            if (SQLITE_OK != (ret = sqlite3_prepare_v2(*m_cacheidx_db, select_sql, -1, &stmt, nullptr)))
+            {
+                Logging::error(m_cacheidx_db->filename(), "Failed to prepare select: (%1) %2\n%3", ret, sqlite3_errmsg(*m_cacheidx_db), select_sql);
+                return false;
+            }
 
-                if (delete_info(key, value))
-                {
-                    remove_cachefile(key, value);
-                }
+            sqlite3_bind_int64(stmt, 1, rowid);
+            sqlite3_bind_int(stmt, 2, MAINTENANCE_BATCH);
+
+            while ((ret = sqlite3_step(stmt)) == SQLITE_ROW)
+            {
+                const char *text = reinterpret_cast<const char *>(sqlite3_column_text(stmt, 1));
 
-                free_bytes += filesizes[n++];
+                rowid = sqlite3_column_int64(stmt, 0);
+                batch.push_back({ text != nullptr ? text : "", static_cast<time_t>(sqlite3_column_int64(stmt, 2)), static_cast<size_t>(sqlite3_column_int64(stmt, 3)) });
+            }
 
-                if (free_bytes >= params.m_min_diskspace + predicted_filesize)
-                {
-                    break;
-                }
+            if (ret != SQLITE_DONE)
+            {
+                Logging::error(m_cacheidx_db->filename(), "Failed to execute select. Return code: %1 Error: %2 SQL: %3", ret, sqlite3_errmsg(*m_cacheidx_db), expanded_sql(stmt).c_str());
+                success = false;
             }
-            Logging::trace(cachepath, "Disk space after prune: %1", format_size(free_bytes).c_str());
+
+            sqlite3_finalize(stmt);
         }
-        else
+
+        for (const KEYFRAME_ITEM & item : batch)
         {
-            Logging::error(cachepath, "Failed to execute select. Return code: %1 Error: %2 SQL: %3", ret, sqlite3_errmsg(*m_cacheidx_db), expanded_sql(stmt).c_str());
+            struct stat sb;
+
+            if (stat(item.m_filename.c_str(), &sb) == 0 && sb.st_mtime == item.m_file_time && static_cast<size_t>(sb.st_size) == item.m_file_size)
+            {
+                // Source unchanged, index still valid
+                continue;
+            }
+
+            std::lock_guard<std::recursive_mutex> lock_mutex(m_mutex);
+
+            if (SQLITE_OK != (ret = sqlite3_prepare_v2(*m_cacheidx_db, delete_sql, -1, &stmt, nullptr)))
+            {
+                Logging::error(m_cacheidx_db->filename(), "Failed to prepare delete: (%1) %2\n%3", ret, sqlite3_errmsg(*m_cacheidx_db), delete_sql);
+                return false;
+            }
+
+            // Matching time and size, so that an index just rebuilt from the changed file is kept
+            sqlite3_bind_text(stmt, 1, item.m_filename.c_str(), -1, nullptr);
+            sqlite3_bind_int64(stmt, 2, static_cast<sqlite3_int64>(item.m_file_time));
+            sqlite3_bind_int64(stmt, 3, static_cast<sqlite3_int64>(item.m_file_size));
+
+            if ((ret = sqlite3_step(stmt)) == SQLITE_DONE)
+            {
+                pruned += static_cast<size_t>(sqlite3_changes(*m_cacheidx_db));
+            }
+            else
+            {
+                Logging::error(m_cacheidx_db->filename(), "Sqlite 3 could not step (execute) delete statement: (%1) %2", ret, sqlite3_errstr(ret));
+                success = false;
+            }
+
+            sqlite3_finalize(stmt);
         }
 
-        sqlite3_finalize(stmt);
+        if (!success || batch.size() < MAINTENANCE_BATCH)
+        {
+            break;
+        }
+
+        maintenance_pause(throttled, 0);
     }
 
-    return true;
+    errno = 0; // sqlite3 sometimes sets errno without any reason, better reset any error
+
+    Logging::trace(m_cacheidx_db->filename(), "%1 key frame indexes pruned.", pruned);
+
+    return success;
+}
+
+bool Cache::prune_cache_size(bool throttled)
+{
+    if (!params.m_max_cache_size)
+    {
+        // There's no limit.
+        return true;
+    }
+
+    size_t total_size = cache_size();
+    bool success = true;
+
+    Logging::trace(m_cacheidx_db->filename(), "%1 in cache.", format_size(total_size).c_str());
+
+    if (total_size <= params.m_max_cache_size)
+    {
+        return true;
+    }
+
+    // Prune a bit more than required so that we do not start over with the next new file
+    size_t low_watermark = params.m_max_cache_size / 100 * MAINTENANCE_LOW_WATERMARK;
+
+    Logging::trace(m_cacheidx_db->filename(), "Pruning %1 of oldest cache entries to limit cache size.", format_size(total_size - low_watermark).c_str());
+
+    const std::string sql("SELECT filename, desttype, encoded_filesize, cache_root FROM cache_entry ORDER BY access_time ASC LIMIT ?;\n");
+
+    while (total_size > low_watermark)
+    {
+        PRUNE_VEC batch;
+        size_t done = 0;
+
+        if (!fetch_prune_batch(sql, nullptr, &batch))
+        {
+            success = false;
+            break;
+        }
+
+        for (const PRUNE_ITEM & item : batch)
+        {
+            if (prune_entry(item))
+            {
+                total_size -= std::min(total_size, item.m_size);
+                done++;
+            }
+
+            if (total_size <= low_watermark)
+            {
+                break;
+            }
+
+            maintenance_pause(throttled, item.m_size);
+        }
+
+        if (batch.size() < MAINTENANCE_BATCH || !done)
+        {
+            break;
+        }
+    }
+
+    Logging::trace(m_cacheidx_db->filename(), "%1 left in cache.", format_size(total_size).c_str());
+
+    return success;
 }
 
-bool Cache::maintenance(size_t predicted_filesize)
+bool Cache::prune_disk_space(size_t predicted_filesize, const std::string & cache_root, bool throttled)
+{
+    const CACHEROOT_VEC & roots = transcoder_cache_roots();
+    bool success = true;
+
+    for (size_t n = 0; n < roots.size(); n++)
+    {
+        // Root 0 is the primary cache path, recorded as empty string in the index
+        const std::string root_key(n ? roots[n].m_path : "");
+
+        success &= prune_disk_space(roots[n], !n, root_key == cache_root ? predicted_filesize : 0, throttled);
+    }
+
+    return success;
+}
+
+bool Cache::prune_disk_space(const CACHEROOT & cache_root, bool is_primary, size_t predicted_filesize, bool throttled)
+{
+    std::string cachepath(cache_root.m_path);
+
+    size_t free_bytes = get_disk_free(cachepath);
+
+    if (!free_bytes && errno)
+    {
+        if (errno == ENOENT)
+        {
+            // Cache path does not exist. Strange problem, but not error. Ignore silently.
+            return true;
+        }
+
+        Logging::error(cachepath, "prune_disk_space() cannot determine free disk space: (%1) %2", errno, strerror(errno));
+        return false;
+    }
+
+    if (free_bytes < predicted_filesize)
+    {
+        Logging::error(cachepath, "prune_disk_space() : Insufficient disk space %1 on cache drive, at least %2 required.", format_size(free_bytes).c_str(), format_size(predicted_filesize).c_str());
+        errno = ENOSPC;
+        return false;
+    }
+
+    Logging::trace(cachepath, "%1 disk space before prune.", format_size(free_bytes).c_str());
+
+    if (free_bytes >= cache_root.m_min_diskspace + predicted_filesize)
+    {
+        return true;
+    }
+
+    Logging::trace(cachepath, "Pruning %1 of oldest cache entries to keep disk space above %2 limit...", format_size(cache_root.m_min_diskspace + predicted_filesize - free_bytes).c_str(), format_size(cache_root.m_min_diskspace).c_str());
+
+    // Only consider entries that actually live on this root
+    const std::string sql("SELECT filename, desttype, encoded_filesize, cache_root FROM cache_entry WHERE cache_root = ? ORDER BY access_time ASC LIMIT ?;\n");
+    const std::string root_key(is_primary ? "" : cachepath);
+    bool success = true;
+
+    while (free_bytes < cache_root.m_min_diskspace + predicted_filesize)
+    {
+        PRUNE_VEC batch;
+        size_t done = 0;
+
+        if (!fetch_prune_batch(sql, &root_key, &batch))
+        {
+            success = false;
+            break;
+        }
+
+        for (const PRUNE_ITEM & item : batch)
+        {
+            if (prune_entry(item))
+            {
+                free_bytes += item.m_size;
+                done++;
+            }
+
+            if (free_bytes >= cache_root.m_min_diskspace + predicted_filesize)
+            {
+                break;
+            }
+
+            maintenance_pause(throttled, item.m_size);
+        }
+
+        if (batch.size() < MAINTENANCE_BATCH || !done)
+        {
+            break;
+        }
+    }
+
+    Logging::trace(cachepath, "Disk space after prune: %1", format_size(free_bytes).c_str());
+
+    return success;
+}
+
+bool Cache::maintenance(size_t predicted_filesize, const std::string & cache_root, bool throttled)
 {
     bool success = true;
 
     // Find and remove expired cache entries
-    success &= prune_expired();
+    success &= prune_expired(throttled);
+
+    // Drop key frame indexes of deleted or changed source files
+    success &= prune_keyframe_index(throttled);
 
     // Check max. cache size
-    success &= prune_cache_size();
+    success &= prune_cache_size(throttled);
 
     // Check min. diskspace required for cache
-    success &= prune_disk_space(predicted_filesize);
+    success &= prune_disk_space(predicted_filesize, cache_root, throttled);
 
     return success;
 }
 
-bool Cache::clear()
+bool Cache::check_watermarks(size_t predicted_filesize, const std::string & cache_root)
 {
-    bool success = true;
+    if (!cache_maintenance_running())
+    {
+        // No maintenance thread, do it right here
+        return maintenance(predicted_filesize, cache_root);
+    }
+
+    const CACHEROOT_VEC & roots = transcoder_cache_roots();
+    bool crossed = false;
+
+    for (size_t n = 0; n < roots.size(); n++)
+    {
+        if ((n ? roots[n].m_path : "") != cache_root)
+        {
+            continue;
+        }
+
+        std::string cachepath(roots[n].m_path);
+        size_t free_bytes = get_disk_free(cachepath);
+
+        if (!free_bytes && errno)
+        {
+            break;
+        }
+
+        if (free_bytes < predicted_filesize)
+        {
+            // Room is needed right now, cannot wait for the maintenance thread
+            return prune_disk_space(roots[n], !n, predicted_filesize, false);
+        }
+
+        crossed = (free_bytes < roots[n].m_min_diskspace + predicted_filesize);
+        break;
+    }
+
+    if (!crossed && params.m_max_cache_size)
+    {
+        crossed = (cache_size() + predicted_filesize > params.m_max_cache_size);
+    }
+
+    if (crossed)
+    {
+        trigger_cache_maintenance();
+    }
+
+    return true;
+}
+
+/**
+ * @brief Calculate the 64 bit FNV-1a hash of a string.
+ * @param[in] str - String to hash.
+ * @return Returns the hash value.
+ */
+static uint64_t fnv1a_hash(const std::string & str)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+
+    for (unsigned char c : str)
+    {
+        hash ^= c;
+        hash *= 0x100000001b3ULL;
+    }
+
+    return hash;
+}
+
+std::string Cache::select_cache_root(const std::string & key, size_t predicted_filesize) const
+{
+    const CACHEROOT_VEC & roots = transcoder_cache_roots();
+
+    if (roots.size() == 1)
+    {
+        return "";
+    }
+
+    ssize_t best = -1;
+    ssize_t best_full = -1;
+    double best_score = 0;
+    double best_full_score = 0;
+
+    for (size_t n = 0; n < roots.size(); n++)
+    {
+        const CACHEROOT & root = roots[n];
+
+        if (!root.m_weight)
+        {
+            // Drained: keep existing entries, but place no new ones here
+            continue;
+        }
+
+        // Map hash to (0, 1), then score -weight / ln(u). The highest score wins.
+        uint64_t hash = fnv1a_hash(key + '\0' + root.m_path);
+        double u = (static_cast<double>(hash >> 11) + 0.5) / 9007199254740992.0;   // 2^53
+        double score = -static_cast<double>(root.m_weight) / std::log(u);
+
+        if (best_full < 0 || score > best_full_score)
+        {
+            best_full = static_cast<ssize_t>(n);
+            best_full_score = score;
+        }
+
+        std::string cachepath(root.m_path);
+
+        errno = 0;
+        size_t free_bytes = get_disk_free(cachepath);
+        if ((!free_bytes && errno) || free_bytes < root.m_min_diskspace + predicted_filesize)
+        {
+            // Unavailable or full
+            continue;
+        }
+
+        if (best < 0 || score > best_score)
+        {
+            best = static_cast<ssize_t>(n);
+            best_score = score;
+        }
+    }
+
+    if (best < 0)
+    {
+        // All roots are full or drained. Place by hash anyway, maintenance will have to make room.
+        best = best_full;
+    }
+
+    if (best <= 0)
+    {
+        return "";
+    }
+
+    return roots[static_cast<size_t>(best)].m_path;
+}
+
+bool Cache::is_cache_root(const std::string & cache_root) const
+{
+    if (cache_root.empty())
+    {
+        return true;
+    }
+
+    const CACHEROOT_VEC & roots = transcoder_cache_roots();
+
+    for (size_t n = 1; n < roots.size(); n++)
+    {
+        if (roots[n].m_path == cache_root)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool Cache::start_scrubber(time_t interval)
+{
+    if (m_scrubber.joinable() || !interval)
+    {
+        return true;
+    }
+
+    m_scrubber_stop = false;
+
+    try
+    {
+        m_scrubber = std::thread(&Cache::scrubber_thread, this, interval);
+    }
+    catch (const std::system_error & e)
+    {
+        Logging::error(nullptr, "Unable to start cache scrubber: %1", e.what());
+        return false;
+    }
+
+    return true;
+}
+
+void Cache::stop_scrubber()
+{
+    if (!m_scrubber.joinable())
+    {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock_scrubber(m_scrubber_mutex);
+        m_scrubber_stop = true;
+    }
+    m_scrubber_cond.notify_all();
+
+    m_scrubber.join();
+}
 
+void Cache::scrubber_thread(time_t interval)
+{
+    // Leave the CPU to the transcoders. On Linux this affects the calling thread only.
+    if (setpriority(PRIO_PROCESS, static_cast<id_t>(syscall(SYS_gettid)), 19) == -1)
+    {
+        Logging::debug(nullptr, "Cache scrubber: Unable to lower priority: (%1) %2", errno, strerror(errno));
+    }
+
+    Logging::info(nullptr, "Cache scrubber started, verifying cache every %1.", format_time(interval).c_str());
+
+    while (!m_scrubber_stop)
+    {
+        {
+            std::unique_lock<std::mutex> lock_scrubber(m_scrubber_mutex);
+            m_scrubber_cond.wait_for(lock_scrubber, std::chrono::seconds(interval), [this] { return m_scrubber_stop.load(); });
+        }
+
+        if (m_scrubber_stop)
+        {
+            break;
+        }
+
+        Logging::debug(nullptr, "Cache scrubber: Starting pass.");
+
+        int64_t rowid = 0;
+        do
+        {
+            scrub_next(rowid, &rowid);
+        }
+        while (rowid && !m_scrubber_stop);
+
+        Logging::debug(nullptr, "Cache scrubber: Pass complete.");
+    }
+
+    Logging::info(nullptr, "Cache scrubber stopped.");
+}
+
+void Cache::scrub_next(int64_t rowid, int64_t *next_rowid)
+{
+    std::string filename;
+    std::string desttype;
+    std::string cache_root;
+    Buffer::CHECKSUM_VEC checksums;
+
+    *next_rowid = 0;
+
+    {
+        std::lock_guard<std::recursive_mutex> lock_mutex(m_mutex);
+
+        sqlite3_stmt * stmt = nullptr;
+        const char * sql = "SELECT rowid, filename, desttype, cache_root, checksums FROM cache_entry WHERE rowid > ? AND finished = ? AND checksums IS NOT NULL ORDER BY rowid LIMIT 1;\n";
+        int ret;
+
+        if (SQLITE_OK != (ret = sqlite3_prepare_v2(*m_cacheidx_db, sql, -1, &stmt, nullptr)))
+        {
+            Logging::error(m_cacheidx_db->filename(), "Failed to prepare scrubber select: (%1) %2\n%3", ret, sqlite3_errmsg(*m_cacheidx_db), sql);
+            return;
+        }
+
+        sqlite3_bind_int64(stmt, 1, rowid);
+        sqlite3_bind_int(stmt, 2, static_cast<int>(RESULTCODE::FINISHED_SUCCESS));
+
+        ret = sqlite3_step(stmt);
+
+        if (ret == SQLITE_ROW)
+        {
+            const char *text;
+
+            *next_rowid = sqlite3_column_int64(stmt, 0);
+            text = reinterpret_cast<const char *>(sqlite3_column_text(stmt, 1));
+            filename    = text != nullptr ? text : "";
+            text = reinterpret_cast<const char *>(sqlite3_column_text(stmt, 2));
+            desttype    = text != nullptr ? text : "";
+            text = reinterpret_cast<const char *>(sqlite3_column_text(stmt, 3));
+            cache_root  = text != nullptr ? text : "";
+
+            const void *blob    = sqlite3_column_blob(stmt, 4);
+            int bytes           = sqlite3_column_bytes(stmt, 4);
+            if (blob != nullptr && bytes > 0)
+            {
+                checksums.resize(static_cast<size_t>(bytes) / sizeof(Buffer::CHECKSUM));
+                std::memcpy(checksums.data(), blob, checksums.size() * sizeof(Buffer::CHECKSUM));
+            }
+        }
+        else if (ret != SQLITE_DONE)
+        {
+            Logging::error(m_cacheidx_db->filename(), "Sqlite 3 could not step (execute) scrubber select: (%1) %2", ret, sqlite3_errstr(ret));
+        }
+
+        sqlite3_finalize(stmt);
+
+        if (!*next_rowid)
+        {
+            return;
+        }
+    }
+
+    // Do not touch entries that are currently in use
+    if (entry_in_use(filename, desttype))
+    {
+        return;
+    }
+
+    const FFmpegfs_Format *format = nullptr;
+    for (const FFmpegfs_Format & fmt : ffmpeg_format)
+    {
+        if (fmt.desttype() == desttype)
+        {
+            format = &fmt;
+            break;
+        }
+    }
+
+    if (format == nullptr)
+    {
+        // Format no longer configured, will be pruned by maintenance
+        return;
+    }
+
+    for (size_t n = 0; n < checksums.size() && !m_scrubber_stop; n++)
+    {
+        if (!checksums[n].m_size)
+        {
+            // Segment not finished
+            continue;
+        }
+
+        std::string cachefile;
+
+        if (format->is_hls())
+        {
+            Buffer::make_cachefile_name(&cachefile, filename + "." + make_filename(static_cast<uint32_t>(n + 1), format->fileext()), format->fileext(), false, cache_root);
+        }
+        else
+        {
+            Buffer::make_cachefile_name(&cachefile, filename, format->fileext(), false, cache_root);
+        }
+
+        struct stat sb_before;
+        if (stat(cachefile.c_str(), &sb_before) == -1)
+        {
+            // Gone, will be repaired when read
+            continue;
+        }
+
+        int res = Buffer::verify_checksum(cachefile, checksums[n], SCRUB_MAX_RATE, &m_scrubber_stop);
+
+        if (res < 0)
+        {
+            if (errno != ECANCELED && errno != ENOENT)
+            {
+                Logging::warning(cachefile, "Cache scrubber: Unable to verify file: (%1) %2", errno, strerror(errno));
+            }
+            continue;
+        }
+
+        if (res)
+        {
+            continue;
+        }
+
+        // Keep the entry from being opened while the file is removed
+        size_t hash = entry_hash(filename, desttype);
+        std::unique_lock<std::shared_mutex> lock_entry(shard(hash).m_mutex);
+
+        // Make sure the file has not been opened or rewritten meanwhile
+        Cache_Entry* cache_entry = find_entry(hash, filename, desttype);
+        struct stat sb_after;
+        if ((cache_entry != nullptr && cache_entry->ref_count() > 0) ||
+                stat(cachefile.c_str(), &sb_after) == -1 ||
+                sb_after.st_mtim.tv_sec != sb_before.st_mtim.tv_sec ||
+                sb_after.st_mtim.tv_nsec != sb_before.st_mtim.tv_nsec ||
+                sb_after.st_size != sb_before.st_size)
+        {
+            continue;
+        }
+
+        Logging::warning(cachefile, "Cache scrubber: Checksum mismatch. Removing corrupted file, it will be transcoded again when read.");
+
+        Buffer::remove_file(cachefile);
+    }
+}
+
+bool Cache::start_sweep(unsigned int threads)
+{
+    if (!m_sweepers.empty() || !threads)
+    {
+        return true;
+    }
+
+    m_sweep_stop        = false;
+    m_sweep_rowid       = 0;
+    m_sweep_checked     = 0;
+    m_sweep_repaired    = 0;
+    m_sweep_started     = time(nullptr);
+    m_sweep_running     = threads;
+
+    Logging::info(nullptr, "Cache consistency sweep started with %1 threads.", threads);
+
+    for (unsigned int n = 0; n < threads; n++)
+    {
+        try
+        {
+            m_sweepers.emplace_back(&Cache::sweep_thread, this);
+        }
+        catch (const std::system_error & e)
+        {
+            Logging::error(nullptr, "Unable to start cache sweeper: %1", e.what());
+            // The threads started so far will do the job
+            m_sweep_running -= threads - n;
+            return !m_sweepers.empty();
+        }
+    }
+
+    return true;
+}
+
+void Cache::stop_sweep()
+{
+    if (m_sweepers.empty())
+    {
+        return;
+    }
+
+    m_sweep_stop = true;
+
+    for (std::thread & sweeper : m_sweepers)
+    {
+        sweeper.join();
+    }
+
+    m_sweepers.clear();
+}
+
+void Cache::sweep_thread()
+{
+    // Leave the CPU to the transcoders. On Linux this affects the calling thread only.
+    if (setpriority(PRIO_PROCESS, static_cast<id_t>(syscall(SYS_gettid)), 19) == -1)
+    {
+        Logging::debug(nullptr, "Cache sweeper: Unable to lower priority: (%1) %2", errno, strerror(errno));
+    }
+
+    SWEEP_VEC batch;
+
+    while (!m_sweep_stop && fetch_sweep_batch(&batch) && !batch.empty())
+    {
+        for (const SWEEP_ITEM & item : batch)
+        {
+            if (m_sweep_stop)
+            {
+                break;
+            }
+
+            sweep_entry(item);
+        }
+    }
+
+    if (m_sweep_running.fetch_sub(1) == 1)
+    {
+        // Last one out
+        Logging::info(nullptr, "Cache consistency sweep %1: %2 entries checked, %3 repaired in %4.",
+                      m_sweep_stop ? "stopped" : "complete",
+                      m_sweep_checked.load(),
+                      m_sweep_repaired.load(),
+                      format_time(time(nullptr) - m_sweep_started).c_str());
+    }
+}
+
+bool Cache::fetch_sweep_batch(SWEEP_VEC *batch)
+{
+    batch->clear();
+
+    // Hand out each batch to one thread only
+    std::lock_guard<std::mutex> lock_sweep(m_sweep_mutex);
     std::lock_guard<std::recursive_mutex> lock_mutex(m_mutex);
 
-    std::vector<cache_key_t> keys;
-    sqlite3_stmt * stmt;
-    const char * sql;
+    sqlite3_stmt * stmt = nullptr;
+    const char * sql = "SELECT rowid, filename, desttype, cache_root, checksums FROM cache_entry WHERE rowid > ? AND finished = ? ORDER BY rowid LIMIT ?;\n";
+    int ret;
 
-    sql = "SELECT filename, desttype FROM cache_entry;\n";
+    if (SQLITE_OK != (ret = sqlite3_prepare_v2(*m_cacheidx_db, sql, -1, &stmt, nullptr)))
+    {
+        Logging::error(m_cacheidx_db->filename(), "Failed to prepare sweep select: (%1) %2\n%3", ret, sqlite3_errmsg(*m_cacheidx_db), sql);
+        return false;
+    }
 
-    sqlite3_prepare(*m_cacheidx_db, sql, -1, &stmt, nullptr);
+    sqlite3_bind_int64(stmt, 1, m_sweep_rowid);
+    sqlite3_bind_int(stmt, 2, static_cast<int>(RESULTCODE::FINISHED_SUCCESS));
+    sqlite3_bind_int64(stmt, 3, static_cast<sqlite3_int64>(SWEEP_BATCH));
 
-    int ret = 0;
-    while((ret = sqlite3_step(stmt)) == SQLITE_ROW)
+    while ((ret = sqlite3_step(stmt)) == SQLITE_ROW)
     {
-        const char *filename = reinterpret_cast<const char *>(sqlite3_column_text(stmt, 0));
-        const char *desttype = reinterpret_cast<const char *>(sqlite3_column_text(stmt, 1));
+        SWEEP_ITEM item;
+        const char *text;
+
+        item.m_rowid        = sqlite3_column_int64(stmt, 0);
+        text = reinterpret_cast<const char *>(sqlite3_column_text(stmt, 1));
+        item.m_filename     = text != nullptr ? text : "";
+        text = reinterpret_cast<const char *>(sqlite3_column_text(stmt, 2));
+        item.m_desttype     = text != nullptr ? text : "";
+        text = reinterpret_cast<const char *>(sqlite3_column_text(stmt, 3));
+        item.m_cache_root   = text != nullptr ? text : "";
 
-        keys.emplace_back(filename, desttype);
+        const void *blob    = sqlite3_column_blob(stmt, 4);
+        int bytes           = sqlite3_column_bytes(stmt, 4);
+        if (blob != nullptr && bytes > 0)
+        {
+            item.m_checksums.resize(static_cast<size_t>(bytes) / sizeof(Buffer::CHECKSUM));
+            std::memcpy(item.m_checksums.data(), blob, item.m_checksums.size() * sizeof(Buffer::CHECKSUM));
+        }
+
+        m_sweep_rowid = item.m_rowid;
+
+        batch->push_back(item);
     }
 
-    Logging::trace(m_cacheidx_db->filename(), "Clearing all %1 entries from cache...", keys.size());
+    if (ret != SQLITE_DONE)
+    {
+        Logging::error(m_cacheidx_db->filename(), "Sqlite 3 could not step (execute) sweep select: (%1) %2", ret, sqlite3_errstr(ret));
+        batch->clear();
+    }
+
+    sqlite3_finalize(stmt);
+
+    return (ret == SQLITE_DONE);
+}
 
-    if (ret == SQLITE_DONE)
+void Cache::sweep_entry(const SWEEP_ITEM & item)
+{
+    const FFmpegfs_Format *format = nullptr;
+    for (const FFmpegfs_Format & fmt : ffmpeg_format)
     {
-        for (const auto& [key, value] : keys)
+        if (fmt.desttype() == item.m_desttype)
         {
-            Logging::trace(m_cacheidx_db->filename(), "Pruning: %1 Type: %2", key.c_str(), value.c_str());
+            format = &fmt;
+            break;
+        }
+    }
+
+    m_sweep_checked++;
 
-            cache_t::iterator p = m_cache.find(make_pair(key, value));
-            if (p != m_cache.end())
+    if (format == nullptr || format->is_frameset() || !is_cache_root(item.m_cache_root))
+    {
+        // Format or cache root no longer configured, will be pruned by maintenance.
+        // Frame sets consist of too many files to be checked here.
+        return;
+    }
+
+    if (format->is_hls())
+    {
+        bool repaired = false;
+
+        for (size_t n = 0; n < item.m_checksums.size() && !m_sweep_stop; n++)
+        {
+            if (!item.m_checksums[n].m_size)
+            {
+                // Segment not finished
+                continue;
+            }
+
+            std::string cachefile;
+            struct stat sb;
+
+            Buffer::make_cachefile_name(&cachefile, item.m_filename + "." + make_filename(static_cast<uint32_t>(n + 1), format->fileext()), format->fileext(), false, item.m_cache_root);
+
+            if (stat(cachefile.c_str(), &sb) == -1 || static_cast<uint64_t>(sb.st_size) == item.m_checksums[n].m_size)
             {
-                delete_entry(&p->second, CACHE_CLOSE_DELETE);
+                // Missing segments will be repaired when read
+                continue;
             }
 
-            if (delete_info(key, value))
+            // Keep the entry from being opened while the segment is removed
+            size_t hash = entry_hash(item.m_filename, item.m_desttype);
+            std::unique_lock<std::shared_mutex> lock_entry(shard(hash).m_mutex);
+
+            // Do not touch entries that are currently in use
+            Cache_Entry* cache_entry = find_entry(hash, item.m_filename, item.m_desttype);
+            if (cache_entry != nullptr && cache_entry->ref_count() > 0)
             {
-                remove_cachefile(key, value);
+                return;
             }
+
+            Logging::warning(cachefile, "Cache sweep: Segment size %1 does not match recorded size %2. Removing the segment, it will be transcoded again when read.", static_cast<uint64_t>(sb.st_size), item.m_checksums[n].m_size);
+
+            Buffer::remove_file(cachefile);
+
+            repaired = true;
+        }
+
+        if (repaired)
+        {
+            m_sweep_repaired++;
         }
+        return;
+    }
+
+    std::string cachefile;
+    struct stat sb;
+
+    Buffer::make_cachefile_name(&cachefile, item.m_filename, format->fileext(), false, item.m_cache_root);
+
+    if (stat(cachefile.c_str(), &sb) == 0)
+    {
+        if (item.m_checksums.empty() || !item.m_checksums[0].m_size || static_cast<uint64_t>(sb.st_size) == item.m_checksums[0].m_size)
+        {
+            return;
+        }
+
+        Logging::warning(cachefile, "Cache sweep: File size %1 does not match recorded size %2. Removing the entry, it will be transcoded again when read.", static_cast<uint64_t>(sb.st_size), item.m_checksums[0].m_size);
+    }
+    else if (errno == ENOENT)
+    {
+        Logging::warning(cachefile, "Cache sweep: Cache file is missing. Removing the entry, it will be transcoded again when read.");
     }
     else
     {
-        Logging::error(m_cacheidx_db->filename(), "Failed to execute select. Return code: %1 Error: %2 SQL: %3", ret, sqlite3_errmsg(*m_cacheidx_db), expanded_sql(stmt).c_str());
+        Logging::warning(cachefile, "Cache sweep: Unable to check file: (%1) %2", errno, strerror(errno));
+        return;
+    }
+
+    // Lock order: registry shard first, then the cache lock
+    size_t hash = entry_hash(item.m_filename, item.m_desttype);
+    std::unique_lock<std::shared_mutex> lock_entry(shard(hash).m_mutex);
+    std::lock_guard<std::recursive_mutex> lock_mutex(m_mutex);
+
+    // Do not touch entries that are currently in use
+    Cache_Entry* cache_entry = find_entry(hash, item.m_filename, item.m_desttype);
+    if (cache_entry != nullptr)
+    {
+        if (cache_entry->ref_count() > 0)
+        {
+            return;
+        }
+
+        delete_entry(&cache_entry, CACHE_CLOSE_DELETE);
+    }
+
+    // Only remove the row if it has not been rewritten meanwhile, e.g. by another process
+    sqlite3_stmt * stmt = nullptr;
+    const char * sql = "DELETE FROM cache_entry WHERE filename = ? AND desttype = ? AND finished = ?;\n";
+    int ret;
+
+    if (SQLITE_OK != (ret = sqlite3_prepare_v2(*m_cacheidx_db, sql, -1, &stmt, nullptr)))
+    {
+        Logging::error(m_cacheidx_db->filename(), "Failed to prepare sweep delete: (%1) %2\n%3", ret, sqlite3_errmsg(*m_cacheidx_db), sql);
+        return;
+    }
+
+    sqlite3_bind_text(stmt, 1, item.m_filename.c_str(), -1, nullptr);
+    sqlite3_bind_text(stmt, 2, item.m_desttype.c_str(), -1, nullptr);
+    sqlite3_bind_int(stmt, 3, static_cast<int>(RESULTCODE::FINISHED_SUCCESS));
+
+    ret = sqlite3_step(stmt);
+
+    if (ret != SQLITE_DONE)
+    {
+        Logging::error(m_cacheidx_db->filename(), "Sqlite 3 could not step (execute) sweep delete: (%1) %2", ret, sqlite3_errstr(ret));
+    }
+    else if (sqlite3_changes(*m_cacheidx_db) > 0)
+    {
+        remove_cachefile(item.m_filename, item.m_desttype, item.m_cache_root);
+
+        m_sweep_repaired++;
     }
 
     sqlite3_finalize(stmt);
+}
+
+bool Cache::clear()
+{
+    bool success = true;
+    PRUNE_VEC items;
+
+    {
+        std::lock_guard<std::recursive_mutex> lock_mutex(m_mutex);
+
+        sqlite3_stmt * stmt;
+        const char * sql;
+
+        sql = "SELECT filename, desttype, encoded_filesize, cache_root FROM cache_entry;\n";
+
+        sqlite3_prepare(*m_cacheidx_db, sql, -1, &stmt, nullptr);
+
+        int ret = 0;
+        while((ret = sqlite3_step(stmt)) == SQLITE_ROW)
+        {
+            const char *filename = reinterpret_cast<const char *>(sqlite3_column_text(stmt, 0));
+            const char *desttype = reinterpret_cast<const char *>(sqlite3_column_text(stmt, 1));
+            const char *cache_root = reinterpret_cast<const char *>(sqlite3_column_text(stmt, 3));
+
+            items.push_back({ filename, desttype, static_cast<size_t>(sqlite3_column_int64(stmt, 2)), cache_root != nullptr ? cache_root : "" });
+        }
+
+        if (ret != SQLITE_DONE)
+        {
+            Logging::error(m_cacheidx_db->filename(), "Failed to execute select. Return code: %1 Error: %2 SQL: %3", ret, sqlite3_errmsg(*m_cacheidx_db), expanded_sql(stmt).c_str());
+            items.clear();
+        }
+
+        sqlite3_finalize(stmt);
+    }
+
+    Logging::trace(m_cacheidx_db->filename(), "Clearing all %1 entries from cache...", items.size());
+
+    {
+        std::lock_guard<std::recursive_mutex> lock_mutex(m_mutex);
+        char *errmsg = nullptr;
+        const char * sql = "DELETE FROM keyframe_index;\n";
+        int ret;
+
+        if (SQLITE_OK != (ret = sqlite3_exec(*m_cacheidx_db, sql, nullptr, nullptr, &errmsg)))
+        {
+            Logging::error(m_cacheidx_db->filename(), "SQLite3 exec error: (%1) %2\n%3", ret, errmsg, sql);
+            sqlite3_free(errmsg);
+            success = false;
+        }
+    }
+
+    // Entries are removed one by one, the cache lock is not held in between
+    for (const PRUNE_ITEM & item : items)
+    {
+        prune_entry(item);
+    }
 
     return success;
 }
 
-bool Cache::remove_cachefile(const std::string & filename, const std::string & fileext)
+bool Cache::remove_cachefile(const std::string & filename, const std::string & fileext, const std::string & cache_root)
 {
     std::string cachefile;
     bool success;
 
-    Buffer::make_cachefile_name(&cachefile, filename, fileext, false);
+    Buffer::make_cachefile_name(&cachefile, filename, fileext, false, cache_root);
 
     success = Buffer::remove_file(cachefile);
 
-    Buffer::make_cachefile_name(&cachefile, filename, fileext, true);
+    Buffer::make_cachefile_name(&cachefile, filename, fileext, true, cache_root);
 
     if (!Buffer::remove_file(cachefile) && errno != ENOENT)
     {
@@ -35,21 +35,29 @@
 #pragma once
 
 #include "buffer.h"
+#include "ffmpeg_keyframeindex.h"
 
-#include <map>
+#include <unordered_map>
+#include <array>
 #include <memory>
+#include <thread>
+#include <shared_mutex>
+#include <string_view>
+#include <atomic>
+#include <condition_variable>
 
 #define     DB_BASE_VERSION_MAJOR   1               /**< @brief The oldest database version major (Release < 1.95) */
 #define     DB_BASE_VERSION_MINOR   0               /**< @brief The oldest database version minor (Release < 1.95) */
 
 #define     DB_VERSION_MAJOR        1               /**< @brief Current database version major */
-#define     DB_VERSION_MINOR        97              /**< @brief Current database version minor */
+#define     DB_VERSION_MINOR        98              /**< @brief Current database version minor */
 
 #define     DB_MIN_VERSION_MAJOR    1               /**< @brief Required database version major (required 1.95) */
-#define     DB_MIN_VERSION_MINOR    97              /**< @brief Required database version minor (required 1.95) */
+#define     DB_MIN_VERSION_MINOR    98              /**< @brief Required database version minor (required 1.95) */
 
 typedef struct sqlite3 sqlite3;                     /**< @brief Forward declaration of sqlite3 handle */
 typedef struct sqlite3_stmt sqlite3_stmt;           /**< @brief Forward declaration of sqlite3 statement handle */
+struct CACHEROOT;                                   /**< @brief Forward declaration of cache root */
 
 /**
   * @brief RESULTCODE of transcoding operation
@@ -83,6 +91,9 @@ typedef struct CACHE_INFO
     size_t                  m_encoded_filesize;     /**< @brief Actual file size after encode */
     uint32_t                m_video_frame_count;    /**< @brief Number of frames in video or 0 if not a video */
     uint32_t                m_segment_count;        /**< @brief Number of segments for HLS */
+    int64_t                 m_segment_duration;     /**< @brief HLS segment duration the entry was created with, in AV_TIME_BASE fractional seconds */
+    bool                    m_keyframe_segments;    /**< @brief true if the entry was created with HLS segments starting at key frames */
+    std::vector<int64_t>    m_segment_starts;       /**< @brief HLS segment start times if aligned to key frames, empty for fixed length segments */
     RESULTCODE              m_result;               /**< @brief Result code: */
     bool                    m_error;                /**< @brief true if encode failed */
     int                     m_errno;                /**< @brief errno if encode failed */
@@ -92,6 +103,9 @@ typedef struct CACHE_INFO
     time_t                  m_file_time;            /**< @brief Source file file time */
     size_t                  m_file_size;            /**< @brief Source file file size */
     unsigned int            m_access_count;         /**< @brief Read access counter */
+    std::string             m_cache_root;           /**< @brief Cache root the files are kept in, empty for the primary cache path */
+    Buffer::CHECKSUM_VEC    m_checksums;            /**< @brief Checksums of finished files or segments, empty if none recorded */
+    Buffer::RESUME_POINT    m_resume;               /**< @brief Point an interrupted transcode can be resumed at, m_offset is 0 if none */
 } CACHE_INFO;
 typedef CACHE_INFO const *LPCCACHE_INFO;            /**< @brief Pointer version of CACHE_INFO */
 typedef CACHE_INFO *LPCACHE_INFO;                   /**< @brief Pointer to const version of CACHE_INFO */
@@ -103,8 +117,92 @@ class Cache_Entry;
  */
 class Cache
 {
-    typedef std::pair<std::string, std::string> cache_key_t;    /**< @brief Filenames and destination types */
-    typedef std::map<cache_key_t, Cache_Entry *> cache_t;       /**< @brief Map of cache entries */
+    /**
+     * @brief Max. bytes per second the scrubber reads from disk.
+     */
+    static constexpr size_t SCRUB_MAX_RATE = 32 * 1024 * 1024;
+    /**
+     * @brief Number of entries fetched from the index at once when pruning.
+     * The cache lock is released between batches and between entries.
+     */
+    static constexpr size_t MAINTENANCE_BATCH = 64;
+    /**
+     * @brief Max. bytes per second removed by throttled maintenance.
+     */
+    static constexpr size_t MAINTENANCE_MAX_RATE = 256 * 1024 * 1024;
+    /**
+     * @brief Min. pause in milliseconds between two entries removed by throttled maintenance.
+     */
+    static constexpr int MAINTENANCE_MIN_PAUSE = 5;
+    /**
+     * @brief When the max. cache size is exceeded, prune down to this percentage of it.
+     */
+    static constexpr size_t MAINTENANCE_LOW_WATERMARK = 90;
+    /**
+     * @brief Number of entries a sweeper thread fetches from the index at once.
+     */
+    static constexpr size_t SWEEP_BATCH = 256;
+    /**
+     * @brief Number of rows copied at once when the database is upgraded.
+     * Progress is reported in between.
+     */
+    static constexpr int64_t UPGRADE_BATCH = 10000;
+    /**
+     * @brief Min. seconds between two progress reports of a database upgrade.
+     */
+    static constexpr int UPGRADE_REPORT_INTERVAL = 5;
+    /**
+     * @brief Max. number of read-only connections to the cache index.
+     * If all are in use, lookups fall back to the writer connection.
+     */
+    static constexpr size_t MAX_READERS = 32;
+    /**
+     * @brief Size of the memory mapped I/O window of read-only connections.
+     */
+    static constexpr int64_t READER_MMAP_SIZE = 256 * 1024 * 1024;
+    /**
+     * @brief Number of shards of the cache entry registry.
+     */
+    static constexpr size_t REGISTRY_SHARDS = 64;
+
+    /**
+     * @brief Cache entry to be pruned
+     */
+    typedef struct PRUNE_ITEM
+    {
+        std::string m_filename;                                 /**< @brief Source file name */
+        std::string m_desttype;                                 /**< @brief Destination type */
+        size_t      m_size;                                     /**< @brief Encoded file size */
+        std::string m_cache_root;                               /**< @brief Cache root, empty for the primary cache path */
+    } PRUNE_ITEM;
+    typedef std::vector<PRUNE_ITEM> PRUNE_VEC;                  /**< @brief Batch of cache entries to be pruned */
+
+    /**
+     * @brief Cache entry to be checked by the consistency sweep
+     */
+    typedef struct SWEEP_ITEM
+    {
+        int64_t                 m_rowid;                        /**< @brief Row id in the cache index */
+        std::string             m_filename;                     /**< @brief Source file name */
+        std::string             m_desttype;                     /**< @brief Destination type */
+        std::string             m_cache_root;                   /**< @brief Cache root, empty for the primary cache path */
+        Buffer::CHECKSUM_VEC    m_checksums;                    /**< @brief Recorded checksums and sizes, empty if none */
+    } SWEEP_ITEM;
+    typedef std::vector<SWEEP_ITEM> SWEEP_VEC;                  /**< @brief Batch of cache entries to be checked */
+
+    typedef std::unordered_multimap<size_t, Cache_Entry *> cache_t;   /**< @brief Cache entries by hash of file name and destination type */
+
+    /**
+     * @brief Shard of the cache entry registry
+     *
+     * Lookups take the shard lock shared, adding and removing entries takes it
+     * exclusively. Lock order is shard first, then the cache lock (m_mutex).
+     */
+    typedef struct CACHE_SHARD
+    {
+        std::shared_mutex       m_mutex;                        /**< @brief Shard lock */
+        cache_t                 m_entries;                      /**< @brief Entries of this shard */
+    } CACHE_SHARD;
 public:
     /**
       * @brief Definition of sql table
@@ -133,6 +231,7 @@ public:
     typedef TABLECOLUMNS_VEC *LPTABLECOLUMNS_VEC;           /**< @brief Pointer to const version of TABLECOLUMNS_VEC */
 
     friend class Cache_Entry;
+    friend class Cache_Archive;
 
     /**
      * @brief The sqlite_t class
@@ -229,10 +328,27 @@ public:
      * Can be done before a new file is added. Set predicted_filesize to make sure disk space
      * or cache size will be kept within limits.
      *
+     * Works in batches and releases the cache lock in between, so that concurrent
+     * opens are not stalled.
+     *
+     * @param[in] predicted_filesize - Size of new file
+     * @param[in] cache_root - Cache root the new file will be placed on, empty for the primary cache path.
+     * @param[in] throttled - If true, pause between entries to limit the rate files are removed at.
+     * @return Returns true on success; false on error.
+     */
+    bool                    maintenance(size_t predicted_filesize = 0, const std::string & cache_root = std::string(), bool throttled = false);
+    /**
+     * @brief Check cache watermarks before a new file is added.
+     *
+     * If the cache size exceeds its limit or free disk space falls below its floor,
+     * the maintenance thread is woken up. Pruning is only done right here if there
+     * is not enough space for the new file, or if there is no maintenance thread.
+     *
      * @param[in] predicted_filesize - Size of new file
+     * @param[in] cache_root - Cache root the new file will be placed on, empty for the primary cache path.
      * @return Returns true on success; false on error.
      */
-    bool                    maintenance(size_t predicted_filesize = 0);
+    bool                    check_watermarks(size_t predicted_filesize, const std::string & cache_root);
     /**
      * @brief Clear cache: deletes all entries.
      * @return Returns true on success; false on error.
@@ -240,26 +356,109 @@ public:
     bool                    clear();
     /**
      * @brief Prune expired cache entries.
+     * @param[in] throttled - If true, limit the rate files are removed at.
      * @return Returns true on success; false on error.
      */
-    bool                    prune_expired();
+    bool                    prune_expired(bool throttled = false);
+    /**
+     * @brief Remove key frame indexes of source files that have been deleted or changed.
+     * @param[in] throttled - If true, pause between two batches.
+     * @return Returns true on success; false on error.
+     */
+    bool                    prune_keyframe_index(bool throttled = false);
     /**
      * @brief Prune cache entries to keep cache size within limit.
+     * Once the limit is exceeded, prunes down to MAINTENANCE_LOW_WATERMARK percent of it.
+     * @param[in] throttled - If true, limit the rate files are removed at.
      * @return Returns true on success; false on error.
      */
-    bool                    prune_cache_size();
+    bool                    prune_cache_size(bool throttled = false);
     /**
-     * @brief Prune cache entries to ensure disk space.
+     * @brief Prune cache entries to ensure disk space on all cache roots.
+     * @param[in] predicted_filesize - Size of new file
+     * @param[in] cache_root - Cache root the new file will be placed on, empty for the primary cache path.
+     * @param[in] throttled - If true, limit the rate files are removed at.
      * @return Returns true on success; false on error.
      */
-    bool                    prune_disk_space(size_t predicted_filesize);
+    bool                    prune_disk_space(size_t predicted_filesize, const std::string & cache_root = std::string(), bool throttled = false);
+    /**
+     * @brief Get the total size of all cache entries.
+     * @return Returns the sum of the encoded file sizes.
+     */
+    size_t                  cache_size();
     /**
      * @brief Remove a cache file from disk.
      * @param[in] filename - Source file name.
      * @param[in] fileext - File extension of target file.
+     * @param[in] cache_root - Cache root the file is kept in, empty for the primary cache path.
      * @return Returns true on success; false on error.
      */
-    bool                    remove_cachefile(const std::string & filename, const std::string &fileext);
+    bool                    remove_cachefile(const std::string & filename, const std::string &fileext, const std::string & cache_root = std::string());
+    /**
+     * @brief Select the cache root for a new cache entry.
+     *
+     * Uses weighted rendezvous hashing, so the same entry always lands on the same
+     * root as long as the set of roots does not change. Adding or removing a root
+     * only moves the entries that hash to it. Roots that would fall below their
+     * free space floor are skipped, unless all of them would.
+     *
+     * @param[in] key - Unique key of the entry, e.g. destination file name and type.
+     * @param[in] predicted_filesize - Size of new file
+     * @return Returns the cache root, empty for the primary cache path.
+     */
+    std::string             select_cache_root(const std::string & key, size_t predicted_filesize) const;
+    /**
+     * @brief Check if a cache root is (still) configured.
+     * @param[in] cache_root - Cache root as recorded in the index, empty for the primary cache path.
+     * @return Returns true if the root is configured; false if not.
+     */
+    bool                    is_cache_root(const std::string & cache_root) const;
+    /**
+     * @brief Start the background scrubber.
+     *
+     * The scrubber runs at low priority and verifies finished cache files
+     * against the checksums recorded in the index. Files that do not match
+     * are removed, they will be transcoded again when next read.
+     *
+     * @param[in] interval - Seconds between two passes over the cache.
+     * @return Returns true on success; false on error.
+     */
+    bool                    start_scrubber(time_t interval);
+    /**
+     * @brief Stop the background scrubber and wait for it to exit.
+     */
+    void                    stop_scrubber();
+    /**
+     * @brief Start the consistency sweep.
+     *
+     * Checks once, in the background, that the files of all finished cache
+     * entries exist and have the recorded size. Entries with missing files are
+     * removed from the index, HLS segments with a wrong size are removed from
+     * disk. They will be transcoded again when next read.
+     *
+     * @param[in] threads - Number of threads to check with, 0 to skip the sweep.
+     * @return Returns true on success; false on error.
+     */
+    bool                    start_sweep(unsigned int threads);
+    /**
+     * @brief Stop the consistency sweep and wait for it to exit.
+     */
+    void                    stop_sweep();
+    /**
+     * @brief Read the key frame index of a source file.
+     * Only returns an index built from the file as it is now, i.e., with the same modification time and size.
+     * @param[in] virtualfile - VIRTUALFILE struct of the file.
+     * @param[out] keyframe_index - Key frame index read.
+     * @return Returns true if found; false if there is no index or on error.
+     */
+    bool                    read_keyframe_index(LPCVIRTUALFILE virtualfile, FFmpeg_KeyframeIndex *keyframe_index);
+    /**
+     * @brief Store the key frame index of a source file, replacing any older one.
+     * @param[in] virtualfile - VIRTUALFILE struct of the file.
+     * @param[in] keyframe_index - Complete key frame index.
+     * @return Returns true on success; false on error.
+     */
+    bool                    write_keyframe_index(LPCVIRTUALFILE virtualfile, const FFmpeg_KeyframeIndex & keyframe_index);
 
 protected:
     /**
@@ -274,6 +473,13 @@ protected:
      * @return Returns true on success; false on error.
      */
     bool                    write_info(LPCCACHE_INFO cache_info);
+    /**
+     * @brief Read the next successfully finished entry from the index.
+     * @param[inout] rowid - In: Row ID of the previous entry, 0 to start. Out: Row ID of the entry returned.
+     * @param[out] cache_info - Structure with cache info data.
+     * @return Returns true if an entry was read; false if there are no more entries or on error.
+     */
+    bool                    next_info(int64_t *rowid, LPCACHE_INFO cache_info);
     /**
      * @brief Delete cache file info.
      * @param[in] filename - Source file name.
@@ -282,23 +488,122 @@ protected:
      */
     bool                    delete_info(const std::string & filename, const std::string & desttype);
     /**
-     * @brief Create cache entry object for a VIRTUALFILE.
+     * @brief Create cache entry object for a VIRTUALFILE. The caller must hold the shard lock of the entry.
      * @param[in] virtualfile - VIRTUALFILE struct of a file.
      * @param[in] desttype - Destination type (MP4, WEBM etc.).
      * @return On success, returns pointer to a Cache_Entry. On error, returns nullptr.
      */
     Cache_Entry*            create_entry(LPVIRTUALFILE virtualfile, const std::string & desttype);
     /**
-     * @brief Delete cache entry object.
+     * @brief Record a cache lookup in the cache trace, if enabled.
+     * @param[in] virtualfile - VIRTUALFILE struct of a file.
+     * @param[in] desttype - Destination type (MP4, WEBM etc.).
+     * @param[in] cache_entry - Cache entry found, nullptr if a new one was created.
+     * @param[in] reused - True if the entry was already open.
+     */
+    void                    trace_open(LPCVIRTUALFILE virtualfile, const std::string & desttype, Cache_Entry *cache_entry, bool reused);
+    /**
+     * @brief Delete cache entry object. The caller must hold the shard lock of the entry.
      * @param[in, out] cache_entry - Cache entry object to be closed.
      * @param[in] flags - One of the CACHE_CLOSE_* flags.
      * @return Returns true if the object was deleted; false if not.
      */
     bool                    delete_entry(Cache_Entry **cache_entry, int flags);
+    /**
+     * @brief Hash of a cache entry key.
+     * @param[in] filename - Destination file name.
+     * @param[in] desttype - Destination type (MP4, WEBM etc.).
+     * @return Returns the hash, also used to select the registry shard.
+     */
+    static size_t           entry_hash(std::string_view filename, std::string_view desttype);
+    /**
+     * @brief Get the registry shard of a hash.
+     * @param[in] hash - Hash as returned by entry_hash().
+     * @return Returns the shard.
+     */
+    CACHE_SHARD &           shard(size_t hash);
+    /**
+     * @brief Lock the registry shard of an entry exclusively.
+     * @param[in] filename - Destination file name.
+     * @param[in] desttype - Destination type (MP4, WEBM etc.).
+     * @return Returns the lock.
+     */
+    std::unique_lock<std::shared_mutex> lock_shard(std::string_view filename, std::string_view desttype);
+    /**
+     * @brief Find an entry in its registry shard. The caller must hold the shard lock.
+     * @param[in] hash - Hash as returned by entry_hash().
+     * @param[in] filename - Destination file name.
+     * @param[in] desttype - Destination type (MP4, WEBM etc.).
+     * @return Returns the entry, or nullptr if not open.
+     */
+    Cache_Entry*            find_entry(size_t hash, std::string_view filename, std::string_view desttype);
+    /**
+     * @brief Check if an entry is currently in use.
+     * @param[in] filename - Destination file name.
+     * @param[in] desttype - Destination type (MP4, WEBM etc.).
+     * @return Returns true if the entry is open and referenced; false if not.
+     */
+    bool                    entry_in_use(std::string_view filename, std::string_view desttype);
+    /**
+     * @brief Prune cache entries to ensure disk space on one cache root.
+     * @param[in] cache_root - Cache root to prune.
+     * @param[in] is_primary - true if this is the primary cache path.
+     * @param[in] predicted_filesize - Size of new file if it will be placed on this root, 0 if not.
+     * @param[in] throttled - If true, limit the rate files are removed at.
+     * @return Returns true on success; false on error.
+     */
+    bool                    prune_disk_space(const CACHEROOT & cache_root, bool is_primary, size_t predicted_filesize, bool throttled);
+    /**
+     * @brief Fetch the next batch of entries to prune. Takes the cache lock for the query only.
+     * @param[in] sql - Select statement. Must return filename, desttype, encoded_filesize and cache_root, and end with "LIMIT ?".
+     * @param[in] cache_root - If not nullptr, bound to the first parameter.
+     * @param[out] batch - Receives up to MAINTENANCE_BATCH entries.
+     * @return Returns true on success; false on error.
+     */
+    bool                    fetch_prune_batch(const std::string & sql, const std::string * cache_root, PRUNE_VEC *batch);
+    /**
+     * @brief Remove one entry from the index and the disk. Takes the cache lock for this entry only.
+     * @param[in] item - Entry to remove.
+     * @return Returns true if the entry has been removed; false on error.
+     */
+    bool                    prune_entry(const PRUNE_ITEM & item);
+    /**
+     * @brief Pause after an entry has been removed when maintenance is throttled.
+     * @param[in] throttled - If false, returns at once.
+     * @param[in] filesize - Size of the entry removed.
+     */
+    static void             maintenance_pause(bool throttled, size_t filesize);
     /**
      * @brief Close cache index.
      */
     void                    close_index();
+    /**
+     * @brief Background scrubber thread.
+     * @param[in] interval - Seconds between two passes over the cache.
+     */
+    void                    scrubber_thread(time_t interval);
+    /**
+     * @brief Verify all files of one cache entry.
+     * @param[in] rowid - Row id of the entry in the cache index.
+     * @param[out] next_rowid - Upon return, contains the row id of the entry verified, or 0 if there are no more.
+     */
+    void                    scrub_next(int64_t rowid, int64_t *next_rowid);
+    /**
+     * @brief Consistency sweep thread.
+     */
+    void                    sweep_thread();
+    /**
+     * @brief Fetch the next batch of finished entries for the consistency sweep.
+     * Batches are handed out in row id order, each entry to one thread only.
+     * @param[out] batch - Receives up to SWEEP_BATCH entries, none if the sweep is complete.
+     * @return Returns true on success; false on error.
+     */
+    bool                    fetch_sweep_batch(SWEEP_VEC *batch);
+    /**
+     * @brief Check the files of one cache entry.
+     * @param[in] item - Entry to check.
+     */
+    void                    sweep_entry(const SWEEP_ITEM & item);
     /**
      * @brief Get expanded SQL string for a statement.
      * @param[in] pStmt - SQLite statement handle.
@@ -310,6 +615,28 @@ protected:
      * @return Returns true on success, false on error.
      */
     bool                    prepare_stmts();
+    /**
+     * @brief Prepare the select statement of a connection.
+     * @param[in] db - Connection to prepare the statement for.
+     * @return Returns true on success, false on error.
+     */
+    bool                    prepare_select(sqlite_t *db);
+    /**
+     * @brief Get a read-only connection to the cache index.
+     *
+     * The index is in WAL mode, so lookups from several threads can run in
+     * parallel, each on its own connection. Connections are pooled rather than
+     * bound to threads, because FUSE starts and ends worker threads as needed.
+     *
+     * @return Returns a connection for the exclusive use of the calling thread,
+     * or nullptr if none is available. Must be handed back with release_reader().
+     */
+    sqlite_t *              acquire_reader();
+    /**
+     * @brief Hand back a connection obtained by acquire_reader().
+     * @param[in] reader - Connection to hand back.
+     */
+    void                    release_reader(sqlite_t *reader);
     /**
      * @brief Check if SQL table exists in database.
      * @param[in] table - name of table
@@ -368,18 +695,49 @@ protected:
      * @return Returns true on success; false on error.
      */
     bool                    upgrade_db(int *db_version_major, int *db_version_minor);
+    /**
+     * @brief Copy all rows of the old cache_entry table to the new one during an upgrade.
+     *
+     * Copies UPGRADE_BATCH rows at a time and reports progress in between,
+     * so that the upgrade of a large index can be followed in the log.
+     *
+     * @param[in] columns - Comma separated list of columns to copy.
+     * @return Returns true on success; false on error.
+     */
+    bool                    upgrade_copy_rows(const std::string & columns);
 
 private:
     static const TABLE_DEF          m_table_cache_entry;    /**< @brief Definition and indexes of table "cache_entry" */
     static const TABLECOLUMNS_VEC   m_columns_cache_entry;  /**< @brief Columns of table "cache_entry" */
     static const TABLE_DEF          m_table_version;        /**< @brief Definition and indexes of table "version" */
     static const TABLECOLUMNS_VEC   m_columns_version;      /**< @brief Columns of table "version" */
+    static const TABLE_DEF          m_table_keyframe_index; /**< @brief Definition and indexes of table "keyframe_index" */
+    static const TABLECOLUMNS_VEC   m_columns_keyframe_index; /**< @brief Columns of table "keyframe_index" */
 
     std::recursive_mutex            m_mutex;                /**< @brief Access mutex */
 
     std::unique_ptr<sqlite_t>       m_cacheidx_db;          /**< @brief SQLite handle of cache index database */
 
-    cache_t                         m_cache;                /**< @brief Cache file (memory mapped file) */
+    std::mutex                      m_readers_mutex;        /**< @brief Read-only connection pool mutex */
+    std::vector<std::unique_ptr<sqlite_t>> m_readers;       /**< @brief All read-only connections */
+    std::vector<sqlite_t *>         m_idle_readers;         /**< @brief Read-only connections not in use */
+    bool                            m_readers_failed;       /**< @brief Set if a read-only connection could not be opened, do not try again */
+
+    std::array<CACHE_SHARD, REGISTRY_SHARDS> m_shards;      /**< @brief Registry of open cache entries */
+
+    std::thread                     m_scrubber;             /**< @brief Background scrubber thread */
+    std::atomic_bool                m_scrubber_stop;        /**< @brief Set to stop the scrubber */
+    std::mutex                      m_scrubber_mutex;       /**< @brief Mutex for m_scrubber_cond */
+    std::condition_variable         m_scrubber_cond;        /**< @brief Signalled to wake up the scrubber */
+
+    std::vector<std::thread>        m_sweepers;             /**< @brief Consistency sweep threads */
+    std::atomic_bool                m_sweep_stop;           /**< @brief Set to stop the consistency sweep */
+    std::mutex                      m_sweep_mutex;          /**< @brief Serialises fetching batches for the sweep */
+    int64_t                         m_sweep_rowid;          /**< @brief Row id of the last entry handed out to a sweeper */
+    std::atomic_uint                m_sweep_running;        /**< @brief Number of sweeper threads still running */
+    std::atomic_size_t              m_sweep_checked;        /**< @brief Entries checked by the sweep */
+    std::atomic_size_t              m_sweep_repaired;       /**< @brief Entries repaired by the sweep */
+    time_t                          m_sweep_started;        /**< @brief Time the sweep was started */
 };
 
 #endif
@@ -0,0 +1,1081 @@
+/*
+ * Copyright (C) 2017-2026 Norbert Schlia (nschlia@oblivion-software.de)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * On Debian systems, the complete text of the GNU General Public License
+ * Version 3 can be found in `/usr/share/common-licenses/GPL-3'.
+ */
+
+/**
+ * @file cache_archive.cc
+ * @brief #Cache_Archive class implementation
+ *
+ * @ingroup ffmpegfs
+ *
+ * @author Norbert Schlia (nschlia@oblivion-software.de)
+ * @copyright Copyright (C) 2017-2026 Norbert Schlia (nschlia@oblivion-software.de)
+ */
+
+#include "cache_archive.h"
+#include "cache_entry.h"
+#include "ffmpegfs.h"
+#include "logging.h"
+
+#include <cstring>
+#include <thread>
+#include <unistd.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <endian.h>
+
+static const char ARCHIVE_MAGIC[16] = "FFMPEGFS-CACHE";    /**< @brief Archive file magic */
+
+static bool write_all(int fd, const void *data, size_t size);
+static bool read_all(int fd, void *data, size_t size);
+static void put_u32(std::vector<uint8_t> *data, uint32_t value);
+static void put_u64(std::vector<uint8_t> *data, uint64_t value);
+static void put_string(std::vector<uint8_t> *data, const std::string & value);
+static bool get_u32(const std::vector<uint8_t> & data, size_t *pos, uint32_t *value);
+static bool get_u64(const std::vector<uint8_t> & data, size_t *pos, uint64_t *value);
+static bool get_string(const std::vector<uint8_t> & data, size_t *pos, std::string *value);
+
+/**
+ * @brief Write a buffer completely.
+ * @param[in] fd - File handle.
+ * @param[in] data - Data to write.
+ * @param[in] size - Number of bytes to write.
+ * @return Returns true on success; false on error, check errno for details.
+ */
+static bool write_all(int fd, const void *data, size_t size)
+{
+    const uint8_t *p = static_cast<const uint8_t *>(data);
+
+    while (size)
+    {
+        ssize_t n = ::write(fd, p, size);
+        if (n == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return false;
+        }
+        p       += n;
+        size    -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+/**
+ * @brief Read a buffer completely.
+ * @param[in] fd - File handle.
+ * @param[out] data - Buffer to read to.
+ * @param[in] size - Number of bytes to read.
+ * @return Returns true on success; false on error or at end of file, check errno for details.
+ */
+static bool read_all(int fd, void *data, size_t size)
+{
+    uint8_t *p = static_cast<uint8_t *>(data);
+
+    while (size)
+    {
+        ssize_t n = ::read(fd, p, size);
+        if (n == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return false;
+        }
+        if (!n)
+        {
+            errno = EIO;    // Truncated
+            return false;
+        }
+        p       += n;
+        size    -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+/**
+ * @brief Append a 32 bit number.
+ * @param[inout] data - Buffer to append to.
+ * @param[in] value - Value to append.
+ */
+static void put_u32(std::vector<uint8_t> *data, uint32_t value)
+{
+    value = htole32(value);
+    data->insert(data->end(), reinterpret_cast<const uint8_t *>(&value), reinterpret_cast<const uint8_t *>(&value) + sizeof(value));
+}
+
+/**
+ * @brief Append a 64 bit number.
+ * @param[inout] data - Buffer to append to.
+ * @param[in] value - Value to append.
+ */
+static void put_u64(std::vector<uint8_t> *data, uint64_t value)
+{
+    value = htole64(value);
+    data->insert(data->end(), reinterpret_cast<const uint8_t *>(&value), reinterpret_cast<const uint8_t *>(&value) + sizeof(value));
+}
+
+/**
+ * @brief Append a string, preceded by its length.
+ * @param[inout] data - Buffer to append to.
+ * @param[in] value - Value to append.
+ */
+static void put_string(std::vector<uint8_t> *data, const std::string & value)
+{
+    put_u32(data, static_cast<uint32_t>(value.size()));
+    data->insert(data->end(), value.cbegin(), value.cend());
+}
+
+/**
+ * @brief Get a 32 bit number.
+ * @param[in] data - Buffer to read from.
+ * @param[inout] pos - Read position, advanced past the value.
+ * @param[out] value - Value read.
+ * @return Returns true on success; false if the buffer is too short.
+ */
+static bool get_u32(const std::vector<uint8_t> & data, size_t *pos, uint32_t *value)
+{
+    if (*pos + sizeof(*value) > data.size())
+    {
+        return false;
+    }
+    std::memcpy(value, data.data() + *pos, sizeof(*value));
+    *value = le32toh(*value);
+    *pos += sizeof(*value);
+    return true;
+}
+
+/**
+ * @brief Get a 64 bit number.
+ * @param[in] data - Buffer to read from.
+ * @param[inout] pos - Read position, advanced past the value.
+ * @param[out] value - Value read.
+ * @return Returns true on success; false if the buffer is too short.
+ */
+static bool get_u64(const std::vector<uint8_t> & data, size_t *pos, uint64_t *value)
+{
+    if (*pos + sizeof(*value) > data.size())
+    {
+        return false;
+    }
+    std::memcpy(value, data.data() + *pos, sizeof(*value));
+    *value = le64toh(*value);
+    *pos += sizeof(*value);
+    return true;
+}
+
+/**
+ * @brief Get a string.
+ * @param[in] data - Buffer to read from.
+ * @param[inout] pos - Read position, advanced past the value.
+ * @param[out] value - Value read.
+ * @return Returns true on success; false if the buffer is too short.
+ */
+static bool get_string(const std::vector<uint8_t> & data, size_t *pos, std::string *value)
+{
+    uint32_t size;
+
+    if (!get_u32(data, pos, &size) || *pos + size > data.size())
+    {
+        return false;
+    }
+    value->assign(reinterpret_cast<const char *>(data.data() + *pos), size);
+    *pos += size;
+    return true;
+}
+
+/**
+ * @brief Write a record header.
+ * @param[in] fd - Archive file handle.
+ * @param[in] type - Record type.
+ * @param[in] segment_no - HLS segment number, or 0.
+ * @param[in] size - Size of the data following the header.
+ * @return Returns true on success; false on error, check errno for details.
+ */
+static bool write_record(int fd, uint32_t type, uint32_t segment_no, uint64_t size)
+{
+    std::vector<uint8_t> header;
+
+    put_u32(&header, type);
+    put_u32(&header, segment_no);
+    put_u64(&header, size);
+
+    return write_all(fd, header.data(), header.size());
+}
+
+Cache_Archive::Cache_Archive(Cache *cache)
+    : m_cache(cache)
+    , m_queue_done(false)
+    , m_entries(0)
+    , m_skipped(0)
+    , m_failed(0)
+    , m_bytes(0)
+{
+}
+
+Cache_Archive::~Cache_Archive()
+{
+}
+
+const FFmpegfs_Format * Cache_Archive::find_format(const std::string & desttype)
+{
+    for (const FFmpegfs_Format & fmt : ffmpeg_format)
+    {
+        if (fmt.desttype() == desttype)
+        {
+            return &fmt;
+        }
+    }
+    return nullptr;
+}
+
+void Cache_Archive::make_member_name(std::string *cachefile, const std::string & destfile, const FFmpegfs_Format *format, const RECORD & record, const std::string & cache_root)
+{
+    // Same names as Buffer::init() uses
+    if (record.m_segment_no)
+    {
+        Buffer::make_cachefile_name(cachefile, destfile + "." + make_filename(record.m_segment_no, format->fileext()), format->fileext(), false, cache_root);
+    }
+    else
+    {
+        Buffer::make_cachefile_name(cachefile, destfile, format->fileext(), record.m_type == RECORDTYPE::INDEXFILE, cache_root);
+    }
+}
+
+bool Cache_Archive::export_cache(const std::string & archive)
+{
+    int fd = (archive == "-") ? STDOUT_FILENO : ::open(archive.c_str(), O_CREAT | O_WRONLY | O_TRUNC | O_CLOEXEC, static_cast<mode_t>(0644));
+    bool success = true;
+
+    if (fd == -1)
+    {
+        Logging::error(archive, "The archive could not be created due to an error: (%1) %2", errno, strerror(errno));
+        return false;
+    }
+
+    Logging::info(archive, "Exporting cache.");
+
+    try
+    {
+        std::vector<uint8_t> header(ARCHIVE_MAGIC, ARCHIVE_MAGIC + sizeof(ARCHIVE_MAGIC));
+
+        put_u32(&header, ARCHIVE_VERSION);
+        put_u32(&header, 0);    // Reserved
+
+        if (!write_all(fd, header.data(), header.size()))
+        {
+            throw false;
+        }
+
+        int64_t rowid = 0;
+        CACHE_INFO cache_info;
+
+        while (m_cache->next_info(&rowid, &cache_info))
+        {
+            int res = export_entry(fd, cache_info);
+
+            if (res < 0)
+            {
+                throw false;
+            }
+            else if (res)
+            {
+                m_entries++;
+            }
+            else
+            {
+                m_skipped++;
+            }
+        }
+
+        if (!write_record(fd, static_cast<uint32_t>(RECORDTYPE::END), 0, 0))
+        {
+            throw false;
+        }
+    }
+    catch (bool _success)
+    {
+        success = _success;
+
+        Logging::error(archive, "Unable to write to the archive: (%1) %2", errno, strerror(errno));
+    }
+
+    if (fd != STDOUT_FILENO && ::close(fd) == -1 && success)
+    {
+        Logging::error(archive, "Unable to write to the archive: (%1) %2", errno, strerror(errno));
+        success = false;
+    }
+
+    Logging::info(archive, "Exported %1 cache entries with %2, skipped %3.", m_entries.load(), format_size(m_bytes).c_str(), m_skipped.load());
+
+    return success;
+}
+
+int Cache_Archive::export_entry(int fd, const CACHE_INFO & cache_info)
+{
+    const FFmpegfs_Format *format = find_format(cache_info.m_desttype.data());
+
+    if (format == nullptr)
+    {
+        Logging::debug(cache_info.m_destfile, "Not exporting: Format '%1' is not configured.", cache_info.m_desttype.data());
+        return 0;
+    }
+
+    // The index only knows the destination name. The source is needed to check
+    // on import if it has changed; only the new name scheme can be reversed.
+    std::string origfile(cache_info.m_destfile);
+    remove_ext(&origfile);
+
+    std::vector<RECORD> records;
+
+    if (format->is_hls())
+    {
+        for (uint32_t segment_no = 1; segment_no <= cache_info.m_segment_count; segment_no++)
+        {
+            records.push_back({ RECORDTYPE::CACHEFILE, segment_no, 0 });
+        }
+    }
+    else
+    {
+        records.push_back({ RECORDTYPE::CACHEFILE, 0, 0 });
+
+        if (format->is_frameset())
+        {
+            records.push_back({ RECORDTYPE::INDEXFILE, 0, 0 });
+        }
+    }
+
+    // Open all files first, the archive cannot be rewound if one is missing
+    std::vector<int> fds;
+    bool complete = true;
+
+    for (RECORD & record : records)
+    {
+        std::string cachefile;
+        struct stat sb;
+
+        make_member_name(&cachefile, cache_info.m_destfile, format, record, cache_info.m_cache_root);
+
+        int filefd = ::open(cachefile.c_str(), O_RDONLY | O_CLOEXEC);
+        if (filefd == -1 || fstat(filefd, &sb) == -1)
+        {
+            Logging::debug(cache_info.m_destfile, "Not exporting: Cache file '%1' is not available: (%2) %3", cachefile.c_str(), errno, strerror(errno));
+            if (filefd != -1)
+            {
+                ::close(filefd);
+            }
+            complete = false;
+            break;
+        }
+
+        record.m_size = static_cast<uint64_t>(sb.st_size);
+        fds.push_back(filefd);
+    }
+
+    int res = complete ? 1 : 0;
+
+    if (complete)
+    {
+        std::vector<uint8_t> entry;
+
+        put_string(&entry, origfile);
+        put_string(&entry, cache_info.m_destfile);
+        put_string(&entry, cache_info.m_desttype.data());
+        put_u64(&entry, static_cast<uint64_t>(cache_info.m_audiobitrate));
+        put_u32(&entry, static_cast<uint32_t>(cache_info.m_audiosamplerate));
+        put_u64(&entry, static_cast<uint64_t>(cache_info.m_videobitrate));
+        put_u32(&entry, static_cast<uint32_t>(cache_info.m_videowidth));
+        put_u32(&entry, static_cast<uint32_t>(cache_info.m_videoheight));
+        put_u32(&entry, cache_info.m_deinterlace ? 1 : 0);
+        put_u64(&entry, static_cast<uint64_t>(cache_info.m_duration));
+        put_u64(&entry, cache_info.m_predicted_filesize);
+        put_u64(&entry, cache_info.m_encoded_filesize);
+        put_u32(&entry, cache_info.m_video_frame_count);
+        put_u32(&entry, cache_info.m_segment_count);
+        put_u64(&entry, static_cast<uint64_t>(cache_info.m_creation_time));
+        put_u64(&entry, static_cast<uint64_t>(cache_info.m_file_time));
+        put_u64(&entry, cache_info.m_file_size);
+        put_u32(&entry, static_cast<uint32_t>(cache_info.m_checksums.size()));
+        for (const Buffer::CHECKSUM & checksum : cache_info.m_checksums)
+        {
+            put_u64(&entry, checksum.m_size);
+            put_u64(&entry, checksum.m_checksum);
+        }
+        put_u64(&entry, static_cast<uint64_t>(cache_info.m_segment_duration));
+        put_u32(&entry, cache_info.m_keyframe_segments ? 1 : 0);
+        put_u32(&entry, static_cast<uint32_t>(cache_info.m_segment_starts.size()));
+        for (int64_t segment_start : cache_info.m_segment_starts)
+        {
+            put_u64(&entry, static_cast<uint64_t>(segment_start));
+        }
+
+        if (!write_record(fd, static_cast<uint32_t>(RECORDTYPE::ENTRY), 0, entry.size()) ||
+                !write_all(fd, entry.data(), entry.size()))
+        {
+            res = -1;
+        }
+
+        std::vector<uint8_t> data(COPY_BUFFER_SIZE);
+
+        for (size_t n = 0; n < records.size() && res > 0; n++)
+        {
+            const RECORD & record = records[n];
+
+            if (!write_record(fd, static_cast<uint32_t>(record.m_type), record.m_segment_no, record.m_size))
+            {
+                res = -1;
+                break;
+            }
+
+            uint64_t remaining = record.m_size;
+
+            while (remaining)
+            {
+                size_t bytes = static_cast<size_t>(std::min<uint64_t>(remaining, data.size()));
+
+                if (!read_all(fds[n], data.data(), bytes))
+                {
+                    // The size is already written. Pad, the checksum will tell on import.
+                    Logging::warning(cache_info.m_destfile, "Cache file shrank during export: (%1) %2", errno, strerror(errno));
+                    std::memset(data.data(), 0, bytes);
+                }
+
+                if (!write_all(fd, data.data(), bytes))
+                {
+                    res = -1;
+                    break;
+                }
+
+                remaining   -= bytes;
+                m_bytes     += bytes;
+            }
+        }
+
+        if (res > 0)
+        {
+            Logging::trace(cache_info.m_destfile, "Exported cache entry.");
+        }
+    }
+
+    for (int filefd : fds)
+    {
+        ::close(filefd);
+    }
+
+    return res;
+}
+
+bool Cache_Archive::import_cache(const std::string & archive, unsigned int threads)
+{
+    int fd = (archive == "-") ? STDIN_FILENO : ::open(archive.c_str(), O_RDONLY | O_CLOEXEC);
+    bool success = true;
+
+    if (fd == -1)
+    {
+        Logging::error(archive, "The archive could not be opened due to an error: (%1) %2", errno, strerror(errno));
+        return false;
+    }
+
+    struct stat sb;
+    const bool seekable = (fstat(fd, &sb) == 0 && S_ISREG(sb.st_mode));
+
+    if (!seekable || !threads)
+    {
+        threads = 1;
+    }
+
+    Logging::info(archive, "Importing cache with %1 thread(s).", threads);
+
+    std::vector<std::thread> import_threads;
+
+    if (seekable)
+    {
+        for (unsigned int n = 0; n < threads; n++)
+        {
+            import_threads.emplace_back(&Cache_Archive::import_thread, this, fd);
+        }
+    }
+
+    std::unique_ptr<IMPORT_JOB> job;
+
+    try
+    {
+        std::array<char, sizeof(ARCHIVE_MAGIC) + 2 * sizeof(uint32_t)> header;
+        std::vector<uint8_t> version(header.size() - sizeof(ARCHIVE_MAGIC));
+        uint32_t archive_version = 0;
+        size_t pos = 0;
+
+        if (!read_all(fd, header.data(), header.size()))
+        {
+            Logging::error(archive, "Unable to read the archive: (%1) %2", errno, strerror(errno));
+            throw false;
+        }
+
+        std::memcpy(version.data(), header.data() + sizeof(ARCHIVE_MAGIC), version.size());
+
+        if (std::memcmp(header.data(), ARCHIVE_MAGIC, sizeof(ARCHIVE_MAGIC)) || !get_u32(version, &pos, &archive_version))
+        {
+            Logging::error(archive, "This is not a cache archive.");
+            throw false;
+        }
+
+        if (archive_version != ARCHIVE_VERSION)
+        {
+            Logging::error(archive, "Unsupported archive version %1, expected %2.", archive_version, ARCHIVE_VERSION);
+            throw false;
+        }
+
+        for (;;)
+        {
+            std::vector<uint8_t> data(2 * sizeof(uint32_t) + sizeof(uint64_t));
+            uint32_t type;
+            RECORD record;
+
+            pos = 0;
+
+            if (!read_all(fd, data.data(), data.size()) ||
+                    !get_u32(data, &pos, &type) ||
+                    !get_u32(data, &pos, &record.m_segment_no) ||
+                    !get_u64(data, &pos, &record.m_size))
+            {
+                Logging::error(archive, "Unable to read the archive: (%1) %2", errno, strerror(errno));
+                throw false;
+            }
+
+            record.m_type = static_cast<RECORDTYPE>(type);
+
+            if (record.m_type == RECORDTYPE::ENTRY || record.m_type == RECORDTYPE::END)
+            {
+                // The previous entry is complete
+                if (job != nullptr)
+                {
+                    if (seekable)
+                    {
+                        queue_job(std::move(job), threads);
+                    }
+                    else
+                    {
+                        finish_import(job.get());
+                    }
+                    job.reset();
+                }
+
+                if (record.m_type == RECORDTYPE::END)
+                {
+                    break;
+                }
+
+                if (record.m_size > MAX_ENTRY_SIZE)
+                {
+                    Logging::error(archive, "The archive is corrupt: Entry too large (%1).", record.m_size);
+                    throw false;
+                }
+
+                std::vector<uint8_t> entry(static_cast<size_t>(record.m_size));
+
+                if (!read_all(fd, entry.data(), entry.size()))
+                {
+                    Logging::error(archive, "Unable to read the archive: (%1) %2", errno, strerror(errno));
+                    throw false;
+                }
+
+                job = std::make_unique<IMPORT_JOB>();
+
+                CACHE_INFO & cache_info = job->m_cache_info;
+                std::string desttype;
+                uint64_t u64[9];
+                uint32_t u32[7];
+                uint32_t checksums;
+
+                pos = 0;
+
+                if (!get_string(entry, &pos, &cache_info.m_origfile) ||
+                        !get_string(entry, &pos, &cache_info.m_destfile) ||
+                        !get_string(entry, &pos, &desttype) ||
+                        !get_u64(entry, &pos, &u64[0]) ||
+                        !get_u32(entry, &pos, &u32[0]) ||
+                        !get_u64(entry, &pos, &u64[1]) ||
+                        !get_u32(entry, &pos, &u32[1]) ||
+                        !get_u32(entry, &pos, &u32[2]) ||
+                        !get_u32(entry, &pos, &u32[3]) ||
+                        !get_u64(entry, &pos, &u64[2]) ||
+                        !get_u64(entry, &pos, &u64[3]) ||
+                        !get_u64(entry, &pos, &u64[4]) ||
+                        !get_u32(entry, &pos, &u32[4]) ||
+                        !get_u32(entry, &pos, &u32[5]) ||
+                        !get_u64(entry, &pos, &u64[5]) ||
+                        !get_u64(entry, &pos, &u64[6]) ||
+                        !get_u64(entry, &pos, &u64[7]) ||
+                        !get_u32(entry, &pos, &checksums) ||
+                        entry.size() - pos < static_cast<size_t>(checksums) * 2 * sizeof(uint64_t))
+                {
+                    Logging::error(archive, "The archive is corrupt: Invalid entry.");
+                    throw false;
+                }
+
+                cache_info.m_desttype[0] = '\0';
+                strncat(cache_info.m_desttype.data(), desttype.c_str(), cache_info.m_desttype.size() - 1);
+                cache_info.m_audiobitrate       = static_cast<int64_t>(u64[0]);
+                cache_info.m_audiosamplerate    = static_cast<int>(u32[0]);
+                cache_info.m_videobitrate       = static_cast<int64_t>(u64[1]);
+                cache_info.m_videowidth         = static_cast<int>(u32[1]);
+                cache_info.m_videoheight        = static_cast<int>(u32[2]);
+                cache_info.m_deinterlace        = u32[3] ? true : false;
+                cache_info.m_duration           = static_cast<int64_t>(u64[2]);
+                cache_info.m_predicted_filesize = static_cast<size_t>(u64[3]);
+                cache_info.m_encoded_filesize   = static_cast<size_t>(u64[4]);
+                cache_info.m_video_frame_count  = u32[4];
+                cache_info.m_segment_count      = u32[5];
+                cache_info.m_creation_time      = static_cast<time_t>(u64[5]);
+                cache_info.m_file_time          = static_cast<time_t>(u64[6]);
+                cache_info.m_file_size          = static_cast<size_t>(u64[7]);
+
+                cache_info.m_checksums.resize(checksums);
+                for (Buffer::CHECKSUM & checksum : cache_info.m_checksums)
+                {
+                    get_u64(entry, &pos, &checksum.m_size);
+                    get_u64(entry, &pos, &checksum.m_checksum);
+                }
+
+                uint32_t segment_starts;
+
+                if (!get_u64(entry, &pos, &u64[0]) ||
+                        !get_u32(entry, &pos, &u32[6]) ||
+                        !get_u32(entry, &pos, &segment_starts) ||
+                        entry.size() - pos < static_cast<size_t>(segment_starts) * sizeof(uint64_t))
+                {
+                    Logging::error(archive, "The archive is corrupt: Invalid entry.");
+                    throw false;
+                }
+
+                cache_info.m_segment_duration   = static_cast<int64_t>(u64[0]);
+                cache_info.m_keyframe_segments  = u32[6] ? true : false;
+                cache_info.m_segment_starts.resize(segment_starts);
+                for (int64_t & segment_start : cache_info.m_segment_starts)
+                {
+                    uint64_t value = 0;
+                    get_u64(entry, &pos, &value);
+                    segment_start = static_cast<int64_t>(value);
+                }
+
+                job->m_format   = find_format(desttype);
+                job->m_claim_fd = -1;
+                job->m_accepted = false;
+                job->m_failed   = false;
+
+                if (!seekable)
+                {
+                    // Streamed: check now, the files follow right away
+                    begin_import(job.get());
+                }
+            }
+            else if (record.m_type == RECORDTYPE::CACHEFILE || record.m_type == RECORDTYPE::INDEXFILE)
+            {
+                if (job == nullptr)
+                {
+                    Logging::error(archive, "The archive is corrupt: File without entry.");
+                    throw false;
+                }
+
+                MEMBER member;
+
+                member.m_record = record;
+                member.m_offset = seekable ? lseek(fd, 0, SEEK_CUR) : 0;
+
+                if (seekable)
+                {
+                    // Copied later by an import thread
+                    job->m_members.push_back(member);
+
+                    if (lseek(fd, static_cast<off_t>(record.m_size), SEEK_CUR) == -1)
+                    {
+                        Logging::error(archive, "Unable to read the archive: (%1) %2", errno, strerror(errno));
+                        throw false;
+                    }
+                }
+                else if (!import_member(job.get(), member, fd, false) && errno == EIO)
+                {
+                    Logging::error(archive, "Unable to read the archive.");
+                    throw false;
+                }
+                else
+                {
+                    job->m_members.push_back(member);
+                }
+            }
+            else
+            {
+                Logging::error(archive, "The archive is corrupt: Unknown record type %1.", type);
+                throw false;
+            }
+        }
+    }
+    catch (bool _success)
+    {
+        success = _success;
+
+        if (job != nullptr)
+        {
+            job->m_failed = true;
+            finish_import(job.get());
+        }
+    }
+
+    if (seekable)
+    {
+        {
+            std::lock_guard<std::mutex> lock_queue_mutex(m_queue_mutex);
+            m_queue_done = true;
+        }
+        m_queue_cond.notify_all();
+
+        for (std::thread & import_thread : import_threads)
+        {
+            import_thread.join();
+        }
+    }
+
+    if (fd != STDIN_FILENO)
+    {
+        ::close(fd);
+    }
+
+    Logging::info(archive, "Imported %1 cache entries with %2, skipped %3, failed %4.", m_entries.load(), format_size(m_bytes).c_str(), m_skipped.load(), m_failed.load());
+
+    return success;
+}
+
+void Cache_Archive::queue_job(std::unique_ptr<IMPORT_JOB> job, unsigned int threads)
+{
+    std::unique_lock<std::mutex> lock_queue_mutex(m_queue_mutex);
+
+    // Do not read ahead too far
+    m_queue_cond.wait(lock_queue_mutex, [this, threads]{ return m_queue.size() < threads * QUEUE_SIZE_PER_THREAD; });
+
+    m_queue.push_back(std::move(job));
+
+    lock_queue_mutex.unlock();
+
+    m_queue_cond.notify_all();
+}
+
+void Cache_Archive::import_thread(int fd)
+{
+    for (;;)
+    {
+        std::unique_ptr<IMPORT_JOB> job;
+
+        {
+            std::unique_lock<std::mutex> lock_queue_mutex(m_queue_mutex);
+
+            m_queue_cond.wait(lock_queue_mutex, [this]{ return !m_queue.empty() || m_queue_done; });
+
+            if (m_queue.empty())
+            {
+                // Done
+                return;
+            }
+
+            job = std::move(m_queue.front());
+            m_queue.pop_front();
+        }
+
+        m_queue_cond.notify_all();
+
+        import_job(job.get(), fd);
+    }
+}
+
+void Cache_Archive::import_job(IMPORT_JOB *job, int fd)
+{
+    begin_import(job);
+
+    for (const MEMBER & member : job->m_members)
+    {
+        if (!job->m_accepted || job->m_failed)
+        {
+            break;
+        }
+
+        import_member(job, member, fd, true);
+    }
+
+    finish_import(job);
+}
+
+void Cache_Archive::begin_import(IMPORT_JOB *job)
+{
+    const CACHE_INFO & cache_info = job->m_cache_info;
+    struct stat sb;
+
+    if (job->m_format == nullptr)
+    {
+        Logging::debug(cache_info.m_destfile, "Not importing: Format '%1' is not configured.", cache_info.m_desttype.data());
+        return;
+    }
+
+    if (cache_info.m_audiobitrate != params.m_audiobitrate ||
+            cache_info.m_audiosamplerate != params.m_audiosamplerate ||
+            cache_info.m_videobitrate != params.m_videobitrate ||
+            cache_info.m_videowidth != params.m_videowidth ||
+            cache_info.m_videoheight != params.m_videoheight ||
+            cache_info.m_deinterlace != (params.m_deinterlace ? true : false))
+    {
+        Logging::debug(cache_info.m_destfile, "Not importing: Transcoded with different parameters.");
+        return;
+    }
+
+    if (stat(cache_info.m_origfile.c_str(), &sb) == -1)
+    {
+        Logging::debug(cache_info.m_destfile, "Not importing: Source file '%1' is not available: (%2) %3", cache_info.m_origfile.c_str(), errno, strerror(errno));
+        return;
+    }
+
+    if (cache_info.m_file_time < sb.st_mtime || cache_info.m_file_size != static_cast<size_t>(sb.st_size))
+    {
+        Logging::debug(cache_info.m_destfile, "Not importing: Source file has changed.");
+        return;
+    }
+
+    // Keep off entries a running mount is transcoding right now
+    Cache_Entry::make_claim_file_name(&job->m_claim_file, cache_info.m_destfile, job->m_format->fileext());
+
+    job->m_claim_fd = Cache_Entry::lock_claim_file(job->m_claim_file);
+    if (job->m_claim_fd == -1)
+    {
+        Logging::debug(cache_info.m_destfile, "Not importing: Entry is being transcoded.");
+        return;
+    }
+
+    CACHE_INFO current;
+
+    current.m_destfile = cache_info.m_destfile;
+    current.m_desttype = cache_info.m_desttype;
+
+    if (m_cache->read_info(&current) && current.m_result == RESULTCODE::FINISHED_SUCCESS)
+    {
+        Logging::debug(cache_info.m_destfile, "Not importing: Entry is already cached.");
+        return;
+    }
+
+    job->m_cache_info.m_cache_root = m_cache->select_cache_root(cache_info.m_destfile + ":" + cache_info.m_desttype.data(), cache_info.m_encoded_filesize);
+    job->m_accepted = true;
+}
+
+bool Cache_Archive::import_member(IMPORT_JOB *job, const MEMBER & member, int fd, bool seekable)
+{
+    const RECORD & record = member.m_record;
+    std::vector<uint8_t> data(COPY_BUFFER_SIZE);
+    std::string cachefile;
+    std::string tmpfile;
+    int tmpfd = -1;
+
+    if (job->m_accepted && !job->m_failed)
+    {
+        make_member_name(&cachefile, job->m_cache_info.m_destfile, job->m_format, record, job->m_cache_info.m_cache_root);
+
+        tmpfile = cachefile + ".import";
+
+        std::shared_ptr<char[]> cachefiletmp = new_strdup(cachefile);
+
+        if (cachefiletmp == nullptr || (mktree(dirname(cachefiletmp.get()), S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH) && errno != EEXIST))
+        {
+            Logging::error(cachefile, "Error creating cache directory: (%1) %2", errno, strerror(errno));
+            job->m_failed = true;
+        }
+        else
+        {
+            tmpfd = ::open(tmpfile.c_str(), O_CREAT | O_WRONLY | O_TRUNC | O_CLOEXEC, static_cast<mode_t>(0644));
+            if (tmpfd == -1)
+            {
+                Logging::error(tmpfile, "The cache file could not be opened due to an error: (%1) %2", errno, strerror(errno));
+                job->m_failed = true;
+            }
+            else
+            {
+                job->m_files.emplace_back(tmpfile, cachefile);
+            }
+        }
+    }
+
+    // Streamed archives must be read on even if the file is not wanted
+    if (tmpfd == -1 && seekable)
+    {
+        return false;
+    }
+
+    off_t offset = member.m_offset;
+    uint64_t remaining = record.m_size;
+    bool success = true;
+
+    while (remaining)
+    {
+        size_t bytes = static_cast<size_t>(std::min<uint64_t>(remaining, data.size()));
+
+        if (seekable)
+        {
+            ssize_t n = pread(fd, data.data(), bytes, offset);
+            if (n <= 0)
+            {
+                Logging::error(tmpfile, "Unable to read the archive: (%1) %2", n ? errno : EIO, strerror(n ? errno : EIO));
+                success = false;
+                break;
+            }
+            bytes = static_cast<size_t>(n);
+        }
+        else if (!read_all(fd, data.data(), bytes))
+        {
+            if (tmpfd != -1)
+            {
+                ::close(tmpfd);
+            }
+            job->m_failed = true;
+            errno = EIO;
+            return false;
+        }
+
+        if (tmpfd != -1 && !write_all(tmpfd, data.data(), bytes))
+        {
+            Logging::error(tmpfile, "Unable to write the cache file: (%1) %2", errno, strerror(errno));
+            ::close(tmpfd);
+            tmpfd = -1;
+            success = false;
+            if (seekable)
+            {
+                break;
+            }
+        }
+
+        offset      += static_cast<off_t>(bytes);
+        remaining   -= bytes;
+    }
+
+    if (tmpfd == -1)
+    {
+        job->m_failed |= job->m_accepted;
+        errno = 0;
+        return false;
+    }
+
+    if (::close(tmpfd) == -1 && success)
+    {
+        Logging::error(tmpfile, "Unable to write the cache file: (%1) %2", errno, strerror(errno));
+        success = false;
+    }
+
+    // Check the contents against the checksum recorded by the exporting node
+    size_t index = record.m_segment_no ? record.m_segment_no - 1 : 0;
+
+    if (success && record.m_type == RECORDTYPE::CACHEFILE &&
+            index < job->m_cache_info.m_checksums.size() && job->m_cache_info.m_checksums[index].m_size &&
+            Buffer::verify_checksum(tmpfile, job->m_cache_info.m_checksums[index]) != 1)
+    {
+        Logging::error(cachefile, "Not importing: The file is corrupt.");
+        success = false;
+    }
+
+    if (!success)
+    {
+        job->m_failed = true;
+        errno = 0;
+        return false;
+    }
+
+    m_bytes += record.m_size;
+
+    return true;
+}
+
+void Cache_Archive::finish_import(IMPORT_JOB *job)
+{
+    CACHE_INFO & cache_info = job->m_cache_info;
+
+    if (job->m_accepted && !job->m_failed)
+    {
+        // All files must be there
+        size_t expected = job->m_format->is_hls() ? cache_info.m_segment_count : (job->m_format->is_frameset() ? 2 : 1);
+
+        if (job->m_files.size() != expected)
+        {
+            Logging::error(cache_info.m_destfile, "Not importing: The archive contains %1 files, expected %2.", job->m_files.size(), expected);
+            job->m_failed = true;
+        }
+    }
+
+    if (job->m_accepted && !job->m_failed)
+    {
+        for (const std::pair<std::string, std::string> & file : job->m_files)
+        {
+            if (rename(file.first.c_str(), file.second.c_str()) == -1)
+            {
+                Logging::error(file.second, "Unable to move the cache file in place: (%1) %2", errno, strerror(errno));
+                job->m_failed = true;
+                break;
+            }
+        }
+    }
+
+    if (job->m_accepted && !job->m_failed)
+    {
+        cache_info.m_result         = RESULTCODE::FINISHED_SUCCESS;
+        cache_info.m_error          = false;
+        cache_info.m_errno          = 0;
+        cache_info.m_averror        = 0;
+        cache_info.m_access_time    = time(nullptr);
+        cache_info.m_access_count   = 0;
+
+        if (!m_cache->write_info(&cache_info))
+        {
+            job->m_failed = true;
+        }
+    }
+
+    if (job->m_failed)
+    {
+        // Whatever got in place is garbage without the index row
+        for (const std::pair<std::string, std::string> & file : job->m_files)
+        {
+            Buffer::remove_file(file.first);
+            if (job->m_accepted)
+            {
+                Buffer::remove_file(file.second);
+            }
+        }
+        m_failed++;
+    }
+    else if (job->m_accepted)
+    {
+        Logging::trace(cache_info.m_destfile, "Imported cache entry.");
+        m_entries++;
+    }
+    else
+    {
+        m_skipped++;
+    }
+
+    if (job->m_claim_fd != -1)
+    {
+        Cache_Entry::unlock_claim_file(job->m_claim_file, job->m_claim_fd);
+        job->m_claim_fd = -1;
+    }
+}
@@ -0,0 +1,226 @@
+/*
+ * Copyright (C) 2017-2026 Norbert Schlia (nschlia@oblivion-software.de)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * On Debian systems, the complete text of the GNU General Public License
+ * Version 3 can be found in `/usr/share/common-licenses/GPL-3'.
+ */
+
+/**
+ * @file cache_archive.h
+ * @brief %Cache export and import
+ *
+ * Packs successfully transcoded cache entries, i.e. their index rows and
+ * cache files, HLS segments and frame set indexes, into a single archive
+ * that can be used to seed the cache of another node.
+ *
+ * The archive is a stream of records and can be read from or written to a
+ * pipe. It starts with a header, followed by one entry record per cache
+ * entry, each followed by its file records, and ends with an end record.
+ * All numbers are stored in little endian byte order. Cache file names are
+ * not stored but made up on import, so the cache path, cache roots and
+ * mount path of the importing node may differ.
+ *
+ * On import, entries are checked against the current parameter set and
+ * the source files' time and size. Entries that are already cached or
+ * currently being transcoded are left alone, so a running mount may keep
+ * using the cache. If the archive is a regular file, entries are imported
+ * by several threads in parallel.
+ *
+ * @ingroup ffmpegfs
+ *
+ * @author Norbert Schlia (nschlia@oblivion-software.de)
+ * @copyright Copyright (C) 2017-2026 Norbert Schlia (nschlia@oblivion-software.de)
+ */
+
+#ifndef CACHE_ARCHIVE_H
+#define CACHE_ARCHIVE_H
+
+#pragma once
+
+#include "cache.h"
+
+#include <deque>
+#include <atomic>
+
+class FFmpegfs_Format;
+
+/**
+ * @brief The #Cache_Archive class
+ */
+class Cache_Archive
+{
+    /**
+     * @brief Archive format version
+     */
+    static constexpr uint32_t ARCHIVE_VERSION = 1;
+    /**
+     * @brief Max. size of an entry record. Anything larger is not an archive of ours.
+     */
+    static constexpr uint64_t MAX_ENTRY_SIZE = 16 * 1024 * 1024;
+    /**
+     * @brief Size of the buffer used to copy files.
+     */
+    static constexpr size_t COPY_BUFFER_SIZE = 1024 * 1024;
+    /**
+     * @brief Max. number of entries waiting to be imported per thread.
+     */
+    static constexpr size_t QUEUE_SIZE_PER_THREAD = 4;
+
+    /**
+     * @brief Archive record types
+     */
+    enum class RECORDTYPE : uint32_t
+    {
+        ENTRY       = 1,                                        /**< @brief Cache entry, serialised index row */
+        CACHEFILE   = 2,                                        /**< @brief Cache file or HLS segment */
+        INDEXFILE   = 3,                                        /**< @brief Frame set index */
+        END         = 4,                                        /**< @brief End of archive */
+    };
+
+    /**
+     * @brief Archive record header
+     */
+    typedef struct RECORD
+    {
+        RECORDTYPE  m_type;                                     /**< @brief Record type */
+        uint32_t    m_segment_no;                               /**< @brief HLS segment number, 0 if not a segment */
+        uint64_t    m_size;                                     /**< @brief Size of the data following the header */
+    } RECORD;
+
+    /**
+     * @brief File of an entry to be imported
+     */
+    typedef struct MEMBER
+    {
+        RECORD      m_record;                                   /**< @brief Record header */
+        off_t       m_offset;                                   /**< @brief Offset of the file data in the archive */
+    } MEMBER;
+
+    /**
+     * @brief Cache entry to be imported
+     */
+    typedef struct IMPORT_JOB
+    {
+        CACHE_INFO                  m_cache_info;               /**< @brief Index row as exported */
+        const FFmpegfs_Format *     m_format;                   /**< @brief Format of the entry */
+        std::vector<MEMBER>         m_members;                  /**< @brief Files of the entry */
+        std::vector<std::pair<std::string, std::string>> m_files; /**< @brief Temporary and final names of the files copied so far */
+        std::string                 m_claim_file;               /**< @brief Name of the claim file */
+        int                         m_claim_fd;                 /**< @brief Claim file handle, -1 if not claimed */
+        bool                        m_accepted;                 /**< @brief true if the entry is to be imported */
+        bool                        m_failed;                   /**< @brief true if copying a file failed */
+    } IMPORT_JOB;
+
+public:
+    /**
+     * @brief Create #Cache_Archive object
+     * @param[in] cache - Cache to export from or import to.
+     */
+    explicit Cache_Archive(Cache *cache);
+    /**
+     * @brief Destroy #Cache_Archive object
+     */
+    virtual ~Cache_Archive();
+
+    /**
+     * @brief Export all successfully finished cache entries.
+     * @param[in] archive - Name of the archive file, "-" for standard output.
+     * @return Returns true on success; false on error.
+     */
+    bool                export_cache(const std::string & archive);
+    /**
+     * @brief Import cache entries from an archive.
+     * @param[in] archive - Name of the archive file, "-" for standard input.
+     * @param[in] threads - Number of threads to import with. Archives read from a pipe are imported by a single thread.
+     * @return Returns true on success; false on error. Skipped entries are not an error.
+     */
+    bool                import_cache(const std::string & archive, unsigned int threads);
+
+protected:
+    /**
+     * @brief Export a single cache entry.
+     * @param[in] fd - Archive file handle.
+     * @param[in] cache_info - Index row of the entry.
+     * @return Returns 1 if the entry has been exported, 0 if it was skipped, -1 on write errors.
+     */
+    int                 export_entry(int fd, const CACHE_INFO & cache_info);
+    /**
+     * @brief Check an entry and claim it for import.
+     * @param[inout] job - Entry to be imported. On success, m_accepted is set.
+     */
+    void                begin_import(IMPORT_JOB *job);
+    /**
+     * @brief Copy a file of an entry from the archive to a temporary file in the cache.
+     * @param[inout] job - Entry to be imported.
+     * @param[in] member - File to copy.
+     * @param[in] fd - Archive file handle.
+     * @param[in] seekable - If true, the data is read from member.m_offset; otherwise it is read from the current position.
+     * @return Returns true on success; false on error. Archive read errors set errno to EIO.
+     */
+    bool                import_member(IMPORT_JOB *job, const MEMBER & member, int fd, bool seekable);
+    /**
+     * @brief Move the copied files in place and write the index row, or clean up if the entry could not be imported.
+     * @param[inout] job - Entry to be imported.
+     */
+    void                finish_import(IMPORT_JOB *job);
+    /**
+     * @brief Import a complete entry from a seekable archive.
+     * @param[inout] job - Entry to be imported.
+     * @param[in] fd - Archive file handle.
+     */
+    void                import_job(IMPORT_JOB *job, int fd);
+    /**
+     * @brief Import thread
+     * @param[in] fd - Archive file handle.
+     */
+    void                import_thread(int fd);
+    /**
+     * @brief Queue an entry for the import threads.
+     * @param[in] job - Entry to be imported.
+     * @param[in] threads - Number of import threads.
+     */
+    void                queue_job(std::unique_ptr<IMPORT_JOB> job, unsigned int threads);
+    /**
+     * @brief Find the format for a destination type.
+     * @param[in] desttype - Destination type.
+     * @return Returns the format, or nullptr if not configured.
+     */
+    static const FFmpegfs_Format * find_format(const std::string & desttype);
+    /**
+     * @brief Make up the name of a cache file of an entry.
+     * @param[out] cachefile - Receives the cache file name.
+     * @param[in] destfile - Destination file name, as stored in the cache index.
+     * @param[in] format - Format of the entry.
+     * @param[in] record - Record describing the file.
+     * @param[in] cache_root - Cache root of the entry.
+     */
+    static void         make_member_name(std::string *cachefile, const std::string & destfile, const FFmpegfs_Format *format, const RECORD & record, const std::string & cache_root);
+
+private:
+    Cache *                                 m_cache;            /**< @brief Cache to export from or import to */
+    std::mutex                              m_queue_mutex;      /**< @brief Job queue mutex */
+    std::condition_variable                 m_queue_cond;       /**< @brief Signalled when the job queue changes */
+    std::deque<std::unique_ptr<IMPORT_JOB>> m_queue;            /**< @brief Entries waiting to be imported */
+    bool                                    m_queue_done;       /**< @brief true when the whole archive has been read */
+    // Statistics
+    std::atomic_size_t                      m_entries;          /**< @brief Entries exported or imported */
+    std::atomic_size_t                      m_skipped;          /**< @brief Entries skipped */
+    std::atomic_size_t                      m_failed;           /**< @brief Entries failed */
+    std::atomic_uint64_t                    m_bytes;            /**< @brief Bytes exported or imported */
+};
+
+#endif // CACHE_ARCHIVE_H
@@ -35,13 +35,21 @@
 #include "logging.h"
 
 #include <cstring>
+#include <unistd.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <sys/file.h>
 
 Cache_Entry::Cache_Entry(Cache *owner, LPVIRTUALFILE virtualfile)
     : m_owner(owner)
     , m_ref_count(0)
     , m_virtualfile(virtualfile)
+    , m_claim_fd(-1)
+    , m_claim_publish_time(0)
+    , m_claim_pid(0)
     , m_is_decoding(false)
     , m_suspend_timeout(false)
+    , m_remote_claim(false)
     , m_seek_to_no(0)
 {
     m_cache_info.m_origfile = virtualfile->m_origfile;
@@ -50,6 +58,10 @@ Cache_Entry::Cache_Entry(Cache *owner, LPVIRTUALFILE virtualfile)
     m_cache_info.m_desttype[0] = '\0';
     strncat(m_cache_info.m_desttype.data(), params.current_format(virtualfile)->desttype().c_str(), m_cache_info.m_desttype.size() - 1);
 
+    make_claim_file_name(&m_claim_file, filename(), params.current_format(virtualfile)->fileext());
+
+    std::memset(&m_claim_published, 0, sizeof(m_claim_published));
+
     m_buffer = std::make_unique<Buffer>();
 
     if (m_buffer != nullptr)
@@ -66,6 +78,8 @@ Cache_Entry::~Cache_Entry()
 {
     std::unique_lock<std::recursive_mutex> lock_active_mutex(m_active_mutex);
 
+    release_claim();
+
     unlock();
 
     Logging::trace(filename(), "Deleted buffer.");
@@ -102,12 +116,18 @@ void Cache_Entry::clear(bool fetch_file_time /*= true*/)
     m_cache_info.m_predicted_filesize   = 0;
     m_cache_info.m_encoded_filesize     = 0;
     m_cache_info.m_video_frame_count    = 0;
+    m_cache_info.m_segment_count        = 0;
+    m_cache_info.m_segment_duration     = params.m_segment_duration;
+    m_cache_info.m_keyframe_segments    = params.m_hls_keyframe_segments ? true : false;
+    m_cache_info.m_segment_starts.clear();
     m_cache_info.m_result               = RESULTCODE::NONE;
     m_cache_info.m_error                = false;
     m_cache_info.m_errno                = 0;
     m_cache_info.m_averror              = 0;
     m_cache_info.m_access_time          = m_cache_info.m_creation_time = time(nullptr);
     m_cache_info.m_access_count         = 0;
+    m_cache_info.m_checksums.clear();
+    m_cache_info.m_resume               = Buffer::RESUME_POINT();
 
     if (fetch_file_time)
     {
@@ -138,6 +158,17 @@ bool Cache_Entry::read_info()
 
 bool Cache_Entry::write_info()
 {
+    if (m_remote_claim)
+    {
+        // The info belongs to the process that transcodes the entry
+        return true;
+    }
+
+    if (m_buffer != nullptr)
+    {
+        m_buffer->get_checksums(&m_cache_info.m_checksums);
+    }
+
     return m_owner->write_info(&m_cache_info);
 }
 
@@ -152,7 +183,7 @@ bool Cache_Entry::update_access(bool update_database /*= false*/)
 
     if (update_database)
     {
-        return m_owner->write_info(&m_cache_info);
+        return write_info();
     }
     else
     {
@@ -177,12 +208,22 @@ bool Cache_Entry::openio(bool create_cache /*= true*/)
         {
             bool erase_cache = !is_finished();
 
+            claim_rebuild(&erase_cache);
+            select_cache_root(&erase_cache);
+
             Logging::trace(filename(), "Initialising cache buffer for an already referenced entry. Result %1 Erasing cache: %2.", static_cast<int>(m_cache_info.m_result), erase_cache);
 
+            if (erase_cache)
+            {
+                m_cache_info.m_checksums.clear();
+                m_cache_info.m_resume = Buffer::RESUME_POINT();
+            }
+
             update_access(true);
 
             if (m_buffer->init(erase_cache))
             {
+                m_buffer->set_checksums(m_cache_info.m_checksums);
                 return true;
             }
             else
@@ -198,6 +239,8 @@ bool Cache_Entry::openio(bool create_cache /*= true*/)
 
     bool erase_cache = !read_info();    // If read_info fails, rebuild cache entry
 
+    m_remote_claim = false;
+
     if (!create_cache)
     {
         return true;
@@ -211,14 +254,24 @@ bool Cache_Entry::openio(bool create_cache /*= true*/)
         erase_cache = true;
     }
 
+    claim_rebuild(&erase_cache);
+    select_cache_root(&erase_cache);
+
     Logging::trace(filename(), "The last transcode was completed. Result %1 Erasing cache: %2.", static_cast<int>(m_cache_info.m_result), erase_cache);
 
+    if (erase_cache)
+    {
+        m_cache_info.m_checksums.clear();
+        m_cache_info.m_resume = Buffer::RESUME_POINT();
+    }
+
     // Store access time
     update_access(true);
 
     // Open the cache
     if (m_buffer->init(erase_cache))
     {
+        m_buffer->set_checksums(m_cache_info.m_checksums);
         return true;
     }
     else
@@ -228,6 +281,48 @@ bool Cache_Entry::openio(bool create_cache /*= true*/)
     }
 }
 
+void Cache_Entry::select_cache_root(bool *erase_cache)
+{
+    if (m_remote_claim)
+    {
+        // Files are where the other process put them, do not move anything
+        m_buffer->set_cache_root(m_cache_info.m_cache_root);
+        return;
+    }
+
+    if (*erase_cache && can_resume() && m_owner->is_cache_root(m_cache_info.m_cache_root))
+    {
+        // Interrupted transcode, keep what has been written so far
+        Logging::info(filename(), "Keeping the interrupted transcode to resume it at %1.", format_duration(m_cache_info.m_resume.m_time).c_str());
+        *erase_cache = false;
+    }
+
+    if (!*erase_cache && m_owner->is_cache_root(m_cache_info.m_cache_root))
+    {
+        // Finished and still available, keep it where it is
+        m_buffer->set_cache_root(m_cache_info.m_cache_root);
+        return;
+    }
+
+    std::string cache_root = m_owner->select_cache_root(m_cache_info.m_destfile + ":" + m_cache_info.m_desttype.data(), m_virtualfile->m_predicted_size);
+
+    if (cache_root != m_cache_info.m_cache_root)
+    {
+        if (!*erase_cache)
+        {
+            Logging::info(filename(), "Cache root '%1' is no longer configured. Rebuilding cache entry.", m_cache_info.m_cache_root.c_str());
+            *erase_cache = true;
+        }
+
+        // Remove whatever has been left over on the old root
+        m_owner->remove_cachefile(m_cache_info.m_destfile, m_cache_info.m_desttype.data(), m_cache_info.m_cache_root);
+
+        m_cache_info.m_cache_root = cache_root;
+    }
+
+    m_buffer->set_cache_root(m_cache_info.m_cache_root);
+}
+
 void Cache_Entry::close_buffer(int flags)
 {
     if (m_buffer->release(flags))
@@ -253,6 +348,11 @@ bool Cache_Entry::closeio(int flags)
     {
         close_buffer(flags);
 
+        if (!m_is_decoding)
+        {
+            release_claim();
+        }
+
         return true;
     }
 
@@ -265,10 +365,15 @@ bool Cache_Entry::closeio(int flags)
 
     close_buffer(flags);
 
+    if (!m_is_decoding)
+    {
+        release_claim();
+    }
+
     return true;
 }
 
-bool Cache_Entry::flush()
+bool Cache_Entry::flush(bool durable /*= false*/)
 {
     if (m_buffer == nullptr)
     {
@@ -276,6 +381,11 @@ bool Cache_Entry::flush()
         return false;
     }
 
+    if (durable)
+    {
+        return m_buffer->flush(true);
+    }
+
     m_buffer->flush();
     //write_info();
 
@@ -423,6 +533,32 @@ bool Cache_Entry::outdated() const
         return true;
     }
 
+    const FFmpegfs_Format *current_format = params.current_format(m_virtualfile);
+    if (current_format != nullptr && current_format->is_hls())
+    {
+        if (m_cache_info.m_segment_duration != params.m_segment_duration)
+        {
+            if (m_cache_info.m_segment_duration)
+            {
+                // Report if old duration is known
+                Logging::debug(filename(), "Triggering re-transcode: Selected segment duration changed from %1 to %2.", m_cache_info.m_segment_duration, params.m_segment_duration);
+            }
+            return true;
+        }
+
+        if (m_cache_info.m_keyframe_segments != (params.m_hls_keyframe_segments ? true : false))
+        {
+            Logging::debug(filename(), "Triggering re-transcode: Selected key frame segments changed from %1 to %2.", m_cache_info.m_keyframe_segments, params.m_hls_keyframe_segments);
+            return true;
+        }
+
+        if (!m_cache_info.m_segment_starts.empty() && m_cache_info.m_segment_starts.size() != m_cache_info.m_segment_count)
+        {
+            Logging::debug(filename(), "Triggering re-transcode: %1 segment start times recorded for %2 segments.", m_cache_info.m_segment_starts.size(), m_cache_info.m_segment_count);
+            return true;
+        }
+    }
+
     if (stat(filename(), &sb) != -1)
     {
         // If source file exists, check file date/size
@@ -462,6 +598,15 @@ bool Cache_Entry::is_finished() const
     return (m_cache_info.m_result != RESULTCODE::NONE);
 }
 
+bool Cache_Entry::can_resume() const
+{
+    return (params.m_resume_transcode &&
+            m_cache_info.m_result == RESULTCODE::NONE &&
+            m_cache_info.m_resume.m_header_size &&
+            m_cache_info.m_resume.m_offset > m_cache_info.m_resume.m_header_size &&
+            !(m_virtualfile->m_flags & (VIRTUALFLAG_HLS | VIRTUALFLAG_FRAME)));
+}
+
 bool Cache_Entry::is_finished_incomplete() const
 {
     return (m_cache_info.m_result == RESULTCODE::FINISHED_INCOMPLETE);
@@ -476,3 +621,274 @@ bool Cache_Entry::is_finished_error() const
 {
     return (m_cache_info.m_result == RESULTCODE::FINISHED_ERROR);
 }
+
+bool Cache_Entry::claim()
+{
+    std::lock_guard<std::recursive_mutex> lock_mutex(m_claim_mutex);
+
+    if (m_claim_fd != -1)
+    {
+        // Already ours
+        return true;
+    }
+
+    if (params.m_disable_cache || (m_virtualfile->m_flags & VIRTUALFLAG_FRAME))
+    {
+        // Nothing to share
+        return true;
+    }
+
+    int fd = lock_claim_file(m_claim_file);
+    if (fd == -1)
+    {
+        // On errors, go ahead as if there was only this process
+        return (errno != EBUSY);
+    }
+
+    std::memset(&m_claim_published, 0, sizeof(m_claim_published));
+    m_claim_publish_time    = 0;
+    m_claim_fd              = fd;
+
+    Logging::trace(filename(), "Claimed the cache entry for transcoding.");
+
+    return true;
+}
+
+void Cache_Entry::make_claim_file_name(std::string * claim_file, const std::string & filename, const std::string & fileext)
+{
+    // Claims always live in the primary cache path, no matter which root holds the files
+    Buffer::make_cachefile_name(claim_file, filename, fileext, false, "");
+    *claim_file += ".lock";
+}
+
+int Cache_Entry::lock_claim_file(const std::string & claim_file)
+{
+    for (int retries = 0; retries < 3; retries++)
+    {
+        int fd = ::open(claim_file.c_str(), O_CREAT | O_RDWR | O_CLOEXEC, static_cast<mode_t>(0644));
+        if (fd == -1 && errno == ENOENT)
+        {
+            std::shared_ptr<char[]> claimfiletmp = new_strdup(claim_file);
+
+            if (claimfiletmp != nullptr && (!mktree(dirname(claimfiletmp.get()), S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH) || errno == EEXIST))
+            {
+                fd = ::open(claim_file.c_str(), O_CREAT | O_RDWR | O_CLOEXEC, static_cast<mode_t>(0644));
+            }
+        }
+
+        if (fd == -1)
+        {
+            Logging::warning(claim_file, "The claim file could not be opened due to an error: (%1) %2", errno, strerror(errno));
+            return -1;
+        }
+
+        if (flock(fd, LOCK_EX | LOCK_NB) == -1)
+        {
+            int _errno = errno;
+
+            ::close(fd);
+
+            if (_errno == EWOULDBLOCK)
+            {
+                errno = EBUSY;
+                return -1;
+            }
+
+            Logging::warning(claim_file, "The claim file could not be locked due to an error: (%1) %2", _errno, strerror(_errno));
+            errno = _errno;
+            return -1;
+        }
+
+        // The previous owner removes the file when done. If this happened after
+        // our open(), we have locked a stale file and must try again.
+        struct stat sbfd;
+        struct stat sbpath;
+
+        if (fstat(fd, &sbfd) == -1 || stat(claim_file.c_str(), &sbpath) == -1 || sbfd.st_ino != sbpath.st_ino || sbfd.st_dev != sbpath.st_dev)
+        {
+            ::close(fd);
+            continue;
+        }
+
+        // Forget whatever a crashed owner may have left
+        if (ftruncate(fd, 0) == -1)
+        {
+            Logging::warning(claim_file, "Error calling ftruncate() to clear the claim file: (%1) %2", errno, strerror(errno));
+        }
+
+        return fd;
+    }
+
+    Logging::warning(claim_file, "The claim file keeps changing.");
+    errno = ESTALE;
+    return -1;
+}
+
+void Cache_Entry::unlock_claim_file(const std::string & claim_file, int fd)
+{
+    // Remove while still locked so nobody takes over a stale file. Processes
+    // that already opened it will notice and retry.
+    if (unlink(claim_file.c_str()) && errno != ENOENT)
+    {
+        Logging::warning(claim_file, "Cannot unlink the file: (%1) %2", errno, strerror(errno));
+    }
+
+    ::close(fd);
+}
+
+void Cache_Entry::claim_rebuild(bool *erase_cache)
+{
+    if (!*erase_cache || claim())
+    {
+        return;
+    }
+
+    Logging::info(filename(), "Another process is transcoding this file. Following its progress.");
+
+    m_remote_claim  = true;
+    m_claim_pid     = 0;
+    *erase_cache    = false;
+}
+
+void Cache_Entry::release_claim()
+{
+    std::lock_guard<std::recursive_mutex> lock_mutex(m_claim_mutex);
+
+    if (m_claim_fd == -1)
+    {
+        return;
+    }
+
+    unlock_claim_file(m_claim_file, m_claim_fd);
+    m_claim_fd = -1;
+
+    Logging::trace(filename(), "Released the claim on the cache entry.");
+}
+
+void Cache_Entry::publish_claim(bool force /*= false*/)
+{
+    std::lock_guard<std::recursive_mutex> lock_mutex(m_claim_mutex);
+
+    if (m_claim_fd == -1 || m_buffer == nullptr)
+    {
+        return;
+    }
+
+    CLAIM_INFO claim_info;
+    time_t now = time(nullptr);
+
+    std::memset(&claim_info, 0, sizeof(claim_info));
+
+    claim_info.m_pid        = static_cast<int32_t>(getpid());
+    claim_info.m_segment_no = m_buffer->current_segment_no();
+    claim_info.m_watermark  = m_buffer->buffer_watermark();
+
+    if (!force &&
+            claim_info.m_segment_no == m_claim_published.m_segment_no &&
+            claim_info.m_watermark < m_claim_published.m_watermark + CLAIM_PUBLISH_SIZE &&
+            (claim_info.m_watermark == m_claim_published.m_watermark || now == m_claim_publish_time))
+    {
+        return;
+    }
+
+    if (pwrite(m_claim_fd, &claim_info, sizeof(claim_info), 0) != static_cast<ssize_t>(sizeof(claim_info)))
+    {
+        Logging::warning(m_claim_file, "Unable to publish progress: (%1) %2", errno, strerror(errno));
+        return;
+    }
+
+    m_claim_published       = claim_info;
+    m_claim_publish_time    = now;
+}
+
+bool Cache_Entry::read_claim(CLAIM_INFO *claim_info)
+{
+    // The buffer may be reopened, keep others out of the entry. The entry
+    // lock must be taken first, transcoder_new() claims while holding it.
+    std::lock_guard<std::recursive_mutex> lock_entry(m_mutex);
+    std::lock_guard<std::recursive_mutex> lock_mutex(m_claim_mutex);
+
+    int fd = ::open(m_claim_file.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+    {
+        return false;
+    }
+
+    ssize_t bytes_read = pread(fd, claim_info, sizeof(CLAIM_INFO), 0);
+
+    ::close(fd);
+
+    if (bytes_read != static_cast<ssize_t>(sizeof(CLAIM_INFO)) || !claim_info->m_pid)
+    {
+        return false;
+    }
+
+    if (claim_info->m_pid != m_claim_pid)
+    {
+        // The index entry has been written before the first progress was
+        // published, so it tells us where the files are.
+        m_claim_pid = claim_info->m_pid;
+
+        read_info();
+
+        if (m_owner->is_cache_root(m_cache_info.m_cache_root))
+        {
+            m_buffer->release(CACHE_CLOSE_NOOPT);
+            m_buffer->set_cache_root(m_cache_info.m_cache_root);
+            m_buffer->init(false);
+        }
+
+        Logging::debug(filename(), "Following transcoder process %1.", m_claim_pid);
+    }
+
+    return true;
+}
+
+bool Cache_Entry::take_over()
+{
+    std::lock_guard<std::recursive_mutex> lock_entry(m_mutex);
+    std::lock_guard<std::recursive_mutex> lock_mutex(m_claim_mutex);
+
+    if (!m_remote_claim)
+    {
+        // Someone else was faster
+        return true;
+    }
+
+    if (!claim())
+    {
+        return false;
+    }
+
+    m_remote_claim = false;
+
+    m_buffer->release(CACHE_CLOSE_NOOPT);
+
+    bool erase_cache = !read_info() || !is_finished();
+
+    if (!erase_cache)
+    {
+        // Done, nothing left to transcode
+        release_claim();
+    }
+
+    Logging::info(filename(), "The other process has %1. Continuing on our own.", erase_cache ? "gone away" : "finished transcoding");
+
+    select_cache_root(&erase_cache);
+
+    if (erase_cache)
+    {
+        m_cache_info.m_checksums.clear();
+        m_cache_info.m_resume = Buffer::RESUME_POINT();
+    }
+
+    if (!m_buffer->init(erase_cache))
+    {
+        clear(false);
+        return true;
+    }
+
+    m_buffer->set_checksums(m_cache_info.m_checksums);
+
+    return true;
+}
@@ -47,7 +47,24 @@ class Buffer;
  */
 class Cache_Entry
 {
+public:
+    /**
+     * @brief Transcoder progress, published in the claim file for other processes.
+     */
+    typedef struct CLAIM_INFO
+    {
+        int32_t             m_pid;                          /**< @brief Process ID of the transcoding process, 0 if nothing was published yet */
+        uint32_t            m_segment_no;                   /**< @brief Segment currently written, 1 for single files */
+        uint64_t            m_watermark;                    /**< @brief Number of bytes written to the current segment */
+    } CLAIM_INFO;
+
 private:
+    /**
+     * @brief Publish progress at least after this number of bytes.
+     * In between, progress is published at most once a second.
+     */
+    static constexpr size_t CLAIM_PUBLISH_SIZE = 256 * 1024;
+
     /**
      * @brief Create Cache_Entry object.
      * @param[in] owner - Cache object of owner.
@@ -92,9 +109,10 @@ public:
     bool                    openio(bool create_cache = true);
     /**
      * @brief Flush current memory cache to disk.
+     * @param[in] durable - If true, wait until the data is on disk. See Buffer::flush().
      * @return On success returns true; on error returns false and errno contains the error code.
      */
-    bool                    flush();
+    bool                    flush(bool durable = false);
     /**
      * @brief Clear the cache entry
      * @param[in] fetch_file_time - If true, the entry file time will be filled in from the source file.
@@ -236,6 +254,80 @@ public:
      * @return Returns true if cache is finished with error, false if not.
      */
     bool                    is_finished_error() const;
+    /**
+     * @brief Check if an interrupted transcode can be continued from its last resume point.
+     * @return Returns true if a resume point has been recorded and resuming is enabled, false if not.
+     */
+    bool                    can_resume() const;
+
+    /**
+     * @brief Claim the entry for transcoding.
+     *
+     * Several ffmpegfs processes may share a cache directory. Only the process
+     * that holds the claim may transcode the entry, others follow its progress.
+     * The claim is a lock on a file in the cache directory and goes away
+     * automatically if the process dies. Frame sets are not coordinated.
+     *
+     * @return Returns true if this process may transcode the entry; false if another process holds the claim.
+     */
+    bool                    claim();
+    /**
+     * @brief Make up the name of the claim file for an entry.
+     * @param[out] claim_file - Receives the name of the claim file.
+     * @param[in] filename - Source file name.
+     * @param[in] fileext - Extension of the cache files.
+     */
+    static void             make_claim_file_name(std::string * claim_file, const std::string & filename, const std::string & fileext);
+    /**
+     * @brief Open and lock a claim file.
+     * @param[in] claim_file - Name of the claim file.
+     * @return On success, returns the file handle; on error, returns -1 and errno is set. errno is EBUSY if another process holds the claim.
+     */
+    static int              lock_claim_file(const std::string & claim_file);
+    /**
+     * @brief Remove and unlock a claim file.
+     * @param[in] claim_file - Name of the claim file.
+     * @param[in] fd - File handle returned by lock_claim_file().
+     */
+    static void             unlock_claim_file(const std::string & claim_file, int fd);
+    /**
+     * @brief Claim an entry that is about to be rebuilt.
+     *
+     * If another process is already rebuilding it, its files must be left alone:
+     * the entry is followed and the cache will not be erased.
+     *
+     * @param[inout] erase_cache - In: true if the cache will be rebuilt. Out: set to false if the entry is followed.
+     */
+    void                    claim_rebuild(bool *erase_cache);
+    /**
+     * @brief Release the claim, if held.
+     */
+    void                    release_claim();
+    /**
+     * @brief Publish transcoder progress for other processes.
+     * @param[in] force - If true, publish even if little has changed.
+     */
+    void                    publish_claim(bool force = false);
+    /**
+     * @brief Read the progress published by the process that holds the claim.
+     *
+     * If the claim has changed hands since the last call, cache info and cache
+     * file names are refreshed from the cache index.
+     *
+     * @param[out] claim_info - Published progress.
+     * @return Returns true if progress has been published; false if not (yet).
+     */
+    bool                    read_claim(CLAIM_INFO *claim_info);
+    /**
+     * @brief Stop following another process once its claim has been released.
+     *
+     * Takes over the claim and reloads the entry from the cache index. If the
+     * other process did not finish the entry, the claim is kept and the cache
+     * is prepared for transcoding it here.
+     *
+     * @return Returns true if the entry is no longer followed; false if the other process still holds the claim.
+     */
+    bool                    take_over();
 
 protected:
     /**
@@ -243,6 +335,16 @@ protected:
      * @param[in] flags - one of the CACHE_CLOSE_* flags
      */
     void                    close_buffer(int flags);
+    /**
+     * @brief Choose the cache root for this entry and pass it on to the buffer.
+     *
+     * Finished entries stay where they are. New or unfinished entries, and entries
+     * whose root is no longer configured, are placed anew. Leftovers on the old
+     * root are removed.
+     *
+     * @param[inout] erase_cache - In: true if the cache will be rebuilt. Out: set to true if the entry had to be moved.
+     */
+    void                    select_cache_root(bool *erase_cache);
     /**
      * @brief Read cache info.
      * @return On success, returns true; returns false on error.
@@ -267,12 +369,20 @@ protected:
 
     LPVIRTUALFILE           m_virtualfile;                  /**< @brief Underlying virtual file object */
 
+    std::recursive_mutex    m_claim_mutex;                  /**< @brief Claim access mutex */
+    std::string             m_claim_file;                   /**< @brief Name of the claim file */
+    int                     m_claim_fd;                     /**< @brief Claim file handle, -1 if the claim is not held */
+    CLAIM_INFO              m_claim_published;              /**< @brief Last progress published */
+    time_t                  m_claim_publish_time;           /**< @brief Time progress was last published */
+    int32_t                 m_claim_pid;                    /**< @brief Process followed, 0 if none yet */
+
 public:
     std::unique_ptr<Buffer> m_buffer;                       /**< @brief Buffer object */
     std::atomic_bool        m_is_decoding;                  /**< @brief true while file is decoding */
     std::recursive_mutex    m_active_mutex;                 /**< @brief Mutex while thread is active */
     std::recursive_mutex    m_restart_mutex;               	/**< @brief Mutex while thread is restarted */
     std::atomic_bool        m_suspend_timeout;              /**< @brief true to temporarly disable read_frame timeout */
+    std::atomic_bool        m_remote_claim;                 /**< @brief true while another process transcodes the entry and this one follows */
 
     CACHE_INFO              m_cache_info;                   /**< @brief Info about cached object */
 
@@ -33,135 +33,132 @@
 #include "ffmpegfs.h"
 #include "logging.h"
 
-#include <csignal>
 #include <unistd.h>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <system_error>
 #include <sys/shm.h>        /* shmat(), IPC_RMID        */
 #include <semaphore.h>      /* sem_open(), sem_destroy(), sem_wait().. */
 
-#define CLOCKID         CLOCK_REALTIME          /**< @brief Use real time clock here. */
-#define SIGMAINT        SIGRTMIN                /**< @brief Map maintenance signal. */
-
 #define SEM_OPEN_FILE   "/" PACKAGE_NAME "_04806785-b5fb-4615-ba56-b30a2946e80b"    /**< @brief Shared semaphore name, should be unique system wide. */
+#define TRIGGER_HOLDOFF 10                      /**< @brief Min. seconds between two maintenance runs started by watermark triggers. */
 
-static sigset_t mask;           /**< @brief Process mask for timer */
-static timer_t  timerid;        /**< @brief Timer id */
+static std::thread              maintenance_thread;     /**< @brief Maintenance thread */
+static std::mutex               maintenance_mutex;      /**< @brief Mutex for maintenance_cond */
+static std::condition_variable  maintenance_cond;       /**< @brief Signalled to wake up the maintenance thread */
+static std::atomic_bool         maintenance_stop;       /**< @brief Set to stop the maintenance thread */
+static std::atomic_bool         maintenance_triggered;  /**< @brief Set if a watermark has been crossed */
 
 static sem_t *  sem;            /**< @brief Semaphore used to synchronise between master and slave processes */
 static int      shmid;          /**< @brief Shared memory segment ID */
 static pid_t *  pid_master;     /**< @brief PID of master process */
 static bool     master;         /**< @brief If true, we are master */
 
-static void maintenance_handler(int sig, __attribute__((unused)) siginfo_t *si, __attribute__((unused)) void *uc);
-static bool start_timer(time_t interval);
-static bool stop_timer();
+static void maintenance_loop(time_t interval);
+static bool start_thread(time_t interval);
+static bool stop_thread();
 static bool link_up();
 static void master_check();
 static bool link_down();
 
 /**
-  * @brief Run maintenance handler
-  * @param[in] sig - Signal, must be SIGMAINT.
-  * @param[in] si
-  * @param[in] uc
-  */
-static void maintenance_handler(int sig, __attribute__((unused)) siginfo_t *si, __attribute__((unused)) void *uc)
+ * @brief Maintenance thread: runs maintenance in intervals, or earlier when triggered.
+ * @param[in] interval - Interval in seconds.
+ */
+static void maintenance_loop(time_t interval)
 {
-    if (sig != SIGMAINT)
+    while (!maintenance_stop)
     {
-        // Wrong signal. Should never happen.
-        return;
-    }
+        bool triggered;
 
-    master_check();
+        {
+            std::unique_lock<std::mutex> lock_maintenance(maintenance_mutex);
+            maintenance_cond.wait_for(lock_maintenance, std::chrono::seconds(interval), [] { return maintenance_stop.load() || maintenance_triggered.load(); });
+        }
 
-    if (master)
-    {
-        Logging::info(nullptr, "Running periodic cache maintenance.");
-        transcoder_cache_maintenance();
+        if (maintenance_stop)
+        {
+            break;
+        }
+
+        triggered = maintenance_triggered.exchange(false);
+
+        master_check();
+
+        if (master)
+        {
+            if (triggered)
+            {
+                Logging::info(nullptr, "Cache watermark crossed, running cache maintenance.");
+            }
+            else
+            {
+                Logging::info(nullptr, "Running periodic cache maintenance.");
+            }
+            transcoder_cache_maintenance(true);
+        }
+
+        if (triggered)
+        {
+            // Do not let a cache that cannot be pruned below the watermark keep us busy
+            std::unique_lock<std::mutex> lock_maintenance(maintenance_mutex);
+            maintenance_cond.wait_for(lock_maintenance, std::chrono::seconds(TRIGGER_HOLDOFF), [] { return maintenance_stop.load(); });
+        }
     }
 }
 
 /**
- * @brief Start the maintenance timer at predefined interval.
- * @param[in] interval - Timer interval in seconds.
+ * @brief Start the maintenance thread.
+ * @param[in] interval - Interval in seconds.
  * @return On success, returns true. On error, returns false. Check errno for details.
  */
-static bool start_timer(time_t interval)
+static bool start_thread(time_t interval)
 {
-    struct sigevent sev;
-    struct itimerspec its;
-    long long freq_nanosecs;
-    struct sigaction sa;
-
-    freq_nanosecs = interval * 1000000000LL;
-
-    Logging::trace(nullptr, "Starting maintenance timer with %1period.", format_time(interval).c_str());
-
-    // Establish maintenance_handler for timer signal
-    sa.sa_flags = SA_SIGINFO;
-    sa.sa_sigaction = maintenance_handler;
-    sigemptyset(&sa.sa_mask);
-    if (sigaction(SIGMAINT, &sa, nullptr) == -1)
-    {
-        Logging::error(nullptr, "start_timer(): sigaction failed: (%1) %2", errno, strerror(errno));
-        return false;
-    }
+    Logging::trace(nullptr, "Starting maintenance thread with %1period.", format_time(interval).c_str());
 
-    // Block timer signal temporarily
-    sigemptyset(&mask);
-    sigaddset(&mask, SIGMAINT);
-    if (sigprocmask(SIG_SETMASK, &mask, nullptr) == -1)
-    {
-        Logging::error(nullptr, "start_timer(): sigprocmask(SIG_SETMASK) failed: (%1) %2", errno, strerror(errno));
-        return false;
-    }
+    maintenance_stop        = false;
+    maintenance_triggered   = false;
 
-    // Create the timer
-    sev.sigev_notify = SIGEV_SIGNAL;
-    sev.sigev_signo = SIGMAINT;
-    sev.sigev_value.sival_ptr = &timerid;
-    if (timer_create(CLOCKID, &sev, &timerid) == -1)
+    try
     {
-        Logging::error(nullptr, "start_timer(): timer_create failed: (%1) %2", errno, strerror(errno));
-        return false;
+        maintenance_thread = std::thread(maintenance_loop, interval);
     }
-
-    // Start the timer
-    its.it_value.tv_sec = static_cast<time_t>(freq_nanosecs / 1000000000);
-    its.it_value.tv_nsec = static_cast<long>(freq_nanosecs % 1000000000);
-    its.it_interval.tv_sec = its.it_value.tv_sec;
-    its.it_interval.tv_nsec = its.it_value.tv_nsec;
-
-    if (timer_settime(timerid, 0, &its, nullptr) == -1)
+    catch (const std::system_error & e)
     {
-        Logging::error(nullptr, "start_timer(): timer_settime failed: (%1) %2", errno, strerror(errno));
+        Logging::error(nullptr, "start_thread(): Unable to start maintenance thread: %1", e.what());
+        errno = e.code().value();
         return false;
     }
 
-    if (sigprocmask(SIG_UNBLOCK, &mask, nullptr) == -1)
-    {
-        Logging::error(nullptr, "start_timer(): sigprocmask(SIG_UNBLOCK) failed: (%1) %2", errno, strerror(errno));
-    }
-
-    Logging::trace(nullptr, "The maintenance timer started successfully.");
+    Logging::trace(nullptr, "The maintenance thread started successfully.");
 
     return true;
 }
 
 /**
- * @brief Stop the maintenance timer.
+ * @brief Stop the maintenance thread and wait for it to exit.
  * @return On success, returns true. On error, returns false. Check errno for details.
  */
-static bool stop_timer()
+static bool stop_thread()
 {
-    Logging::info(nullptr, "Stopping the maintenance timer.");
+    Logging::info(nullptr, "Stopping the maintenance thread.");
 
-    if (timer_delete(timerid) == -1 && errno)
+    if (!maintenance_thread.joinable())
     {
-        Logging::error(nullptr, "stop_timer(): timer_delete failed: (%1) %2", errno, strerror(errno));
-        return false;
+        return true;
     }
 
+    {
+        std::lock_guard<std::mutex> lock_maintenance(maintenance_mutex);
+        maintenance_stop = true;
+    }
+    maintenance_cond.notify_all();
+
+    maintenance_thread.join();
+
     return true;
 }
 
@@ -324,16 +321,16 @@ bool start_cache_maintenance(time_t interval)
         return false;
     }
 
-    // Now start timer
-    return start_timer(interval);
+    // Now start thread
+    return start_thread(interval);
 }
 
 bool stop_cache_maintenance()
 {
     bool success = true;
 
-    // Stop timer first
-    if (!stop_timer())
+    // Stop thread first
+    if (!stop_thread())
     {
         success = false;
     }
@@ -346,3 +343,24 @@ bool stop_cache_maintenance()
 
     return success;
 }
+
+bool trigger_cache_maintenance()
+{
+    if (!maintenance_thread.joinable())
+    {
+        return false;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock_maintenance(maintenance_mutex);
+        maintenance_triggered = true;
+    }
+    maintenance_cond.notify_all();
+
+    return true;
+}
+
+bool cache_maintenance_running()
+{
+    return maintenance_thread.joinable();
+}
@@ -23,8 +23,10 @@
  * @file cache_maintenance.h
  * @brief %Cache maintenance
  *
- * Creates a POSIX timer that starts the cache maintenance in preset
- * intervals. To ensure that only one instance of FFmpegfs cleans up
+ * Creates a thread that runs the cache maintenance in preset intervals,
+ * or earlier when a cache watermark has been crossed. Maintenance works
+ * in small increments and is rate limited, so that it does not stall
+ * concurrent opens. To ensure that only one instance of FFmpegfs cleans up
  * the cache a shared memory area and a named semaphore is also created.
  *
  * The first FFmpegfs process acts as master, all subsequently started
@@ -45,15 +47,25 @@
 #include <time.h>
 
 /**
- * @brief Start cache maintenance timer.
- * @param[in] interval - Interval in seconds to run timer at.
+ * @brief Start cache maintenance thread.
+ * @param[in] interval - Interval in seconds to run maintenance at.
  * @return On success, returns true. On error, returns false. Check errno for details.
  */
 bool start_cache_maintenance(time_t interval);
 /**
- * @brief Stop cache maintenance timer.
+ * @brief Stop cache maintenance thread.
  * @return On success, returns true. On error, returns false. Check errno for details.
  */
 bool stop_cache_maintenance();
+/**
+ * @brief Wake up the maintenance thread because a watermark has been crossed.
+ * @return Returns true if the maintenance thread is running; false if not.
+ */
+bool trigger_cache_maintenance();
+/**
+ * @brief Check if the maintenance thread is running.
+ * @return Returns true if the maintenance thread is running; false if not.
+ */
+bool cache_maintenance_running();
 
 #endif // CACHE_MAINTENANCE_H
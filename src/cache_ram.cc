@@ -0,0 +1,387 @@
+/*
+ * Copyright (C) 2017-2026 Norbert Schlia (nschlia@oblivion-software.de)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * On Debian systems, the complete text of the GNU General Public License
+ * Version 3 can be found in `/usr/share/common-licenses/GPL-3'.
+ */
+
+/**
+ * @file cache_ram.cc
+ * @brief #Cache_Ram class implementation
+ *
+ * @ingroup ffmpegfs
+ *
+ * @author Norbert Schlia (nschlia@oblivion-software.de)
+ * @copyright Copyright (C) 2017-2026 Norbert Schlia (nschlia@oblivion-software.de)
+ */
+
+#include "cache_ram.h"
+#include "ffmpeg_utils.h"
+#include "logging.h"
+
+#include <fstream>
+#include <sstream>
+#include <cstring>
+#include <unistd.h>
+
+std::unique_ptr<Cache_Ram>  ram_cache;
+
+Cache_Ram::Cache_Ram(size_t budget, size_t max_item_size, unsigned int min_hits)
+    : m_budget(budget)
+    , m_max_item_size(max_item_size)
+    , m_min_hits(min_hits)
+    , m_size(0)
+    , m_reserved(0)
+    , m_generation(0)
+    , m_last_pressure_check(0)
+    , m_hits(0)
+    , m_admissions(0)
+    , m_demotions(0)
+{
+}
+
+Cache_Ram::~Cache_Ram()
+{
+    Logging::debug(nullptr, "Memory tier: %1 reads served, %2 items admitted, %3 demoted.", m_hits, m_admissions, m_demotions);
+}
+
+/**
+ * @brief Get size and modification time of a cache file.
+ * @param[in] cachefile - Name of the cache file.
+ * @param[out] st - Receives the file status.
+ * @return Returns true on success; false if the file cannot be accessed.
+ */
+static bool stat_cachefile(const std::string & cachefile, struct stat *st)
+{
+    return (stat(cachefile.c_str(), st) == 0);
+}
+
+std::string Cache_Ram::frame_key(const std::string & cachefile, uint32_t frame_no)
+{
+    return cachefile + ":" + std::to_string(frame_no);
+}
+
+bool Cache_Ram::read(const std::string & key, const std::string & cachefile, uint8_t *out_data, size_t offset, size_t *len)
+{
+    std::lock_guard<std::recursive_mutex> lock_mutex(m_mutex);
+
+    RAM_ENTRY * entry = find(key, cachefile);
+    if (entry == nullptr)
+    {
+        return false;
+    }
+
+    if (offset >= entry->m_data.size())
+    {
+        *len = 0;
+        return true;
+    }
+
+    if (offset + *len > entry->m_data.size())
+    {
+        *len = entry->m_data.size() - offset;
+    }
+
+    std::memcpy(out_data, entry->m_data.data() + offset, *len);
+
+    return true;
+}
+
+bool Cache_Ram::read(const std::string & key, const std::string & cachefile, std::vector<uint8_t> *data)
+{
+    std::lock_guard<std::recursive_mutex> lock_mutex(m_mutex);
+
+    RAM_ENTRY * entry = find(key, cachefile);
+    if (entry == nullptr)
+    {
+        return false;
+    }
+
+    *data = entry->m_data;
+
+    return true;
+}
+
+Cache_Ram::RAM_ENTRY * Cache_Ram::find(const std::string & key, const std::string & cachefile)
+{
+    auto it = m_entries.find(key);
+    if (it == m_entries.end())
+    {
+        return nullptr;
+    }
+
+    RAM_ENTRY & entry = it->second;
+
+    // Writers in this process call remove(). Only look at the file now and then
+    // in case another process sharing the cache has rewritten it, so that a hit
+    // normally costs no system call.
+    time_t now = time(nullptr);
+
+    if (now - entry.m_checked >= VALIDATE_INTERVAL)
+    {
+        struct stat st;
+
+        if (!stat_cachefile(cachefile, &st) ||
+                st.st_size != entry.m_file_size ||
+                st.st_mtim.tv_sec != entry.m_file_mtime.tv_sec ||
+                st.st_mtim.tv_nsec != entry.m_file_mtime.tv_nsec)
+        {
+            Logging::trace(key, "Memory tier: Cache file has changed, item dropped.");
+            erase(it);
+            m_demotions++;
+            return nullptr;
+        }
+
+        entry.m_checked = now;
+    }
+
+    entry.m_hits++;
+    m_hits++;
+
+    // Most recently used go to the front
+    m_lru.splice(m_lru.begin(), m_lru, entry.m_lru);
+
+    return &entry;
+}
+
+std::map<std::string, Cache_Ram::RAM_ENTRY>::iterator Cache_Ram::erase(std::map<std::string, RAM_ENTRY>::iterator it)
+{
+    m_size -= it->second.m_data.size();
+    m_lru.erase(it->second.m_lru);
+    return m_entries.erase(it);
+}
+
+bool Cache_Ram::access(const std::string & key, const std::string & cachefile, size_t size, const LOADER & loader)
+{
+    if (!size || size > m_max_item_size || size > m_budget)
+    {
+        // Too large or nothing to keep
+        return false;
+    }
+
+    std::unique_lock<std::recursive_mutex> lock_mutex(m_mutex);
+
+    if (m_entries.find(key) != m_entries.end() || m_loading.find(key) != m_loading.end())
+    {
+        // Already resident, or being loaded by another thread
+        return false;
+    }
+
+    unsigned int hits = ++m_candidates[key];
+
+    if (hits < m_min_hits)
+    {
+        if (m_candidates.size() > MAX_CANDIDATES)
+        {
+            // Forget about cold items. This also ages the counters.
+            m_candidates.clear();
+        }
+        return false;
+    }
+
+    check_pressure();
+
+    demote(size);
+
+    if (m_size + m_reserved + size > m_budget)
+    {
+        return false;
+    }
+
+    // Reserve the item and load it without holding the lock. The loader may
+    // take the buffer lock, while buffer code calls remove() with the buffer
+    // lock held.
+    uint64_t generation = m_generation;
+
+    m_loading.insert(key);
+    m_reserved += size;
+
+    lock_mutex.unlock();
+
+    RAM_ENTRY entry;
+    struct stat st_before;
+    struct stat st_after;
+    bool loaded = false;
+
+    try
+    {
+        entry.m_data.resize(size);
+
+        loaded = (stat_cachefile(cachefile, &st_before) &&
+                  loader(entry.m_data.data(), size) &&
+                  stat_cachefile(cachefile, &st_after));
+    }
+    catch (const std::bad_alloc &)
+    {
+        Logging::warning(key, "Memory tier: Out of memory, item not admitted.");
+    }
+
+    lock_mutex.lock();
+
+    m_loading.erase(key);
+    m_reserved -= size;
+
+    if (!loaded)
+    {
+        return false;
+    }
+
+    if (generation != m_generation ||
+            st_before.st_size != st_after.st_size ||
+            st_before.st_mtim.tv_sec != st_after.st_mtim.tv_sec ||
+            st_before.st_mtim.tv_nsec != st_after.st_mtim.tv_nsec)
+    {
+        // Removed or changed while loading, try again next time
+        return false;
+    }
+
+    demote(size);
+
+    if (m_size + m_reserved + size > m_budget)
+    {
+        return false;
+    }
+
+    entry.m_hits        = hits;
+    entry.m_file_size   = st_after.st_size;
+    entry.m_file_mtime  = st_after.st_mtim;
+    entry.m_checked     = time(nullptr);
+
+    m_candidates.erase(key);
+    m_lru.push_front(key);
+    entry.m_lru = m_lru.begin();
+    m_entries.emplace(key, std::move(entry));
+    m_size += size;
+    m_admissions++;
+
+    Logging::trace(key, "Memory tier: Admitted %1 after %2 accesses (%3 of %4 used).", format_size(size).c_str(), hits, format_size(m_size).c_str(), format_size(m_budget).c_str());
+
+    return true;
+}
+
+void Cache_Ram::remove(const std::string & cachefile)
+{
+    std::lock_guard<std::recursive_mutex> lock_mutex(m_mutex);
+
+    // The item itself and, for frame sets, all "cachefile:frame_no" items sort right behind it.
+    auto it = m_entries.lower_bound(cachefile);
+    while (it != m_entries.end() && !it->first.compare(0, cachefile.size(), cachefile))
+    {
+        const std::string & key = it->first;
+
+        if (key.size() == cachefile.size() || key[cachefile.size()] == ':')
+        {
+            it = erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+
+    m_candidates.erase(cachefile);
+
+    // Items being loaded right now are not admitted
+    m_generation++;
+}
+
+void Cache_Ram::clear()
+{
+    std::lock_guard<std::recursive_mutex> lock_mutex(m_mutex);
+
+    m_demotions += m_entries.size();
+
+    m_entries.clear();
+    m_lru.clear();
+    m_candidates.clear();
+    m_size = 0;
+    m_generation++;
+}
+
+size_t Cache_Ram::size() const
+{
+    std::lock_guard<std::recursive_mutex> lock_mutex(m_mutex);
+
+    return m_size;
+}
+
+void Cache_Ram::demote(size_t size)
+{
+    while (!m_lru.empty() && m_size + m_reserved + size > m_budget)
+    {
+        // Least recently used at the back
+        auto victim = m_entries.find(m_lru.back());
+
+        Logging::trace(victim->first, "Memory tier: Demoted %1 after %2 accesses.", format_size(victim->second.m_data.size()).c_str(), victim->second.m_hits);
+
+        erase(victim);
+        m_demotions++;
+    }
+}
+
+void Cache_Ram::check_pressure()
+{
+    time_t now = time(nullptr);
+
+    if (now - m_last_pressure_check < PRESSURE_CHECK_INTERVAL)
+    {
+        return;
+    }
+
+    m_last_pressure_check = now;
+
+    std::ifstream meminfo("/proc/meminfo");
+    std::string line;
+    size_t total = 0;
+    size_t available = 0;
+
+    while (std::getline(meminfo, line))
+    {
+        std::istringstream iss(line);
+        std::string name;
+        size_t value = 0;
+
+        if (!(iss >> name >> value))
+        {
+            continue;
+        }
+
+        if (name == "MemTotal:")
+        {
+            total = value;      // kB
+        }
+        else if (name == "MemAvailable:")
+        {
+            available = value;  // kB
+        }
+    }
+
+    if (!total || !available || available >= total / PRESSURE_DIVISOR)
+    {
+        return;
+    }
+
+    Logging::info(nullptr, "Memory tier: System is low on memory (%1 available), demoting items.", format_size(available * 1024).c_str());
+
+    // Keep the hotter half
+    size_t target = m_size / 2;
+
+    if (m_size > target)
+    {
+        demote(m_budget - target);
+    }
+}
@@ -0,0 +1,211 @@
+/*
+ * Copyright (C) 2017-2026 Norbert Schlia (nschlia@oblivion-software.de)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * On Debian systems, the complete text of the GNU General Public License
+ * Version 3 can be found in `/usr/share/common-licenses/GPL-3'.
+ */
+
+/**
+ * @file cache_ram.h
+ * @brief In-memory cache tier
+ *
+ * Keeps small, finished cache files (complete files, HLS segments and
+ * frame images) in process memory so that hot items are served without
+ * depending on the kernel's page cache. Items are admitted only after
+ * they have been requested a minimum number of times, and demoted back to
+ * disk-only, least recently used first, when the byte budget is exceeded
+ * or the system runs low on memory. An item is also dropped when its cache
+ * file is rewritten. Changes made by another process sharing the cache are
+ * noticed within a few seconds.
+ *
+ * @ingroup ffmpegfs
+ *
+ * @author Norbert Schlia (nschlia@oblivion-software.de)
+ * @copyright Copyright (C) 2017-2026 Norbert Schlia (nschlia@oblivion-software.de)
+ */
+
+#ifndef CACHE_RAM_H
+#define CACHE_RAM_H
+
+#pragma once
+
+#include <map>
+#include <list>
+#include <set>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <memory>
+#include <functional>
+#include <stdint.h>
+#include <sys/stat.h>
+
+/**
+ * @brief The #Cache_Ram class
+ */
+class Cache_Ram
+{
+    /**
+     * @brief Max. number of non-resident items to count accesses for.
+     * When exceeded, the access counters are reset.
+     */
+    static constexpr size_t MAX_CANDIDATES = 65536;
+    /**
+     * @brief Min. interval (seconds) between memory pressure checks.
+     */
+    static constexpr time_t PRESSURE_CHECK_INTERVAL = 5;
+    /**
+     * @brief Min. interval (seconds) between checks whether the cache file of a resident item has been changed by another process.
+     */
+    static constexpr time_t VALIDATE_INTERVAL = 5;
+    /**
+     * @brief If free physical memory falls below total memory divided by this value, half of the tier will be demoted.
+     */
+    static constexpr long PRESSURE_DIVISOR = 20;
+
+    /**
+     * @brief Resident item
+     */
+    typedef struct RAM_ENTRY
+    {
+        std::vector<uint8_t>    m_data;                     /**< @brief Item contents */
+        unsigned int            m_hits;                     /**< @brief Number of accesses */
+        off_t                   m_file_size;                /**< @brief Size of the cache file when loaded */
+        struct timespec         m_file_mtime;               /**< @brief Modification time of the cache file when loaded */
+        time_t                  m_checked;                  /**< @brief Time the cache file was last found unchanged */
+        std::list<std::string>::iterator m_lru;             /**< @brief Position in the LRU list */
+    } RAM_ENTRY;
+
+public:
+    /**
+     * @brief Function to load an item. Must fill exactly size bytes.
+     */
+    typedef std::function<bool(uint8_t *data, size_t size)> LOADER;
+
+    /**
+     * @brief Create #Cache_Ram object
+     * @param[in] budget - Max. number of bytes to keep in memory.
+     * @param[in] max_item_size - Items larger than this will never be admitted.
+     * @param[in] min_hits - Number of accesses before an item is admitted.
+     */
+    explicit Cache_Ram(size_t budget, size_t max_item_size, unsigned int min_hits);
+    /**
+     * @brief Destroy #Cache_Ram object, releasing all memory.
+     */
+    virtual ~Cache_Ram();
+
+    /**
+     * @brief Make up the key for an image frame of a frame set.
+     * @param[in] cachefile - Name of the frame set cache file.
+     * @param[in] frame_no - Frame number 1...n
+     * @return Returns the key.
+     */
+    static std::string  frame_key(const std::string & cachefile, uint32_t frame_no);
+
+    /**
+     * @brief Copy data from a resident item.
+     * @param[in] key - Item key, normally the cache file name.
+     * @param[in] cachefile - Cache file the item was loaded from. If it has changed since, the item is dropped.
+     * @param[out] out_data - Buffer to copy data to.
+     * @param[in] offset - Offset in item to copy data from.
+     * @param[inout] len - In: Size of out_data. Out: Number of bytes copied, may be less at end of item.
+     * @return Returns true if the item is resident and data has been copied; false if the caller must read from disk.
+     */
+    bool                read(const std::string & key, const std::string & cachefile, uint8_t *out_data, size_t offset, size_t *len);
+    /**
+     * @brief Get a copy of a resident item.
+     * @param[in] key - Item key.
+     * @param[in] cachefile - Cache file the item was loaded from. If it has changed since, the item is dropped.
+     * @param[out] data - Receives the complete item.
+     * @return Returns true if the item is resident; false if the caller must read from disk.
+     */
+    bool                read(const std::string & key, const std::string & cachefile, std::vector<uint8_t> *data);
+    /**
+     * @brief Record an access to a finished, non-resident item and admit it if it is hot enough.
+     * @param[in] key - Item key.
+     * @param[in] cachefile - Cache file the item is loaded from, to detect changes later.
+     * @param[in] size - Size of the item in bytes.
+     * @param[in] loader - Called to load the item contents if admitted, without the lock held.
+     * @return Returns true if the item has been admitted; false if not.
+     */
+    bool                access(const std::string & key, const std::string & cachefile, size_t size, const LOADER & loader);
+    /**
+     * @brief Remove an item, and all image frames if it is a frame set, from memory.
+     * Must be called whenever the file on disk changes or is deleted.
+     * @param[in] cachefile - Name of the cache file.
+     */
+    void                remove(const std::string & cachefile);
+    /**
+     * @brief Demote all items.
+     */
+    void                clear();
+    /**
+     * @brief Get number of bytes currently held in memory.
+     * @return Returns the number of bytes held in memory.
+     */
+    size_t              size() const;
+
+protected:
+    /**
+     * @brief Look up a resident item, and drop it if its cache file has changed.
+     * The file is only checked every #VALIDATE_INTERVAL seconds, changes made in this
+     * process are reported by remove().
+     * Marks the item as most recently used.
+     * @param[in] key - Item key.
+     * @param[in] cachefile - Cache file the item was loaded from.
+     * @return Returns a pointer to the item, or nullptr if not resident.
+     */
+    RAM_ENTRY *         find(const std::string & key, const std::string & cachefile);
+    /**
+     * @brief Remove a resident item.
+     * @param[in] it - Item to remove.
+     * @return Returns the item following the removed one.
+     */
+    std::map<std::string, RAM_ENTRY>::iterator erase(std::map<std::string, RAM_ENTRY>::iterator it);
+    /**
+     * @brief Demote items until at least size bytes are available in the budget.
+     * The least recently used items are demoted first.
+     * @param[in] size - Number of bytes required.
+     */
+    void                demote(size_t size);
+    /**
+     * @brief Check for system memory pressure and demote half of the tier if the system runs low on memory.
+     */
+    void                check_pressure();
+
+private:
+    mutable std::recursive_mutex        m_mutex;            /**< @brief Access mutex */
+    const size_t                        m_budget;           /**< @brief Max. number of bytes to keep in memory */
+    const size_t                        m_max_item_size;    /**< @brief Max. size of a single item */
+    const unsigned int                  m_min_hits;         /**< @brief Accesses required before admission */
+    std::map<std::string, RAM_ENTRY>    m_entries;          /**< @brief Resident items */
+    std::list<std::string>              m_lru;              /**< @brief Keys of resident items, most recently used first */
+    std::map<std::string, unsigned int> m_candidates;       /**< @brief Access counters for non-resident items */
+    std::set<std::string>               m_loading;          /**< @brief Keys of items being loaded */
+    size_t                              m_size;             /**< @brief Bytes currently held in memory */
+    size_t                              m_reserved;         /**< @brief Bytes reserved for items being loaded */
+    uint64_t                            m_generation;       /**< @brief Incremented by remove() and clear(), items loaded meanwhile are not admitted */
+    time_t                              m_last_pressure_check;  /**< @brief Time of last memory pressure check */
+    // Statistics
+    uint64_t                            m_hits;             /**< @brief Reads served from memory */
+    uint64_t                            m_admissions;       /**< @brief Items admitted */
+    uint64_t                            m_demotions;        /**< @brief Items demoted */
+};
+
+extern std::unique_ptr<Cache_Ram>   ram_cache;              /**< @brief Memory tier, nullptr if disabled */
+
+#endif // CACHE_RAM_H
@@ -0,0 +1,319 @@
+/*
+ * Copyright (C) 2017-2026 Norbert Schlia (nschlia@oblivion-software.de)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * On Debian systems, the complete text of the GNU General Public License
+ * Version 3 can be found in `/usr/share/common-licenses/GPL-3'.
+ */
+
+/**
+ * @file cache_trace.cc
+ * @brief %Cache access trace implementation
+ *
+ * @ingroup ffmpegfs
+ *
+ * @author Norbert Schlia (nschlia@oblivion-software.de)
+ * @copyright Copyright (C) 2017-2026 Norbert Schlia (nschlia@oblivion-software.de)
+ */
+
+#include "cache_trace.h"
+#include "logging.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <cstring>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <vector>
+#include <memory>
+#include <system_error>
+
+#define TRACE_FLUSH_RECORDS 4096                        /**< @brief Wake up the writer when this many records are pending */
+#define TRACE_FLUSH_SECONDS 1                           /**< @brief Write pending records at least this often */
+#define TRACE_MAX_PENDING   (64 * 1024)                 /**< @brief Drop records if the writer falls this far behind. Must be a power of 2. */
+
+/**
+ * @brief Slot of the queue of pending records
+ */
+typedef struct TRACE_SLOT
+{
+    std::atomic_uint64_t    m_seq;                      /**< @brief Position the slot can be written at, or position + 1 once written */
+    TRACE_RECORD            m_record;                   /**< @brief Record */
+} TRACE_SLOT;
+
+static std::thread                  trace_thread;       /**< @brief Writer thread */
+static std::mutex                   trace_mutex;        /**< @brief Used with trace_cond only, the queue does not need it */
+static std::condition_variable      trace_cond;         /**< @brief Signalled to wake up the writer thread */
+static std::unique_ptr<TRACE_SLOT[]> trace_queue;       /**< @brief Records not yet written, a lock-free queue with many writers and one reader */
+static std::atomic_uint64_t         trace_head;         /**< @brief Position the next record is added at */
+static uint64_t                     trace_tail;         /**< @brief Position the next record is taken from, used by the writer thread only */
+static std::atomic_bool             trace_active;       /**< @brief Set while recording */
+static std::atomic_bool             trace_stop;         /**< @brief Set to stop the writer thread */
+static std::atomic_uint64_t         trace_dropped;      /**< @brief Number of records dropped because the writer fell behind */
+static int                          trace_fd = -1;      /**< @brief Trace file handle */
+
+static bool write_records(const std::vector<TRACE_RECORD> & records);
+static void take_records(std::vector<TRACE_RECORD> *records);
+static void trace_loop();
+
+/**
+ * @brief Write records to the trace file.
+ * @param[in] records - Records to write.
+ * @return Returns true on success; false on error, check errno for details.
+ */
+static bool write_records(const std::vector<TRACE_RECORD> & records)
+{
+    const uint8_t * p   = reinterpret_cast<const uint8_t *>(records.data());
+    size_t size         = records.size() * sizeof(TRACE_RECORD);
+
+    while (size)
+    {
+        ssize_t n = ::write(trace_fd, p, size);
+        if (n == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return false;
+        }
+        p       += n;
+        size    -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+/**
+ * @brief Take all records that have been completely added from the queue.
+ * @param[out] records - Receives the records.
+ */
+static void take_records(std::vector<TRACE_RECORD> *records)
+{
+    for (;;)
+    {
+        TRACE_SLOT & slot = trace_queue[trace_tail & (TRACE_MAX_PENDING - 1)];
+
+        if (slot.m_seq.load(std::memory_order_acquire) != trace_tail + 1)
+        {
+            // Empty, or the next record is still being written
+            break;
+        }
+
+        records->push_back(slot.m_record);
+
+        // Free the slot for the round after next
+        slot.m_seq.store(trace_tail + TRACE_MAX_PENDING, std::memory_order_release);
+        trace_tail++;
+    }
+}
+
+/**
+ * @brief Writer thread: writes pending records in intervals, or earlier when enough have been collected.
+ */
+static void trace_loop()
+{
+    std::vector<TRACE_RECORD> records;
+
+    records.reserve(TRACE_FLUSH_RECORDS);
+
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock_trace(trace_mutex);
+            trace_cond.wait_for(lock_trace, std::chrono::seconds(TRACE_FLUSH_SECONDS), [] { return trace_stop.load() || trace_head.load() - trace_tail >= TRACE_FLUSH_RECORDS; });
+        }
+
+        // Read the stop flag first, records added before stopping must not be left behind
+        bool stop = trace_stop;
+
+        take_records(&records);
+
+        if (!records.empty() && !write_records(records))
+        {
+            Logging::error(nullptr, "Unable to write to the cache trace file. Recording stopped (%1) %2", errno, strerror(errno));
+            trace_active = false;
+            break;
+        }
+
+        records.clear();
+
+        if (stop)
+        {
+            break;
+        }
+    }
+}
+
+bool cache_trace_start(const std::string & filename)
+{
+    struct stat sb;
+
+    trace_fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (trace_fd == -1)
+    {
+        Logging::error(filename, "Unable to open the cache trace file (%1) %2", errno, strerror(errno));
+        return false;
+    }
+
+    if (fstat(trace_fd, &sb) == -1)
+    {
+        Logging::error(filename, "Unable to stat the cache trace file (%1) %2", errno, strerror(errno));
+        ::close(trace_fd);
+        trace_fd = -1;
+        return false;
+    }
+
+    if (!sb.st_size)
+    {
+        TRACE_HEADER header;
+
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.m_magic, TRACE_MAGIC, sizeof(header.m_magic));
+        header.m_version        = TRACE_VERSION;
+        header.m_bom            = TRACE_BOM;
+        header.m_record_size    = sizeof(TRACE_RECORD);
+
+        if (::write(trace_fd, &header, sizeof(header)) != sizeof(header))
+        {
+            Logging::error(filename, "Unable to write the cache trace header (%1) %2", errno, strerror(errno));
+            ::close(trace_fd);
+            trace_fd = -1;
+            return false;
+        }
+    }
+    else if ((sb.st_size - static_cast<off_t>(sizeof(TRACE_HEADER))) % static_cast<off_t>(sizeof(TRACE_RECORD)))
+    {
+        Logging::warning(filename, "The cache trace file seems to be truncated. Records appended may not be readable.");
+    }
+
+    trace_stop      = false;
+    trace_dropped   = 0;
+    trace_head      = 0;
+    trace_tail      = 0;
+    trace_queue     = std::make_unique<TRACE_SLOT[]>(TRACE_MAX_PENDING);
+
+    for (uint64_t n = 0; n < TRACE_MAX_PENDING; n++)
+    {
+        trace_queue[n].m_seq.store(n, std::memory_order_relaxed);
+    }
+
+    try
+    {
+        trace_thread = std::thread(trace_loop);
+    }
+    catch (const std::system_error & e)
+    {
+        Logging::error(filename, "Unable to start the cache trace thread: %1", e.what());
+        ::close(trace_fd);
+        trace_fd = -1;
+        errno = e.code().value();
+        return false;
+    }
+
+    trace_active = true;
+
+    Logging::info(filename, "Recording cache events.");
+
+    return true;
+}
+
+void cache_trace_stop()
+{
+    if (!trace_thread.joinable())
+    {
+        return;
+    }
+
+    trace_active = false;
+
+    {
+        std::lock_guard<std::mutex> lock_trace(trace_mutex);
+        trace_stop = true;
+    }
+    trace_cond.notify_all();
+
+    trace_thread.join();
+
+    ::close(trace_fd);
+    trace_fd = -1;
+
+    if (trace_dropped)
+    {
+        Logging::warning(nullptr, "%1 cache trace records were dropped because the trace file could not be written fast enough.", trace_dropped.load());
+    }
+}
+
+bool cache_trace_active()
+{
+    return trace_active.load(std::memory_order_relaxed);
+}
+
+void cache_trace(TRACE_RECORD record)
+{
+    if (!cache_trace_active())
+    {
+        return;
+    }
+
+    record.m_time = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count());
+
+    // Called on every read, so the queue is lock-free: claim a slot by
+    // advancing the head, fill it in, then mark it as written.
+    uint64_t pos = trace_head.load(std::memory_order_relaxed);
+    TRACE_SLOT * slot;
+
+    for (;;)
+    {
+        slot = &trace_queue[pos & (TRACE_MAX_PENDING - 1)];
+
+        int64_t diff = static_cast<int64_t>(slot->m_seq.load(std::memory_order_acquire) - pos);
+
+        if (!diff)
+        {
+            if (trace_head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else if (diff < 0)
+        {
+            // Full, the writer has not taken this slot yet
+            trace_dropped++;
+            return;
+        }
+        else
+        {
+            // Someone else has claimed it
+            pos = trace_head.load(std::memory_order_relaxed);
+        }
+    }
+
+    slot->m_record = record;
+    slot->m_seq.store(pos + 1, std::memory_order_release);
+
+    if (!((pos + 1) % TRACE_FLUSH_RECORDS))
+    {
+        // Only once in a while, pass the mutex so the writer cannot miss the wake up
+        {
+            std::lock_guard<std::mutex> lock_trace(trace_mutex);
+        }
+        trace_cond.notify_one();
+    }
+}
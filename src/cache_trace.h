@@ -0,0 +1,163 @@
+/*
+ * Copyright (C) 2017-2026 Norbert Schlia (nschlia@oblivion-software.de)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * On Debian systems, the complete text of the GNU General Public License
+ * Version 3 can be found in `/usr/share/common-licenses/GPL-3'.
+ */
+
+/**
+ * @file cache_trace.h
+ * @brief %Cache access trace
+ *
+ * Records cache events (lookups, reads, transcodes and pruning) to a binary
+ * trace file. The trace can be replayed with ffmpegfs_tracesim against other
+ * cache sizes, expiry times and eviction policies.
+ *
+ * The file starts with a TRACE_HEADER, followed by TRACE_RECORDs. Both are
+ * written in host byte order; the header contains a byte order mark so
+ * that foreign traces can be detected. Records are collected in memory and
+ * written by a background thread, so tracing does not add disk I/O to the
+ * read path.
+ *
+ * This header is also used by the simulator and must not depend on FFmpeg
+ * or FUSE.
+ *
+ * @ingroup ffmpegfs
+ *
+ * @author Norbert Schlia (nschlia@oblivion-software.de)
+ * @copyright Copyright (C) 2017-2026 Norbert Schlia (nschlia@oblivion-software.de)
+ */
+
+#ifndef CACHE_TRACE_H
+#define CACHE_TRACE_H
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#define TRACE_MAGIC         "FFMTRACE"                  /**< @brief Trace file magic, 8 characters */
+#define TRACE_VERSION       1                           /**< @brief Trace file format version */
+#define TRACE_BOM           0x01020304                  /**< @brief Byte order mark */
+
+#define TRACE_FLAG_HIT      0x01                        /**< @brief Served from the cache without waiting for the transcoder */
+#define TRACE_FLAG_RAM      0x02                        /**< @brief READ: served from the memory tier */
+#define TRACE_FLAG_OPEN     0x04                        /**< @brief OPEN: entry was already open */
+#define TRACE_FLAG_COMPLETE 0x08                        /**< @brief TRANSCODE: transcode finished successfully */
+#define TRACE_FLAG_SHARED   0x10                        /**< @brief TRANSCODE: other transcodes ran at the same time, m_cpu_time includes theirs */
+
+/**
+ * @brief Trace event types
+ */
+enum class TRACE_EVENT : uint8_t
+{
+    OPEN        = 1,                                    /**< @brief Cache entry looked up, m_size is the (predicted) file size */
+    READ        = 2,                                    /**< @brief Data read, m_offset and m_size are the range read */
+    TRANSCODE   = 3,                                    /**< @brief Transcode ended, m_size is the size of the result */
+    PRUNE       = 4,                                    /**< @brief Entry removed from the cache, m_size is its size */
+};
+
+/**
+ * @brief Trace file header
+ */
+typedef struct TRACE_HEADER
+{
+    char        m_magic[8];                             /**< @brief TRACE_MAGIC */
+    uint32_t    m_version;                              /**< @brief TRACE_VERSION */
+    uint32_t    m_bom;                                  /**< @brief TRACE_BOM in the byte order of the writer */
+    uint32_t    m_record_size;                          /**< @brief sizeof(TRACE_RECORD) */
+    uint32_t    m_reserved;                             /**< @brief Reserved, 0 */
+} TRACE_HEADER;
+
+/**
+ * @brief Trace record
+ */
+typedef struct TRACE_RECORD
+{
+    uint64_t    m_time;                                 /**< @brief Time of the event, microseconds since the epoch */
+    uint64_t    m_key;                                  /**< @brief Key of the cache entry, see cache_trace_key() */
+    uint64_t    m_offset;                               /**< @brief READ: Offset read from */
+    uint64_t    m_size;                                 /**< @brief Size, see TRACE_EVENT */
+    uint32_t    m_duration;                             /**< @brief READ: latency in microseconds. TRANSCODE: wall clock time in milliseconds. */
+    uint32_t    m_cpu_time;                             /**< @brief TRANSCODE: CPU time used by the process in milliseconds, see TRACE_FLAG_SHARED */
+    uint32_t    m_segment_no;                           /**< @brief HLS segment number, 0 if not a segment */
+    TRACE_EVENT m_event;                                /**< @brief Event type */
+    uint8_t     m_flags;                                /**< @brief One or more TRACE_FLAG_* flags */
+    uint16_t    m_reserved;                             /**< @brief Reserved, 0 */
+} TRACE_RECORD;
+
+static_assert(sizeof(TRACE_RECORD) == 48, "TRACE_RECORD must not contain padding");
+
+/**
+ * @brief Make up the key of a cache entry.
+ *
+ * Uses the 64 bit FNV-1a hash, which, unlike std::hash, is the same for all
+ * builds and platforms.
+ *
+ * @param[in] filename - Destination file name.
+ * @param[in] desttype - Destination type (MP4, WEBM etc.).
+ * @return Returns the key.
+ */
+inline uint64_t cache_trace_key(std::string_view filename, std::string_view desttype)
+{
+    uint64_t hash = 0xcbf29ce484222325;
+
+    for (char c : filename)
+    {
+        hash = (hash ^ static_cast<uint8_t>(c)) * 0x100000001b3;
+    }
+
+    hash = (hash ^ ':') * 0x100000001b3;
+
+    for (char c : desttype)
+    {
+        hash = (hash ^ static_cast<uint8_t>(c)) * 0x100000001b3;
+    }
+
+    return hash;
+}
+
+/**
+ * @brief Start recording cache events.
+ *
+ * Records are appended if the file exists. Must be called after FUSE has
+ * forked into the background, as it starts the writer thread.
+ *
+ * @param[in] filename - Name of the trace file.
+ * @return Returns true on success; false on error.
+ */
+bool cache_trace_start(const std::string & filename);
+/**
+ * @brief Stop recording, write pending records and close the trace file.
+ */
+void cache_trace_stop();
+/**
+ * @brief Check if cache events are being recorded.
+ * @return Returns true if recording; false if not.
+ */
+bool cache_trace_active();
+/**
+ * @brief Record a cache event. Does nothing if not recording.
+ *
+ * Lock-free, may be called from any thread. The record is dropped if the
+ * writer thread has fallen too far behind.
+ * @param[in] record - Event to record. m_time is set here.
+ */
+void cache_trace(TRACE_RECORD record);
+
+#endif // CACHE_TRACE_H
@@ -1,17 +1,32 @@
 /*
- * Copyright (C) 2017-2026 by Norbert Schlia (nschlia@oblivion-software.de)
+ * Copyright (C) 2017-2026 Norbert Schlia (nschlia@oblivion-software.de)
  *
  * This program is free software; you can redistribute it and/or modify
  * it under the terms of the GNU General Public License as published by
  * the Free Software Foundation; either version 3 of the License, or
  * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * On Debian systems, the complete text of the GNU General Public License
+ * Version 3 can be found in `/usr/share/common-licenses/GPL-3'.
  */
 
 /**
  * @file ffmpeg_audiofifo.cc
- * @brief FFmpeg AVAudioFifo RAII wrapper
+ * @brief Audio sample ring buffer
  *
  * @ingroup ffmpegfs
+ *
+ * @author Norbert Schlia (nschlia@oblivion-software.de)
+ * @copyright Copyright (C) 2017-2026 Norbert Schlia (nschlia@oblivion-software.de)
  */
 
 #ifdef __cplusplus
@@ -20,7 +35,8 @@ extern "C" {
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wconversion"
 #pragma GCC diagnostic ignored "-Wsign-conversion"
-#include <libavutil/audio_fifo.h>
+#include <libavutil/mem.h>
+#include <libavutil/samplefmt.h>
 #pragma GCC diagnostic pop
 #ifdef __cplusplus
 }
@@ -28,13 +44,26 @@ extern "C" {
 
 #include "ffmpeg_audiofifo.h"
 
+#include <algorithm>
+#include <cstring>
+
 FFmpeg_AudioFifo::FFmpeg_AudioFifo()
-    : m_fifo(nullptr)
+    : m_buffer(nullptr)
+    , m_capacity(0)
+    , m_sample_size(0)
+    , m_plane_size(0)
+    , m_head(0)
+    , m_tail(0)
 {
 }
 
 FFmpeg_AudioFifo::FFmpeg_AudioFifo(AVSampleFormat sample_fmt, int channels, int nb_samples)
-    : m_fifo(nullptr)
+    : m_buffer(nullptr)
+    , m_capacity(0)
+    , m_sample_size(0)
+    , m_plane_size(0)
+    , m_head(0)
+    , m_tail(0)
 {
     alloc(sample_fmt, channels, nb_samples);
 }
@@ -45,9 +74,17 @@ FFmpeg_AudioFifo::~FFmpeg_AudioFifo()
 }
 
 FFmpeg_AudioFifo::FFmpeg_AudioFifo(FFmpeg_AudioFifo&& fifo) noexcept
-    : m_fifo(fifo.m_fifo)
+    : m_buffer(fifo.m_buffer)
+    , m_capacity(fifo.m_capacity)
+    , m_sample_size(fifo.m_sample_size)
+    , m_plane_size(fifo.m_plane_size)
+    , m_head(fifo.m_head.load())
+    , m_tail(fifo.m_tail.load())
+    , m_write_span(std::move(fifo.m_write_span))
+    , m_read_span(std::move(fifo.m_read_span))
 {
-    fifo.m_fifo = nullptr;
+    fifo.m_buffer = nullptr;
+    fifo.reset();
 }
 
 FFmpeg_AudioFifo& FFmpeg_AudioFifo::operator=(FFmpeg_AudioFifo&& fifo) noexcept
@@ -55,8 +92,16 @@ FFmpeg_AudioFifo& FFmpeg_AudioFifo::operator=(FFmpeg_AudioFifo&& fifo) noexcept
     if (this != &fifo)
     {
         reset();
-        m_fifo = fifo.m_fifo;
-        fifo.m_fifo = nullptr;
+        m_buffer        = fifo.m_buffer;
+        m_capacity      = fifo.m_capacity;
+        m_sample_size   = fifo.m_sample_size;
+        m_plane_size    = fifo.m_plane_size;
+        m_head          = fifo.m_head.load();
+        m_tail          = fifo.m_tail.load();
+        m_write_span    = std::move(fifo.m_write_span);
+        m_read_span     = std::move(fifo.m_read_span);
+        fifo.m_buffer   = nullptr;
+        fifo.reset();
     }
     return *this;
 }
@@ -65,88 +110,246 @@ int FFmpeg_AudioFifo::alloc(AVSampleFormat sample_fmt, int channels, int nb_samp
 {
     reset();
 
-    m_fifo = av_audio_fifo_alloc(sample_fmt, channels, nb_samples);
-    if (m_fifo == nullptr)
+    int bytes_per_sample = av_get_bytes_per_sample(sample_fmt);
+
+    if (bytes_per_sample <= 0 || channels <= 0 || nb_samples <= 0)
+    {
+        return AVERROR(EINVAL);
+    }
+
+    size_t planes;
+
+    if (av_sample_fmt_is_planar(sample_fmt))
     {
+        planes          = static_cast<size_t>(channels);
+        m_sample_size   = static_cast<size_t>(bytes_per_sample);
+    }
+    else
+    {
+        planes          = 1;
+        m_sample_size   = static_cast<size_t>(bytes_per_sample) * static_cast<size_t>(channels);
+    }
+
+    m_capacity      = static_cast<size_t>(nb_samples);
+    m_plane_size    = m_capacity * m_sample_size;
+
+    m_buffer = static_cast<uint8_t *>(av_malloc(m_plane_size * planes));
+    if (m_buffer == nullptr)
+    {
+        reset();
         return AVERROR(ENOMEM);
     }
 
+    m_write_span.assign(planes, nullptr);
+    m_read_span.assign(planes, nullptr);
+
     return 0;
 }
 
 void FFmpeg_AudioFifo::reset()
 {
-    if (m_fifo != nullptr)
-    {
-        av_audio_fifo_free(m_fifo);
-        m_fifo = nullptr;
-    }
+    av_freep(&m_buffer);
+
+    m_capacity      = 0;
+    m_sample_size   = 0;
+    m_plane_size    = 0;
+    m_head          = 0;
+    m_tail          = 0;
+    m_write_span.clear();
+    m_read_span.clear();
 }
 
 bool FFmpeg_AudioFifo::empty() const
 {
-    return m_fifo == nullptr;
+    return m_buffer == nullptr;
 }
 
 int FFmpeg_AudioFifo::size() const
 {
-    if (m_fifo == nullptr)
-    {
-        return 0;
-    }
-    return av_audio_fifo_size(m_fifo);
+    // Load the head first: it can only move towards the tail
+    size_t head = m_head.load();
+
+    return static_cast<int>(m_tail.load() - head);
+}
+
+int FFmpeg_AudioFifo::capacity() const
+{
+    return static_cast<int>(m_capacity);
 }
 
 int FFmpeg_AudioFifo::realloc(int nb_samples)
 {
-    if (m_fifo == nullptr)
+    if (m_buffer == nullptr)
     {
         return AVERROR(EINVAL);
     }
-    return av_audio_fifo_realloc(m_fifo, nb_samples);
+
+    if (nb_samples <= 0 || static_cast<size_t>(nb_samples) <= m_capacity)
+    {
+        return 0;
+    }
+
+    // Grow at least by half to keep the number of reallocations low
+    size_t capacity     = std::max(static_cast<size_t>(nb_samples), m_capacity + m_capacity / 2);
+    size_t plane_size   = capacity * m_sample_size;
+    size_t planes       = m_write_span.size();
+    uint8_t * buffer    = static_cast<uint8_t *>(av_malloc(plane_size * planes));
+
+    if (buffer == nullptr)
+    {
+        return AVERROR(ENOMEM);
+    }
+
+    // Move the stored samples to the start of the new buffer
+    size_t head = m_head.load();
+    size_t tail = m_tail.load();
+    size_t size = tail - head;
+    size_t first = std::min(size, m_capacity - head % m_capacity);
+
+    for (size_t plane = 0; plane < planes; plane++)
+    {
+        uint8_t * src = m_buffer + plane * m_plane_size;
+        uint8_t * dst = buffer + plane * plane_size;
+
+        std::memcpy(dst, src + (head % m_capacity) * m_sample_size, first * m_sample_size);
+        std::memcpy(dst + first * m_sample_size, src, (size - first) * m_sample_size);
+    }
+
+    av_free(m_buffer);
+
+    m_buffer        = buffer;
+    m_capacity      = capacity;
+    m_plane_size    = plane_size;
+    m_head          = 0;
+    m_tail          = size;
+
+    return 0;
 }
 
-int FFmpeg_AudioFifo::write(void **data, int nb_samples)
+int FFmpeg_AudioFifo::write(uint8_t * const *data, int nb_samples)
 {
-    if (m_fifo == nullptr)
+    if (m_buffer == nullptr)
     {
         return AVERROR(EINVAL);
     }
-    return av_audio_fifo_write(m_fifo, data, nb_samples);
+
+    int written = 0;
+
+    // At most two spans, before and after the end of the ring
+    while (written < nb_samples)
+    {
+        int span_size;
+        uint8_t ** span = write_span(&span_size);
+
+        if (!span_size)
+        {
+            break;
+        }
+
+        span_size = std::min(span_size, nb_samples - written);
+
+        for (size_t plane = 0; plane < m_write_span.size(); plane++)
+        {
+            std::memcpy(span[plane], data[plane] + static_cast<size_t>(written) * m_sample_size, static_cast<size_t>(span_size) * m_sample_size);
+        }
+
+        commit(span_size);
+
+        written += span_size;
+    }
+
+    return written;
 }
 
-int FFmpeg_AudioFifo::read(void **data, int nb_samples)
+int FFmpeg_AudioFifo::read(uint8_t * const *data, int nb_samples)
 {
-    if (m_fifo == nullptr)
+    if (m_buffer == nullptr)
     {
         return AVERROR(EINVAL);
     }
-    return av_audio_fifo_read(m_fifo, data, nb_samples);
+
+    int samples_read = 0;
+
+    // At most two spans, before and after the end of the ring
+    while (samples_read < nb_samples)
+    {
+        int span_size;
+        uint8_t * const * span = read_span(&span_size);
+
+        if (!span_size)
+        {
+            break;
+        }
+
+        span_size = std::min(span_size, nb_samples - samples_read);
+
+        for (size_t plane = 0; plane < m_read_span.size(); plane++)
+        {
+            std::memcpy(data[plane] + static_cast<size_t>(samples_read) * m_sample_size, span[plane], static_cast<size_t>(span_size) * m_sample_size);
+        }
+
+        consume(span_size);
+
+        samples_read += span_size;
+    }
+
+    return samples_read;
 }
 
-AVAudioFifo* FFmpeg_AudioFifo::get()
+uint8_t ** FFmpeg_AudioFifo::write_span(int *nb_samples)
 {
-    return m_fifo;
+    if (m_buffer == nullptr)
+    {
+        *nb_samples = 0;
+        return m_write_span.data();
+    }
+
+    size_t tail     = m_tail.load(std::memory_order_relaxed);  // Only changed by this thread
+    size_t head     = m_head.load(std::memory_order_acquire);  // Reader is done with the samples before
+    size_t offset   = tail % m_capacity;
+
+    *nb_samples = static_cast<int>(std::min(m_capacity - (tail - head), m_capacity - offset));
+
+    set_span(&m_write_span, offset);
+
+    return m_write_span.data();
 }
 
-const AVAudioFifo* FFmpeg_AudioFifo::get() const
+void FFmpeg_AudioFifo::commit(int nb_samples)
 {
-    return m_fifo;
+    // Publish the samples to the reader
+    m_tail.store(m_tail.load(std::memory_order_relaxed) + static_cast<size_t>(nb_samples), std::memory_order_release);
 }
 
-AVAudioFifo* FFmpeg_AudioFifo::release()
+uint8_t * const * FFmpeg_AudioFifo::read_span(int *nb_samples)
 {
-    AVAudioFifo *fifo = m_fifo;
-    m_fifo = nullptr;
-    return fifo;
+    if (m_buffer == nullptr)
+    {
+        *nb_samples = 0;
+        return m_read_span.data();
+    }
+
+    size_t head     = m_head.load(std::memory_order_relaxed);  // Only changed by this thread
+    size_t tail     = m_tail.load(std::memory_order_acquire);  // Samples written before are visible
+    size_t offset   = head % m_capacity;
+
+    *nb_samples = static_cast<int>(std::min(tail - head, m_capacity - offset));
+
+    set_span(&m_read_span, offset);
+
+    return m_read_span.data();
 }
 
-FFmpeg_AudioFifo::operator AVAudioFifo*()
+void FFmpeg_AudioFifo::consume(int nb_samples)
 {
-    return m_fifo;
+    // Hand the space back to the writer
+    m_head.store(m_head.load(std::memory_order_relaxed) + static_cast<size_t>(nb_samples), std::memory_order_release);
 }
 
-FFmpeg_AudioFifo::operator const AVAudioFifo*() const
+void FFmpeg_AudioFifo::set_span(std::vector<uint8_t *> * span, size_t pos) const
 {
-    return m_fifo;
+    for (size_t plane = 0; plane < span->size(); plane++)
+    {
+        (*span)[plane] = m_buffer + plane * m_plane_size + pos * m_sample_size;
+    }
 }
@@ -1,17 +1,32 @@
 /*
- * Copyright (C) 2017-2026 by Norbert Schlia (nschlia@oblivion-software.de)
+ * Copyright (C) 2017-2026 Norbert Schlia (nschlia@oblivion-software.de)
  *
  * This program is free software; you can redistribute it and/or modify
  * it under the terms of the GNU General Public License as published by
  * the Free Software Foundation; either version 3 of the License, or
  * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * On Debian systems, the complete text of the GNU General Public License
+ * Version 3 can be found in `/usr/share/common-licenses/GPL-3'.
  */
 
 /**
  * @file ffmpeg_audiofifo.h
- * @brief FFmpeg AVAudioFifo RAII wrapper.
+ * @brief Audio sample ring buffer.
  *
  * @ingroup ffmpegfs
+ *
+ * @author Norbert Schlia (nschlia@oblivion-software.de)
+ * @copyright Copyright (C) 2017-2026 Norbert Schlia (nschlia@oblivion-software.de)
  */
 
 #ifndef FFMPEG_AUDIOFIFO_H
@@ -21,19 +36,34 @@
 
 #include "ffmpeg_utils.h"
 
-struct AVAudioFifo;
+#include <atomic>
+#include <cstddef>
+#include <vector>
 
 /**
- * @brief RAII wrapper for AVAudioFifo.
+ * @brief Ring buffer for audio samples, planar or packed.
+ *
+ * Replaces AVAudioFifo, which grows on every write that does not fit and
+ * copies through an intermediate FIFO per channel. The capacity is allocated
+ * up front; write() and read() copy blocks of samples with at most two
+ * memcpy() calls per plane.
  *
- * Owns an AVAudioFifo allocated with av_audio_fifo_alloc() and releases it
- * with av_audio_fifo_free(). The wrapper is movable but not copyable.
+ * write_span() gives direct access to the free space as a contiguous span, to
+ * let the resampler write into the FIFO; the samples are then added with
+ * commit(). There is no such access for the reader: audio frames are queued
+ * before they are encoded, so they need a copy of the samples of their own,
+ * which read() makes.
+ *
+ * One thread may write while another one reads. The number of samples
+ * written is only changed by the writer, the number of samples read only by
+ * the reader. realloc(), alloc() and reset() must not be called while the
+ * other side is active.
  */
 class FFmpeg_AudioFifo
 {
 public:
     /**
-     * @brief Construct an empty FIFO wrapper.
+     * @brief Construct an empty FIFO.
      */
     FFmpeg_AudioFifo();
 
@@ -41,12 +71,12 @@ public:
      * @brief Construct and allocate an audio FIFO.
      * @param[in] sample_fmt Sample format stored in the FIFO.
      * @param[in] channels Number of audio channels.
-     * @param[in] nb_samples Initial allocation size in samples.
+     * @param[in] nb_samples Capacity in samples.
      */
     FFmpeg_AudioFifo(AVSampleFormat sample_fmt, int channels, int nb_samples = 1);
 
     /**
-     * @brief Release the owned FIFO, if any.
+     * @brief Release the buffer, if any.
      */
     ~FFmpeg_AudioFifo();
 
@@ -54,97 +84,117 @@ public:
     FFmpeg_AudioFifo& operator=(const FFmpeg_AudioFifo&) = delete;
 
     /**
-     * @brief Move-construct a FIFO wrapper.
-     * @param[in,out] fifo Source wrapper whose FIFO ownership is transferred.
+     * @brief Move-construct a FIFO.
+     * @param[in,out] fifo Source FIFO whose buffer is transferred.
      */
     FFmpeg_AudioFifo(FFmpeg_AudioFifo&& fifo) noexcept;
 
     /**
-     * @brief Move-assign a FIFO wrapper.
-     * @param[in,out] fifo Source wrapper whose FIFO ownership is transferred.
-     * @return Reference to this wrapper.
+     * @brief Move-assign a FIFO.
+     * @param[in,out] fifo Source FIFO whose buffer is transferred.
+     * @return Reference to this FIFO.
      */
     FFmpeg_AudioFifo& operator=(FFmpeg_AudioFifo&& fifo) noexcept;
 
     /**
-     * @brief Allocate a new audio FIFO, replacing any existing one.
+     * @brief Allocate a new buffer, replacing any existing one.
      * @param[in] sample_fmt Sample format stored in the FIFO.
      * @param[in] channels Number of audio channels.
-     * @param[in] nb_samples Initial allocation size in samples.
+     * @param[in] nb_samples Capacity in samples.
      * @return 0 on success, or a negative FFmpeg error code.
      */
     int             alloc(AVSampleFormat sample_fmt, int channels, int nb_samples = 1);
 
     /**
-     * @brief Free the owned FIFO and reset the wrapper to empty.
+     * @brief Free the buffer and reset the FIFO to empty.
      */
     void            reset();
 
     /**
-     * @brief Check whether the wrapper currently owns a FIFO.
-     * @return true if no FIFO is owned, false otherwise.
+     * @brief Check whether a buffer has been allocated.
+     * @return true if no buffer is allocated, false otherwise.
      */
     bool            empty() const;
 
     /**
      * @brief Return the number of samples currently stored in the FIFO.
-     * @return Number of queued samples, or 0 if the wrapper is empty.
+     * @return Number of queued samples, or 0 if no buffer is allocated.
      */
     int             size() const;
 
     /**
-     * @brief Resize the FIFO allocation.
-     * @param[in] nb_samples New allocation size in samples.
+     * @brief Return the number of samples the FIFO can hold.
+     * @return Capacity in samples, or 0 if no buffer is allocated.
+     */
+    int             capacity() const;
+
+    /**
+     * @brief Grow the buffer if it cannot hold nb_samples samples.
+     * Stored samples are kept. Not safe while the other side is active.
+     * @param[in] nb_samples Minimum capacity in samples.
      * @return 0 on success, or a negative FFmpeg error code.
      */
     int             realloc(int nb_samples);
 
     /**
      * @brief Write audio samples into the FIFO.
-     * @param[in] data Per-channel sample buffers as expected by FFmpeg.
+     * @param[in] data Per-plane sample buffers as expected by FFmpeg.
      * @param[in] nb_samples Number of samples to write.
-     * @return Number of samples written, or a negative FFmpeg error code.
+     * @return Number of samples written, less than nb_samples if the FIFO is full, or a negative FFmpeg error code.
      */
-    int             write(void **data, int nb_samples);
+    int             write(uint8_t * const *data, int nb_samples);
 
     /**
      * @brief Read audio samples from the FIFO.
-     * @param[out] data Per-channel destination buffers as expected by FFmpeg.
+     * @param[out] data Per-plane destination buffers as expected by FFmpeg.
      * @param[in] nb_samples Number of samples to read.
-     * @return Number of samples read, or a negative FFmpeg error code.
+     * @return Number of samples read, less than nb_samples if the FIFO runs empty, or a negative FFmpeg error code.
      */
-    int             read(void **data, int nb_samples);
+    int             read(uint8_t * const *data, int nb_samples);
 
     /**
-     * @brief Get the owned FFmpeg FIFO pointer.
-     * @return Mutable AVAudioFifo pointer, or nullptr if empty.
+     * @brief Get the free space at the write position.
+     * @param[out] nb_samples Number of samples that fit in the span, 0 if the FIFO is full.
+     * @return Per-plane pointers to the span, valid until the next call by the writer.
      */
-    AVAudioFifo*    get();
+    uint8_t **      write_span(int *nb_samples);
 
     /**
-     * @brief Get the owned FFmpeg FIFO pointer.
-     * @return Const AVAudioFifo pointer, or nullptr if empty.
+     * @brief Add samples written to the span returned by write_span().
+     * @param[in] nb_samples Number of samples written.
      */
-    const AVAudioFifo* get() const;
+    void            commit(int nb_samples);
 
+private:
     /**
-     * @brief Release ownership without freeing the FIFO.
-     * @return Previously owned AVAudioFifo pointer, or nullptr if empty.
+     * @brief Get the samples at the read position.
+     * @param[out] nb_samples Number of samples in the span, 0 if the FIFO is empty.
+     * @return Per-plane pointers to the span, valid until the next call by the reader.
      */
-    AVAudioFifo*    release();
+    uint8_t * const * read_span(int *nb_samples);
 
     /**
-     * @brief Convert to the underlying mutable FIFO pointer.
+     * @brief Remove samples from the read position after they have been copied from the span returned by read_span().
+     * @param[in] nb_samples Number of samples to remove.
      */
-    operator        AVAudioFifo*();
+    void            consume(int nb_samples);
 
     /**
-     * @brief Convert to the underlying const FIFO pointer.
+     * @brief Set the per-plane pointers of a span.
+     * @param[out] span Pointers to set.
+     * @param[in] pos Position of the span in samples.
      */
-    operator const  AVAudioFifo*() const;
+    void            set_span(std::vector<uint8_t *> * span, size_t pos) const;
 
 private:
-    AVAudioFifo *   m_fifo;     /**< @brief Pointer to underlying AVAudioFifo. */
+    uint8_t *               m_buffer;           /**< @brief All planes, one after another */
+    size_t                  m_capacity;         /**< @brief Capacity in samples */
+    size_t                  m_sample_size;      /**< @brief Size of one sample in one plane, in bytes */
+    size_t                  m_plane_size;       /**< @brief Size of one plane, in bytes */
+    std::atomic_size_t      m_head;             /**< @brief Number of samples read, only changed by the reader */
+    std::atomic_size_t      m_tail;             /**< @brief Number of samples written, only changed by the writer */
+    std::vector<uint8_t *>  m_write_span;       /**< @brief Plane pointers returned by write_span() */
+    std::vector<uint8_t *>  m_read_span;        /**< @brief Plane pointers returned by read_span() */
 };
 
 #endif // FFMPEG_AUDIOFIFO_H
@@ -0,0 +1,232 @@
+/*
+ * Copyright (C) 2017-2026 Norbert Schlia (nschlia@oblivion-software.de)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * On Debian systems, the complete text of the GNU General Public License
+ * Version 3 can be found in `/usr/share/common-licenses/GPL-3'.
+ */
+
+/**
+ * @file ffmpeg_bufferpool.cc
+ * @brief Pooled data buffers for audio and video frames
+ *
+ * @ingroup ffmpegfs
+ *
+ * @author Norbert Schlia (nschlia@oblivion-software.de)
+ * @copyright Copyright (C) 2017-2026 Norbert Schlia (nschlia@oblivion-software.de)
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wconversion"
+#pragma GCC diagnostic ignored "-Wsign-conversion"
+#include <libavcodec/avcodec.h>
+#include <libavutil/buffer.h>
+#include <libavutil/frame.h>
+#include <libavutil/imgutils.h>
+#include <libavutil/pixdesc.h>
+#include <libavutil/samplefmt.h>
+#pragma GCC diagnostic pop
+#ifdef __cplusplus
+}
+#endif
+
+#include "ffmpeg_bufferpool.h"
+
+#define MAX_POOLS   8       /**< @brief Max. number of buffer sizes pooled */
+
+FFmpeg_BufferPool::FFmpeg_BufferPool()
+{
+}
+
+FFmpeg_BufferPool::~FFmpeg_BufferPool()
+{
+    reset();
+}
+
+AVBufferRef * FFmpeg_BufferPool::get(size_t size)
+{
+    size_t n;
+
+    for (n = 0; n < m_pools.size() && m_pools[n].m_size != size; n++)
+    {
+    }
+
+    if (n == m_pools.size())
+    {
+        POOL pool;
+
+        pool.m_size = size;
+#if LAVU_BUFFER_SIZE_T
+        pool.m_pool = av_buffer_pool_init(size, nullptr);
+#else   // !LAVU_BUFFER_SIZE_T
+        pool.m_pool = av_buffer_pool_init(static_cast<int>(size), nullptr);
+#endif  // !LAVU_BUFFER_SIZE_T
+        if (pool.m_pool == nullptr)
+        {
+            return nullptr;
+        }
+
+        if (m_pools.size() >= MAX_POOLS)
+        {
+            // Buffers still in use are freed when returned
+            av_buffer_pool_uninit(&m_pools.back().m_pool);
+            m_pools.pop_back();
+        }
+
+        m_pools.insert(m_pools.begin(), pool);
+    }
+    else if (n)
+    {
+        // Keep most recently used first
+        std::swap(m_pools[n], m_pools[0]);
+    }
+
+    return av_buffer_pool_get(m_pools[0].m_pool);
+}
+
+int FFmpeg_BufferPool::get_audio_buffer(AVFrame *frame, int channels)
+{
+    AVSampleFormat sample_fmt = static_cast<AVSampleFormat>(frame->format);
+    int planes = av_sample_fmt_is_planar(sample_fmt) ? channels : 1;
+    int linesize;
+    int ret;
+
+    if (planes > AV_NUM_DATA_POINTERS)
+    {
+        // Would need extended buffers, leave that to FFmpeg
+        return av_frame_get_buffer(frame, 0);
+    }
+
+    ret = av_samples_get_buffer_size(&linesize, channels, frame->nb_samples, sample_fmt, 0);
+    if (ret < 0)
+    {
+        return ret;
+    }
+
+    for (int plane = 0; plane < planes; plane++)
+    {
+        frame->buf[plane] = get(static_cast<size_t>(linesize));
+        if (frame->buf[plane] == nullptr)
+        {
+            for (int n = 0; n < plane; n++)
+            {
+                av_buffer_unref(&frame->buf[n]);
+                frame->data[n] = nullptr;
+            }
+            return AVERROR(ENOMEM);
+        }
+        frame->data[plane] = frame->buf[plane]->data;
+    }
+
+    frame->extended_data    = frame->data;
+    frame->linesize[0]      = linesize;
+
+    return 0;
+}
+
+int FFmpeg_BufferPool::get_video_buffer(AVFrame *frame, int align)
+{
+    AVPixelFormat pix_fmt = static_cast<AVPixelFormat>(frame->format);
+    const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(pix_fmt);
+    uint8_t *data[4];
+    int ret;
+
+    if (desc == nullptr || (desc->flags & AV_PIX_FMT_FLAG_HWACCEL))
+    {
+        // Leave that to FFmpeg
+        return av_frame_get_buffer(frame, align);
+    }
+
+    ret = av_image_check_size(static_cast<unsigned int>(frame->width), static_cast<unsigned int>(frame->height), 0, nullptr);
+    if (ret < 0)
+    {
+        return ret;
+    }
+
+    // Same layout as av_frame_get_buffer(): SIMD code may read and write
+    // past the end of a line or plane, and past the last line up to a
+    // multiple of 32 lines.
+    if (align <= 0)
+    {
+        align = 32;
+    }
+
+    for (int width_align = 1; width_align <= align; width_align += width_align)
+    {
+        ret = av_image_fill_linesizes(frame->linesize, pix_fmt, FFALIGN(frame->width, width_align));
+        if (ret < 0)
+        {
+            return ret;
+        }
+
+        if (!(frame->linesize[0] & (align - 1)))
+        {
+            break;
+        }
+    }
+
+    for (int plane = 0; plane < 4 && frame->linesize[plane]; plane++)
+    {
+        frame->linesize[plane] = FFALIGN(frame->linesize[plane], align);
+    }
+
+    const int padded_height = FFALIGN(frame->height, 32);
+    const int plane_padding = FFMAX(16 + 16, align);
+
+    int size = av_image_fill_pointers(data, pix_fmt, padded_height, nullptr, frame->linesize);
+    if (size < 0)
+    {
+        return size;
+    }
+
+    frame->buf[0] = get(static_cast<size_t>(size) + 4 * static_cast<size_t>(plane_padding + align) + AV_INPUT_BUFFER_PADDING_SIZE);
+    if (frame->buf[0] == nullptr)
+    {
+        return AVERROR(ENOMEM);
+    }
+
+    ret = av_image_fill_pointers(frame->data, pix_fmt, padded_height, frame->buf[0]->data, frame->linesize);
+    if (ret < 0)
+    {
+        av_buffer_unref(&frame->buf[0]);
+        return ret;
+    }
+
+    for (int plane = 1; plane < 4; plane++)
+    {
+        if (frame->data[plane] != nullptr)
+        {
+            frame->data[plane] += plane * plane_padding;
+            frame->data[plane] = reinterpret_cast<uint8_t *>(FFALIGN(reinterpret_cast<uintptr_t>(frame->data[plane]), static_cast<uintptr_t>(align)));
+        }
+    }
+
+    frame->extended_data = frame->data;
+
+    return 0;
+}
+
+void FFmpeg_BufferPool::reset()
+{
+    for (POOL & pool : m_pools)
+    {
+        av_buffer_pool_uninit(&pool.m_pool);
+    }
+    m_pools.clear();
+}
@@ -0,0 +1,116 @@
+/*
+ * Copyright (C) 2017-2026 Norbert Schlia (nschlia@oblivion-software.de)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * On Debian systems, the complete text of the GNU General Public License
+ * Version 3 can be found in `/usr/share/common-licenses/GPL-3'.
+ */
+
+/**
+ * @file ffmpeg_bufferpool.h
+ * @brief Pooled data buffers for audio and video frames.
+ *
+ * @ingroup ffmpegfs
+ *
+ * @author Norbert Schlia (nschlia@oblivion-software.de)
+ * @copyright Copyright (C) 2017-2026 Norbert Schlia (nschlia@oblivion-software.de)
+ */
+
+#ifndef FFMPEG_BUFFERPOOL_H
+#define FFMPEG_BUFFERPOOL_H
+
+#pragma once
+
+#include "ffmpeg_utils.h"
+
+#include <vector>
+
+struct AVBufferPool;
+struct AVBufferRef;
+struct AVFrame;
+
+/**
+ * @brief Data buffers for frames, recycled through AVBufferPools.
+ *
+ * Frames created by the transcoder always have the same format, sample
+ * count and picture size, apart from the last frame of a stream. Instead of
+ * allocating and freeing their data for every frame, buffers are taken from
+ * an AVBufferPool of the required size and go back to the pool when the
+ * last reference to them is dropped, e.g. after the encoder is done with
+ * the frame.
+ *
+ * Format, sample count and picture size only matter through the size of
+ * the buffers they need, so there is one pool per buffer size. The least
+ * recently used pool is dropped if too many sizes are used. Buffers still
+ * in use stay valid when their pool is dropped or the object is destroyed.
+ */
+class FFmpeg_BufferPool
+{
+public:
+    /**
+     * @brief Construct an empty buffer pool.
+     */
+    FFmpeg_BufferPool();
+    /**
+     * @brief Release all pools.
+     */
+    ~FFmpeg_BufferPool();
+
+    FFmpeg_BufferPool(const FFmpeg_BufferPool&) = delete;
+    FFmpeg_BufferPool& operator=(const FFmpeg_BufferPool&) = delete;
+
+    /**
+     * @brief Get a buffer.
+     * @param[in] size - Size of the buffer in bytes.
+     * @return Returns a reference to the buffer, or nullptr if out of memory. Free with av_buffer_unref().
+     */
+    AVBufferRef *   get(size_t size);
+    /**
+     * @brief Allocate the data of an audio frame, like av_frame_get_buffer().
+     * format and nb_samples must be set.
+     * @param[in] frame - Frame to allocate data for.
+     * @param[in] channels - Number of channels.
+     * @return On success, returns 0; on error, a negative AVERROR value.
+     */
+    int             get_audio_buffer(AVFrame *frame, int channels);
+    /**
+     * @brief Allocate the data of a video frame, like av_frame_get_buffer().
+     * format, width and height must be set. Line sizes, padding and plane
+     * alignment are the same as with av_frame_get_buffer().
+     * @param[in] frame - Frame to allocate data for.
+     * @param[in] align - Alignment of the line sizes and planes, 0 for the default.
+     * @return On success, returns 0; on error, a negative AVERROR value.
+     */
+    int             get_video_buffer(AVFrame *frame, int align);
+    /**
+     * @brief Release all pools.
+     */
+    void            reset();
+
+protected:
+    /**
+     * @brief Pool for buffers of one size
+     */
+    typedef struct POOL
+    {
+        size_t          m_size;                     /**< @brief Size of the buffers */
+        AVBufferPool *  m_pool;                     /**< @brief The pool */
+    } POOL;
+
+    std::vector<POOL>   m_pools;                    /**< @brief Pools, most recently used first */
+};
+
+#endif // FFMPEG_BUFFERPOOL_H
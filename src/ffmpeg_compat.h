@@ -143,5 +143,24 @@
  *   AVCodec.supported_samplerates and AVCodec.ch_layouts.
  */
 #define LAVC_USE_SUPPORTED_CFG              (LIBAVCODEC_VERSION_INT >= AV_VERSION_INT(61, 13, 0))
+/**
+ * 2021-04-27 - lavu 57.0.100 - buffer.h
+ * Buffer sizes are size_t instead of int (FF_API_BUFFER_SIZE_T removed).
+ */
+#define LAVU_BUFFER_SIZE_T                  (LIBAVUTIL_VERSION_INT >= AV_VERSION_INT(57, 0, 0))
+/**
+ * 2021-04-27 - lavf 58.76.100 - avformat.h
+ * Add avformat_index_get_entries_count(), avformat_index_get_entry() and
+ * avformat_index_get_entry_from_timestamp(). AVStream.nb_index_entries
+ * and AVStream.index_entries are no longer public.
+ */
+#define LAVF_INDEX_GET_ENTRY                (LIBAVFORMAT_VERSION_INT >= AV_VERSION_INT(58, 76, 100))
+/**
+ * 2021-09-20 - 74a18ebc4f - lsws 6.1.100 - swscale.h
+ * Add AVFrame-based scaling API: sws_scale_frame(), sws_frame_start(),
+ * sws_frame_end(), sws_send_slice() and sws_receive_slice(). Only the
+ * new API supports slice threading (option "threads").
+ */
+#define LSWS_SCALE_FRAME                    (LIBSWSCALE_VERSION_INT >= AV_VERSION_INT(6, 1, 100))
 
 #endif // FFMPEG_COMPAT_H
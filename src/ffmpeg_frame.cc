@@ -45,8 +45,134 @@ extern "C" {
 #include "ffmpeg_utils.h"
 #include "ffmpeg_frame.h"
 
+#include <vector>
+
+#define MAX_POOLED_FRAMES   32      /**< @brief Max. number of free AVFrame structs kept per thread */
+
+static thread_local bool frame_pool_destroyed = false;  /**< @brief Set when the frame pool of the current thread has been destroyed */
+
+/**
+ * @brief Free AVFrame structs of a thread, kept for reuse.
+ *
+ * Each thread has a pool of its own that only it uses, so no locking is
+ * needed. Frames may be allocated by one thread and released by another,
+ * e.g. by the decoder thread with --pipeline and the transcoder thread;
+ * they go to the pool of the thread that releases them. The frames are
+ * freed when the thread exits.
+ */
+class Frame_Pool
+{
+public:
+    /**
+     * @brief Free all pooled frames.
+     */
+    ~Frame_Pool()
+    {
+        for (AVFrame *frame : m_frames)
+        {
+            av_frame_free(&frame);
+        }
+        m_frames.clear();
+        frame_pool_destroyed = true;
+    }
+
+    /**
+     * @brief Get a blank frame, from the pool if possible.
+     * @return Returns a blank AVFrame struct, or nullptr if out of memory.
+     */
+    AVFrame * alloc()
+    {
+        if (m_frames.empty())
+        {
+            return av_frame_alloc();
+        }
+
+        AVFrame *frame = m_frames.back();
+        m_frames.pop_back();
+        return frame;
+    }
+
+    /**
+     * @brief Unreference a frame and put it back to the pool, or free it if the pool is full.
+     * @param[inout] frame - Frame to release, set to nullptr.
+     */
+    void release(AVFrame **frame)
+    {
+        if (m_frames.size() >= MAX_POOLED_FRAMES)
+        {
+            av_frame_free(frame);
+            return;
+        }
+
+        av_frame_unref(*frame);
+        m_frames.push_back(*frame);
+        *frame = nullptr;
+    }
+
+    /**
+     * @brief Make a new reference to a frame, like av_frame_clone(), using a pooled frame.
+     * @param[in] src - Frame to reference.
+     * @return Returns the new frame, or nullptr on error.
+     */
+    AVFrame * clone(const AVFrame *src)
+    {
+        AVFrame *frame = alloc();
+
+        if (frame != nullptr && av_frame_ref(frame, src) < 0)
+        {
+            release(&frame);
+        }
+
+        return frame;
+    }
+
+protected:
+    std::vector<AVFrame*>   m_frames;               /**< @brief Free frames */
+};
+
+static thread_local Frame_Pool frame_pool;  /**< @brief Free frames of the current thread */
+
+/**
+ * @brief Get a blank frame from the pool of the current thread.
+ *
+ * frame_pool must not be touched once it has been destroyed at thread
+ * exit, frames destructed afterwards are freed directly. The flag lives
+ * outside the pool: it is trivially destructible and thus stays valid.
+ * @return Returns a blank AVFrame struct, or nullptr if out of memory.
+ */
+static AVFrame * pool_alloc()
+{
+    return !frame_pool_destroyed ? frame_pool.alloc() : av_frame_alloc();
+}
+
+/**
+ * @brief Release a frame to the pool of the current thread, see pool_alloc().
+ * @param[inout] frame - Frame to release, set to nullptr.
+ */
+static void pool_release(AVFrame **frame)
+{
+    if (!frame_pool_destroyed)
+    {
+        frame_pool.release(frame);
+    }
+    else
+    {
+        av_frame_free(frame);
+    }
+}
+
+/**
+ * @brief Make a new reference to a frame using the pool of the current thread, see pool_alloc().
+ * @param[in] src - Frame to reference.
+ * @return Returns the new frame, or nullptr on error.
+ */
+static AVFrame * pool_clone(const AVFrame *src)
+{
+    return !frame_pool_destroyed ? frame_pool.clone(src) : av_frame_clone(src);
+}
+
 FFmpeg_Frame::FFmpeg_Frame(int stream_index) :
-    m_frame(av_frame_alloc()),
+    m_frame(pool_alloc()),
     m_res(0),
     m_stream_idx(stream_index)
 {
@@ -60,7 +186,7 @@ FFmpeg_Frame::FFmpeg_Frame(const FFmpeg_Frame& frame) :
 {
     if (frame.m_frame != nullptr)
     {
-        m_frame = av_frame_clone(frame.m_frame);
+        m_frame = pool_clone(frame.m_frame);
 
         m_res = (m_frame != nullptr) ? 0 : AVERROR(ENOMEM);
     }
@@ -70,6 +196,15 @@ FFmpeg_Frame::FFmpeg_Frame(const FFmpeg_Frame& frame) :
     }
 }
 
+FFmpeg_Frame::FFmpeg_Frame(FFmpeg_Frame && frame) noexcept :
+    m_frame(frame.m_frame),
+    m_res(frame.m_res),
+    m_stream_idx(frame.m_stream_idx)
+{
+    frame.m_frame   = nullptr;
+    frame.m_res     = AVERROR(EINVAL);
+}
+
 FFmpeg_Frame::FFmpeg_Frame(const AVFrame * frame) :
     m_frame(nullptr),
     m_res(0),
@@ -77,7 +212,7 @@ FFmpeg_Frame::FFmpeg_Frame(const AVFrame * frame) :
 {
     if (frame != nullptr)
     {
-        m_frame = av_frame_clone(frame);
+        m_frame = pool_clone(frame);
 
         m_res = (m_frame != nullptr) ? 0 : AVERROR(ENOMEM);
     }
@@ -109,8 +244,7 @@ void FFmpeg_Frame::free()
 {
     if (m_frame != nullptr)
     {
-        av_frame_free(&m_frame);
-        m_frame = nullptr;
+        pool_release(&m_frame);
     }
 }
 
@@ -144,7 +278,7 @@ FFmpeg_Frame& FFmpeg_Frame::operator=(const FFmpeg_Frame & frame) noexcept
     // Do self assignment check
     if (this != &frame && m_frame != frame.m_frame)
     {
-        AVFrame *new_frame = av_frame_clone(frame.m_frame);
+        AVFrame *new_frame = pool_clone(frame.m_frame);
 
         free();
 
@@ -158,11 +292,28 @@ FFmpeg_Frame& FFmpeg_Frame::operator=(const FFmpeg_Frame & frame) noexcept
     return *this;
 }
 
+FFmpeg_Frame& FFmpeg_Frame::operator=(FFmpeg_Frame && frame) noexcept
+{
+    if (this != &frame)
+    {
+        free();
+
+        m_frame         = frame.m_frame;
+        m_res           = frame.m_res;
+        m_stream_idx    = frame.m_stream_idx;
+
+        frame.m_frame   = nullptr;
+        frame.m_res     = AVERROR(EINVAL);
+    }
+
+    return *this;
+}
+
 FFmpeg_Frame& FFmpeg_Frame::operator=(const AVFrame * frame) noexcept
 {
     if (m_frame != frame)
     {
-        AVFrame *new_frame = av_frame_clone(frame);
+        AVFrame *new_frame = pool_clone(frame);
 
         free();
 
@@ -53,6 +53,12 @@ public:
      * @note Do not declare explicit, breaks use in std::variant
      */
     FFmpeg_Frame(const FFmpeg_Frame & frame);
+    /**
+     * @brief Move construct from FFmpeg_Frame object.
+     * Takes over the AVFrame struct, does not allocate.
+     * @param[in] frame - Source FFmpeg_Frame object, invalid afterwards.
+     */
+    FFmpeg_Frame(FFmpeg_Frame && frame) noexcept;
     /**
      * @brief Copy construct from AVFrame struct.
      * @param[in] frame - Pointer to source AVFrame struct.
@@ -106,6 +112,13 @@ public:
      * @return Reference to new FFmpeg_Frame object.
      */
     FFmpeg_Frame& operator=(const FFmpeg_Frame & frame) noexcept;
+    /**
+     * @brief Move from other FFmpeg_Frame object.
+     * Takes over the AVFrame struct, does not allocate.
+     * @param[in] frame - Source FFmpeg_Frame object, invalid afterwards.
+     * @return Reference to this FFmpeg_Frame object.
+     */
+    FFmpeg_Frame& operator=(FFmpeg_Frame && frame) noexcept;
     /**
      * @brief Make copy from AVFrame structure.
      * @param[in] frame - Pointer to source AVFrame structure.
@@ -0,0 +1,131 @@
+/*
+ * Copyright (C) 2017-2026 Norbert Schlia (nschlia@oblivion-software.de)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * On Debian systems, the complete text of the GNU General Public License
+ * Version 3 can be found in `/usr/share/common-licenses/GPL-3'.
+ */
+
+/**
+ * @file ffmpeg_keyframeindex.cc
+ * @brief Key frame index of a source file
+ *
+ * @ingroup ffmpegfs
+ *
+ * @author Norbert Schlia (nschlia@oblivion-software.de)
+ * @copyright Copyright (C) 2017-2026 Norbert Schlia (nschlia@oblivion-software.de)
+ */
+
+#include "ffmpeg_keyframeindex.h"
+
+#include <algorithm>
+#include <cstring>
+
+FFmpeg_KeyframeIndex::FFmpeg_KeyframeIndex()
+    : m_stream_idx(-1)
+    , m_complete(false)
+{
+}
+
+void FFmpeg_KeyframeIndex::reset(int stream_idx)
+{
+    m_keyframes.clear();
+    m_stream_idx    = stream_idx;
+    m_complete      = false;
+}
+
+bool FFmpeg_KeyframeIndex::assign(int stream_idx, const void *data, size_t size)
+{
+    reset(stream_idx);
+
+    if (data == nullptr || !size || size % sizeof(KEYFRAME))
+    {
+        return false;
+    }
+
+    m_keyframes.resize(size / sizeof(KEYFRAME));
+    std::memcpy(m_keyframes.data(), data, size);
+
+    // Should have been stored sorted, but do not rely on that for find()
+    if (!std::is_sorted(m_keyframes.begin(), m_keyframes.end(), [](const KEYFRAME & a, const KEYFRAME & b) { return (a.m_pts < b.m_pts); }))
+    {
+        m_keyframes.clear();
+        return false;
+    }
+
+    m_complete = true;
+
+    return true;
+}
+
+void FFmpeg_KeyframeIndex::add(int64_t pts, int64_t pos)
+{
+    // Key frames practically always come in order, then this is an append.
+    if (m_keyframes.empty() || m_keyframes.back().m_pts < pts)
+    {
+        m_keyframes.push_back({ pts, pos });
+        return;
+    }
+
+    auto it = std::lower_bound(m_keyframes.begin(), m_keyframes.end(), pts, [](const KEYFRAME & keyframe, int64_t value) { return (keyframe.m_pts < value); });
+
+    if (it != m_keyframes.end() && it->m_pts == pts)
+    {
+        // Already known
+        return;
+    }
+
+    m_keyframes.insert(it, { pts, pos });
+}
+
+bool FFmpeg_KeyframeIndex::find(int64_t pts, KEYFRAME *keyframe) const
+{
+    auto it = std::upper_bound(m_keyframes.begin(), m_keyframes.end(), pts, [](int64_t value, const KEYFRAME & keyframe) { return (value < keyframe.m_pts); });
+
+    if (it == m_keyframes.begin())
+    {
+        return false;
+    }
+
+    *keyframe = *(--it);
+
+    return true;
+}
+
+void FFmpeg_KeyframeIndex::set_complete()
+{
+    m_complete = true;
+}
+
+bool FFmpeg_KeyframeIndex::complete() const
+{
+    return m_complete;
+}
+
+int FFmpeg_KeyframeIndex::stream_idx() const
+{
+    return m_stream_idx;
+}
+
+size_t FFmpeg_KeyframeIndex::size() const
+{
+    return m_keyframes.size();
+}
+
+const FFmpeg_KeyframeIndex::KEYFRAME * FFmpeg_KeyframeIndex::data() const
+{
+    return m_keyframes.data();
+}
@@ -0,0 +1,126 @@
+/*
+ * Copyright (C) 2017-2026 Norbert Schlia (nschlia@oblivion-software.de)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * On Debian systems, the complete text of the GNU General Public License
+ * Version 3 can be found in `/usr/share/common-licenses/GPL-3'.
+ */
+
+/**
+ * @file ffmpeg_keyframeindex.h
+ * @brief Key frame index of a source file.
+ *
+ * @ingroup ffmpegfs
+ *
+ * @author Norbert Schlia (nschlia@oblivion-software.de)
+ * @copyright Copyright (C) 2017-2026 Norbert Schlia (nschlia@oblivion-software.de)
+ */
+
+#ifndef FFMPEG_KEYFRAMEINDEX_H
+#define FFMPEG_KEYFRAMEINDEX_H
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * @brief Positions of all key frames of the video stream of a source file.
+ *
+ * Recorded while a file is read from start to end, and kept in the cache
+ * index. With it, a seek goes straight to the byte position of the last key
+ * frame before the target. The demuxer does not need to search for it, and
+ * no frames before that key frame need to be read and decoded.
+ *
+ * Key frames are sorted by presentation time stamp, in the time base of the
+ * video stream.
+ */
+class FFmpeg_KeyframeIndex
+{
+public:
+    /**
+     * @brief Key frame entry
+     */
+    typedef struct KEYFRAME
+    {
+        int64_t     m_pts;                          /**< @brief Presentation time stamp in the time base of the stream */
+        int64_t     m_pos;                          /**< @brief Byte position of the packet in the input file */
+    } KEYFRAME;
+
+    /**
+     * @brief Construct an empty index.
+     */
+    FFmpeg_KeyframeIndex();
+
+    /**
+     * @brief Remove all entries and start a new index.
+     * @param[in] stream_idx - Index of the video stream in the input file.
+     */
+    void            reset(int stream_idx);
+    /**
+     * @brief Set the index from data stored before.
+     * @param[in] stream_idx - Index of the video stream in the input file.
+     * @param[in] data - Entries as returned by data().
+     * @param[in] size - Size of the data in bytes.
+     * @return Returns true on success; false if the data is not a valid index.
+     */
+    bool            assign(int stream_idx, const void *data, size_t size);
+    /**
+     * @brief Add a key frame.
+     * @param[in] pts - Presentation time stamp in the time base of the stream.
+     * @param[in] pos - Byte position of the packet in the input file.
+     */
+    void            add(int64_t pts, int64_t pos);
+    /**
+     * @brief Find the last key frame at or before a time stamp.
+     * @param[in] pts - Time stamp to look for, in the time base of the stream.
+     * @param[out] keyframe - Key frame found.
+     * @return Returns true if found; false if there is no key frame before pts.
+     */
+    bool            find(int64_t pts, KEYFRAME *keyframe) const;
+    /**
+     * @brief Mark the index complete, i.e., all key frames of the file have been added.
+     */
+    void            set_complete();
+    /**
+     * @brief Check if the index contains all key frames of the file.
+     * @return Returns true if complete; false if not.
+     */
+    bool            complete() const;
+    /**
+     * @brief Get the video stream the index was built for.
+     * @return Returns the index of the stream in the input file.
+     */
+    int             stream_idx() const;
+    /**
+     * @brief Get the number of key frames.
+     * @return Returns the number of key frames.
+     */
+    size_t          size() const;
+    /**
+     * @brief Get all entries, e.g. to store them.
+     * @return Returns a pointer to size() entries.
+     */
+    const KEYFRAME *data() const;
+
+protected:
+    std::vector<KEYFRAME>   m_keyframes;            /**< @brief Key frames, sorted by time stamp */
+    int                     m_stream_idx;           /**< @brief Index of the video stream in the input file */
+    bool                    m_complete;             /**< @brief All key frames of the file have been added */
+};
+
+#endif // FFMPEG_KEYFRAMEINDEX_H
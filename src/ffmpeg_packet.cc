@@ -28,8 +28,91 @@ extern "C" {
 
 #include "ffmpeg_packet.h"
 
+#include <vector>
+
+#define MAX_POOLED_PACKETS  32      /**< @brief Max. number of free AVPacket structs kept per thread */
+
+/**
+ * @brief Free AVPacket structs of a thread, kept for reuse.
+ *
+ * Works like the frame pool in ffmpeg_frame.cc: one pool per transcoder
+ * thread, no locking, freed when the thread exits.
+ */
+class Packet_Pool
+{
+public:
+    /**
+     * @brief Free all pooled packets.
+     */
+    ~Packet_Pool()
+    {
+        for (AVPacket *packet : m_packets)
+        {
+            av_packet_free(&packet);
+        }
+        m_packets.clear();
+        m_destroyed = true;
+    }
+
+    /**
+     * @brief Get a blank packet, from the pool if possible.
+     * @return Returns a blank AVPacket struct, or nullptr if out of memory.
+     */
+    AVPacket * alloc()
+    {
+        if (m_destroyed || m_packets.empty())
+        {
+            return av_packet_alloc();
+        }
+
+        AVPacket *packet = m_packets.back();
+        m_packets.pop_back();
+        return packet;
+    }
+
+    /**
+     * @brief Unreference a packet and put it back to the pool, or free it if the pool is full.
+     * @param[inout] packet - Packet to release, set to nullptr.
+     */
+    void release(AVPacket **packet)
+    {
+        if (m_destroyed || m_packets.size() >= MAX_POOLED_PACKETS)
+        {
+            av_packet_free(packet);
+            return;
+        }
+
+        av_packet_unref(*packet);
+        m_packets.push_back(*packet);
+        *packet = nullptr;
+    }
+
+    /**
+     * @brief Make a new reference to a packet, like av_packet_clone(), using a pooled packet.
+     * @param[in] src - Packet to reference.
+     * @return Returns the new packet, or nullptr on error.
+     */
+    AVPacket * clone(const AVPacket *src)
+    {
+        AVPacket *packet = alloc();
+
+        if (packet != nullptr && av_packet_ref(packet, src) < 0)
+        {
+            release(&packet);
+        }
+
+        return packet;
+    }
+
+protected:
+    std::vector<AVPacket*>  m_packets;              /**< @brief Free packets */
+    bool                    m_destroyed = false;    /**< @brief Set when the thread exits, packets destructed afterwards are freed */
+};
+
+static thread_local Packet_Pool packet_pool;    /**< @brief Free packets of the current thread */
+
 FFmpeg_Packet::FFmpeg_Packet(int stream_index) :
-    m_packet(av_packet_alloc()),
+    m_packet(packet_pool.alloc()),
     m_res(0)
 {
     m_res = (m_packet != nullptr) ? 0 : AVERROR(ENOMEM);
@@ -46,7 +129,7 @@ FFmpeg_Packet::FFmpeg_Packet(const AVPacket *packet) :
 {
     if (packet != nullptr)
     {
-        m_packet = av_packet_clone(packet);
+        m_packet = packet_pool.clone(packet);
         m_res = (m_packet != nullptr) ? 0 : AVERROR(ENOMEM);
     }
     else
@@ -61,7 +144,7 @@ FFmpeg_Packet::FFmpeg_Packet(const FFmpeg_Packet &packet) :
 {
     if (packet.m_packet != nullptr)
     {
-        m_packet = av_packet_clone(packet.m_packet);
+        m_packet = packet_pool.clone(packet.m_packet);
         m_res = (m_packet != nullptr) ? 0 : AVERROR(ENOMEM);
     }
     else
@@ -92,7 +175,7 @@ FFmpeg_Packet& FFmpeg_Packet::operator=(const FFmpeg_Packet &packet) noexcept
 
         if (packet.m_packet != nullptr)
         {
-            new_packet = av_packet_clone(packet.m_packet);
+            new_packet = packet_pool.clone(packet.m_packet);
             new_res = (new_packet != nullptr) ? 0 : AVERROR(ENOMEM);
         }
 
@@ -130,7 +213,7 @@ FFmpeg_Packet& FFmpeg_Packet::operator=(const AVPacket *packet) noexcept
 
         if (packet != nullptr)
         {
-            new_packet = av_packet_clone(packet);
+            new_packet = packet_pool.clone(packet);
             new_res = (new_packet != nullptr) ? 0 : AVERROR(ENOMEM);
         }
 
@@ -165,8 +248,7 @@ void FFmpeg_Packet::free()
 {
     if (m_packet != nullptr)
     {
-        av_packet_free(&m_packet);
-        m_packet = nullptr;
+        packet_pool.release(&m_packet);
     }
 }
 
@@ -0,0 +1,346 @@
+/*
+ * Copyright (C) 2017-2026 Norbert Schlia (nschlia@oblivion-software.de)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * On Debian systems, the complete text of the GNU General Public License
+ * Version 3 can be found in `/usr/share/common-licenses/GPL-3'.
+ */
+
+/**
+ * @file ffmpeg_pipeline.cc
+ * @brief Decoder stage running in a thread of its own
+ *
+ * @ingroup ffmpegfs
+ *
+ * @author Norbert Schlia (nschlia@oblivion-software.de)
+ * @copyright Copyright (C) 2017-2026 Norbert Schlia (nschlia@oblivion-software.de)
+ */
+
+#include "ffmpeg_pipeline.h"
+
+#include <system_error>
+
+FFmpeg_Pipeline::FFmpeg_Pipeline(size_t capacity, const STAGE & stage)
+    : m_mask(0)
+    , m_head(0)
+    , m_tail(0)
+    , m_stage(stage)
+    , m_producer_waiting(false)
+    , m_consumer_waiting(false)
+    , m_stop(false)
+    , m_pause(false)
+    , m_idle(true)
+    , m_finished(true)
+    , m_eof(false)
+    , m_result(0)
+    , m_epoch(0)
+    , m_stage_epoch(0)
+{
+    size_t size = 2;
+
+    while (size < capacity)
+    {
+        size <<= 1;
+    }
+
+    m_slots.resize(size);
+    m_mask = size - 1;
+}
+
+FFmpeg_Pipeline::~FFmpeg_Pipeline()
+{
+    stop();
+}
+
+bool FFmpeg_Pipeline::start()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if (m_thread.joinable())
+    {
+        return true;
+    }
+
+    m_stop      = false;
+    m_pause     = false;
+    m_idle      = false;
+    m_finished  = false;
+    m_eof       = false;
+    m_result    = 0;
+
+    try
+    {
+        // The thread waits for the lock before it starts, so m_thread_id is set in time
+        m_thread    = std::thread(&FFmpeg_Pipeline::run, this);
+        m_thread_id = m_thread.get_id();
+    }
+    catch (const std::system_error &)
+    {
+        m_idle      = true;
+        m_finished  = true;
+        return false;
+    }
+
+    return true;
+}
+
+void FFmpeg_Pipeline::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        m_stop = true;
+        m_cond.notify_all();
+    }
+
+    if (m_thread.joinable())
+    {
+        m_thread.join();
+    }
+
+    // Drop frames not received
+    size_t tail = m_tail.load();
+
+    for (size_t head = m_head.load(); head != tail; head++)
+    {
+        m_slots[head & m_mask].m_multiframe.reset();
+    }
+    m_head.store(tail);
+
+    m_thread_id = std::thread::id();
+}
+
+bool FFmpeg_Pipeline::is_decoder_thread() const
+{
+    return (std::this_thread::get_id() == m_thread_id);
+}
+
+bool FFmpeg_Pipeline::push(int64_t pos, MULTIFRAME && multiframe)
+{
+    size_t tail = m_tail.load(std::memory_order_relaxed);   // Only written by this thread
+
+    if (m_stop || m_pause || m_epoch != m_stage_epoch)
+    {
+        // Shutting down, going to seek, or decoded from before a seek
+        return false;
+    }
+
+    if (tail - m_head.load() > m_mask)
+    {
+        // Ring is full, wait for the encoder to catch up. This does not count
+        // as idle: if the transcoder wants to pause us, give up the frame so
+        // that the stage function returns to run() first.
+        std::unique_lock<std::mutex> lock(m_mutex);
+
+        m_producer_waiting  = true;
+
+        m_cond.wait(lock, [&]{ return (m_stop || m_pause || m_epoch != m_stage_epoch || tail - m_head.load() <= m_mask); });
+
+        m_producer_waiting  = false;
+
+        if (m_stop || m_pause || m_epoch != m_stage_epoch)
+        {
+            return false;
+        }
+    }
+
+    SLOT & slot = m_slots[tail & m_mask];
+
+    slot.m_pos = pos;
+    slot.m_multiframe.emplace(std::move(multiframe));
+
+    m_tail.store(tail + 1);
+
+    wake(m_consumer_waiting);
+
+    return true;
+}
+
+int FFmpeg_Pipeline::receive(FFmpeg_ReorderBuffer & frame_map, int *finished)
+{
+    *finished = 0;
+
+    for (;;)
+    {
+        size_t head = m_head.load(std::memory_order_relaxed);  // Only written by this thread
+        size_t tail = m_tail.load();
+
+        if (head != tail)
+        {
+            for (; head != tail; head++)
+            {
+                SLOT & slot = m_slots[head & m_mask];
+
+                frame_map.push(slot.m_pos, std::move(*slot.m_multiframe));
+                slot.m_multiframe.reset();
+            }
+
+            m_head.store(head);
+
+            wake(m_producer_waiting);
+
+            return 0;
+        }
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+
+        m_consumer_waiting = true;
+
+        m_cond.wait(lock, [&]{ return (m_tail.load() != head || m_eof || m_finished); });
+
+        m_consumer_waiting = false;
+
+        if (m_tail.load() != head)
+        {
+            continue;
+        }
+
+        if (m_eof)
+        {
+            // All frames received
+            if (!m_result)
+            {
+                *finished = 1;
+            }
+            return m_result;
+        }
+
+        // Stopped without reaching the end of input
+        return AVERROR_EXIT;
+    }
+}
+
+void FFmpeg_Pipeline::pause()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    m_pause = true;
+    m_cond.notify_all();    // Wake up push() if waiting for room in the ring
+
+    m_cond.wait(lock, [&]{ return (m_idle || m_finished); });
+}
+
+bool FFmpeg_Pipeline::resume()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    m_pause = false;
+    m_cond.notify_all();
+
+    if (!m_finished || m_eof || m_stop || !m_thread.joinable())
+    {
+        return true;
+    }
+
+    // Finished before, but flushed after a seek: decode again from the new position
+    lock.unlock();
+
+    m_thread.join();
+
+    return start();
+}
+
+void FFmpeg_Pipeline::flush()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    // The decoder is idle outside of the stage function, so the tail does not change
+    size_t tail = m_tail.load();
+
+    for (size_t head = m_head.load(); head != tail; head++)
+    {
+        m_slots[head & m_mask].m_multiframe.reset();
+    }
+    m_head.store(tail);
+
+    m_epoch++;
+    m_eof       = false;
+    m_result    = 0;
+
+    m_cond.notify_all();
+}
+
+void FFmpeg_Pipeline::run()
+{
+    {
+        // Wait until start() is done
+        std::lock_guard<std::mutex> lock(m_mutex);
+    }
+
+    for (;;)
+    {
+        if (m_pause || m_stop)
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+
+            m_idle = true;
+            m_cond.notify_all();
+
+            m_cond.wait(lock, [&]{ return (!m_pause || m_stop); });
+
+            m_idle = false;
+
+            if (m_stop)
+            {
+                break;
+            }
+        }
+
+        int finished = 0;
+        int ret;
+
+        m_stage_epoch = m_epoch;
+
+        ret = m_stage(&finished);
+
+        if (m_epoch != m_stage_epoch)
+        {
+            // Flushed while decoding, the result refers to the old position
+            continue;
+        }
+
+        if (ret == AVERROR_EXIT && (m_pause || m_stop))
+        {
+            // push() gave up a frame, interrupted to pause or stop
+            continue;
+        }
+
+        if (ret < 0 || finished)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+
+            m_result    = (ret < 0) ? ret : 0;
+            m_eof       = true;
+            break;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    m_idle      = true;
+    m_finished  = true;
+    m_cond.notify_all();
+}
+
+void FFmpeg_Pipeline::wake(const std::atomic_bool & waiting)
+{
+    if (waiting)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        m_cond.notify_all();
+    }
+}
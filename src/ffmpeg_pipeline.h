@@ -0,0 +1,180 @@
+/*
+ * Copyright (C) 2017-2026 Norbert Schlia (nschlia@oblivion-software.de)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * On Debian systems, the complete text of the GNU General Public License
+ * Version 3 can be found in `/usr/share/common-licenses/GPL-3'.
+ */
+
+/**
+ * @file ffmpeg_pipeline.h
+ * @brief Decoder stage running in a thread of its own.
+ *
+ * @ingroup ffmpegfs
+ *
+ * @author Norbert Schlia (nschlia@oblivion-software.de)
+ * @copyright Copyright (C) 2017-2026 Norbert Schlia (nschlia@oblivion-software.de)
+ */
+
+#ifndef FFMPEG_PIPELINE_H
+#define FFMPEG_PIPELINE_H
+
+#pragma once
+
+#include "ffmpeg_reorderbuffer.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief Runs the decoder stage of a transcoder in a separate thread.
+ *
+ * The stage function reads, decodes, filters and converts input and hands
+ * the frames to push(). They are passed through a bounded single producer,
+ * single consumer ring to the transcoder thread, which collects them with
+ * receive() and encodes them. Adding and removing frames only takes atomic
+ * operations; the mutex is only used to sleep when the ring is full or empty.
+ *
+ * When the ring is full, the decoder waits, so it never gets more than the
+ * ring size ahead of the encoder. Before the transcoder touches decoder state
+ * itself, e.g. to seek, it calls pause(). This interrupts the stage function:
+ * push() refuses further frames, the stage function returns AVERROR_EXIT,
+ * and pause() returns once the decoder thread is idle between two calls of
+ * the stage function. The frames the interrupted call had not added are
+ * lost, so pause() must be followed by a seek and flush(), which drops all
+ * frames decoded from the old position.
+ */
+class FFmpeg_Pipeline
+{
+public:
+    typedef FFmpeg_ReorderBuffer::MULTIFRAME MULTIFRAME;        /**< @brief Combined audio/videoframe and subtitle */
+    /**
+     * @brief Decoder stage function
+     * Decodes the next part of the input and adds the frames with push().
+     * Sets finished to 1 at the end of input. Returns 0 on success, or a
+     * negative AVERROR value on error. Must return AVERROR_EXIT as soon as
+     * push() fails.
+     */
+    typedef std::function<int(int *finished)> STAGE;
+
+    /**
+     * @brief Construct a pipeline.
+     * @param[in] capacity - Max. number of frames decoded ahead, rounded up to a power of two.
+     * @param[in] stage - Decoder stage function.
+     */
+    FFmpeg_Pipeline(size_t capacity, const STAGE & stage);
+    /**
+     * @brief Stop the decoder thread and release all frames.
+     */
+    virtual ~FFmpeg_Pipeline();
+
+    FFmpeg_Pipeline(const FFmpeg_Pipeline&) = delete;
+    FFmpeg_Pipeline& operator=(const FFmpeg_Pipeline&) = delete;
+
+    /**
+     * @brief Start the decoder thread.
+     * @return Returns true on success; false if the thread could not be created.
+     */
+    bool            start();
+    /**
+     * @brief Stop the decoder thread and drop all frames not yet received.
+     */
+    void            stop();
+    /**
+     * @brief Check if the calling thread is the decoder thread.
+     * @return Returns true if called by the decoder thread; false if not.
+     */
+    bool            is_decoder_thread() const;
+    /**
+     * @brief Add a frame, called by the stage function.
+     * Waits until there is room in the ring. If it fails, the stage function
+     * must return AVERROR_EXIT without decoding any further.
+     * @param[in] pos - Position of the frame in AV_TIME_BASE units.
+     * @param[in] multiframe - Frame or subtitle, moved into the ring.
+     * @return Returns true if the frame was added; false if dropped because the pipeline is stopping, pausing or was flushed.
+     */
+    bool            push(int64_t pos, MULTIFRAME && multiframe);
+    /**
+     * @brief Move all decoded frames to the reorder buffer.
+     * Waits until at least one frame has been decoded or the decoder has
+     * finished.
+     * @param[in] frame_map - Reorder buffer to add the frames to.
+     * @param[out] finished - Set to 1 if the decoder has reached the end of input and all frames have been received.
+     * @return On success, returns 0; on error, the negative AVERROR value returned by the stage function, after all frames decoded before the error have been received.
+     */
+    int             receive(FFmpeg_ReorderBuffer & frame_map, int *finished);
+    /**
+     * @brief Interrupt the decoder, wait until it has left the stage function and keep it from continuing until resume() is called.
+     */
+    void            pause();
+    /**
+     * @brief Let the decoder continue after pause(). Restarts the decoder thread if it has finished and was flushed since.
+     * @return Returns true on success; false if the thread could not be restarted.
+     */
+    bool            resume();
+    /**
+     * @brief Drop all frames not yet received, and the end of input or an error if reported. Call while paused.
+     */
+    void            flush();
+
+protected:
+    /**
+     * @brief Decoder thread
+     */
+    void            run();
+    /**
+     * @brief Wake up the other thread if it is waiting.
+     * @param[in] waiting - Flag set by the thread while it sleeps.
+     */
+    void            wake(const std::atomic_bool & waiting);
+
+protected:
+    /**
+     * @brief Ring buffer slot
+     */
+    typedef struct SLOT
+    {
+        int64_t                     m_pos;          /**< @brief Position of the frame */
+        std::optional<MULTIFRAME>   m_multiframe;   /**< @brief Frame or subtitle, empty if the slot is unused */
+    } SLOT;
+
+    std::vector<SLOT>       m_slots;                /**< @brief Ring buffer, size is a power of two */
+    size_t                  m_mask;                 /**< @brief Size of the ring minus one */
+    std::atomic_size_t      m_head;                 /**< @brief Number of frames received, only written by the transcoder thread */
+    std::atomic_size_t      m_tail;                 /**< @brief Number of frames added, only written by the decoder thread */
+    STAGE                   m_stage;                /**< @brief Decoder stage function */
+    std::thread             m_thread;               /**< @brief Decoder thread */
+    std::thread::id         m_thread_id;            /**< @brief ID of the decoder thread */
+    std::mutex              m_mutex;                /**< @brief Protects the flags below when sleeping or waking up */
+    std::condition_variable m_cond;                 /**< @brief Signalled when a frame was added or removed, or the state changed */
+    std::atomic_bool        m_producer_waiting;     /**< @brief Decoder thread is waiting for room in the ring */
+    std::atomic_bool        m_consumer_waiting;     /**< @brief Transcoder thread is waiting for frames */
+    std::atomic_bool        m_stop;                 /**< @brief Decoder thread should exit */
+    std::atomic_bool        m_pause;                /**< @brief Decoder thread should wait */
+    bool                    m_idle;                 /**< @brief Decoder thread is paused or not running, never set while inside the stage function */
+    bool                    m_finished;             /**< @brief Decoder thread has exited */
+    std::atomic_bool        m_eof;                  /**< @brief Decoder has reached the end of input or failed */
+    int                     m_result;               /**< @brief Result of the stage function, 0 or a negative AVERROR value */
+    std::atomic_uint64_t    m_epoch;                /**< @brief Incremented by flush() */
+    uint64_t                m_stage_epoch;          /**< @brief Epoch when the current call of the stage function started; if flushed since, its frames are dropped */
+};
+
+#endif // FFMPEG_PIPELINE_H
@@ -0,0 +1,215 @@
+/*
+ * Copyright (C) 2017-2026 Norbert Schlia (nschlia@oblivion-software.de)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * On Debian systems, the complete text of the GNU General Public License
+ * Version 3 can be found in `/usr/share/common-licenses/GPL-3'.
+ */
+
+/**
+ * @file ffmpeg_reorderbuffer.cc
+ * @brief Timestamp ordered buffer for decoded frames and subtitles
+ *
+ * @ingroup ffmpegfs
+ *
+ * @author Norbert Schlia (nschlia@oblivion-software.de)
+ * @copyright Copyright (C) 2017-2026 Norbert Schlia (nschlia@oblivion-software.de)
+ */
+
+#include "ffmpeg_reorderbuffer.h"
+
+#define MIN_LANE_SLOTS  64      /**< @brief Initial ring size of a lane, about two seconds of video */
+
+FFmpeg_ReorderBuffer::FFmpeg_ReorderBuffer()
+    : m_size(0)
+    , m_seq(0)
+{
+}
+
+void FFmpeg_ReorderBuffer::push(int64_t pos, MULTIFRAME && multiframe)
+{
+    int stream_idx = std::visit([](const auto & frame) { return frame.m_stream_idx; }, multiframe);
+    LANE & l = lane(stream_idx);
+
+    if (l.m_count == l.m_slots.size())
+    {
+        grow(l);
+    }
+
+    // Frames of a stream practically always come in order, then this is an append.
+    // Otherwise move later frames up; frames with the same position stay in order.
+    size_t n = l.m_count;
+    while (n > 0 && slot(l, n - 1).m_pos > pos)
+    {
+        SLOT & prev = slot(l, n - 1);
+        SLOT & next = slot(l, n);
+
+        next.m_pos          = prev.m_pos;
+        next.m_seq          = prev.m_seq;
+        next.m_multiframe   = std::move(prev.m_multiframe);
+        n--;
+    }
+
+    SLOT & s = slot(l, n);
+
+    s.m_pos = pos;
+    s.m_seq = m_seq++;
+    s.m_multiframe.emplace(std::move(multiframe));
+
+    l.m_count++;
+    m_size++;
+}
+
+FFmpeg_ReorderBuffer::MULTIFRAME FFmpeg_ReorderBuffer::pop()
+{
+    LANE & l = m_lanes[front_lane()];
+    SLOT & s = slot(l, 0);
+    MULTIFRAME multiframe(std::move(*s.m_multiframe));
+
+    s.m_multiframe.reset();
+
+    l.m_head = (l.m_head + 1) % l.m_slots.size();
+    l.m_count--;
+    m_size--;
+
+    return multiframe;
+}
+
+int64_t FFmpeg_ReorderBuffer::front_pos() const
+{
+    return slot(m_lanes[front_lane()], 0).m_pos;
+}
+
+int64_t FFmpeg_ReorderBuffer::back_pos() const
+{
+    bool found = false;
+    int64_t pos = 0;
+
+    for (const LANE & l : m_lanes)
+    {
+        if (l.m_count && (!found || slot(l, l.m_count - 1).m_pos > pos))
+        {
+            pos     = slot(l, l.m_count - 1).m_pos;
+            found   = true;
+        }
+    }
+
+    return pos;
+}
+
+bool FFmpeg_ReorderBuffer::empty() const
+{
+    return !m_size;
+}
+
+size_t FFmpeg_ReorderBuffer::size() const
+{
+    return m_size;
+}
+
+void FFmpeg_ReorderBuffer::clear()
+{
+    for (LANE & l : m_lanes)
+    {
+        for (size_t n = 0; n < l.m_count; n++)
+        {
+            slot(l, n).m_multiframe.reset();
+        }
+        l.m_head    = 0;
+        l.m_count   = 0;
+    }
+    m_size = 0;
+}
+
+FFmpeg_ReorderBuffer::LANE & FFmpeg_ReorderBuffer::lane(int stream_idx)
+{
+    // Only a handful of streams, a linear search is fastest
+    for (LANE & l : m_lanes)
+    {
+        if (l.m_stream_idx == stream_idx)
+        {
+            return l;
+        }
+    }
+
+    LANE l;
+
+    l.m_stream_idx  = stream_idx;
+    l.m_head        = 0;
+    l.m_count       = 0;
+
+    m_lanes.push_back(std::move(l));
+
+    return m_lanes.back();
+}
+
+size_t FFmpeg_ReorderBuffer::front_lane() const
+{
+    size_t front = m_lanes.size();
+
+    for (size_t n = 0; n < m_lanes.size(); n++)
+    {
+        const LANE & l = m_lanes[n];
+
+        if (!l.m_count)
+        {
+            continue;
+        }
+
+        if (front == m_lanes.size())
+        {
+            front = n;
+            continue;
+        }
+
+        const SLOT & s      = slot(l, 0);
+        const SLOT & best   = slot(m_lanes[front], 0);
+
+        if (s.m_pos < best.m_pos || (s.m_pos == best.m_pos && s.m_seq < best.m_seq))
+        {
+            front = n;
+        }
+    }
+
+    return front;
+}
+
+void FFmpeg_ReorderBuffer::grow(LANE & lane)
+{
+    std::vector<SLOT> slots(lane.m_slots.empty() ? MIN_LANE_SLOTS : lane.m_slots.size() * 2);
+
+    for (size_t n = 0; n < lane.m_count; n++)
+    {
+        SLOT & s = slot(lane, n);
+
+        slots[n].m_pos          = s.m_pos;
+        slots[n].m_seq          = s.m_seq;
+        slots[n].m_multiframe   = std::move(s.m_multiframe);
+    }
+
+    lane.m_slots.swap(slots);
+    lane.m_head = 0;
+}
+
+FFmpeg_ReorderBuffer::SLOT & FFmpeg_ReorderBuffer::slot(LANE & lane, size_t n)
+{
+    return lane.m_slots[(lane.m_head + n) % lane.m_slots.size()];
+}
+
+const FFmpeg_ReorderBuffer::SLOT & FFmpeg_ReorderBuffer::slot(const LANE & lane, size_t n)
+{
+    return lane.m_slots[(lane.m_head + n) % lane.m_slots.size()];
+}
@@ -0,0 +1,166 @@
+/*
+ * Copyright (C) 2017-2026 Norbert Schlia (nschlia@oblivion-software.de)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * On Debian systems, the complete text of the GNU General Public License
+ * Version 3 can be found in `/usr/share/common-licenses/GPL-3'.
+ */
+
+/**
+ * @file ffmpeg_reorderbuffer.h
+ * @brief Timestamp ordered buffer for decoded frames and subtitles.
+ *
+ * @ingroup ffmpegfs
+ *
+ * @author Norbert Schlia (nschlia@oblivion-software.de)
+ * @copyright Copyright (C) 2017-2026 Norbert Schlia (nschlia@oblivion-software.de)
+ */
+
+#ifndef FFMPEG_REORDERBUFFER_H
+#define FFMPEG_REORDERBUFFER_H
+
+#pragma once
+
+#include "ffmpeg_utils.h"
+#include "ffmpeg_frame.h"
+#include "ffmpeg_subtitle.h"
+
+#include <variant>
+#include <optional>
+#include <vector>
+
+/**
+ * @brief Reorder buffer for decoded audio/video frames and subtitles.
+ *
+ * Frames are kept in one ring buffer per stream, sorted by position.
+ * Within each stream frames practically always arrive in order, so adding
+ * a frame is an append, and the next frame to be encoded is the smallest
+ * head of all rings. Frames with the same position are returned in the
+ * order they were added, like std::multimap does.
+ *
+ * Ring slots are reused, and the rings only grow until they can hold the
+ * frames of the buffer delay. After that, adding and removing frames does
+ * not allocate memory.
+ */
+class FFmpeg_ReorderBuffer
+{
+public:
+    typedef std::variant<FFmpeg_Frame, FFmpeg_Subtitle> MULTIFRAME;   /**< @brief Combined audio/videoframe and subtitle */
+
+    /**
+     * @brief Construct an empty buffer.
+     */
+    FFmpeg_ReorderBuffer();
+
+    /**
+     * @brief Add a frame or subtitle.
+     * @param[in] pos - Position of the frame in AV_TIME_BASE units.
+     * @param[in] multiframe - Frame or subtitle, moved into the buffer.
+     */
+    void            push(int64_t pos, MULTIFRAME && multiframe);
+    /**
+     * @brief Remove the frame or subtitle with the lowest position.
+     * The buffer must not be empty.
+     * @return Returns the frame or subtitle removed.
+     */
+    MULTIFRAME      pop();
+    /**
+     * @brief Get the lowest position in the buffer.
+     * The buffer must not be empty.
+     * @return Returns the position of the frame pop() will return next.
+     */
+    int64_t         front_pos() const;
+    /**
+     * @brief Get the highest position in the buffer.
+     * The buffer must not be empty.
+     * @return Returns the highest position.
+     */
+    int64_t         back_pos() const;
+    /**
+     * @brief Check if the buffer is empty.
+     * @return Returns true if empty; false if not.
+     */
+    bool            empty() const;
+    /**
+     * @brief Get the number of frames and subtitles in the buffer.
+     * @return Returns the number of frames and subtitles.
+     */
+    size_t          size() const;
+    /**
+     * @brief Remove all frames and subtitles. Memory is kept for reuse.
+     */
+    void            clear();
+
+protected:
+    /**
+     * @brief Ring buffer slot
+     */
+    typedef struct SLOT
+    {
+        int64_t                     m_pos;          /**< @brief Position of the frame */
+        uint64_t                    m_seq;          /**< @brief Sequence number, keeps frames with the same position in order */
+        std::optional<MULTIFRAME>   m_multiframe;   /**< @brief Frame or subtitle, empty if the slot is unused */
+    } SLOT;
+
+    /**
+     * @brief Frames of one stream, sorted by position and sequence number
+     */
+    typedef struct LANE
+    {
+        int                 m_stream_idx;           /**< @brief Stream index */
+        std::vector<SLOT>   m_slots;                /**< @brief Ring buffer */
+        size_t              m_head;                 /**< @brief Index of the first frame */
+        size_t              m_count;                /**< @brief Number of frames */
+    } LANE;
+
+    /**
+     * @brief Get the lane of a stream, add one if not yet present.
+     * @param[in] stream_idx - Stream index.
+     * @return Returns the lane.
+     */
+    LANE &          lane(int stream_idx);
+    /**
+     * @brief Get the lane with the lowest head.
+     * @return Returns the index of the lane, or m_lanes.size() if empty.
+     */
+    size_t          front_lane() const;
+    /**
+     * @brief Double the size of a lane's ring, keeping the frames in order.
+     * @param[in] lane - Lane to grow.
+     */
+    static void     grow(LANE & lane);
+    /**
+     * @brief Get a slot of a lane.
+     * @param[in] lane - Lane.
+     * @param[in] n - Number of the frame, counted from the head.
+     * @return Returns the slot.
+     */
+    static SLOT &   slot(LANE & lane, size_t n);
+    /**
+     * @brief Get a slot of a lane.
+     * @param[in] lane - Lane.
+     * @param[in] n - Number of the frame, counted from the head.
+     * @return Returns the slot.
+     */
+    static const SLOT & slot(const LANE & lane, size_t n);
+
+protected:
+    std::vector<LANE>   m_lanes;                    /**< @brief One lane per stream */
+    size_t              m_size;                     /**< @brief Total number of frames */
+    uint64_t            m_seq;                      /**< @brief Next sequence number */
+};
+
+#endif // FFMPEG_REORDERBUFFER_H
@@ -55,6 +55,24 @@ public:
      * @brief Destruct FFmpeg_Subtitle object.
      */
     virtual ~FFmpeg_Subtitle() = default;
+    /**
+     * @brief Copy construct from FFmpeg_Subtitle object. Shares the subtitle.
+     */
+    FFmpeg_Subtitle(const FFmpeg_Subtitle &) = default;
+    /**
+     * @brief Move construct from FFmpeg_Subtitle object.
+     */
+    FFmpeg_Subtitle(FFmpeg_Subtitle &&) noexcept = default;
+    /**
+     * @brief Make copy from other FFmpeg_Subtitle object. Shares the subtitle.
+     * @return Reference to this FFmpeg_Subtitle object.
+     */
+    FFmpeg_Subtitle& operator=(const FFmpeg_Subtitle &) = default;
+    /**
+     * @brief Move from other FFmpeg_Subtitle object.
+     * @return Reference to this FFmpeg_Subtitle object.
+     */
+    FFmpeg_Subtitle& operator=(FFmpeg_Subtitle &&) noexcept = default;
     /**
      * @brief Get result of last operation
      * @return Returns 0 if last operation was successful, or negative AVERROR value.
@@ -39,7 +39,6 @@ extern "C" {
 #include <libswscale/swscale.h>
 #include <libavutil/imgutils.h>
 #include <libavutil/opt.h>
-#include <libavutil/audio_fifo.h>
 #include <libavfilter/avfilter.h>
 #include <libavfilter/buffersink.h>
 #include <libavfilter/buffersrc.h>
@@ -66,6 +65,7 @@ extern "C" {
 #include <thread>
 
 #define FRAME_SEEK_THRESHOLD    25  /**< @brief Ignore seek if target is within the next n frames */
+#define AUDIO_FIFO_LOOKAHEAD    8192    /**< @brief Samples per decoded audio frame assumed if the decoder does not tell */
 
 const std::vector<FFmpeg_Transcoder::PRORES_BITRATE> FFmpeg_Transcoder::m_prores_bitrate =
 {
@@ -143,6 +143,8 @@ const std::vector<FFmpeg_Transcoder::PRORES_BITRATE> FFmpeg_Transcoder::m_prores
     {	8192,	4320,	{ {	60,	false }                   },	{	1556,	3500,	5028,	7542,	11313,	16970	}	}
 };
 
+std::atomic_int FFmpeg_Transcoder::m_threads_used(0);
+
 const FFmpeg_Transcoder::DEVICETYPE_MAP FFmpeg_Transcoder::m_devicetype_map =
 {
     { AV_HWDEVICE_TYPE_VAAPI,           AV_PIX_FMT_NV12 },          ///< VAAPI uses the NV12 pix format
@@ -172,7 +174,8 @@ FFmpeg_Transcoder::StreamRef::StreamRef() :
     m_codec_ctx(nullptr),
     m_stream(nullptr),
     m_stream_idx(INVALID_STREAM),
-    m_start_time(0)
+    m_start_time(0),
+    m_time_base({ 0, 1 })
 {
 
 }
@@ -223,13 +226,19 @@ FFmpeg_Transcoder::FFmpeg_Transcoder()
     , m_is_video(false)
     , m_cur_sample_fmt(AV_SAMPLE_FMT_NONE)
     , m_cur_sample_rate(-1)
+    , m_audio_frames_passed(0)
+    , m_sws_threads(0)
     , m_buffer_sink_context(nullptr)
     , m_buffer_source_context(nullptr)
     , m_filter_graph(nullptr)
+    , m_filter_threads(0)
     , m_pts(AV_NOPTS_VALUE)
     , m_pos(AV_NOPTS_VALUE)
     , m_current_segment(1)
     , m_insert_keyframe(true)
+    , m_keyframe_segment(1)
+    , m_build_keyframe_index(false)
+    , m_keyframe_index_built(false)
     , m_copy_audio(false)
     , m_copy_video(false)
     , m_cur_audio_ts(0)
@@ -238,6 +247,8 @@ FFmpeg_Transcoder::FFmpeg_Transcoder()
     , m_buffer(nullptr)
     , m_reset_pts(0)
     , m_fake_frame_no(0)
+    , m_resume{0, 0, 0, 0}
+    , m_resume_pts(AV_NOPTS_VALUE)
     , m_hwaccel_enc_mode(HWACCELMODE::NONE)
     , m_hwaccel_dec_mode(HWACCELMODE::NONE)
     , m_hwaccel_enable_enc_buffering(false)
@@ -566,6 +577,16 @@ int FFmpeg_Transcoder::open_input_file(LPVIRTUALFILE virtualfile, std::shared_pt
         return ret;
     }
 
+    // Record the key frames while reading, unless we need to seek
+    m_keyframe_index.reset(m_in.m_video.m_stream_idx);
+    m_build_keyframe_index  = can_index_keyframes();
+    m_keyframe_index_built  = false;
+
+    if (is_hls() && params.m_hls_keyframe_segments && !m_virtualfile->segment_starts_known())
+    {
+        find_keyframe_segments();
+    }
+
     if (m_virtualfile->m_flags & VIRTUALFLAG_CUESHEET)
     {
         // Position to start of cue sheet track
@@ -1332,7 +1353,7 @@ int FFmpeg_Transcoder::open_output(Buffer *buffer)
     // a lot of havoc.
     initialise_output_start_times();
 
-    return 0;
+    return resume_output();
 }
 
 int FFmpeg_Transcoder::initialise_hls_output_segment(Buffer *buffer)
@@ -1517,6 +1538,23 @@ int FFmpeg_Transcoder::open_regular_output_cache_file(Buffer *buffer)
     // 0 here would switch the active cache file back to the first segment
     // and make repair/seek runs append the following output to 000001.ts.
     size_t buffsize = predicted_filesize();
+
+    if (m_resume.m_offset)
+    {
+        if (resume_supported() && buffer->open_resume(m_resume.m_offset, buffsize))
+        {
+            return 0;
+        }
+
+        Logging::warning(virtname(), "The interrupted transcode cannot be resumed. Starting over.");
+
+        // Keep the fragment count, the index will be written all the same
+        m_resume.m_offset   = 0;
+        m_resume.m_time     = 0;
+
+        buffer->clear();
+    }
+
     if (!buffer->open_file(0, CACHE_FLAG_RW, buffsize))
     {
         return AVERROR(EPERM);
@@ -1542,6 +1580,12 @@ void FFmpeg_Transcoder::initialise_audio_output_start_time()
             m_out.m_audio.m_stream->start_time  = AV_NOPTS_VALUE;
         }
     }
+
+    if (m_out.m_audio.m_stream != nullptr)
+    {
+        // The header is written again at every HLS segment, the decoder thread uses this copy
+        m_out.m_audio.m_time_base               = m_out.m_audio.m_stream->time_base;
+    }
 }
 
 void FFmpeg_Transcoder::initialise_video_output_start_time()
@@ -1561,6 +1605,12 @@ void FFmpeg_Transcoder::initialise_video_output_start_time()
             m_out.m_video.m_stream->start_time  = AV_NOPTS_VALUE;
         }
     }
+
+    if (m_out.m_video.m_stream != nullptr)
+    {
+        // The header is written again at every HLS segment, the decoder thread uses this copy
+        m_out.m_video.m_time_base               = m_out.m_video.m_stream->time_base;
+    }
 }
 
 void FFmpeg_Transcoder::initialise_subtitle_output_start_times()
@@ -1807,6 +1857,48 @@ int FFmpeg_Transcoder::init_rescaler(AVPixelFormat in_pix_fmt, int in_width, int
                            out_width, out_height);
         }
 
+#if LSWS_SCALE_FRAME
+        // Set up the context by options: the number of threads cannot be passed to sws_getContext()
+        m_sws_ctx.reset(sws_alloc_context());
+        release_threads(&m_sws_threads);
+        if (m_sws_ctx == nullptr)
+        {
+            Logging::error(virtname(), "Could not allocate a scaling/conversion context.");
+            return AVERROR(ENOMEM);
+        }
+
+        SwsContext *sws_ctx = m_sws_ctx.get();
+        int threads = acquire_threads(get_slice_threads(std::max(static_cast<int64_t>(in_width) * in_height, static_cast<int64_t>(out_width) * out_height)));
+        int ret;
+
+        av_opt_set_int(sws_ctx, "srcw",       in_width,           0);
+        av_opt_set_int(sws_ctx, "srch",       in_height,          0);
+        av_opt_set_int(sws_ctx, "src_format", in_pix_fmt,         0);
+        av_opt_set_int(sws_ctx, "dstw",       out_width,          0);
+        av_opt_set_int(sws_ctx, "dsth",       out_height,         0);
+        av_opt_set_int(sws_ctx, "dst_format", out_pix_fmt,        0);
+        av_opt_set_int(sws_ctx, "sws_flags",  SWS_FAST_BILINEAR,  0);    // Maybe SWS_LANCZOS | SWS_ACCURATE_RND
+
+        // Slice threading was added after sws_scale_frame(), older versions simply do not know the option
+        if (av_opt_set_int(sws_ctx, "threads", threads, 0) < 0)
+        {
+            release_threads(&threads);
+            threads = acquire_threads(1);
+        }
+
+        m_sws_threads = threads;
+
+        ret = sws_init_context(sws_ctx, nullptr, nullptr);
+        if (ret < 0)
+        {
+            Logging::error(virtname(), "Could not initialise the scaling/conversion context (error '%1').", ffmpeg_geterror(ret).c_str());
+            m_sws_ctx.reset();
+            release_threads(&m_sws_threads);
+            return ret;
+        }
+
+        Logging::debug(virtname(), "Scaling/converting images with %1 thread(s).", threads);
+#else   // !LSWS_SCALE_FRAME
         m_sws_ctx.reset(sws_getContext(
                     // Source settings
                     in_width,               // width
@@ -1822,11 +1914,70 @@ int FFmpeg_Transcoder::init_rescaler(AVPixelFormat in_pix_fmt, int in_width, int
             Logging::error(virtname(), "Could not allocate a scaling/conversion context.");
             return AVERROR(ENOMEM);
         }
+#endif  // !LSWS_SCALE_FRAME
     }
 
     return 0;
 }
 
+int FFmpeg_Transcoder::get_slice_threads(int64_t pixels)
+{
+    // Each thread processes a band of lines. Up to 1080p the bands are too small to make up for
+    // starting and syncing the threads, and more than 8 hardly scale any better.
+    const int64_t pixels_per_thread = 2 * 1024 * 1024;
+    const int64_t max_threads       = 8;
+
+    int64_t threads = std::min(pixels / pixels_per_thread + 1, max_threads);
+    int64_t cores   = static_cast<int64_t>(std::thread::hardware_concurrency());
+
+    if (cores > 0)
+    {
+        threads = std::min(threads, cores);
+    }
+
+    return static_cast<int>(std::max(threads, static_cast<int64_t>(1)));
+}
+
+int FFmpeg_Transcoder::get_filter_threads(int64_t pixels)
+{
+    // Deinterlacing costs several times more per pixel than bilinear scaling,
+    // so threads pay off for smaller pictures already: SD is filtered in one
+    // thread, 1080i in four, 4K in 8.
+    const int64_t pixels_per_thread = 512 * 1024;
+    const int64_t max_threads       = 8;
+
+    int64_t threads = std::min(pixels / pixels_per_thread + 1, max_threads);
+
+    return static_cast<int>(std::max(threads, static_cast<int64_t>(1)));
+}
+
+int FFmpeg_Transcoder::acquire_threads(int threads)
+{
+    // Several transcoders each picking threads for themselves would start
+    // many more threads than there are cores, which then only compete.
+    const int budget = static_cast<int>(std::thread::hardware_concurrency());
+    int used = m_threads_used.load();
+    int granted;
+
+    do
+    {
+        granted = budget > 0 ? std::min(threads, budget - used) : threads;
+        granted = std::max(granted, 1);
+    }
+    while (!m_threads_used.compare_exchange_weak(used, used + granted));
+
+    return granted;
+}
+
+void FFmpeg_Transcoder::release_threads(int *threads)
+{
+    if (*threads > 0)
+    {
+        m_threads_used -= *threads;
+        *threads = 0;
+    }
+}
+
 #if IF_DECLARED_CONST
 int FFmpeg_Transcoder::find_output_encoder(AVCodecID codec_id, const AVCodec **output_codec)
 #else // !IF_DECLARED_CONST
@@ -3275,6 +3426,12 @@ int FFmpeg_Transcoder::open_output_filestreams(Buffer *buffer)
     }
     m_out.m_format_ctx.set_custom_io();
 
+    if (resume_supported())
+    {
+        // Get notified of fragment boundaries to record resume points
+        m_out.m_format_ctx->pb->write_data_type = output_write_data_type;
+    }
+
     return 0;
 }
 
@@ -3430,8 +3587,22 @@ int FFmpeg_Transcoder::init_resampler()
 
 int FFmpeg_Transcoder::init_audio_fifo()
 {
+    // The FIFO holds less than one encoder frame, plus the samples one decoded frame
+    // adds after resampling. Allow for twice that, so it normally never needs to grow.
+    int64_t lookahead = AUDIO_FIFO_LOOKAHEAD;
+
+    if (m_in.m_audio.m_codec_ctx != nullptr && m_in.m_audio.m_codec_ctx->sample_rate > 0)
+    {
+        lookahead = av_rescale_rnd((m_in.m_audio.m_codec_ctx->frame_size > 0) ? m_in.m_audio.m_codec_ctx->frame_size : AUDIO_FIFO_LOOKAHEAD,
+                                   m_out.m_audio.m_codec_ctx->sample_rate,
+                                   m_in.m_audio.m_codec_ctx->sample_rate,
+                                   AV_ROUND_UP);
+    }
+
+    int capacity = static_cast<int>(2 * (audio_output_frame_size() + lookahead));
+
     // Create the audio FIFO buffer based on the specified output sample format.
-    int ret = m_audio_fifo.alloc(m_out.m_audio.m_codec_ctx->sample_fmt, get_channels(m_out.m_audio.m_codec_ctx.get()), 1);
+    int ret = m_audio_fifo.alloc(m_out.m_audio.m_codec_ctx->sample_fmt, get_channels(m_out.m_audio.m_codec_ctx.get()), capacity);
     if (ret < 0)
     {
         Logging::error(virtname(), "Could not allocate an audio FIFO.");
@@ -3493,6 +3664,22 @@ int FFmpeg_Transcoder::prepare_format(AVDictionary** dict, FILETYPE filetype) co
         dict_set_with_check(dict, "flags:v", "+global_header", 0, virtname());
     }
 
+    if (ret >= 0 && resume_supported())
+    {
+        if (av_dict_get(*dict, "frag_duration", nullptr, 0) == nullptr && av_dict_get(*dict, "frag_size", nullptr, 0) == nullptr)
+        {
+            // Otherwise the whole file ends up in a single fragment
+            dict_set_with_check(dict, "movflags", "+frag_keyframe", AV_DICT_APPEND, virtname());
+        }
+
+        if (m_resume.m_offset)
+        {
+            // Continue the fragment sequence and take the fragment times from the packets
+            dict_set_with_check(dict, "movflags", "+frag_discont", AV_DICT_APPEND, virtname());
+            dict_set_with_check(dict, "fragment_index", static_cast<int64_t>(m_resume.m_fragment) + 1, 0, virtname());
+        }
+    }
+
     return ret;
 }
 
@@ -3697,7 +3884,7 @@ int FFmpeg_Transcoder::write_output_file_header()
     return ret;
 }
 
-int FFmpeg_Transcoder::alloc_picture(AVFrame *frame, AVPixelFormat pix_fmt, int width, int height) const
+int FFmpeg_Transcoder::alloc_picture(AVFrame *frame, AVPixelFormat pix_fmt, int width, int height)
 {
     int ret;
 
@@ -3705,8 +3892,8 @@ int FFmpeg_Transcoder::alloc_picture(AVFrame *frame, AVPixelFormat pix_fmt, int
     frame->width  = width;
     frame->height = height;
 
-    // allocate the buffers for the frame data
-    ret = av_frame_get_buffer(frame, 32);
+    // allocate the buffers for the frame data, recycled once the encoder is done with them
+    ret = m_buffer_pool.get_video_buffer(frame, 32);
     if (ret < 0)
     {
         Logging::error(virtname(), "Could not allocate frame data (error '%1').", ffmpeg_geterror(ret).c_str());
@@ -3819,55 +4006,23 @@ int FFmpeg_Transcoder::decode_audio_frame(AVPacket *pkt, int *decoded)
         // If there is decoded data, convert and store it
         if (frame->nb_samples)
         {
-            // Temporary storage for the converted input samples.
-            uint8_t **converted_input_samples = nullptr;
-            try
+            // Initialise the resampler to be able to convert audio sample formats.
+            ret = init_resampler();
+            if (ret)
             {
-                int nb_output_samples;
-
-                // Initialise the resampler to be able to convert audio sample formats.
-                ret = init_resampler();
-                if (ret)
-                {
-                    throw ret;
-                }
-
-                nb_output_samples = (m_audio_resample_ctx != nullptr) ? swr_get_out_samples(m_audio_resample_ctx, frame->nb_samples) : frame->nb_samples;
-
-                // Store audio frame
-                // Initialise the temporary storage for the converted input samples.
-                ret = init_converted_samples(&converted_input_samples, nb_output_samples);
-                if (ret < 0)
-                {
-                    throw ret;
-                }
-
-                // Convert the input samples to the desired output sample format.
-                // This requires a temporary storage provided by converted_input_samples.
-                ret = convert_samples(frame->extended_data, frame->nb_samples, converted_input_samples, &nb_output_samples);
-                if (ret < 0)
-                {
-                    throw ret;
-                }
-
-                // Add the converted input samples to the audio FIFO buffer for later processing.
-                ret = add_samples_to_fifo(converted_input_samples, nb_output_samples);
-                if (ret < 0)
-                {
-                    throw ret;
-                }
-                ret = 0;
-            }
-            catch (int _ret)
-            {
-                ret = _ret;
+                break;
             }
 
-            if (converted_input_samples != nullptr)
+            if (m_audio_resample_ctx == nullptr)
             {
-                av_freep(&converted_input_samples[0]);
-                av_free(converted_input_samples);
+                // Formats are the same, no conversion required
+                ret = store_audio_samples(frame);
+                continue;
             }
+
+            // Convert the input samples to the desired output sample format,
+            // straight into the audio FIFO buffer for later processing.
+            ret = convert_samples(frame->extended_data, frame->nb_samples);
         }
     }
     return ret;
@@ -3976,6 +4131,12 @@ int FFmpeg_Transcoder::decode_video_frame(AVPacket *pkt, int *decoded)
 
         if (frame != nullptr)
         {
+            if (before_resume_point(frame->best_effort_timestamp != AV_NOPTS_VALUE ? frame->best_effort_timestamp : frame->pts, m_in.m_video.m_stream->time_base))
+            {
+                // Decoded from the previous key frame, but already in the cache file
+                continue;
+            }
+
             if (!(frame->flags & AV_FRAME_FLAG_CORRUPT || frame->flags & AV_FRAME_FLAG_DISCARD))
             {
                 ret = send_filters(&frame, ret);
@@ -4003,10 +4164,20 @@ int FFmpeg_Transcoder::decode_video_frame(AVPacket *pkt, int *decoded)
                         break;
                     }
 
+#if LSWS_SCALE_FRAME
+                    // Scales in slices on the context's threads
+                    ret = sws_scale_frame(m_sws_ctx, tmp_frame, frame);
+                    if (ret < 0)
+                    {
+                        Logging::error(filename(), "Could not scale video frame (error '%1').", ffmpeg_geterror(ret).c_str());
+                        break;
+                    }
+#else   // !LSWS_SCALE_FRAME
                     sws_scale(m_sws_ctx,
                               static_cast<const uint8_t * const *>(frame->data), frame->linesize,
                               0, frame->height,
                               tmp_frame->data, tmp_frame->linesize);
+#endif  // !LSWS_SCALE_FRAME
 
                     tmp_frame->pts                      = frame->pts;
                     tmp_frame->best_effort_timestamp    = frame->best_effort_timestamp;
@@ -4030,17 +4201,17 @@ int FFmpeg_Transcoder::decode_video_frame(AVPacket *pkt, int *decoded)
 
                 if (m_out.m_video.m_stream != nullptr && frame->pts != AV_NOPTS_VALUE)
                 {
-                    if (m_in.m_video.m_stream->time_base.den != m_out.m_video.m_stream->time_base.den || m_in.m_video.m_stream->time_base.num != m_out.m_video.m_stream->time_base.num)
+                    if (m_in.m_video.m_stream->time_base.den != m_out.m_video.m_time_base.den || m_in.m_video.m_stream->time_base.num != m_out.m_video.m_time_base.num)
                     {
-                        frame->pts = ffmpeg_rescale_q_rnd(frame->pts, m_in.m_video.m_stream->time_base, m_out.m_video.m_stream->time_base);
-                        video_start_time = ffmpeg_rescale_q_rnd(video_start_time, m_in.m_video.m_stream->time_base, m_out.m_video.m_stream->time_base);
+                        frame->pts = ffmpeg_rescale_q_rnd(frame->pts, m_in.m_video.m_stream->time_base, m_out.m_video.m_time_base);
+                        video_start_time = ffmpeg_rescale_q_rnd(video_start_time, m_in.m_video.m_stream->time_base, m_out.m_video.m_time_base);
                     }
 
                     // Fix for issue #46: bitrate too high.
                     // Solution found here https://stackoverflow.com/questions/11466184/setting-video-bit-rate-through-ffmpeg-api-is-ignored-for-libx264-codec
                     // This is permanently used in the current ffmpeg.c code (see commit: e3fb9af6f1353f30855eaa1cbd5befaf06e303b8 Date:Wed Jan 22 15:52:10 2020 +0100)
-                    frame->pts = ffmpeg_rescale_q_rnd(frame->pts, m_out.m_video.m_stream->time_base, m_out.m_video.m_codec_ctx->time_base);
-                    video_start_time = ffmpeg_rescale_q_rnd(video_start_time, m_out.m_video.m_stream->time_base, m_out.m_video.m_codec_ctx->time_base);
+                    frame->pts = ffmpeg_rescale_q_rnd(frame->pts, m_out.m_video.m_time_base, m_out.m_video.m_codec_ctx->time_base);
+                    video_start_time = ffmpeg_rescale_q_rnd(video_start_time, m_out.m_video.m_time_base, m_out.m_video.m_codec_ctx->time_base);
                 }
 
                 frame->quality      = m_out.m_video.m_codec_ctx->global_quality;
@@ -4063,7 +4234,27 @@ int FFmpeg_Transcoder::decode_video_frame(AVPacket *pkt, int *decoded)
                         // Issue #90: Insert key frame at start of each subsequent HLS segment
                         uint32_t next_segment = get_next_segment(pos);
 
-                        if (goto_next_segment(next_segment) && !m_insert_keyframe)
+                        bool insert_keyframe;
+
+                        if (m_pipeline != nullptr && m_pipeline->is_decoder_thread())
+                        {
+                            // Decoding ahead of the encoder, m_current_segment may lag behind
+                            insert_keyframe = (next_segment > m_keyframe_segment && next_segment <= m_virtualfile->get_segment_count());
+                            if (insert_keyframe)
+                            {
+                                m_keyframe_segment = next_segment;
+                            }
+                        }
+                        else
+                        {
+                            insert_keyframe = (goto_next_segment(next_segment) && !m_insert_keyframe);
+                            if (insert_keyframe)
+                            {
+                                m_insert_keyframe = true;
+                            }
+                        }
+
+                        if (insert_keyframe)
                         {
                             Logging::debug(virtname(), "Force key frame for next segment no. %1 at PTS=%2 (%3).", next_segment, tmp_pts, format_duration(pos).c_str());
 
@@ -4073,15 +4264,14 @@ int FFmpeg_Transcoder::decode_video_frame(AVPacket *pkt, int *decoded)
                             frame->key_frame    = 1;                    // This is required to reset the GOP counter (insert the next key frame after gop_size frames)
 #endif  // !LAVU_ADD_NEW_FRAME_FLAGS
                             frame->pict_type    = AV_PICTURE_TYPE_I;
-                            m_insert_keyframe   = true;
                         }
                     }
 
-                    m_frame_map.emplace(pos, frame);
+                    ret = store_frame(pos, std::move(frame));
                 }
                 else
                 {
-                    m_frame_map.emplace(0, frame);
+                    ret = store_frame(0, std::move(frame));
                 }
             }
         }
@@ -4154,7 +4344,9 @@ int FFmpeg_Transcoder::decode_subtitle(AVCodecContext *codec_ctx, AVPacket *pkt,
     {
         // If there is decoded data, store it
         // sub->pts is already in AV_TIME_BASE
-        m_frame_map.emplace(subtitle->pts, subtitle);
+        int64_t pos = subtitle->pts;
+
+        ret = store_frame(pos, std::move(subtitle));
     }
 
     return ret;
@@ -4204,8 +4396,16 @@ int FFmpeg_Transcoder::store_packet(AVPacket *pkt, AVMediaType mediatype)
                 pos = 0;
             }
             uint32_t next_segment = get_next_segment(pos);
+            bool next = goto_next_segment(next_segment);
 
-            if (goto_next_segment(next_segment))
+            if (next && m_copy_video && m_virtualfile->has_keyframe_segments() && !(m_inhibit_stream_msk & FFMPEGFS_VIDEO) && !(pkt->flags & AV_PKT_FLAG_KEY))
+            {
+                // The segment starts at a key frame of the source. Packets before it belong
+                // to the previous group of pictures, even if presented after the segment start.
+                next = false;
+            }
+
+            if (next)
             {
                 if (!(m_inhibit_stream_msk & FFMPEGFS_VIDEO))
                 {
@@ -4318,13 +4518,19 @@ int FFmpeg_Transcoder::decode_frame(AVPacket *pkt)
 
     if (m_in.m_audio.m_stream != nullptr && is_audio_stream(pkt->stream_index) && stream_exists(m_out.m_audio.m_stream_idx))
     {
+        if (before_resume_point(pkt->pts, m_in.m_audio.m_stream->time_base))
+        {
+            // Already in the cache file
+            return 0;
+        }
+
         if (m_reset_pts & FFMPEGFS_AUDIO && pkt->pts != AV_NOPTS_VALUE)
         {
             m_reset_pts &= ~FFMPEGFS_AUDIO; // Clear reset bit
 
             int64_t pkt_pts = ffmpeg_rescale_q(pkt->pts, m_in.m_audio.m_stream->time_base);
 
-            m_out.m_audio_pts = ffmpeg_rescale_q(pkt_pts, av_get_time_base_q(), m_out.m_audio.m_stream->time_base);
+            m_out.m_audio_pts = ffmpeg_rescale_q(pkt_pts, av_get_time_base_q(), m_out.m_audio.m_time_base);
 
             Logging::debug(virtname(), "Reset the PTS from the audio packet to %1.", format_duration(pkt_pts).c_str());
         }
@@ -4358,7 +4564,7 @@ int FFmpeg_Transcoder::decode_frame(AVPacket *pkt)
 
             int64_t pkt_pts = ffmpeg_rescale_q(pkt->pts, m_in.m_video.m_stream->time_base);
 
-            m_out.m_video_pts = ffmpeg_rescale_q(pkt_pts, av_get_time_base_q(), m_out.m_video.m_stream->time_base);
+            m_out.m_video_pts = ffmpeg_rescale_q(pkt_pts, av_get_time_base_q(), m_out.m_video.m_time_base);
 
             Logging::debug(virtname(), "Reset PTS from the video packet to %1.", format_duration(pkt_pts).c_str());
         }
@@ -4402,7 +4608,10 @@ int FFmpeg_Transcoder::decode_frame(AVPacket *pkt)
 
                     if (ret < 0 && ret != AVERROR(EAGAIN))
                     {
-                        Logging::error(filename(), "Could not decode video frame (error '%1').", ffmpeg_geterror(ret).c_str());
+                        if (ret != AVERROR_EXIT)
+                        {
+                            Logging::error(filename(), "Could not decode video frame (error '%1').", ffmpeg_geterror(ret).c_str());
+                        }
                         return ret;
                     }
 
@@ -4435,6 +4644,12 @@ int FFmpeg_Transcoder::decode_frame(AVPacket *pkt)
     }
     else if (is_subtitle_stream(pkt->stream_index))
     {
+        if (before_resume_point(pkt->pts, m_in.m_format_ctx->streams[pkt->stream_index]->time_base))
+        {
+            // Already in the cache file
+            return 0;
+        }
+
         // Decode subtitle. No copy option available.
         int decoded = 0;
         ret = decode_subtitle(pkt, &decoded);
@@ -4481,78 +4696,88 @@ int FFmpeg_Transcoder::decode_frame(AVPacket *pkt)
     return ret;
 }
 
-int FFmpeg_Transcoder::init_converted_samples(uint8_t ***converted_input_samples, int frame_size)
+int FFmpeg_Transcoder::convert_samples(uint8_t **input_data, int in_samples)
 {
     int ret;
 
-    // Allocate as many pointers as there are audio channels.
-    // Each pointer will later point to the audio samples of the corresponding
-    // channels (although it may be nullptr for interleaved formats).
-
-    *converted_input_samples = static_cast<uint8_t **>(av_calloc(static_cast<size_t>(get_channels(m_out.m_audio.m_codec_ctx.get())), sizeof(**converted_input_samples)));
-
-    if (*converted_input_samples == nullptr)
-    {
-        Logging::error(virtname(), "Could not allocate converted input sample pointers.");
-        return AVERROR(ENOMEM);
-    }
-
-    // Allocate memory for the samples of all channels in one consecutive
-    // block for convenience.
-    ret = av_samples_alloc(*converted_input_samples, nullptr,
-                           get_channels(m_out.m_audio.m_codec_ctx.get()),
-                           frame_size,
-                           m_out.m_audio.m_codec_ctx->sample_fmt, 0);
+    // Make sure all output samples fit in the FIFO
+    ret = m_audio_fifo.realloc(m_audio_fifo.size() + swr_get_out_samples(m_audio_resample_ctx, in_samples));
     if (ret < 0)
     {
-        Logging::error(virtname(), "Could not allocate converted input samples (error '%1').", ffmpeg_geterror(ret).c_str());
-        av_freep(&(*converted_input_samples)[0]);
-        av_free(*converted_input_samples);
+        Logging::error(virtname(), "Could not reallocate the audio FIFO.");
         return ret;
     }
-    return 0;
-}
 
-int FFmpeg_Transcoder::convert_samples(uint8_t **input_data, int in_samples, uint8_t **converted_data, int *out_samples)
-{
-    if (m_audio_resample_ctx != nullptr)
+    for (;;)
     {
-        int ret;
+        int nb_samples;
+        uint8_t **converted_data = m_audio_fifo.write_span(&nb_samples);
 
         // Convert the samples using the resampler.
-        ret = swr_convert(m_audio_resample_ctx, converted_data, *out_samples, const_cast<const uint8_t **>(input_data), in_samples);
-        if (ret  < 0)
+        ret = swr_convert(m_audio_resample_ctx, converted_data, nb_samples, const_cast<const uint8_t **>(input_data), in_samples);
+        if (ret < 0)
         {
             Logging::error(virtname(), "Could not convert input samples (error '%1').", ffmpeg_geterror(ret).c_str());
             return ret;
         }
 
-        *out_samples = ret;
-    }
-    else
-    {
-        *out_samples = in_samples;
+        m_audio_fifo.commit(ret);
 
-        // No resampling, just copy samples
-        if (!av_sample_fmt_is_planar(m_out.m_audio.m_codec_ctx->sample_fmt))
-        {
-            // Interleaved format
-            int samples = in_samples * av_get_bytes_per_sample(m_out.m_audio.m_codec_ctx->sample_fmt) * get_channels(m_in.m_audio.m_codec_ctx.get());
-            std::memcpy(converted_data[0], input_data[0], static_cast<size_t>(samples));
-        }
-        else
+        if (ret < nb_samples || !nb_samples)
         {
-            // Planar format
-            int samples = in_samples * av_get_bytes_per_sample(m_out.m_audio.m_codec_ctx->sample_fmt);
-            for (int n = 0; n < get_channels(m_out.m_audio.m_codec_ctx.get()); n++)
-            {
-                std::memcpy(converted_data[n], input_data[n], static_cast<size_t>(samples));
-            }
+            break;
         }
+
+        // Reached the end of the ring. The resampler keeps the samples that did not
+        // fit, get them without passing more input.
+        in_samples = 0;
     }
+
     return 0;
 }
 
+int FFmpeg_Transcoder::store_audio_samples(FFmpeg_Frame & frame)
+{
+    bool pass_frame = !m_audio_fifo.size();
+
+    if (pass_frame && !(m_out.m_audio.m_codec_ctx->codec->capabilities & AV_CODEC_CAP_VARIABLE_FRAME_SIZE))
+    {
+        // Encoder requires fixed size frames
+        pass_frame = (frame->nb_samples == m_out.m_audio.m_codec_ctx->frame_size);
+    }
+
+    if (pass_frame)
+    {
+        // The encoder checks the frame, not the decoder context
+#if LAVU_DEP_OLD_CHANNEL_LAYOUT
+        pass_frame = (frame->format == m_out.m_audio.m_codec_ctx->sample_fmt &&
+                      frame->sample_rate == m_out.m_audio.m_codec_ctx->sample_rate &&
+                      !av_channel_layout_compare(&frame->ch_layout, &m_out.m_audio.m_codec_ctx->ch_layout));
+#else   // !LAVU_DEP_OLD_CHANNEL_LAYOUT
+        pass_frame = (frame->format == m_out.m_audio.m_codec_ctx->sample_fmt &&
+                      frame->sample_rate == m_out.m_audio.m_codec_ctx->sample_rate &&
+                      frame->channel_layout == m_out.m_audio.m_codec_ctx->channel_layout);
+#endif  // !LAVU_DEP_OLD_CHANNEL_LAYOUT
+    }
+
+    if (!pass_frame)
+    {
+        // Frame sizes differ, re-chunk in the FIFO. Saves the copy to converted samples at least.
+        return add_samples_to_fifo(frame->extended_data, frame->nb_samples);
+    }
+
+    // Hand the decoded frame to the encoder, only the time stamps need to be replaced
+#if !LAVU_DEP_PKT_DURATION
+    frame->pkt_duration = 0;
+#else
+    frame->duration     = 0;
+#endif
+
+    m_audio_frames_passed++;
+
+    return store_audio_frame(std::move(frame));
+}
+
 int FFmpeg_Transcoder::add_samples_to_fifo(uint8_t **converted_input_samples, int frame_size)
 {
     int ret;
@@ -4568,7 +4793,7 @@ int FFmpeg_Transcoder::add_samples_to_fifo(uint8_t **converted_input_samples, in
     }
 
     // Store the new samples in the audio FIFO buffer.
-    ret = m_audio_fifo.write(reinterpret_cast<void **>(converted_input_samples), frame_size);
+    ret = m_audio_fifo.write(converted_input_samples, frame_size);
     if (ret < frame_size)
     {
         if (ret < 0)
@@ -4682,6 +4907,15 @@ int FFmpeg_Transcoder::read_decode_convert_and_store(int *finished)
                 // If we are the the end of the file, flush the decoder below.
                 *finished = 1;
                 Logging::trace(virtname(), "Read input file to EOF.");
+
+                if (m_build_keyframe_index)
+                {
+                    // Read from start to end without seeking, so we have seen all key frames
+                    m_keyframe_index.set_complete();
+                    m_build_keyframe_index  = false;
+                    m_keyframe_index_built  = true;
+                    Logging::debug(virtname(), "Built key frame index with %1 entries.", m_keyframe_index.size());
+                }
             }
             else
             {
@@ -4689,6 +4923,15 @@ int FFmpeg_Transcoder::read_decode_convert_and_store(int *finished)
                 throw ret;
             }
         }
+        else if (m_build_keyframe_index && pkt->stream_index == m_in.m_video.m_stream_idx && (pkt->flags & AV_PKT_FLAG_KEY) && pkt->pos >= 0)
+        {
+            int64_t pts = (pkt->pts != AV_NOPTS_VALUE) ? pkt->pts : pkt->dts;
+
+            if (pts != AV_NOPTS_VALUE)
+            {
+                m_keyframe_index.add(pts, pkt->pos);
+            }
+        }
 
         if (m_virtualfile->m_flags & VIRTUALFLAG_CUESHEET)
         {
@@ -4721,7 +4964,11 @@ int FFmpeg_Transcoder::read_decode_convert_and_store(int *finished)
         else
         {
             // Flush cached frames, ignoring any errors
-            flush_frames_all(true);
+            if (flush_frames_all(true) == AVERROR_EXIT)
+            {
+                // Interrupted by the transcoder thread, see store_frame()
+                throw static_cast<int>(AVERROR_EXIT);
+            }
         }
 
         ret = 0;    // Errors will be reported by exception
@@ -4734,7 +4981,7 @@ int FFmpeg_Transcoder::read_decode_convert_and_store(int *finished)
     return ret;
 }
 
-int FFmpeg_Transcoder::init_audio_output_frame(AVFrame *frame, int frame_size) const
+int FFmpeg_Transcoder::init_audio_output_frame(AVFrame *frame, int frame_size)
 {
     int ret;
 
@@ -4762,8 +5009,9 @@ int FFmpeg_Transcoder::init_audio_output_frame(AVFrame *frame, int frame_size) c
     // Allocate the samples of the created frame. This call will make
     // sure that the audio frame can hold as many samples as specified.
     // 29.05.2021: Let API decide about alignment. Should be properly set for the current CPU.
+    // The samples come from the buffer pool and go back there once the encoder is done with them.
 
-    ret = av_frame_get_buffer(frame, 0);
+    ret = m_buffer_pool.get_audio_buffer(frame, get_channels(m_out.m_audio.m_codec_ctx.get()));
     if (ret < 0)
     {
         Logging::error(virtname(), "Could allocate output frame samples (error '%1').", ffmpeg_geterror(ret).c_str());
@@ -5358,7 +5606,7 @@ int FFmpeg_Transcoder::create_audio_frame(int frame_size)
     // Read as many samples from the FIFO buffer as required to fill the frame.
     // The samples are stored in the frame temporarily.
 
-    ret = m_audio_fifo.read(reinterpret_cast<void **>(output_frame->data), frame_size);
+    ret = m_audio_fifo.read(output_frame->extended_data, frame_size);
     if (ret < frame_size)
     {
         if (ret < 0)
@@ -5373,6 +5621,11 @@ int FFmpeg_Transcoder::create_audio_frame(int frame_size)
         return ret;
     }
 
+    return store_audio_frame(std::move(output_frame));
+}
+
+int FFmpeg_Transcoder::store_audio_frame(FFmpeg_Frame && output_frame)
+{
     /*
      * Build the output frame PTS.
      *
@@ -5390,26 +5643,24 @@ int FFmpeg_Transcoder::create_audio_frame(int frame_size)
     {
         // Not used for encoding, but keep it meaningful for diagnostics.
         output_frame->best_effort_timestamp = ffmpeg_rescale_q(stream_pts,
-                                                               m_out.m_audio.m_stream->time_base,
+                                                               m_out.m_audio.m_time_base,
                                                                m_in.m_audio.m_stream->time_base);
 
         output_frame->pts = ffmpeg_rescale_q(stream_pts,
-                                             m_out.m_audio.m_stream->time_base,
+                                             m_out.m_audio.m_time_base,
                                              m_out.m_audio.m_codec_ctx->time_base);
 
         // duration = `a * b / c` = AV_TIME_BASE * output_frame->nb_samples / output_frame->sample_rate;
         int64_t sample_duration = av_rescale(AV_TIME_BASE, output_frame->nb_samples, output_frame->sample_rate);
 
-        sample_duration = ffmpeg_rescale_q(sample_duration, av_get_time_base_q(), m_out.m_audio.m_stream->time_base);
+        sample_duration = ffmpeg_rescale_q(sample_duration, av_get_time_base_q(), m_out.m_audio.m_time_base);
 
         m_out.m_audio_pts += sample_duration;
     }
 
-    int64_t pos = ffmpeg_rescale_q_rnd(stream_pts - m_out.m_audio.m_start_time, m_out.m_audio.m_stream->time_base);
+    int64_t pos = ffmpeg_rescale_q_rnd(stream_pts - m_out.m_audio.m_start_time, m_out.m_audio.m_time_base);
 
-    m_frame_map.emplace(pos, output_frame);
-
-    return ret;
+    return store_frame(pos, std::move(output_frame));
 }
 
 int FFmpeg_Transcoder::write_output_file_trailer()
@@ -5598,6 +5849,7 @@ void FFmpeg_Transcoder::flush_buffers()
 int FFmpeg_Transcoder::do_seek_frame(uint32_t frame_no)
 {
     m_have_seeked           = true;     // Note that we have seeked, thus skipped frames. We need to start transcoding over to fill any gaps.
+    m_build_keyframe_index  = false;    // Would miss key frames
 
     //m_skip_next_frame = true; /**< @todo Take deinterlace into account. If deinterlace is on the frame number is decreased by one. */
 
@@ -5613,18 +5865,23 @@ int FFmpeg_Transcoder::do_seek_frame(uint32_t frame_no)
         vstream_pts += m_in.m_video.m_stream->start_time;
     }
 
+    if (seek_keyframe(vstream_pts) == 0)
+    {
+        return 0;
+    }
+
     return av_seek_frame(m_in.m_format_ctx, m_in.m_video.m_stream_idx, vstream_pts, AVSEEK_FLAG_BACKWARD|AVSEEK_FLAG_FRAME);
 }
 
 int FFmpeg_Transcoder::skip_decoded_frames(uint32_t frame_no, bool forced_seek)
 {
     int ret = 0;
-    uint32_t next_frame_no = frame_no;
+    uint32_t next_frame_no = m_buffer->next_missing_frame(frame_no);
 
-    // Seek next undecoded frame
-    for (; m_buffer->have_frame(next_frame_no); next_frame_no++)
+    if (!next_frame_no)
     {
-        std::this_thread::yield();
+        // No frame map, start at requested frame
+        next_frame_no = frame_no;
     }
 
     if (next_frame_no > m_virtualfile->m_video_frame_count)
@@ -5736,20 +5993,23 @@ int FFmpeg_Transcoder::flush_delayed_subtitles()    /** @todo Implement flush_de
     return 0;
 }
 
-int FFmpeg_Transcoder::copy_audio_to_frame_buffer(int *finished)
+int FFmpeg_Transcoder::audio_output_frame_size() const
 {
-    int output_frame_size;
-
     if (m_out.m_audio.m_codec_ctx->codec->capabilities & AV_CODEC_CAP_VARIABLE_FRAME_SIZE)
     {
         // Encode supports variable frame size, use an arbitrary value
-        output_frame_size =  10000;
+        return 10000;
     }
     else
     {
         // Use the encoder's desired frame size for processing.
-        output_frame_size = m_out.m_audio.m_codec_ctx->frame_size;
+        return m_out.m_audio.m_codec_ctx->frame_size;
     }
+}
+
+int FFmpeg_Transcoder::copy_audio_to_frame_buffer(int *finished)
+{
+    int output_frame_size = audio_output_frame_size();
 
     // Make sure that there is one frame worth of samples in the audio FIFO
     // buffer so that the encoder can do its work.
@@ -5757,7 +6017,10 @@ int FFmpeg_Transcoder::copy_audio_to_frame_buffer(int *finished)
     // need to FIFO buffer to store as many frames worth of input samples
     // that they make up at least one frame worth of output samples.
 
-    while (m_audio_fifo.size() < output_frame_size)
+    // Frames that need no conversion and have the right size bypass the FIFO.
+    const uint64_t audio_frames_passed = m_audio_frames_passed;
+
+    while (m_audio_fifo.size() < output_frame_size && m_audio_frames_passed == audio_frames_passed)
     {
         int ret = 0;
 
@@ -5800,6 +6063,87 @@ int FFmpeg_Transcoder::copy_audio_to_frame_buffer(int *finished)
     return 0;
 }
 
+int FFmpeg_Transcoder::decode_stage(int *finished)
+{
+    if (!m_copy_audio && stream_exists(m_out.m_audio.m_stream_idx))
+    {
+        // Copy audio FIFO into frame buffer
+        return copy_audio_to_frame_buffer(finished);
+    }
+    else
+    {
+        // If we have no audio stream, we'll only get video data
+        // or we simply copy audio and/or video frames into the packet queue
+        return read_decode_convert_and_store(finished);
+    }
+}
+
+int FFmpeg_Transcoder::store_frame(int64_t pos, MULTIFRAME && multiframe)
+{
+    if (m_pipeline != nullptr && m_pipeline->is_decoder_thread())
+    {
+        // Waits if the encoder lags behind. If the transcoder is about to seek,
+        // or is stopping, stop decoding and return to the decoder thread's loop.
+        if (!m_pipeline->push(pos, std::move(multiframe)))
+        {
+            return AVERROR_EXIT;
+        }
+    }
+    else
+    {
+        m_frame_map.push(pos, std::move(multiframe));
+    }
+    return 0;
+}
+
+bool FFmpeg_Transcoder::can_pipeline() const
+{
+    if (!params.m_pipeline || is_frameset() || m_copy_audio || m_copy_video)
+    {
+        return false;
+    }
+
+    for (const StreamRef & album_art : m_in.m_album_art)
+    {
+        if (!(album_art.m_stream->disposition & AV_DISPOSITION_ATTACHED_PIC))
+        {
+            // Muxed while decoding
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void FFmpeg_Transcoder::start_pipeline()
+{
+    // The decoder runs ahead of m_current_segment, it keeps track of key frames itself
+    m_keyframe_segment = m_insert_keyframe ? m_current_segment + 1 : m_current_segment;
+
+    m_pipeline = std::make_unique<FFmpeg_Pipeline>(params.m_pipeline, [this](int *finished) { return decode_stage(finished); });
+
+    if (!m_pipeline->start())
+    {
+        Logging::warning(virtname(), "Could not start the decoder thread, decoding in the transcoder thread.");
+        m_pipeline.reset();
+        return;
+    }
+
+    Logging::debug(virtname(), "Decoding in a separate thread up to %1 frames ahead.", params.m_pipeline);
+}
+
+void FFmpeg_Transcoder::stop_pipeline()
+{
+    if (m_pipeline != nullptr)
+    {
+        // Join the thread first, it uses m_pipeline until it exits
+        m_pipeline->stop();
+        m_pipeline.reset();
+
+        Logging::trace(virtname(), "Decoder thread stopped.");
+    }
+}
+
 int FFmpeg_Transcoder::process_single_fr(DECODER_STATUS *status)
 {
     int finished = 0;
@@ -5826,12 +6170,17 @@ int FFmpeg_Transcoder::process_single_fr(DECODER_STATUS *status)
             }
         }
 
-        if (!m_copy_audio && stream_exists(m_out.m_audio.m_stream_idx))
+        if (m_pipeline == nullptr && can_pipeline())
+        {
+            start_pipeline();
+        }
+
+        if (m_pipeline != nullptr)
         {
             int ret = 0;
 
-            // Copy audio FIFO into frame buffer
-            ret = copy_audio_to_frame_buffer(&finished);
+            // Collect the frames from the decoder thread
+            ret = m_pipeline->receive(m_frame_map, &finished);
             if (ret < 0)
             {
                 throw ret;
@@ -5841,18 +6190,11 @@ int FFmpeg_Transcoder::process_single_fr(DECODER_STATUS *status)
         {
             int ret = 0;
 
-            // If we have no audio stream, we'll only get video data
-            // or we simply copy audio and/or video frames into the packet queue
-            ret = read_decode_convert_and_store(&finished);
+            ret = decode_stage(&finished);
             if (ret < 0)
             {
                 throw ret;
             }
-
-            if (finished)
-            {
-                *status = DECODER_STATUS::DEC_EOF;  // Report EOF
-            }
         }
 
         do
@@ -5871,19 +6213,16 @@ int FFmpeg_Transcoder::process_single_fr(DECODER_STATUS *status)
                     delay = 6 * AV_TIME_BASE;                       // 6 seconds
                 }
 
-                if (!finished && (!m_frame_map.empty() && m_frame_map.cbegin()->first + delay > m_frame_map.crbegin()->first))
+                if (!finished && (!m_frame_map.empty() && m_frame_map.front_pos() + delay > m_frame_map.back_pos()))
                 {
                     return 0;
                 }
 
                 while (!m_frame_map.empty())
                 {
-                    // Take first entry in map
-                    MULTIFRAME_MAP::const_iterator it = m_frame_map.cbegin();
-
                     if (is_hls())
                     {
-                        uint32_t next_segment = get_next_segment(it->first);
+                        uint32_t next_segment = get_next_segment(m_frame_map.front_pos());
 
                         if (goto_next_segment(next_segment))
                         {
@@ -5893,11 +6232,8 @@ int FFmpeg_Transcoder::process_single_fr(DECODER_STATUS *status)
                         }
                     }
 
-                    // Get multiframe from map
-                    MULTIFRAME multiframe = it->second;
-
-                    // Drop key from map, we've got a clone in multiframe now.
-                    m_frame_map.erase(it);
+                    // Take first frame from buffer
+                    MULTIFRAME multiframe = m_frame_map.pop();
 
                     if (std::holds_alternative<FFmpeg_Frame>(multiframe))
                     {
@@ -5971,11 +6307,7 @@ int FFmpeg_Transcoder::process_single_fr(DECODER_STATUS *status)
                 // Frame sets: no audio, no subtitles, no output stream (index)
                 while (!m_frame_map.empty())
                 {
-                    // Although I abhore "auto", it seems that nodes are declared slightly different throughout
-                    // several std::map implementations. To avoid #ifdef orgies, I resign: Using "auto" here
-                    // is much more coherent.
-                    auto nh = m_frame_map.extract(m_frame_map.cbegin());
-                    const MULTIFRAME & multiframe = nh.mapped();
+                    MULTIFRAME multiframe = m_frame_map.pop();
                     int ret = 0;
                     int data_written = 0;
 
@@ -5992,13 +6324,26 @@ int FFmpeg_Transcoder::process_single_fr(DECODER_STATUS *status)
             if (is_hls() && m_active_stream_msk == m_inhibit_stream_msk)
             {
                 // Start new HLS segment
+                uint32_t seek_segment = next_seek_segment();
                 int ret = 0;
 
-                ret = start_new_segment();
+                if (m_pipeline != nullptr && seek_segment)
+                {
+                    // Going to seek the input, keep the decoder off it
+                    m_pipeline->pause();
+                }
+
+                ret = start_new_segment(seek_segment);
                 if (ret < 0)
                 {
                     throw ret;
                 }
+
+                if (m_pipeline != nullptr && seek_segment && !m_pipeline->resume())
+                {
+                    Logging::error(virtname(), "Could not restart the decoder thread.");
+                    throw static_cast<int>(AVERROR(ENOMEM));
+                }
             }
         } while (finished && !m_frame_map.empty()); // Ensure we've processed all frames in our buffer
 
@@ -6098,14 +6443,22 @@ bool FFmpeg_Transcoder::discard_hls_seek_near_beginning(uint32_t segment_no) con
 
 int FFmpeg_Transcoder::seek_hls_segment(uint32_t segment_no, bool require_output_streams)
 {
-    int ret = 0;
-    const int64_t pos = (segment_no - 1) * params.m_segment_duration;
+    const int64_t pos = m_virtualfile->get_segment_start(segment_no);
 
     m_reset_pts    = FFMPEGFS_AUDIO | FFMPEGFS_VIDEO;
     m_have_seeked   = true;
 
     Logging::info(virtname(), "Performing seek request to HLS segment no. %1.", segment_no);
 
+    return seek_input(pos, require_output_streams);
+}
+
+int FFmpeg_Transcoder::seek_input(int64_t pos, bool require_output_streams)
+{
+    int ret = 0;
+
+    m_build_keyframe_index = false;    // Would miss key frames
+
     const bool can_seek_video = require_output_streams
         ? (m_in.m_video.m_stream_idx && stream_exists(m_out.m_video.m_stream_idx) && m_in.m_video.m_stream != nullptr)
         : (stream_exists(m_in.m_video.m_stream_idx) && m_in.m_video.m_stream != nullptr);
@@ -6122,7 +6475,11 @@ int FFmpeg_Transcoder::seek_hls_segment(uint32_t segment_no, bool require_output
             vstream_pts += m_in.m_video.m_stream->start_time;
         }
 
-        ret = av_seek_frame(m_in.m_format_ctx, m_in.m_video.m_stream_idx, vstream_pts, AVSEEK_FLAG_BACKWARD);
+        ret = seek_keyframe(vstream_pts);
+        if (ret < 0)
+        {
+            ret = av_seek_frame(m_in.m_format_ctx, m_in.m_video.m_stream_idx, vstream_pts, AVSEEK_FLAG_BACKWARD);
+        }
     }
     else if (can_seek_audio)
     {
@@ -6147,20 +6504,41 @@ int FFmpeg_Transcoder::seek_hls_segment(uint32_t segment_no, bool require_output
     return 0;
 }
 
-int FFmpeg_Transcoder::start_new_segment()
+int FFmpeg_Transcoder::seek_keyframe(int64_t vstream_pts)
 {
-    bool opened = false;
+    FFmpeg_KeyframeIndex::KEYFRAME keyframe;
+    int ret;
 
-    encode_finish();
+    if (!m_keyframe_index.complete() || !m_keyframe_index.find(vstream_pts, &keyframe))
+    {
+        return AVERROR(ENOENT);
+    }
+
+    // Go straight to the key frame, the demuxer resumes with its packet
+    ret = av_seek_frame(m_in.m_format_ctx, -1, keyframe.m_pos, AVSEEK_FLAG_BYTE);
+    if (ret < 0)
+    {
+        Logging::warning(virtname(), "Seek to key frame at byte position %1 failed (error '%2').", keyframe.m_pos, ffmpeg_geterror(ret).c_str());
+        return ret;
+    }
+
+    Logging::trace(virtname(), "Seeked to key frame at %1, byte position %2.", format_duration(ffmpeg_rescale_q(keyframe.m_pts, m_in.m_video.m_stream->time_base)).c_str(), keyframe.m_pos);
+
+    return 0;
+}
 
+uint32_t FFmpeg_Transcoder::next_seek_segment()
+{
     // Go to next requested segment...
-    uint32_t next_segment = m_current_segment + 1;
+    const uint32_t next_segment = m_current_segment + 1;
 
     // ...or process any stacked seek requests.
     // No check if m_segment_duration == 0, values <= 0 not accepted.
     // Cast is OK here, the result will always be small enough for an int32.
     const uint32_t min_seek_segments = static_cast<uint32_t>(params.m_min_seek_time_diff / params.m_segment_duration);
 
+    std::lock_guard<std::recursive_mutex> lock_seek_to_fifo_mutex(m_seek_to_fifo_mutex);
+
     while (!m_seek_to_fifo.empty())
     {
         uint32_t segment_no = m_seek_to_fifo.front();
@@ -6179,36 +6557,59 @@ int FFmpeg_Transcoder::start_new_segment()
 
         if (!m_buffer->segment_exists(segment_no) || !m_buffer->tell(segment_no)) // NOT EXIST or NO DATA YET
         {
-            int ret = seek_hls_segment(segment_no, true);
-            if (ret < 0)
-            {
-                return ret;
-            }
+            return segment_no;
+        }
 
-            close_output_file();
+        Logging::info(virtname(), "Discarded seek request to HLS segment no. %1.", segment_no);
+    }
 
-            purge_hls_fifo();   // We do not need the packets for the next frame, we start a new one at another position!
+    return 0;
+}
 
-            // open_output() selects the active HLS cache file before
-            // process_output()/avformat_write_header() can emit data.  Make
-            // the requested seek segment visible before reopening the output,
-            // otherwise a mid-stream repair can reopen the previous segment.
-            m_current_segment = segment_no;
+int FFmpeg_Transcoder::start_new_segment(uint32_t seek_segment)
+{
+    bool opened = false;
 
-            ret = open_output(m_buffer);
-            if (ret < 0)
-            {
-                return ret;
-            }
+    // Finish the segment in the muxer only. The encoders keep running, their
+    // packets for the next segment are held back in the HLS packet FIFO.
+    encode_finish();
 
-            next_segment = segment_no;
+    uint32_t next_segment = m_current_segment + 1;
 
-            opened = true;
+    if (seek_segment)
+    {
+        // Discontinuity: start over with new encoders at the new position
+        int ret = seek_hls_segment(seek_segment, true);
+        if (ret < 0)
+        {
+            return ret;
+        }
 
-            break;
+        if (m_pipeline != nullptr)
+        {
+            // Drop frames the decoder thread has decoded ahead from the old position
+            m_pipeline->flush();
         }
 
-        Logging::info(virtname(), "Discarded seek request to HLS segment no. %1.", segment_no);
+        close_output_file();
+
+        purge_hls_fifo();   // We do not need the packets for the next frame, we start a new one at another position!
+
+        // open_output() selects the active HLS cache file before
+        // process_output()/avformat_write_header() can emit data.  Make
+        // the requested seek segment visible before reopening the output,
+        // otherwise a mid-stream repair can reopen the previous segment.
+        m_current_segment = seek_segment;
+
+        ret = open_output(m_buffer);
+        if (ret < 0)
+        {
+            return ret;
+        }
+
+        next_segment = seek_segment;
+
+        opened = true;
     }
 
     // Set current segment
@@ -6216,6 +6617,13 @@ int FFmpeg_Transcoder::start_new_segment()
     m_inhibit_stream_msk    = 0;
     m_insert_keyframe       = false;
 
+    if (opened)
+    {
+        // Pipelined: after a seek, start over with key frames from here.
+        // Otherwise the decoder thread keeps track of them itself.
+        m_keyframe_segment  = m_current_segment;
+    }
+
     Logging::info(virtname(), "Starting HLS segment no. %1 of %2.", m_current_segment, m_virtualfile->get_segment_count());
 
     if (!m_buffer->set_segment(m_current_segment, m_virtualfile->m_predicted_size / m_virtualfile->get_segment_count()))   /** @todo Set reasonable size here */
@@ -6904,6 +7312,29 @@ int64_t FFmpeg_Transcoder::seek(void * opaque, int64_t offset, int whence)
     return res_offset;
 }
 
+#if LAVF_WRITEPACKET_CONST
+int FFmpeg_Transcoder::output_write_data_type(void * opaque, const uint8_t * data, int size, enum AVIODataMarkerType type, int64_t time)
+#else
+int FFmpeg_Transcoder::output_write_data_type(void * opaque, uint8_t * data, int size, enum AVIODataMarkerType type, int64_t time)
+#endif
+{
+    Buffer * buffer = static_cast<Buffer *>(opaque);
+
+    if (buffer == nullptr)
+    {
+        Logging::error(nullptr, "output_write_data_type(): Internal error: FileIO is NULL!");
+        return AVERROR(EINVAL);
+    }
+
+    if (type == AVIO_DATA_MARKER_SYNC_POINT || type == AVIO_DATA_MARKER_BOUNDARY_POINT)
+    {
+        // A new fragment starts here, everything before it is complete.
+        buffer->start_fragment(time, type == AVIO_DATA_MARKER_SYNC_POINT);
+    }
+
+    return output_write(opaque, data, size);
+}
+
 bool FFmpeg_Transcoder::close_resample()
 {
     return m_audio_resample_ctx.reset();
@@ -6987,10 +7418,12 @@ bool FFmpeg_Transcoder::close_output_file()
     // The deinterlace filter graph belongs to the current output/transcoding
     // pipeline. HLS seeks and output reopens can rebuild that pipeline without
     // closing the input file, so do not leave an old AVFilterGraph attached
-    // until close_input_file().
+    // until close_input_file(). The filters keep earlier frames for reference,
+    // a graph reused after a seek would blend pictures from before the seek in.
     free_filters();
 
     m_sws_ctx.reset();
+    release_threads(&m_sws_threads);
 
     // Close output file
     m_out.m_audio.reset();
@@ -7034,6 +7467,9 @@ void FFmpeg_Transcoder::closeio()
 {
     bool closed = false;
 
+    // Stop decoding ahead before the input is closed
+    stop_pipeline();
+
     // Close input file
     closed |= close_input_file();
 
@@ -7044,6 +7480,9 @@ void FFmpeg_Transcoder::closeio()
     hwdevice_ctx_free(&m_hwaccel_dec_device_ctx);
     hwdevice_ctx_free(&m_hwaccel_enc_device_ctx);
 
+    // Release pooled buffers, frames still in use keep theirs until freed
+    m_buffer_pool.reset();
+
     // Closed anything (anything had been open to be closed in the first place)...
     if (closed)
     {
@@ -7096,6 +7535,12 @@ int FFmpeg_Transcoder::init_deinterlace_filters(AVCodecContext *codec_ctx, AVPix
             throw static_cast<int>(AVERROR(ENOMEM));
         }
 
+        // Slice threads for all filters of the graph, must be set before the
+        // filters are added. The default of 0 would start one per CPU core for
+        // every transcoder, regardless of the picture size.
+        m_filter_threads = acquire_threads(get_filter_threads(static_cast<int64_t>(codec_ctx->width) * codec_ctx->height));
+        m_filter_graph->nb_threads = m_filter_threads;
+
         // --- buffersrc (Quelle) direkt mit Args erstellen ---
         std::string args;
         strsprintf(&args,
@@ -7191,8 +7636,29 @@ int FFmpeg_Transcoder::init_deinterlace_filters(AVCodecContext *codec_ctx, AVPix
         // args "null"      passthrough (dummy) filter for audio
 
         // --- Deinterlace-Filterkette
-		// Deinterlace using the Bob Weaver Filter
-        const char * filters = "bwdif=mode=send_frame:parity=auto:deint=all";
+        const char * filters;
+        switch (params.m_deinterlace_mode)
+        {
+        case DEINTERLACE::YADIF:
+        {
+            // Yet another deinterlacing filter
+            filters = "yadif=mode=send_frame:parity=auto:deint=all";
+            break;
+        }
+        case DEINTERLACE::FAST:
+        {
+            // yadif without spatial interlacing check
+            filters = "yadif=mode=send_frame_nospatial:parity=auto:deint=all";
+            break;
+        }
+        case DEINTERLACE::BWDIF:
+        default:
+        {
+            // Deinterlace using the Bob Weaver Filter
+            filters = "bwdif=mode=send_frame:parity=auto:deint=all";
+            break;
+        }
+        }
 
         ret = avfilter_graph_parse_ptr(m_filter_graph, filters, &inputs, &outputs, nullptr);
         if (ret < 0)
@@ -7208,7 +7674,7 @@ int FFmpeg_Transcoder::init_deinterlace_filters(AVCodecContext *codec_ctx, AVPix
             throw ret;
         }
 
-        Logging::debug(virtname(), "Deinterlacing initialised with filters '%1'.", filters);
+        Logging::debug(virtname(), "Deinterlacing initialised with filters '%1' and %2 thread(s).", filters, m_filter_threads);
     }
     catch (int _ret)
     {
@@ -7310,6 +7776,8 @@ void FFmpeg_Transcoder::free_filters()
     m_buffer_source_context = nullptr;
     m_buffer_sink_context   = nullptr;
     m_filter_graph          = nullptr;
+
+    release_threads(&m_filter_threads);
 }
 
 int FFmpeg_Transcoder::stack_seek_frame(uint32_t frame_no)
@@ -7386,6 +7854,177 @@ bool FFmpeg_Transcoder::have_seeked() const
     return m_have_seeked;
 }
 
+void FFmpeg_Transcoder::set_resume_point(const Buffer::RESUME_POINT & resume_point)
+{
+    m_resume = resume_point;
+}
+
+bool FFmpeg_Transcoder::can_index_keyframes() const
+{
+    if (m_virtualfile == nullptr || m_virtualfile->m_type != VIRTUALTYPE::DISK || (m_virtualfile->m_flags & VIRTUALFLAG_CUESHEET))
+    {
+        return false;
+    }
+
+    if (m_in.m_format_ctx == nullptr || m_in.m_video.m_stream == nullptr || (m_in.m_format_ctx->iformat->flags & AVFMT_NO_BYTE_SEEK))
+    {
+        return false;
+    }
+
+    // Other demuxers need context, e.g. the Matroska cluster, to continue at a packet.
+    // They mostly come with an index of their own anyway.
+    const char * name = m_in.m_format_ctx->iformat->name;
+
+    return (!strcmp(name, "mpegts") || !strcmp(name, "mpeg"));
+}
+
+bool FFmpeg_Transcoder::set_keyframe_index(const FFmpeg_KeyframeIndex & keyframe_index)
+{
+    if (!can_index_keyframes() || !keyframe_index.complete() || keyframe_index.stream_idx() != m_in.m_video.m_stream_idx)
+    {
+        return false;
+    }
+
+    m_keyframe_index        = keyframe_index;
+    m_build_keyframe_index  = false;
+    m_keyframe_index_built  = false;
+
+    return true;
+}
+
+const FFmpeg_KeyframeIndex & FFmpeg_Transcoder::keyframe_index() const
+{
+    return m_keyframe_index;
+}
+
+bool FFmpeg_Transcoder::keyframe_index_built() const
+{
+    return m_keyframe_index_built;
+}
+
+bool FFmpeg_Transcoder::resume_supported() const
+{
+    if (!params.m_resume_transcode || is_multiformat() || m_copy_audio || m_copy_video || m_current_format == nullptr)
+    {
+        return false;
+    }
+
+    if (m_current_format->audio_codec() == AV_CODEC_ID_OPUS)
+    {
+        // Output is not seekable
+        return false;
+    }
+
+    // The header must be complete before the first fragment is written, so
+    // it can be written again when resuming. This requires an empty moov atom.
+    std::string movflags;
+
+    for (const PROFILE_LIST & profile : m_profile)
+    {
+        if (profile.m_filetype != m_current_format->filetype() || profile.m_profile != params.m_profile)
+        {
+            continue;
+        }
+
+        for (const PROFILE_OPTION & option : profile.m_option_format)
+        {
+            if (((option.m_options & OPT_AUDIO) && stream_exists(m_out.m_video.m_stream_idx)) ||
+                    ((option.m_options & OPT_VIDEO) && !stream_exists(m_out.m_video.m_stream_idx)) ||
+                    strcmp(option.m_key, "movflags"))
+            {
+                continue;
+            }
+
+            if (option.m_flags & AV_DICT_APPEND)
+            {
+                movflags += option.m_value;
+            }
+            else
+            {
+                movflags = option.m_value;
+            }
+        }
+        break;
+    }
+
+    return (movflags.find("empty_moov") != std::string::npos);
+}
+
+int FFmpeg_Transcoder::resume_output()
+{
+    if (!resume_supported())
+    {
+        return 0;
+    }
+
+    // Make sure the header is in the cache file
+    avio_flush(m_out.m_format_ctx->pb);
+
+    Buffer::RESUME_POINT resume_point = m_resume;
+    size_t header_size = m_buffer->tell();
+
+    if (resume_point.m_offset && resume_point.m_header_size != header_size)
+    {
+        Logging::warning(virtname(), "The file header size changed from %1 to %2 bytes. Cannot resume the interrupted transcode, starting over.", resume_point.m_header_size, header_size);
+        resume_point.m_offset = 0;
+    }
+
+    // The muxer shifts fragmented output to start at 0, so the time of the resume
+    // point is relative to the start of the input, not an input time stamp.
+    const int64_t start_time = (m_in.m_format_ctx->start_time != AV_NOPTS_VALUE) ? m_in.m_format_ctx->start_time : 0;
+
+    if (resume_point.m_offset)
+    {
+        int64_t pos = resume_point.m_time + start_time;
+        const AVStream * stream = (m_in.m_video.m_stream != nullptr) ? m_in.m_video.m_stream : m_in.m_audio.m_stream;
+
+        if (stream != nullptr && stream->start_time != AV_NOPTS_VALUE)
+        {
+            pos -= ffmpeg_rescale_q(stream->start_time, stream->time_base);
+        }
+
+        if (seek_input(pos > 0 ? pos : 0, true) < 0)
+        {
+            Logging::warning(virtname(), "Cannot resume the interrupted transcode, starting over.");
+            resume_point.m_offset = 0;
+        }
+    }
+
+    if (!resume_point.m_offset)
+    {
+        // Drop whatever an earlier run has left behind the header
+        m_buffer->truncate_at_pos();
+
+        resume_point.m_time         = 0;
+        resume_point.m_header_size  = header_size;
+        m_buffer->set_resume_point(resume_point);
+        m_resume                    = resume_point;
+        return 0;
+    }
+
+    int64_t ret = avio_seek(m_out.m_format_ctx->pb, static_cast<int64_t>(resume_point.m_offset), SEEK_SET);
+    if (ret < 0)
+    {
+        Logging::error(virtname(), "Could not seek to the resume point (error '%1').", ffmpeg_geterror(static_cast<int>(ret)).c_str());
+        return static_cast<int>(ret);
+    }
+
+    m_buffer->set_resume_point(resume_point);
+
+    // Packets and frames before the resume point are already in the file
+    m_reset_pts     = FFMPEGFS_AUDIO | FFMPEGFS_VIDEO;
+    m_resume_pts    = resume_point.m_time + start_time;
+
+    Logging::info(virtname(), "Resuming the interrupted transcode at %1 (offset %2).", format_duration(resume_point.m_time).c_str(), format_size(resume_point.m_offset).c_str());
+
+    return 0;
+}
+
+bool FFmpeg_Transcoder::before_resume_point(int64_t pts, const AVRational & time_base) const
+{
+    return (m_resume_pts != AV_NOPTS_VALUE && pts != AV_NOPTS_VALUE && ffmpeg_rescale_q(pts, time_base) < m_resume_pts);
+}
+
 enum AVPixelFormat FFmpeg_Transcoder::get_format_static(AVCodecContext *input_codec_ctx, const enum AVPixelFormat *pix_fmts)
 {
     FFmpeg_Transcoder * pThis = static_cast<FFmpeg_Transcoder *>(input_codec_ctx->opaque);
@@ -8087,7 +8726,7 @@ void FFmpeg_Transcoder::get_pix_formats(AVPixelFormat *in_pix_fmt, AVPixelFormat
 
 uint32_t FFmpeg_Transcoder::get_next_segment(int64_t pos) const
 {
-    return (static_cast<uint32_t>(pos / params.m_segment_duration + 1));
+    return m_virtualfile->get_segment_no(pos);
 }
 
 bool FFmpeg_Transcoder::goto_next_segment(uint32_t next_segment) const
@@ -8095,6 +8734,64 @@ bool FFmpeg_Transcoder::goto_next_segment(uint32_t next_segment) const
     return (next_segment == m_current_segment + 1 && next_segment <= m_virtualfile->get_segment_count());
 }
 
+void FFmpeg_Transcoder::find_keyframe_segments()
+{
+    std::vector<int64_t> segment_starts;
+
+    // If the video is encoded, key frames are inserted at fixed segment starts anyway
+    if (m_in.m_video.m_stream != nullptr && m_virtualfile->m_type == VIRTUALTYPE::DISK && !(m_virtualfile->m_flags & VIRTUALFLAG_CUESHEET) && can_copy_stream(m_in.m_video.m_stream))
+    {
+        const AVStream * stream = m_in.m_video.m_stream;
+        const int64_t start_time = (stream->start_time != AV_NOPTS_VALUE) ? stream->start_time : 0;
+#if LAVF_INDEX_GET_ENTRY
+        const int entries = avformat_index_get_entries_count(stream);
+#else
+        const int entries = stream->nb_index_entries;
+#endif
+        int64_t next_start = params.m_segment_duration;
+        int64_t last_keyframe = 0;
+
+        segment_starts.push_back(0);
+
+        for (int n = 0; n < entries; n++)
+        {
+#if LAVF_INDEX_GET_ENTRY
+            const AVIndexEntry * entry = avformat_index_get_entry(const_cast<AVStream *>(stream), n);
+#else
+            const AVIndexEntry * entry = &stream->index_entries[n];
+#endif
+            if (entry == nullptr || !(entry->flags & AVINDEX_KEYFRAME))
+            {
+                continue;
+            }
+
+            int64_t pos = ffmpeg_rescale_q(entry->timestamp - start_time, stream->time_base);
+
+            last_keyframe = pos;
+
+            // Do not leave a very short last segment
+            if (pos >= next_start && pos < m_virtualfile->m_duration - AV_TIME_BASE)
+            {
+                segment_starts.push_back(pos);
+                next_start = pos + params.m_segment_duration;
+            }
+        }
+
+        // The index may only cover the beginning, e.g. fragmented MP4
+        if (segment_starts.size() < 2 || last_keyframe + 2 * params.m_segment_duration < m_virtualfile->m_duration)
+        {
+            Logging::info(filename(), "No usable key frame index found, using HLS segments of fixed length.");
+            segment_starts.clear();
+        }
+        else
+        {
+            Logging::info(filename(), "Starting %1 HLS segments at key frames.", segment_starts.size());
+        }
+    }
+
+    m_virtualfile->set_segment_starts(std::move(segment_starts));
+}
+
 bool FFmpeg_Transcoder::is_audio_stream(int stream_idx) const
 {
     return (stream_exists(stream_idx) && stream_idx == m_in.m_audio.m_stream_idx);
@@ -8424,11 +9121,9 @@ int FFmpeg_Transcoder::add_external_subtitle_streams()
 
 int64_t FFmpeg_Transcoder::pts() const
 {
-    MULTIFRAME_MAP::const_reverse_iterator it = m_frame_map.crbegin();
-
-    if (it != m_frame_map.crend())
+    if (!m_frame_map.empty())
     {
-        return it->first;
+        return m_frame_map.back_pos();
     }
     else
     {
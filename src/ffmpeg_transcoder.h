@@ -42,9 +42,14 @@
 #include "ffmpeg_swscontext.h"
 #include "ffmpeg_packet.h"
 #include "ffmpeg_subtitle.h"
+#include "ffmpeg_reorderbuffer.h"
+#include "ffmpeg_bufferpool.h"
+#include "ffmpeg_pipeline.h"
+#include "ffmpeg_keyframeindex.h"
 #include "id3v1tag.h"
 #include "fileio.h"
 #include "ffmpeg_profiles.h"
+#include "buffer.h"
 
 #include <queue>
 #include <mutex>
@@ -52,9 +57,9 @@
 #include <functional>
 #include <optional>
 #include <atomic>
+#include <memory>
 #include <utility>
 
-class Buffer;
 class FFmpeg_Dictionary;
 struct AVFilterContext;
 struct AVFilterGraph;
@@ -137,6 +142,7 @@ protected:
         AVStream *                      m_stream;                   /**< @brief AVStream for this encoder stream */
         int                             m_stream_idx;               /**< @brief Stream index in AVFormatContext */
         int64_t                         m_start_time;               /**< @brief Start time of the stream in stream time base units, may be 0 */
+        AVRational                      m_time_base;                /**< @brief Output streams: stream time base, copied once the header has been written. Used while decoding, as the header is written again at every HLS segment. */
     };
 
     typedef std::map<int, StreamRef> StreamRef_map;                 /**< @brief Map stream index to StreamRef */
@@ -172,8 +178,8 @@ protected:
             std::memset(&m_id3v1, 0, sizeof(m_id3v1));
         }
 
-        int64_t                 m_audio_pts;                        /**< @brief Global timestamp for the audio frames in output audio stream time base units  */
-        int64_t                 m_video_pts;                        /**< @brief Global timestamp for the video frames in output video stream time base units  */
+        std::atomic_int64_t     m_audio_pts;                        /**< @brief Global timestamp for the audio frames in output audio stream time base units. Atomic as the decoder may run in a thread of its own. */
+        std::atomic_int64_t     m_video_pts;                        /**< @brief Global timestamp for the video frames in output video stream time base units. Atomic as the decoder may run in a thread of its own. */
         int64_t                 m_last_mux_dts;                     /**< @brief Last muxed DTS */
 
         ID3v1                   m_id3v1;                            /**< @brief mp3 only, can be referenced at any time */
@@ -188,8 +194,7 @@ protected:
         FALLBACK                                                    /**< @brief Hardware acceleration selected, but fell back to software */
     };
 
-    typedef std::variant<FFmpeg_Frame, FFmpeg_Subtitle> MULTIFRAME; /**< @brief Combined audio/videoframe and subtitle */
-    typedef std::multimap<int64_t, MULTIFRAME>  MULTIFRAME_MAP;     /**< @brief Audio frame/video frame/subtitle buffer */
+    typedef FFmpeg_ReorderBuffer::MULTIFRAME    MULTIFRAME;         /**< @brief Combined audio/videoframe and subtitle */
     typedef std::map<int, int>                  STREAM_MAP;         /**< @brief Map input subtitle stream to output stream */
 
 public:
@@ -364,6 +369,43 @@ public:
      * @return Returns true if a seek was done, false if not.
      */
     bool                        have_seeked() const;
+    /**
+     * @brief Continue an interrupted transcode instead of starting over.
+     *
+     * Must be called before open_output_file(). If the output cannot be
+     * resumed, the transcode silently starts over.
+     *
+     * @param[in] resume_point - Resume point recorded in the cache index.
+     */
+    void                        set_resume_point(const Buffer::RESUME_POINT & resume_point);
+    /**
+     * @brief Check if a key frame index can be built and used for the input file.
+     *
+     * Only for regular files in formats that can be seeked to any byte
+     * position, like MPEG transport and program streams, where the demuxer
+     * picks up at the next packet.
+     *
+     * @return Returns true if possible; false if not.
+     */
+    bool                        can_index_keyframes() const;
+    /**
+     * @brief Use a key frame index stored before to seek.
+     * Must be called after open_input_file().
+     * @param[in] keyframe_index - Complete key frame index of the input file.
+     * @return Returns true if the index is used; false if it does not fit the input file.
+     */
+    bool                        set_keyframe_index(const FFmpeg_KeyframeIndex & keyframe_index);
+    /**
+     * @brief Get the key frame index of the input file.
+     * @return Returns the key frame index.
+     */
+    const FFmpeg_KeyframeIndex &keyframe_index() const;
+    /**
+     * @brief Check if a key frame index has been built while transcoding.
+     * The input file must have been read from start to end, without seeking.
+     * @return Returns true if a new, complete index is available; false if not.
+     */
+    bool                        keyframe_index_built() const;
     /**
      * @brief Flush FFmpeg's input buffers
      */
@@ -401,6 +443,43 @@ protected:
      * @return On success, returns 0; on error, a negative AVERROR value.
      */
     int                         copy_audio_to_frame_buffer(int *finished);
+    /**
+     * @brief Get the number of samples per frame passed to the audio encoder.
+     * @return Returns the encoder's frame size, or an arbitrary value if it accepts any size.
+     */
+    int                         audio_output_frame_size() const;
+    /**
+     * @brief Decode the next part of the input and store the frames.
+     * Called by process_single_fr(), or by the decoder thread if pipelined.
+     * @param[out] finished - Set to 1 at the end of input.
+     * @return On success, returns 0; on error, a negative AVERROR value.
+     */
+    int                         decode_stage(int *finished);
+    /**
+     * @brief Store a decoded frame or subtitle for encoding.
+     * In the decoder thread, the frame is passed to the transcoder thread,
+     * otherwise it goes directly to the reorder buffer.
+     * @param[in] pos - Position of the frame in AV_TIME_BASE units.
+     * @param[in] multiframe - Frame or subtitle, moved.
+     * @return On success, returns 0. Returns AVERROR_EXIT in the decoder thread if the frame was dropped because the transcoder pauses or stops it; the caller must stop decoding and return the error.
+     */
+    int                         store_frame(int64_t pos, MULTIFRAME && multiframe);
+    /**
+     * @brief Check if decoding can run in a thread of its own (--pipeline).
+     * Not possible if packets are written while decoding, i.e. for copied
+     * streams and album arts, or for frame sets.
+     * @return Returns true if decoding can be pipelined; false if not.
+     */
+    bool                        can_pipeline() const;
+    /**
+     * @brief Start decoding in a thread of its own if enabled and possible.
+     * Falls back to decoding in the transcoder thread if the thread cannot be started.
+     */
+    void                        start_pipeline();
+    /**
+     * @brief Stop the decoder thread if running.
+     */
+    void                        stop_pipeline();
     /**
      * @brief Find best match stream and open codec context for it.
      * @param[in] format_ctx - Output format context
@@ -799,26 +878,14 @@ protected:
      * @return On success, returns 0; on error, a negative AVERROR value.
      */
     int                         decode_frame(AVPacket *pkt);
-    /**
-     * @brief Initialise a temporary storage for the specified number of audio samples.
-     * The conversion requires temporary storage due to the different format.
-     * The number of audio samples to be allocated is specified in frame_size.
-     * @param[out] converted_input_samples - Memory for input samples.
-     * @param[in] frame_size - Size of one frame.
-     * @return On success, returns 0; on error, a negative AVERROR value.
-     */
-    int                         init_converted_samples(uint8_t ***converted_input_samples, int frame_size);
     /**
      * @brief Convert the input audio samples into the output sample format.
-     * The conversion happens on a per-frame basis, the size of which is
-     * specified by frame_size.
+     * The resampler writes directly into the audio FIFO buffer.
      * @param[in] input_data - Input data.
      * @param[in] in_samples - Number of input samples.
-     * @param[out] converted_data - Converted data.
-     * @param[out] out_samples - Number of output samples
      * @return On success, returns 0; on error, a negative AVERROR value.
      */
-    int                         convert_samples(uint8_t **input_data, int in_samples, uint8_t **converted_data, int *out_samples);
+    int                         convert_samples(uint8_t **input_data, int in_samples);
     /**
      * @brief Add converted input audio samples to the FIFO buffer for later processing.
      * @param[in] converted_input_samples - Samples to add.
@@ -826,6 +893,15 @@ protected:
      * @return On success, returns 0; on error, a negative AVERROR value.
      */
     int                         add_samples_to_fifo(uint8_t **converted_input_samples, int frame_size);
+    /**
+     * @brief Store decoded audio samples that need no conversion.
+     * If the audio FIFO is empty and the encoder accepts the frame size, the
+     * frame is passed to the encoder as it is. Otherwise, the samples are
+     * added to the audio FIFO and re-chunked to the encoder's frame size.
+     * @param[in] frame - Decoded frame. Moved out if passed to the encoder.
+     * @return On success, returns 0; on error, a negative AVERROR value.
+     */
+    int                         store_audio_samples(FFmpeg_Frame & frame);
     /**
      * @brief Flush the remaining frames for all streams.
      * @return On success, returns 0; on error, a negative AVERROR value.
@@ -851,7 +927,7 @@ protected:
      * @param[in] frame_size - Size of new frame.
      * @return On success, returns 0; on error, a negative AVERROR value.
      */
-    int                         init_audio_output_frame(AVFrame *frame, int frame_size) const;
+    int                         init_audio_output_frame(AVFrame *frame, int frame_size);
     /**
      * @brief Allocate memory for one picture.
      * @param[in] frame - Frame to prepare
@@ -860,7 +936,7 @@ protected:
      * @param[in] height - Picture height
      * @return On success, returns 0; on error, a negative AVERROR value.
      */
-    int                         alloc_picture(AVFrame *frame, AVPixelFormat pix_fmt, int width, int height) const;
+    int                         alloc_picture(AVFrame *frame, AVPixelFormat pix_fmt, int width, int height);
     /**
      * @brief Produce audio dts/pts. This is required because the target codec usually has a different
      * frame size than the source, so the number of packets will not match 1:1.
@@ -885,6 +961,12 @@ protected:
      * @return On success, returns 0. On error, returns a negative AVERROR value.
      */
     int                         create_audio_frame(int frame_size);
+    /**
+     * @brief Set the time stamp of an audio frame and store it in the frame buffer.
+     * @param[in] output_frame - Audio frame to encode, in the output format.
+     * @return On success, returns 0. On error, returns a negative AVERROR value, see store_frame().
+     */
+    int                         store_audio_frame(FFmpeg_Frame && output_frame);
     /**
      * @brief Create one frame worth of audio to the output file.
      * @param[in] frame - Audio frame to encode
@@ -953,6 +1035,24 @@ protected:
      * @return On successs returns 0. On error, returns -1 and sets errno accordingly.
      */
     static int64_t              seek(void * opaque, int64_t offset, int whence);
+    /**
+     * @brief Custom write function for FFmpeg that also receives fragment boundaries
+     *
+     * Records the start of fragments in the buffer, so an interrupted transcode
+     * can be resumed.
+     *
+     * @param[in] opaque - Payload given to FFmpeg, basically the Buffer object
+     * @param[in] data - Buffer with data to write.
+     * @param[in] size - Size of data block.
+     * @param[in] type - Type of data, see AVIODataMarkerType.
+     * @param[in] time - Time of the data in AV_TIME_BASE units, AV_NOPTS_VALUE if unknown.
+     * @return On success, returns bytes written. On error, returns a negative AVERROR value.
+     */
+#if LAVF_WRITEPACKET_CONST
+    static int                  output_write_data_type(void * opaque, const uint8_t * data, int size, enum AVIODataMarkerType type, int64_t time);
+#else
+    static int                  output_write_data_type(void * opaque, uint8_t * data, int size, enum AVIODataMarkerType type, int64_t time);
+#endif
 
     /**
      * @brief Calculate the appropriate bitrate for a ProRes file given several parameters.
@@ -1043,6 +1143,32 @@ protected:
      * @return Returns 0 if OK, or negative AVERROR value.
      */
     int 						init_rescaler(AVPixelFormat in_pix_fmt, int in_width, int in_height, AVPixelFormat out_pix_fmt, int out_width, int out_height);
+    /**
+     * @brief Get the number of threads to scale and convert images with.
+     * Small images are not worth the overhead, larger ones get about one thread per two megapixels.
+     * @param[in] pixels - Number of pixels of the image
+     * @return Returns the number of threads, at least 1.
+     */
+    static int                  get_slice_threads(int64_t pixels);
+    /**
+     * @brief Get the number of threads to deinterlace images with.
+     * Deinterlacing is more expensive than scaling, images get about one thread per half megapixel.
+     * @param[in] pixels - Number of pixels of the image
+     * @return Returns the number of threads, at least 1.
+     */
+    static int                  get_filter_threads(int64_t pixels);
+    /**
+     * @brief Take up to the desired number of threads from the budget shared by all transcoders.
+     * The budget is the number of CPU cores. If it is used up, a single thread is granted anyway.
+     * @param[in] threads - Desired number of threads.
+     * @return Returns the number of threads granted, at least 1. Must be handed back with release_threads().
+     */
+    static int                  acquire_threads(int threads);
+    /**
+     * @brief Hand back threads granted by acquire_threads().
+     * @param[in, out] threads - Number of threads to hand back, set to 0.
+     */
+    static void                 release_threads(int *threads);
     /**
      * @brief Purge all samples in audio FIFO
      * @return Number of samples that have been purged. Function never fails.
@@ -1246,6 +1372,14 @@ protected:
      * @return Returns true if next segment should start, false if not.
      */
     bool                        goto_next_segment(uint32_t next_segment) const;
+    /**
+     * @brief Determine HLS segments starting at key frames of the source.
+     * Takes the key frames from the index of the input container. Segments
+     * are at least the segment duration long and end at the next key frame.
+     * If the video stream cannot be copied or there is no index, segments of
+     * fixed length are used.
+     */
+    void                        find_keyframe_segments();
 
     /**
      * @brief Create a fake WAV header
@@ -1344,12 +1478,66 @@ protected:
      * @return 0 on success, a negative AVERROR code on failure.
      */
     int                         seek_hls_segment(uint32_t segment_no, bool require_output_streams);
+    /**
+     * @brief Seek the input file to a position.
+     * @param[in] pos Position in AV_TIME_BASE units, relative to the start of the file.
+     * @param[in] require_output_streams Also require matching output streams.
+     * @return 0 on success, a negative AVERROR code on failure.
+     */
+    int                         seek_input(int64_t pos, bool require_output_streams);
+    /**
+     * @brief Seek the input file to the last key frame before a time stamp, if indexed.
+     * @param[in] vstream_pts - Time stamp in the time base of the video stream.
+     * @return Returns 0 if OK, or negative AVERROR value. AVERROR(ENOENT) if the key frame index cannot be used.
+     */
+    int                         seek_keyframe(int64_t vstream_pts);
+    /**
+     * @brief Check if the output can be resumed after an interruption.
+     *
+     * Only fragmented MP4 files that are not stream copied can be resumed:
+     * every completed fragment is a valid point to continue at.
+     *
+     * @return Returns true if resume points are recorded for this output.
+     */
+    bool                        resume_supported() const;
+    /**
+     * @brief Record the header size and, if requested, continue at the resume point.
+     *
+     * Must be called after the output header has been written. If the header
+     * differs from the one written before, everything after it is discarded
+     * and the transcode starts over.
+     *
+     * @return 0 on success, a negative AVERROR code on failure.
+     */
+    int                         resume_output();
+    /**
+     * @brief Check if a packet or frame has already been written before the resume point.
+     * @param[in] pts - Presentation time stamp.
+     * @param[in] time_base - Time base of pts.
+     * @return Returns true if it is to be dropped, false if not.
+     */
+    bool                        before_resume_point(int64_t pts, const AVRational & time_base) const;
 
+    /**
+     * @brief HLS only: get the segment to seek to before the next segment is started.
+     * Removes all stacked seek requests up to that segment. Requests for
+     * segments that have been transcoded already, or that are close ahead,
+     * are discarded.
+     * @return Returns the segment number, or 0 to continue with the next segment.
+     */
+    uint32_t                    next_seek_segment();
     /**
      * @brief HLS only: start a new HLS segment.
+     *
+     * Without a seek, only the muxer is restarted: the finished segment gets
+     * its trailer and the next one a new header. The encoders keep running
+     * across the boundary; a key frame has been forced at its PTS already.
+     * After a seek, the output including the encoders is opened again.
+     *
+     * @param[in] seek_segment - Segment to seek to as returned by next_seek_segment(), or 0 to continue with the next segment.
      * @return 0 on success, a negative AVERROR code on failure.
      */
-    int                         start_new_segment();
+    int                         start_new_segment(uint32_t seek_segment);
 
     /**
      * @brief FFmpeg_Transcoder::read_packet
@@ -1485,7 +1673,7 @@ private:
     bool                        m_skip_next_frame;              /**< @brief After seek, skip next video frame */
     bool                        m_is_video;                     /**< @brief true if input is a video file */
 
-    MULTIFRAME_MAP              m_frame_map;                    /**< @brief Audio/video/subtitle frame map */
+    FFmpeg_ReorderBuffer        m_frame_map;                    /**< @brief Audio/video/subtitle frames, ordered by position */
 
     // Audio conversion and buffering
     AVSampleFormat              m_cur_sample_fmt;               /**< @brief Currently selected audio sample format */
@@ -1497,12 +1685,16 @@ private:
 #endif  // !LAVU_DEP_OLD_CHANNEL_LAYOUT
     FFmpeg_SwrContext           m_audio_resample_ctx;           /**< @brief SwResample context for audio resampling */
     FFmpeg_AudioFifo            m_audio_fifo;                   /**< @brief Audio sample FIFO */
+    uint64_t                    m_audio_frames_passed;          /**< @brief Number of decoded audio frames passed to the encoder without conversion */
+    FFmpeg_BufferPool           m_buffer_pool;                  /**< @brief Pooled data buffers for output frames */
 
     // Video conversion and buffering
     FFmpeg_SwsContext           m_sws_ctx;                      /**< @brief Context for video filtering */
+    int                         m_sws_threads;                  /**< @brief Threads taken from the thread budget for m_sws_ctx */
     AVFilterContext *           m_buffer_sink_context;          /**< @brief Video filter sink context */
     AVFilterContext *           m_buffer_source_context;        /**< @brief Video filter source context */
     AVFilterGraph *             m_filter_graph;                 /**< @brief Video filter graph */
+    int                         m_filter_threads;               /**< @brief Threads taken from the thread budget for m_filter_graph */
     int64_t                     m_pts;                          /**< @brief Generated PTS */
     int64_t                     m_pos;                          /**< @brief Generated position */
 
@@ -1513,6 +1705,15 @@ private:
 
     uint32_t                    m_current_segment;              /**< @brief HLS only: Segment file number currently being encoded */
     bool                        m_insert_keyframe;              /**< @brief HLS only: Allow insertion of 1 keyframe */
+    uint32_t                    m_keyframe_segment;             /**< @brief HLS only, pipelined: Segment the last key frame was inserted for. The decoder may be ahead of m_current_segment. */
+
+    // Pipelined decoding
+    std::unique_ptr<FFmpeg_Pipeline> m_pipeline;                /**< @brief Decoder running in a thread of its own, nullptr if decoding in the transcoder thread */
+
+    // Key frame index
+    FFmpeg_KeyframeIndex        m_keyframe_index;               /**< @brief Key frame positions of the input file, used to seek if complete */
+    bool                        m_build_keyframe_index;         /**< @brief Record key frames while reading; cleared when seeking */
+    bool                        m_keyframe_index_built;         /**< @brief A complete key frame index was built while reading */
 
     // If the audio and/or video stream is copied, packets will be stuffed into the packet queue.
     bool                        m_copy_audio;                   /**< @brief If true, copy audio stream from source to target (just remux, no recode). */
@@ -1529,8 +1730,14 @@ private:
     uint32_t                    m_reset_pts;                    /**< @brief We have to reset audio/video pts to the new position */
     uint32_t                    m_fake_frame_no;                /**< @brief The MJEPG codec requires monotonically growing PTS values so we fake some to avoid them going backwards after seeks */
 
+    // Resuming interrupted transcodes
+    Buffer::RESUME_POINT        m_resume;                       /**< @brief Resume point to continue at, m_offset is 0 to start from the beginning */
+    int64_t                     m_resume_pts;                   /**< @brief Drop audio packets and video frames before this input time stamp (AV_TIME_BASE units), AV_NOPTS_VALUE if none */
+
     static const std::vector<PRORES_BITRATE> m_prores_bitrate;	/**< @brief ProRes bitrate table. Used for file size prediction. */
 
+    static std::atomic_int      m_threads_used;                 /**< @brief Slice threads currently used by all transcoders, see acquire_threads() */
+
     // Hardware acceleration
     static const DEVICETYPE_MAP m_devicetype_map;               /**< @brief List of AVPixelFormats mapped to hardware acceleration types */
     HWACCELMODE                 m_hwaccel_enc_mode;             /**< @brief Current hardware acceleration mode for encoder */
@@ -2070,6 +2070,53 @@ size_t get_disk_free(std::string & path)
     return static_cast<size_t>(buf.f_bfree * buf.f_bsize);
 }
 
+/**
+ * @brief Mix one 64 bit word into the hash.
+ * @param[in] hash - Current hash.
+ * @param[in] word - Word to mix in.
+ * @return Returns the new hash.
+ */
+static inline uint64_t hash64_round(uint64_t hash, uint64_t word)
+{
+    hash ^= word * 0x9E3779B97F4A7C15ULL;
+    hash  = (hash << 27) | (hash >> 37);
+    return hash * 0xC2B2AE3D27D4EB4FULL + 0x165667B19E3779F9ULL;
+}
+
+uint64_t hash64_update(uint64_t hash, const uint8_t *data, size_t size)
+{
+    size_t n;
+
+    for (n = 0; n + sizeof(uint64_t) <= size; n += sizeof(uint64_t))
+    {
+        uint64_t word;
+
+        std::memcpy(&word, data + n, sizeof(word));
+        hash = hash64_round(hash, word);
+    }
+
+    if (n < size)
+    {
+        uint64_t word = 0;
+
+        std::memcpy(&word, data + n, size - n);
+        hash = hash64_round(hash, word);
+    }
+
+    return hash;
+}
+
+uint64_t hash64_final(uint64_t hash, uint64_t total_size)
+{
+    hash ^= total_size;
+    hash ^= hash >> 33;
+    hash *= 0xFF51AFD7ED558CCDULL;
+    hash ^= hash >> 33;
+    hash *= 0xC4CEB9FE1A85EC53ULL;
+    hash ^= hash >> 33;
+    return hash;
+}
+
 bool check_ignore(size_t size, size_t offset)
 {
     std::array<size_t, 3> blocksize_arr = { 0x2000, 0x8000, 0x10000 };
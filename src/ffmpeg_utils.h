@@ -234,6 +234,16 @@ enum class AUTOCOPY
     STRICTLIMIT,  /**< @brief Same as STRICT, only copy if target not larger, transcode otherwise. */
 };
 
+/**
+  * Deinterlace filter options
+  */
+enum class DEINTERLACE
+{
+    BWDIF = 0,  /**< @brief Bob Weaver deinterlacing filter, best quality. */
+    YADIF,      /**< @brief Yet another deinterlacing filter, faster than bwdif. */
+    FAST,       /**< @brief yadif without spatial interlacing check, fastest. */
+};
+
 /**
   * Recode to same format options
   */
@@ -939,6 +949,27 @@ struct comp
  */
 size_t              get_disk_free(std::string & path);
 
+/**
+ * @brief Fast, non-cryptographic 64 bit hash, used for cache file checksums.
+ *
+ * Can be computed in chunks: pass the result of the previous call as hash
+ * (0 for the first chunk). All chunks but the last must be a multiple of 8
+ * bytes in size. Finish with hash64_final().
+ *
+ * @param[in] hash - Hash of the previous chunks, or 0.
+ * @param[in] data - Data to hash.
+ * @param[in] size - Size of data.
+ * @return Returns the intermediate hash.
+ */
+uint64_t            hash64_update(uint64_t hash, const uint8_t *data, size_t size);
+/**
+ * @brief Finish a hash computed with hash64_update().
+ * @param[in] hash - Intermediate hash.
+ * @param[in] total_size - Total number of bytes hashed.
+ * @return Returns the final hash.
+ */
+uint64_t            hash64_final(uint64_t hash, uint64_t total_size);
+
 /**
  * @brief For use with win_smb_fix=1: Check if this an illegal access offset by Windows
  * @param[in] size - sizeof of the file
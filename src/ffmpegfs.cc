@@ -104,8 +104,10 @@ FFMPEGFS_PARAMS::FFMPEGFS_PARAMS()
     , m_videowidth(0)                                   // default: do not change width
     , m_videoheight(0)                                  // default: do not change height
     , m_deinterlace(0)                                  // default: do not interlace video
+    , m_deinterlace_mode(DEINTERLACE::BWDIF)            // default: Bob Weaver deinterlacing filter
     , m_segment_duration(10 * AV_TIME_BASE)             // default: 10 seconds
     , m_min_seek_time_diff(30 * AV_TIME_BASE)           // default: 30 seconds
+    , m_hls_keyframe_segments(0)                        // default: fixed segment duration
     // Hardware acceleration
     , m_hwaccel_enc_API(HWACCELAPI::NONE)                // default: Use software encoder
     , m_hwaccel_enc_device_type(AV_HWDEVICE_TYPE_NONE)  // default: Use software encoder
@@ -136,12 +138,28 @@ FFMPEGFS_PARAMS::FFMPEGFS_PARAMS()
     , m_prebuffer_size(100 /* KB */ * 1024)             // default: 100 KB
     , m_max_cache_size(0)                               // default: no limit
     , m_min_diskspace(0)                                // default: no minimum
+    , m_ram_cache_size(0)                               // default: memory tier disabled
+    , m_ram_cache_max_item(8 /* MB */ * 1024 * 1024)    // default: 8 MB
+    , m_ram_cache_min_hits(2)                           // default: admit on second access
+    , m_hls_mapped_files(128)                           // default: keep up to 128 idle segments mapped
+    , m_hls_mapped_size(512 /* MB */ * 1024 * 1024)     // default: 512 MB
+    , m_writeback_chunk(4 /* MB */ * 1024 * 1024)       // default: 4 MB
+    , m_writeback_max_dirty(32 /* MB */ * 1024 * 1024)  // default: 32 MB
+    , m_writeback_drop_behind(64 /* MB */ * 1024 * 1024) // default: 64 MB
     , m_cachepath("")                                   // default: $XDG_CACHE_HOME/ffmpegfs
+    , m_cache_roots(new (std::nothrow) CACHEROOT_VEC)   // default: no additional roots
     , m_disable_cache(0)                                // default: enabled
+    , m_resume_transcode(0)                             // default: start over
     , m_cache_maintenance((60*60))                      // default: prune every 60 minutes
+    , m_cache_scrub(0)                                  // default: do not verify checksums
+    , m_cache_sweep(0)                                  // default: do not check cache at start up
     , m_prune_cache(0)                                  // default: Do not prune cache immediately
     , m_clear_cache(0)                                  // default: Do not clear cache on startup
+    , m_export_cache("")                                // default: Do not export cache
+    , m_import_cache("")                                // default: Do not import cache
+    , m_cache_trace("")                                 // default: Do not record cache events
     , m_max_threads(0)                                  // default: 16 * CPU cores (this value here is overwritten later)
+    , m_pipeline(0)                                     // default: decode in the recoder thread
     , m_decoding_errors(0)                              // default: ignore errors
     , m_min_dvd_chapter_duration(1)                     // default: 1 second
     , m_oldnamescheme(0)                                // default: new scheme
@@ -185,8 +203,10 @@ FFMPEGFS_PARAMS& FFMPEGFS_PARAMS::operator=(const FFMPEGFS_PARAMS & other) noexc
         m_videowidth = other.m_videowidth;
         m_videoheight = other.m_videoheight;
         m_deinterlace = other.m_deinterlace;
+        m_deinterlace_mode = other.m_deinterlace_mode;
         m_segment_duration = other.m_segment_duration;
         m_min_seek_time_diff = other.m_min_seek_time_diff;
+        m_hls_keyframe_segments = other.m_hls_keyframe_segments;
 
         m_hwaccel_enc_API = other.m_hwaccel_enc_API;
         m_hwaccel_enc_device_type = other.m_hwaccel_enc_device_type;
@@ -217,12 +237,28 @@ FFMPEGFS_PARAMS& FFMPEGFS_PARAMS::operator=(const FFMPEGFS_PARAMS & other) noexc
         m_prebuffer_size = other.m_prebuffer_size;
         m_max_cache_size = other.m_max_cache_size;
         m_min_diskspace = other.m_min_diskspace;
+        m_ram_cache_size = other.m_ram_cache_size;
+        m_ram_cache_max_item = other.m_ram_cache_max_item;
+        m_ram_cache_min_hits = other.m_ram_cache_min_hits;
+        m_hls_mapped_files = other.m_hls_mapped_files;
+        m_hls_mapped_size = other.m_hls_mapped_size;
+        m_writeback_chunk = other.m_writeback_chunk;
+        m_writeback_max_dirty = other.m_writeback_max_dirty;
+        m_writeback_drop_behind = other.m_writeback_drop_behind;
         m_cachepath = other.m_cachepath;
+        *m_cache_roots = *other.m_cache_roots;
         m_disable_cache = other.m_disable_cache;
+        m_resume_transcode = other.m_resume_transcode;
         m_cache_maintenance = other.m_cache_maintenance;
+        m_cache_scrub = other.m_cache_scrub;
+        m_cache_sweep = other.m_cache_sweep;
         m_prune_cache = other.m_prune_cache;
         m_clear_cache = other.m_clear_cache;
+        m_export_cache = other.m_export_cache;
+        m_import_cache = other.m_import_cache;
+        m_cache_trace = other.m_cache_trace;
         m_max_threads = other.m_max_threads;
+        m_pipeline = other.m_pipeline;
         m_decoding_errors = other.m_decoding_errors;
         m_min_dvd_chapter_duration = other.m_min_dvd_chapter_duration;
         m_oldnamescheme = other.m_oldnamescheme;
@@ -274,10 +310,22 @@ enum    // enum class or typedef here is not compatible with Fuse API
     KEY_PREBUFFER_SIZE,
     KEY_MAX_CACHE_SIZE,
     KEY_MIN_DISKSPACE_SIZE,
+    KEY_RAM_CACHE_SIZE,
+    KEY_RAM_CACHE_MAX_ITEM,
+    KEY_HLS_MAPPED_SIZE,
+    KEY_WRITEBACK_CHUNK,
+    KEY_WRITEBACK_MAX_DIRTY,
+    KEY_WRITEBACK_DROP_BEHIND,
     KEY_CACHEPATH,
+    KEY_CACHE_ROOT,
     KEY_CACHE_MAINTENANCE,
+    KEY_CACHE_SCRUB,
+    KEY_EXPORT_CACHE,
+    KEY_IMPORT_CACHE,
+    KEY_CACHE_TRACE,
     KEY_AUTOCOPY,
     KEY_RECODESAME,
+    KEY_DEINTERLACE_MODE,
     KEY_PROFILE,
     KEY_LEVEL,
     KEY_LOG_MAXLEVEL,
@@ -340,11 +388,15 @@ static struct fuse_opt ffmpegfs_opts[] =    // NOLINT(modernize-avoid-c-arrays)
     FFMPEGFS_OPT("videowidth=%u",                   m_videowidth, 0),
     FFMPEGFS_OPT("--deinterlace",                   m_deinterlace, 1),
     FFMPEGFS_OPT("deinterlace",                     m_deinterlace, 1),
+    FUSE_OPT_KEY("--deinterlace_mode=%s",           KEY_DEINTERLACE_MODE),
+    FUSE_OPT_KEY("deinterlace_mode=%s",             KEY_DEINTERLACE_MODE),
     // HLS
     FUSE_OPT_KEY("--segment_duration=%s",           KEY_SEGMENT_DURATION),
     FUSE_OPT_KEY("segment_duration=%s",             KEY_SEGMENT_DURATION),
     FUSE_OPT_KEY("--min_seek_time_diff=%s",         KEY_MIN_SEEK_TIME_DIFF),
     FUSE_OPT_KEY("min_seek_time_diff=%s",           KEY_MIN_SEEK_TIME_DIFF),
+    FFMPEGFS_OPT("--hls_keyframe_segments",         m_hls_keyframe_segments, 1),
+    FFMPEGFS_OPT("hls_keyframe_segments",           m_hls_keyframe_segments, 1),
     // Hardware acceleration
     FUSE_OPT_KEY("--hwaccel_enc=%s",                KEY_HWACCEL_ENCODER_API),
     FUSE_OPT_KEY("hwaccel_enc=%s",                  KEY_HWACCEL_ENCODER_API),
@@ -385,19 +437,49 @@ static struct fuse_opt ffmpegfs_opts[] =    // NOLINT(modernize-avoid-c-arrays)
     FUSE_OPT_KEY("max_cache_size=%s",               KEY_MAX_CACHE_SIZE),
     FUSE_OPT_KEY("--min_diskspace=%s",              KEY_MIN_DISKSPACE_SIZE),
     FUSE_OPT_KEY("min_diskspace=%s",                KEY_MIN_DISKSPACE_SIZE),
+    FUSE_OPT_KEY("--ram_cache_size=%s",             KEY_RAM_CACHE_SIZE),
+    FUSE_OPT_KEY("ram_cache_size=%s",               KEY_RAM_CACHE_SIZE),
+    FUSE_OPT_KEY("--ram_cache_max_item=%s",         KEY_RAM_CACHE_MAX_ITEM),
+    FUSE_OPT_KEY("ram_cache_max_item=%s",           KEY_RAM_CACHE_MAX_ITEM),
+    FFMPEGFS_OPT("--ram_cache_min_hits=%u",         m_ram_cache_min_hits, 0),
+    FFMPEGFS_OPT("ram_cache_min_hits=%u",           m_ram_cache_min_hits, 0),
+    FFMPEGFS_OPT("--hls_mapped_files=%u",           m_hls_mapped_files, 0),
+    FFMPEGFS_OPT("hls_mapped_files=%u",             m_hls_mapped_files, 0),
+    FUSE_OPT_KEY("--hls_mapped_size=%s",            KEY_HLS_MAPPED_SIZE),
+    FUSE_OPT_KEY("hls_mapped_size=%s",              KEY_HLS_MAPPED_SIZE),
+    FUSE_OPT_KEY("--writeback_chunk=%s",            KEY_WRITEBACK_CHUNK),
+    FUSE_OPT_KEY("writeback_chunk=%s",              KEY_WRITEBACK_CHUNK),
+    FUSE_OPT_KEY("--writeback_max_dirty=%s",        KEY_WRITEBACK_MAX_DIRTY),
+    FUSE_OPT_KEY("writeback_max_dirty=%s",          KEY_WRITEBACK_MAX_DIRTY),
+    FUSE_OPT_KEY("--writeback_drop_behind=%s",      KEY_WRITEBACK_DROP_BEHIND),
+    FUSE_OPT_KEY("writeback_drop_behind=%s",        KEY_WRITEBACK_DROP_BEHIND),
     FUSE_OPT_KEY("--cachepath=%s",                  KEY_CACHEPATH),
     FUSE_OPT_KEY("cachepath=%s",                    KEY_CACHEPATH),
+    FUSE_OPT_KEY("--cache_root=%s",                 KEY_CACHE_ROOT),
+    FUSE_OPT_KEY("cache_root=%s",                   KEY_CACHE_ROOT),
     FFMPEGFS_OPT("--disable_cache",                 m_disable_cache, 1),
     FFMPEGFS_OPT("disable_cache",                   m_disable_cache, 1),
+    FFMPEGFS_OPT("--resume_transcode",              m_resume_transcode, 1),
+    FFMPEGFS_OPT("resume_transcode",                m_resume_transcode, 1),
     FUSE_OPT_KEY("--cache_maintenance=%s",          KEY_CACHE_MAINTENANCE),
     FUSE_OPT_KEY("cache_maintenance=%s",            KEY_CACHE_MAINTENANCE),
+    FUSE_OPT_KEY("--cache_scrub=%s",                KEY_CACHE_SCRUB),
+    FUSE_OPT_KEY("cache_scrub=%s",                  KEY_CACHE_SCRUB),
+    FFMPEGFS_OPT("--cache_sweep=%u",                m_cache_sweep, 0),
+    FFMPEGFS_OPT("cache_sweep=%u",                  m_cache_sweep, 0),
     FFMPEGFS_OPT("--prune_cache",                   m_prune_cache, 1),
     FFMPEGFS_OPT("--clear_cache",                   m_clear_cache, 1),
     FFMPEGFS_OPT("clear_cache",                     m_clear_cache, 1),
+    FUSE_OPT_KEY("--export_cache=%s",               KEY_EXPORT_CACHE),
+    FUSE_OPT_KEY("--import_cache=%s",               KEY_IMPORT_CACHE),
+    FUSE_OPT_KEY("--cache_trace=%s",                KEY_CACHE_TRACE),
+    FUSE_OPT_KEY("cache_trace=%s",                  KEY_CACHE_TRACE),
 
     // Other
     FFMPEGFS_OPT("--max_threads=%u",                m_max_threads, 0),
     FFMPEGFS_OPT("max_threads=%u",                  m_max_threads, 0),
+    FFMPEGFS_OPT("--pipeline=%u",                   m_pipeline, 0),
+    FFMPEGFS_OPT("pipeline=%u",                     m_pipeline, 0),
     FFMPEGFS_OPT("--decoding_errors=%u",            m_decoding_errors, 0),
     FFMPEGFS_OPT("decoding_errors=%u",              m_decoding_errors, 0),
     FFMPEGFS_OPT("--min_dvd_chapter_duration=%u",   m_min_dvd_chapter_duration, 0),
@@ -439,6 +521,7 @@ typedef std::map<const std::string, const AUTOCOPY, comp> AUTOCOPY_MAP;
 typedef std::map<const std::string, const PROFILE, comp> PROFILE_MAP;           /**< @brief Map command line option to PROFILE enum */
 typedef std::map<const std::string, const PRORESLEVEL, comp> LEVEL_MAP;         /**< @brief Map command line option to LEVEL enum */
 typedef std::map<const std::string, const RECODESAME, comp> RECODESAME_MAP;     /**< @brief Map command line option to RECODESAME enum */
+typedef std::map<const std::string, const DEINTERLACE, comp> DEINTERLACE_MAP;   /**< @brief Map command line option to DEINTERLACE enum */
 
 typedef struct HWACCEL                                                          /**< @brief Hardware acceleration device and type */
 {
@@ -544,6 +627,16 @@ static const RECODESAME_MAP recode_map
     { "YES",            RECODESAME::YES },
 };
 
+/**
+  * List of deinterlace options.
+  */
+static const DEINTERLACE_MAP deinterlace_map
+{
+    { "BWDIF",          DEINTERLACE::BWDIF },
+    { "YADIF",          DEINTERLACE::YADIF },
+    { "FAST",           DEINTERLACE::FAST },
+};
+
 /**
   * List if hardware acceleration options.
   * See https://trac.ffmpeg.org/wiki/HWAccelIntro
@@ -639,6 +732,7 @@ static int          get_audiocodec(const std::string & arg, AVCodecID *audio_cod
 static int          get_videocodec(const std::string & arg, AVCodecID *video_codec);
 static int          get_autocopy(const std::string & arg, AUTOCOPY *autocopy);
 static int          get_recodesame(const std::string & arg, RECODESAME *recode);
+static int          get_deinterlace_mode(const std::string & arg, DEINTERLACE *deinterlace_mode);
 static int          get_profile(const std::string & arg, PROFILE *profile);
 static int          get_level(const std::string & arg, PRORESLEVEL *level);
 static int          get_segment_duration(const std::string & arg, int64_t *value);
@@ -646,6 +740,7 @@ static int          get_seek_time_diff(const std::string & arg, int64_t *value);
 static int          get_hwaccel(const std::string & arg, HWACCELAPI *hwaccel_API, AVHWDeviceType *hwaccel_device_type);
 static int          get_codec(const std::string & codec, AVCodecID *codec_id);
 static int          get_hwaccel_dec_blocked(const std::string & arg, HWACCEL_BLOCKED_MAP **hwaccel_dec_blocked);
+static int          get_cache_root(const std::string & arg, CACHEROOT_VEC *cache_roots);
 static int          get_value(const std::string & arg, int *value);
 static int          get_value(const std::string & arg, std::string *value);
 static int          get_value(const std::string & arg, MATCHVEC *value);
@@ -1320,6 +1415,52 @@ std::string get_recodesame_text(RECODESAME recode)
     return "INVALID";
 }
 
+/**
+ * @brief Get deinterlace option.
+ * @param[in] arg - One of the deinterlace options.
+ * @param[out] deinterlace_mode - Upon return contains selected DEINTERLACE enum.
+ * @return Returns 0 if found; if not found returns -1.
+ */
+static int get_deinterlace_mode(const std::string & arg, DEINTERLACE *deinterlace_mode)
+{
+    size_t pos = arg.find('=');
+
+    if (pos != std::string::npos)
+    {
+        std::string param(arg.substr(0, pos));
+        std::string data(arg.substr(pos + 1));
+
+        DEINTERLACE_MAP::const_iterator it = deinterlace_map.find(data);
+
+        if (it == deinterlace_map.cend())
+        {
+            std::fprintf(stderr, "INVALID PARAMETER (%s): Invalid deinterlace option: %s\n", param.c_str(), data.c_str());
+
+            list_options("Valid deinterlace options are", deinterlace_map);
+
+            return -1;
+        }
+
+        *deinterlace_mode = it->second;
+
+        return 0;
+    }
+
+    std::fprintf(stderr, "INVALID PARAMETER (%s): Missing argument\n", arg.c_str());
+
+    return -1;
+}
+
+std::string get_deinterlace_mode_text(DEINTERLACE deinterlace_mode)
+{
+    DEINTERLACE_MAP::const_iterator it = search_by_value(deinterlace_map, deinterlace_mode);
+    if (it != deinterlace_map.cend())
+    {
+        return it->first;
+    }
+    return "INVALID";
+}
+
 /**
  * @brief Get profile option.
  * @param[in] arg - One of the auto profile options.
@@ -1611,6 +1752,65 @@ bool check_hwaccel_dec_blocked(AVCodecID codec_id, int profile)
     return false;
 }
 
+/**
+ * @brief Get an additional cache root: DIR[:WEIGHT[:MINFREE]]
+ * @param[in] arg - Parameter with directory, optional weight and optional free space floor.
+ * @param[out] cache_roots - List of cache roots, the new root will be appended.
+ * @return Returns 0 on success; on error returns -1.
+ */
+static int get_cache_root(const std::string & arg, CACHEROOT_VEC *cache_roots)
+{
+    size_t pos = arg.find('=');
+
+    if (pos != std::string::npos)
+    {
+        std::string param(arg.substr(0, pos));
+        std::stringstream data(arg.substr(pos + 1));
+        std::string path;
+        std::string weight;
+        std::string min_diskspace;
+        CACHEROOT cache_root;
+
+        if (!std::getline(data, path, ':') || path.empty())
+        {
+            std::fprintf(stderr, "INVALID PARAMETER (%s): Missing argument\n", param.c_str());
+            return -1;
+        }
+
+        expand_path(&cache_root.m_path, path);
+        append_sep(&cache_root.m_path);
+
+        cache_root.m_weight         = 1;
+        cache_root.m_min_diskspace  = 0;    // Use --min_diskspace
+
+        if (std::getline(data, weight, ':') && !weight.empty())
+        {
+            if (reg_compare(weight, "^[0-9]+$"))
+            {
+                std::fprintf(stderr, "INVALID PARAMETER (%s): Invalid weight '%s'\n", param.c_str(), weight.c_str());
+                return -1;
+            }
+            cache_root.m_weight = static_cast<unsigned int>(std::stoul(weight));
+        }
+
+        if (std::getline(data, min_diskspace) && !min_diskspace.empty())
+        {
+            if (get_size(param + "=" + min_diskspace, &cache_root.m_min_diskspace))
+            {
+                return -1;
+            }
+        }
+
+        cache_roots->push_back(cache_root);
+
+        return 0;
+    }
+
+    std::fprintf(stderr, "INVALID PARAMETER (%s): Missing argument\n", arg.c_str());
+
+    return -1;
+}
+
 std::string get_hwaccel_API_text(HWACCELAPI hwaccel_API)
 {
     HWACCEL_MAP::const_iterator it = hwaccel_map.cbegin();
@@ -1882,6 +2082,10 @@ static int ffmpegfs_opt_proc(__attribute__((unused)) void* data, const char* arg
     {
         return get_recodesame(arg, &params.m_recodesame);
     }
+    case KEY_DEINTERLACE_MODE:
+    {
+        return get_deinterlace_mode(arg, &params.m_deinterlace_mode);
+    }
     case KEY_PROFILE:
     {
         return get_profile(arg, &params.m_profile);
@@ -1974,14 +2178,69 @@ static int ffmpegfs_opt_proc(__attribute__((unused)) void* data, const char* arg
     {
         return get_size(arg, &params.m_min_diskspace);
     }
+    case KEY_RAM_CACHE_SIZE:
+    {
+        return get_size(arg, &params.m_ram_cache_size);
+    }
+    case KEY_RAM_CACHE_MAX_ITEM:
+    {
+        return get_size(arg, &params.m_ram_cache_max_item);
+    }
+    case KEY_HLS_MAPPED_SIZE:
+    {
+        return get_size(arg, &params.m_hls_mapped_size);
+    }
+    case KEY_WRITEBACK_CHUNK:
+    {
+        return get_size(arg, &params.m_writeback_chunk);
+    }
+    case KEY_WRITEBACK_MAX_DIRTY:
+    {
+        return get_size(arg, &params.m_writeback_max_dirty);
+    }
+    case KEY_WRITEBACK_DROP_BEHIND:
+    {
+        return get_size(arg, &params.m_writeback_drop_behind);
+    }
     case KEY_CACHEPATH:
     {
         return get_value(arg, &params.m_cachepath);
     }
+    case KEY_EXPORT_CACHE:
+    {
+        return get_value(arg, &params.m_export_cache);
+    }
+    case KEY_IMPORT_CACHE:
+    {
+        return get_value(arg, &params.m_import_cache);
+    }
+    case KEY_CACHE_TRACE:
+    {
+        std::string cache_trace;
+        int res = get_value(arg, &cache_trace);
+
+        if (res)
+        {
+            return res;
+        }
+
+        expand_path(&params.m_cache_trace, cache_trace);
+        sanitise_filepath(&params.m_cache_trace);
+
+        return 0;
+    }
+    case KEY_CACHE_ROOT:
+    {
+        return get_cache_root(arg, params.m_cache_roots.get());
+    }
     case KEY_CACHE_MAINTENANCE:
     {
         return get_time(arg, &params.m_cache_maintenance);
     }
+    case KEY_CACHE_SCRUB:
+    {
+        return get_time(arg, &params.m_cache_scrub);
+    }
     case KEY_LOG_MAXLEVEL:
     {
         return get_value(arg, &params.m_log_maxlevel);
@@ -2128,9 +2387,11 @@ static void print_params()
     Logging::trace(nullptr, "Bitrate           : %1", format_bitrate(params.m_videobitrate).c_str());
     Logging::trace(nullptr, "Dimension         : width=%1 height=%2", format_number(params.m_videowidth).c_str(), format_number(params.m_videoheight).c_str());
     Logging::trace(nullptr, "Deinterlace       : %1", params.m_deinterlace ? "yes" : "no");
+    Logging::trace(nullptr, "Deinterlace Mode  : %1", get_deinterlace_mode_text(params.m_deinterlace_mode).c_str());
     Logging::trace(nullptr, "--------- HLS Options ---------");
     Logging::trace(nullptr, "Segment Duration  : %1", format_time(static_cast<time_t>(params.m_segment_duration / AV_TIME_BASE)).c_str());
     Logging::trace(nullptr, "Seek Time Diff    : %1", format_time(static_cast<time_t>(params.m_min_seek_time_diff / AV_TIME_BASE)).c_str());
+    Logging::trace(nullptr, "Key Frame Segments: %1", params.m_hls_keyframe_segments ? "yes" : "no");
     Logging::trace(nullptr, "---- Hardware Acceleration ----");
     Logging::trace(nullptr, "Hardware Decoder:");
     Logging::trace(nullptr, "API               : %1", get_hwaccel_API_text(params.m_hwaccel_dec_API).c_str());
@@ -2159,13 +2420,32 @@ static void print_params()
     Logging::trace(nullptr, "Pre-buffer Size   : %1", format_size(params.m_prebuffer_size).c_str());
     Logging::trace(nullptr, "Max. Cache Size   : %1", format_size(params.m_max_cache_size).c_str());
     Logging::trace(nullptr, "Min. Disk Space   : %1", format_size(params.m_min_diskspace).c_str());
+    Logging::trace(nullptr, "Memory Tier Size  : %1", params.m_ram_cache_size ? format_size(params.m_ram_cache_size).c_str() : "disabled");
+    Logging::trace(nullptr, "Memory Tier Item  : %1", format_size(params.m_ram_cache_max_item).c_str());
+    Logging::trace(nullptr, "Memory Tier Hits  : %1", params.m_ram_cache_min_hits);
+    Logging::trace(nullptr, "HLS Mapped Files  : %1", params.m_hls_mapped_files ? format_number(params.m_hls_mapped_files).c_str() : "disabled");
+    Logging::trace(nullptr, "HLS Mapped Size   : %1", format_size(params.m_hls_mapped_size).c_str());
+    Logging::trace(nullptr, "Writeback Chunk   : %1", params.m_writeback_chunk ? format_size(params.m_writeback_chunk).c_str() : "disabled");
+    Logging::trace(nullptr, "Writeback Dirty   : %1", format_size(params.m_writeback_max_dirty).c_str());
+    Logging::trace(nullptr, "Writeback Drop    : %1", params.m_writeback_drop_behind ? format_size(params.m_writeback_drop_behind).c_str() : "disabled");
     Logging::trace(nullptr, "Cache Path        : %1", cachepath.c_str());
+    for (const CACHEROOT & cache_root : *params.m_cache_roots)
+    {
+        Logging::trace(nullptr, "Cache Root        : %1 (weight %2, min. free %3)", cache_root.m_path.c_str(), cache_root.m_weight, format_size(cache_root.m_min_diskspace).c_str());
+    }
     Logging::trace(nullptr, "Disable Cache     : %1", params.m_disable_cache ? "yes" : "no");
+    Logging::trace(nullptr, "Resume Transcode  : %1", params.m_resume_transcode ? "yes" : "no");
     Logging::trace(nullptr, "Maintenance Timer : %1", params.m_cache_maintenance ? format_time(params.m_cache_maintenance).c_str() : "inactive");
+    Logging::trace(nullptr, "Cache Scrubber    : %1", params.m_cache_scrub ? format_time(params.m_cache_scrub).c_str() : "inactive");
+    Logging::trace(nullptr, "Cache Sweep       : %1", params.m_cache_sweep ? (format_number(params.m_cache_sweep) + " threads").c_str() : "inactive");
     Logging::trace(nullptr, "Clear Cache       : %1", params.m_clear_cache ? "yes" : "no");
+    Logging::trace(nullptr, "Import Cache      : %1", !params.m_import_cache.empty() ? params.m_import_cache.c_str() : "no");
+    Logging::trace(nullptr, "Export Cache      : %1", !params.m_export_cache.empty() ? params.m_export_cache.c_str() : "no");
+    Logging::trace(nullptr, "Cache Trace       : %1", !params.m_cache_trace.empty() ? params.m_cache_trace.c_str() : "no");
     Logging::trace(nullptr, "--------- Various Options ---------");
     Logging::trace(nullptr, "Remove Album Arts : %1", params.m_noalbumarts ? "yes" : "no");
     Logging::trace(nullptr, "Max. Threads      : %1", format_number(params.m_max_threads).c_str());
+    Logging::trace(nullptr, "Pipeline          : %1", params.m_pipeline ? (format_number(params.m_pipeline) + " frames").c_str() : "disabled");
     Logging::trace(nullptr, "Decoding Errors   : %1", params.m_decoding_errors ? "break transcode" : "ignore");
     Logging::trace(nullptr, "Min. DVD Chapter  : %1", format_duration(params.m_min_dvd_chapter_duration * AV_TIME_BASE).c_str());
     Logging::trace(nullptr, "Old Name Scheme   : %1", params.m_oldnamescheme ? "yes" : "no");
@@ -2534,6 +2814,24 @@ int main(int argc, char *argv[])
 
     print_params();
 
+    if (!params.m_import_cache.empty() || !params.m_export_cache.empty())
+    {
+        // Import and/or export cache and exit. Import first, so an archive can be passed on.
+        if (!params.m_import_cache.empty() && !transcoder_cache_import(params.m_import_cache))
+        {
+            return 1;
+        }
+
+        if (!params.m_export_cache.empty() && !transcoder_cache_export(params.m_export_cache))
+        {
+            return 1;
+        }
+
+        transcoder_free();
+
+        return 0;
+    }
+
     if (params.m_clear_cache)
     {
         // Prune cache and exit
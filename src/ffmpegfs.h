@@ -153,6 +153,18 @@ enum class HWACCELAPI
 
 typedef std::multimap<AVCodecID, int> HWACCEL_BLOCKED_MAP;      /**< @brief Map command line option to AVCodecID */
 
+/**
+ * @brief Cache root directory
+ */
+typedef struct CACHEROOT
+{
+    std::string             m_path;                         /**< @brief Cache directory, ends with a path separator */
+    unsigned int            m_weight;                       /**< @brief Placement weight, 0 to place no new entries on this root */
+    size_t                  m_min_diskspace;                /**< @brief Min. diskspace to keep free on this root */
+} CACHEROOT;
+
+typedef std::vector<CACHEROOT> CACHEROOT_VEC;                   /**< @brief List of cache roots */
+
 extern FFMPEGFS_FORMAT_ARR ffmpeg_format;                       /**< @brief Two FFmpegfs_Format infos, 0: video file, 1: audio file */
 
 /**
@@ -209,9 +221,11 @@ extern struct FFMPEGFS_PARAMS
     int                     m_videowidth;                   /**< @brief Output video width */
     int                     m_videoheight;                  /**< @brief Output video height */
     int                     m_deinterlace;                  /**< @brief 1: deinterlace video, 0: no deinterlace */
+    DEINTERLACE             m_deinterlace_mode;             /**< @brief Deinterlace filter to use */
     // HLS Options
     int64_t                 m_segment_duration;             /**< @brief Duration of one HLS segment file, in AV_TIME_BASE fractional seconds. */
     int64_t                 m_min_seek_time_diff;           /**< @brief Minimum time diff from current to next requested segment to perform a seek, in AV_TIME_BASE fractional seconds. */
+    int                     m_hls_keyframe_segments;        /**< @brief 1: start segments at key frames of the source if video is copied, 0: fixed segment duration */
     // Hardware acceleration
     HWACCELAPI              m_hwaccel_enc_API;              /**< @brief Encoder API */
     AVHWDeviceType          m_hwaccel_enc_device_type;      /**< @brief Enable hardware acceleration buffering for encoder */
@@ -242,12 +256,28 @@ extern struct FFMPEGFS_PARAMS
     size_t                  m_prebuffer_size;               /**< @brief Number of bytes that will be decoded before the output can be accessed */
     size_t                  m_max_cache_size;               /**< @brief Max. cache size in MB. When exceeded, oldest entries will be pruned */
     size_t                  m_min_diskspace;                /**< @brief Min. diskspace required for cache */
+    size_t                  m_ram_cache_size;               /**< @brief Memory tier budget in bytes, 0 to disable */
+    size_t                  m_ram_cache_max_item;           /**< @brief Max. size of an item kept in the memory tier */
+    unsigned int            m_ram_cache_min_hits;           /**< @brief Number of accesses before an item is admitted to the memory tier */
+    unsigned int            m_hls_mapped_files;             /**< @brief Max. number of HLS segments kept mapped after the last reader is done, 0 to disable */
+    size_t                  m_hls_mapped_size;              /**< @brief Max. size of HLS segments kept mapped after the last reader is done */
+    size_t                  m_writeback_chunk;              /**< @brief Size of chunks handed to writeback behind the write head, 0 to sync synchronously */
+    size_t                  m_writeback_max_dirty;          /**< @brief Max. bytes per cache file pending writeback before the writer waits */
+    size_t                  m_writeback_drop_behind;        /**< @brief Distance behind the write head after which written back pages are dropped from the page cache, 0 to keep */
     std::string             m_cachepath;                    /**< @brief Disk cache path, defaults to $XDG_CACHE_HOME */
+    std::unique_ptr<CACHEROOT_VEC> m_cache_roots;           /**< @brief Additional cache roots. Must be a pointer as the fuse API cannot handle advanced c++ objects. */
     int                     m_disable_cache;                /**< @brief Disable cache */
+    int                     m_resume_transcode;             /**< @brief Resume interrupted transcodes of fragmented MP4 files instead of starting over */
     time_t                  m_cache_maintenance;            /**< @brief Prune timer interval */
+    time_t                  m_cache_scrub;                  /**< @brief Interval between checksum verification passes, 0 to disable */
+    unsigned int            m_cache_sweep;                  /**< @brief Number of threads for the consistency sweep at start up, 0 to disable */
     int                     m_prune_cache;                  /**< @brief Prune cache immediately */
     int                     m_clear_cache;                  /**< @brief Clear cache on start up */
+    std::string             m_export_cache;                 /**< @brief Export cache entries to this archive and exit */
+    std::string             m_import_cache;                 /**< @brief Import cache entries from this archive and exit */
+    std::string             m_cache_trace;                  /**< @brief Record cache events to this file, empty to disable */
     unsigned int            m_max_threads;                  /**< @brief Max. number of recoder threads */
+    unsigned int            m_pipeline;                     /**< @brief Max. number of frames decoded ahead in a separate thread, 0 to decode in the recoder thread */
     // Miscellanous options
     int                     m_decoding_errors;              /**< @brief Break transcoding on decoding error */
     int                     m_min_dvd_chapter_duration;     /**< @brief Min. DVD chapter duration. Shorter chapters will be ignored. */
@@ -290,6 +320,17 @@ void            init_fuse_ops();
  * @param[out] path Receives the complete transcoder cache directory path.
  */
 void            transcoder_cache_path(std::string *path);
+/**
+ * @brief Get all cache roots.
+ *
+ * The first entry is always the primary cache path as returned by
+ * transcoder_cache_path(), followed by the roots added with --cache_root.
+ * The list is built on the first call, after the command line has been
+ * parsed, and does not change afterwards.
+ *
+ * @return Returns the list of cache roots.
+ */
+const CACHEROOT_VEC & transcoder_cache_roots();
 /**
  * @brief Initialise transcoder, create cache.
  * @return Returns true on success; false on error. Check errno for details.
@@ -301,14 +342,37 @@ bool            transcoder_init();
 void            transcoder_free();
 /**
  * @brief Run cache maintenance.
+ * @param[in] throttled - If true, work in small increments and limit the rate files are removed at.
  * @return Returns true on success; false on error. Check errno for details.
  */
-bool            transcoder_cache_maintenance();
+bool            transcoder_cache_maintenance(bool throttled = false);
 /**
  * @brief Clear transcoder cache.
  * @return Returns true on success; false on error. Check errno for details.
  */
 bool            transcoder_cache_clear();
+/**
+ * @brief Export all finished cache entries to an archive.
+ * @param[in] archive - Name of the archive file, "-" for standard output.
+ * @return Returns true on success; false on error.
+ */
+bool            transcoder_cache_export(const std::string & archive);
+/**
+ * @brief Import cache entries from an archive.
+ * @param[in] archive - Name of the archive file, "-" for standard input.
+ * @return Returns true on success; false on error.
+ */
+bool            transcoder_cache_import(const std::string & archive);
+/**
+ * @brief Start the background cache scrubber if enabled.
+ * @return Returns true on success; false on error.
+ */
+bool            transcoder_start_scrubber();
+/**
+ * @brief Start the background cache consistency sweep if enabled.
+ * @return Returns true on success; false on error.
+ */
+bool            transcoder_start_sweep();
 /**
  * @brief Add new virtual file to internal list.
  *
@@ -422,6 +486,12 @@ std::string 	get_autocopy_text(AUTOCOPY autocopy);
  * @return RECODESAME enum as text or "INVALID" if not known.
  */
 std::string 	get_recodesame_text(RECODESAME recode);
+/**
+ * @brief Convert DEINTERLACE enum to human readable text.
+ * @param[in] deinterlace_mode - DEINTERLACE enum value to convert.
+ * @return DEINTERLACE enum as text or "INVALID" if not known.
+ */
+std::string 	get_deinterlace_mode_text(DEINTERLACE deinterlace_mode);
 /**
  * @brief Convert PROFILE enum to human readable text.
  * @param[in] profile - PROFILE enum value to convert.
@@ -42,9 +42,17 @@
 #include "blurayio.h"
 #endif // USE_LIBBLURAY
 
+#include <algorithm>
+
 uint32_t VIRTUALFILE::get_segment_count() const
 {
-    if (m_duration && params.m_segment_duration)
+    std::shared_ptr<const std::vector<int64_t>> segment_starts = std::atomic_load(&m_segment_starts);
+
+    if (segment_starts != nullptr && !segment_starts->empty())
+    {
+        return static_cast<uint32_t>(segment_starts->size());
+    }
+    else if (m_duration && params.m_segment_duration)
     {
         return static_cast<uint32_t>((m_duration - 200000) / params.m_segment_duration) + 1;
     }
@@ -54,6 +62,108 @@ uint32_t VIRTUALFILE::get_segment_count() const
     }
 }
 
+uint32_t VIRTUALFILE::get_segment_no(int64_t pos) const
+{
+    std::shared_ptr<const std::vector<int64_t>> segment_starts = std::atomic_load(&m_segment_starts);
+
+    if (segment_starts != nullptr && !segment_starts->empty())
+    {
+        // Last segment starting at or before pos
+        auto it = std::upper_bound(segment_starts->cbegin(), segment_starts->cend(), pos);
+
+        if (it == segment_starts->cbegin())
+        {
+            return 1;
+        }
+        return static_cast<uint32_t>(it - segment_starts->cbegin());
+    }
+    else
+    {
+        return static_cast<uint32_t>(pos / params.m_segment_duration + 1);
+    }
+}
+
+int64_t VIRTUALFILE::get_segment_start(uint32_t segment_no) const
+{
+    std::shared_ptr<const std::vector<int64_t>> segment_starts = std::atomic_load(&m_segment_starts);
+
+    if (!segment_no)
+    {
+        return 0;
+    }
+
+    if (segment_starts != nullptr && !segment_starts->empty())
+    {
+        if (segment_no > segment_starts->size())
+        {
+            return m_duration;
+        }
+        return (*segment_starts)[segment_no - 1];
+    }
+    else
+    {
+        return (segment_no - 1) * params.m_segment_duration;
+    }
+}
+
+int64_t VIRTUALFILE::get_segment_duration(uint32_t segment_no) const
+{
+    std::shared_ptr<const std::vector<int64_t>> segment_starts = std::atomic_load(&m_segment_starts);
+
+    if (segment_starts != nullptr && !segment_starts->empty())
+    {
+        if (!segment_no || segment_no > segment_starts->size())
+        {
+            return 0;
+        }
+        else if (segment_no < segment_starts->size())
+        {
+            return (*segment_starts)[segment_no] - (*segment_starts)[segment_no - 1];
+        }
+        else
+        {
+            return m_duration - (*segment_starts)[segment_no - 1];
+        }
+    }
+    else if (segment_no < get_segment_count())
+    {
+        return params.m_segment_duration;
+    }
+    else
+    {
+        return m_duration % params.m_segment_duration;
+    }
+}
+
+void VIRTUALFILE::set_segment_starts(std::vector<int64_t> && segment_starts)
+{
+    std::atomic_store(&m_segment_starts, std::shared_ptr<const std::vector<int64_t>>(std::make_shared<std::vector<int64_t>>(std::move(segment_starts))));
+}
+
+std::vector<int64_t> VIRTUALFILE::get_segment_starts() const
+{
+    std::shared_ptr<const std::vector<int64_t>> segment_starts = std::atomic_load(&m_segment_starts);
+
+    if (segment_starts == nullptr)
+    {
+        return std::vector<int64_t>();
+    }
+
+    return *segment_starts;
+}
+
+bool VIRTUALFILE::segment_starts_known() const
+{
+    return (std::atomic_load(&m_segment_starts) != nullptr);
+}
+
+bool VIRTUALFILE::has_keyframe_segments() const
+{
+    std::shared_ptr<const std::vector<int64_t>> segment_starts = std::atomic_load(&m_segment_starts);
+
+    return (segment_starts != nullptr && !segment_starts->empty());
+}
+
 FileIO::FileIO()
     : m_virtualfile(nullptr)
 {
@@ -142,6 +142,13 @@ typedef struct VIRTUALFILE
     }
 
     uint32_t get_segment_count() const;                             /**< @brief Number of HLS segments in set */
+    uint32_t get_segment_no(int64_t pos) const;                     /**< @brief HLS segment (1...n) a position in AV_TIME_BASE units belongs to */
+    int64_t get_segment_start(uint32_t segment_no) const;           /**< @brief Start of HLS segment (1...n) in AV_TIME_BASE units */
+    int64_t get_segment_duration(uint32_t segment_no) const;        /**< @brief Duration of HLS segment (1...n) in AV_TIME_BASE units */
+    void set_segment_starts(std::vector<int64_t> && segment_starts);/**< @brief Set HLS segment start times, empty for fixed length segments */
+    std::vector<int64_t> get_segment_starts() const;                /**< @brief Copy of the HLS segment start times, empty for fixed length segments or if not known yet */
+    bool segment_starts_known() const;                              /**< @brief True if set_segment_starts() has been called */
+    bool has_keyframe_segments() const;                             /**< @brief True if HLS segments start at key frames of the source and vary in length */
 
     VIRTUALTYPE             m_type;                                 /**< @brief Type of this virtual file */
     int                     m_flags;                                /**< @brief One of the VIRTUALFLAG_* flags */
@@ -156,6 +163,7 @@ typedef struct VIRTUALFILE
     int64_t                 m_duration;                             /**< @brief Track/chapter duration, in AV_TIME_BASE fractional seconds. */
     size_t                  m_predicted_size;                       /**< @brief Use this as the size instead of computing it over and over. */
     uint32_t                m_video_frame_count;                    /**< @brief Number of frames in video or 0 if not a video */
+    std::shared_ptr<const std::vector<int64_t>> m_segment_starts;   /**< @brief HLS segment start times in AV_TIME_BASE units if aligned to key frames, empty for fixed length, nullptr if not known yet. Read and written by several threads, use the access functions. */
 
     bool                    m_has_audio;                            /**< @brief True if file has an audio track */
     bool                    m_has_video;                            /**< @brief True if file has a video track */
@@ -35,6 +35,7 @@
 
 #include "transcode.h"
 #include "cache_maintenance.h"
+#include "cache_trace.h"
 #include "logging.h"
 #ifdef USE_LIBVCD
 #include "vcdparser.h"
@@ -51,6 +52,7 @@
 #include "cache_entry.h"
 
 #include <dirent.h>
+#include <algorithm>
 #include <list>
 #include <csignal>
 #include <cstring>
@@ -65,6 +67,7 @@ static bool                         is_passthrough(const std::string & ext);
 static bool                         virtual_name(std::string *virtualpath, const std::string &origpath = "", const FFmpegfs_Format **current_format = nullptr);
 static FILENAME_MAP::const_iterator find_prefix(const FILENAME_MAP & map, const std::string & search_for);
 static void                         stat_to_dir(struct stat *stbuf);
+static int                          lstat_cachefile(const std::string & filename, const std::string & fileext, struct stat *stbuf, size_t *root_hint = nullptr);
 static void                         flags_to_dir(int *flags);
 static void                         insert(const VIRTUALFILE & virtualfile);
 static int                          get_source_properties(const std::string & origpath, LPVIRTUALFILE virtualfile);
@@ -1369,6 +1372,15 @@ static void *ffmpegfs_init(struct fuse_conn_info *conn, struct fuse_config *cfg)
     //conn->want |= FUSE_CAP_ASYNC_READ;
     //conn->want |= FUSE_CAP_SPLICE_READ;
 
+    if (!params.m_cache_trace.empty())
+    {
+        // Writer thread, must be started after FUSE has forked into the background
+        if (!cache_trace_start(params.m_cache_trace))
+        {
+            exit(1);
+        }
+    }
+
     if (params.m_cache_maintenance)
     {
         if (!start_cache_maintenance(params.m_cache_maintenance))
@@ -1377,6 +1389,18 @@ static void *ffmpegfs_init(struct fuse_conn_info *conn, struct fuse_config *cfg)
         }
     }
 
+    if (params.m_cache_scrub)
+    {
+        // Must be started after FUSE has forked into the background
+        transcoder_start_scrubber();
+    }
+
+    if (params.m_cache_sweep)
+    {
+        // Check the cache in the background, do not hold up the mount
+        transcoder_start_sweep();
+    }
+
     if (params.m_enablescript)
     {
         prepare_script();
@@ -1412,6 +1436,9 @@ static void ffmpegfs_destroy(__attribute__((unused)) void * p)
         tp.reset();
     }
 
+    // Last, to catch events of transcoders that just finished
+    cache_trace_stop();
+
     script_file.clear();
 
     Logging::info(nullptr, "%1 V%2 terminated.", PACKAGE_NAME, FFMPEFS_VERSION);
@@ -1686,6 +1713,40 @@ LPVIRTUALFILE insert_file(VIRTUALTYPE type, const std::string & virtfile, const
     return &it->second;
 }
 
+/**
+ * @brief Get file status of a cache file, whichever cache root it is kept in.
+ * @param[in] filename - Source file name.
+ * @param[in] fileext - File extension (MP4, WEBM etc.).
+ * @param[out] stbuf - Receives the file status.
+ * @param[inout] root_hint - If not nullptr, index of the cache root to try first. Receives the root the file was found in.
+ * @return On success, returns 0. On error, returns -1 and sets errno.
+ */
+static int lstat_cachefile(const std::string & filename, const std::string & fileext, struct stat *stbuf, size_t *root_hint)
+{
+    const CACHEROOT_VEC & roots = transcoder_cache_roots();
+    size_t first = (root_hint != nullptr && *root_hint < roots.size()) ? *root_hint : 0;
+
+    for (size_t i = 0; i < roots.size(); i++)
+    {
+        // Start with the hinted root, then try the others in order
+        size_t n = !i ? first : (i <= first ? i - 1 : i);
+        std::string cachefile;
+
+        Buffer::make_cachefile_name(&cachefile, filename, fileext, false, n ? roots[n].m_path : "");
+
+        if (!lstat(cachefile.c_str(), stbuf))
+        {
+            if (root_hint != nullptr)
+            {
+                *root_hint = n;
+            }
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
 /**
  * @brief Convert stbuf to directory
  * @param[inout] stbuf - Buffer to convert to directory
@@ -1816,12 +1877,8 @@ int load_path(const std::string & path, const struct stat *statbuf, void *buf, f
 
             title_count++;
 
-            std::string cachefile;
-
-            Buffer::make_cachefile_name(&cachefile, virtualfile->m_destfile, params.current_format(virtualfile)->fileext(), false);
-
             struct stat stbuf2;
-            if (!lstat(cachefile.c_str(), &stbuf2))
+            if (!lstat_cachefile(virtualfile->m_destfile, params.current_format(virtualfile)->fileext(), &stbuf2))
             {
                 // Cache file exists, use cache file size here
 
@@ -2015,7 +2072,7 @@ static int make_hls_fileset(void * buf, fuse_fill_dir_t filler, const std::strin
 {
     // Generate set of TS segment files and necessary M3U lists
 
-    if (!virtualfile->get_segment_count())
+    if (!virtualfile->get_segment_count() || (params.m_hls_keyframe_segments && !virtualfile->segment_starts_known()))
     {
         int res = get_source_properties(origpath, virtualfile);
         if (res < 0)
@@ -2045,15 +2102,31 @@ static int make_hls_fileset(void * buf, fuse_fill_dir_t filler, const std::strin
                           "#EXT-X-STREAM-INF:PROGRAM-ID=1\n"
                           "index_0_av.m3u8\n";
 
+        // With segments starting at key frames, durations vary. The target duration must not be exceeded.
+        int64_t target_duration     = params.m_segment_duration;
+
+        if (virtualfile->has_keyframe_segments())
+        {
+            for (uint32_t file_no = 1; file_no <= virtualfile->get_segment_count(); file_no++)
+            {
+                target_duration = std::max(target_duration, virtualfile->get_segment_duration(file_no));
+            }
+        }
+
         strsprintf(&index_0_av_contents, "#EXTM3U\n"
                                          "#EXT-X-TARGETDURATION:%i\n"
                                          "#EXT-X-ALLOW-CACHE:YES\n"
                                          "#EXT-X-PLAYLIST-TYPE:VOD\n"
                                          "#EXT-X-VERSION:3\n"
-                                         "#EXT-X-MEDIA-SEQUENCE:1\n", static_cast<int32_t>(params.m_segment_duration / AV_TIME_BASE));
+                                         "#EXT-X-MEDIA-SEQUENCE:1\n", static_cast<int32_t>((target_duration + AV_TIME_BASE - 1) / AV_TIME_BASE));
 
-        int64_t remaining_duration  = virtualfile->m_duration % params.m_segment_duration;
         size_t  segment_size        = virtualfile->m_predicted_size / virtualfile->get_segment_count();
+        std::vector<size_t> segment_sizes;
+
+        transcoder_cached_segment_sizes(virtualfile, &segment_sizes);
+
+        // All segments are kept in the same cache root, look there first
+        size_t root_hint = 0;
 
         for (uint32_t file_no = 1; file_no <= virtualfile->get_segment_count(); file_no++)
         {
@@ -2061,7 +2134,6 @@ static int make_hls_fileset(void * buf, fuse_fill_dir_t filler, const std::strin
             std::string segment_name = make_filename(file_no, params.current_format(virtualfile)->fileext());
 
             struct stat stbuf;
-            std::string cachefile;
             std::string _origpath(origpath);
             remove_sep(&_origpath);
 
@@ -2070,9 +2142,12 @@ static int make_hls_fileset(void * buf, fuse_fill_dir_t filler, const std::strin
             filename.append(".");
             filename.append(segment_name);
 
-            Buffer::make_cachefile_name(&cachefile, filename, params.current_format(virtualfile)->fileext(), false);
-
-            if (!lstat(cachefile.c_str(), &stbuf))
+            if (file_no <= segment_sizes.size() && segment_sizes[file_no - 1])
+            {
+                // Finished segment, size recorded with checksum
+                make_file(buf, filler, virtualfile->m_type, origpath, segment_name, segment_sizes[file_no - 1], virtualfile->m_st.st_ctime, VIRTUALFLAG_HLS);
+            }
+            else if (!lstat_cachefile(filename, params.current_format(virtualfile)->fileext(), &stbuf, &root_hint))
             {
                 make_file(buf, filler, virtualfile->m_type, origpath, segment_name, static_cast<size_t>(stbuf.st_size), virtualfile->m_st.st_ctime, VIRTUALFLAG_HLS);
             }
@@ -2081,14 +2156,7 @@ static int make_hls_fileset(void * buf, fuse_fill_dir_t filler, const std::strin
                 make_file(buf, filler, virtualfile->m_type, origpath, segment_name, segment_size, virtualfile->m_st.st_ctime, VIRTUALFLAG_HLS);
             }
 
-            if (file_no < virtualfile->get_segment_count())
-            {
-                strsprintf(&buffer, "#EXTINF:%.3f,\n", static_cast<double>(params.m_segment_duration) / AV_TIME_BASE);
-            }
-            else
-            {
-                strsprintf(&buffer, "#EXTINF:%.3f,\n", static_cast<double>(remaining_duration) / AV_TIME_BASE);
-            }
+            strsprintf(&buffer, "#EXTINF:%.3f,\n", static_cast<double>(virtualfile->get_segment_duration(file_no)) / AV_TIME_BASE);
 
             index_0_av_contents += buffer;
             index_0_av_contents += segment_name;
@@ -0,0 +1,931 @@
+/*
+ * Copyright (C) 2017-2026 Norbert Schlia (nschlia@oblivion-software.de)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * On Debian systems, the complete text of the GNU General Public License
+ * Version 3 can be found in `/usr/share/common-licenses/GPL-3'.
+ */
+
+/**
+ * @file tracesim.cc
+ * @brief %Cache policy simulator
+ *
+ * Replays a cache trace recorded with --cache_trace against simulated
+ * caches of different sizes, expiry times and eviction policies, and
+ * reports the hit ratios and the transcoding CPU time each would save.
+ *
+ * Every OPEN event is a request for the whole cache entry. If the entry is
+ * resident in the simulated cache it is a hit, otherwise it is transcoded
+ * and added. READ events are used for the byte hit ratio; after a miss, reads
+ * only count as hits once the transcode would have finished. The size, CPU
+ * cost and duration of an entry are taken from its TRANSCODE events; entries
+ * that were already cached when the trace was started are costed at the
+ * average per byte of all transcodes in the trace. PRUNE events are ignored,
+ * the simulated caches do their own eviction.
+ *
+ * @ingroup ffmpegfs
+ *
+ * @author Norbert Schlia (nschlia@oblivion-software.de)
+ * @copyright Copyright (C) 2017-2026 Norbert Schlia (nschlia@oblivion-software.de)
+ */
+
+#include "config.h"
+#include "cache_trace.h"
+
+#include <getopt.h>
+#include <strings.h>
+#include <cstdio>
+#include <cstring>
+#include <cctype>
+#include <cerrno>
+#include <cinttypes>
+#include <string>
+#include <vector>
+#include <set>
+#include <tuple>
+#include <memory>
+#include <regex>
+#include <unordered_map>
+
+#define READ_CHUNK  4096                                /**< @brief Number of records read at once */
+
+/**
+ * @brief Eviction policies
+ */
+enum class POLICY
+{
+    LRU,                                                /**< @brief Least recently used, this is what FFmpegfs does */
+    LFU,                                                /**< @brief Least frequently used, ties broken by LRU */
+    FIFO,                                               /**< @brief First in, first out */
+    GDSF,                                               /**< @brief Greedy dual size frequency, weighs CPU cost against size */
+};
+
+/**
+ * @brief Size and cost of a cache entry, collected from the whole trace
+ */
+typedef struct OBJECT
+{
+    uint64_t    m_size          = 0;                    /**< @brief Size in bytes */
+    uint64_t    m_cpu_time      = 0;                    /**< @brief CPU time to transcode in milliseconds */
+    uint64_t    m_duration      = 0;                    /**< @brief Wall clock time to transcode in microseconds */
+    bool        m_transcoded    = false;                /**< @brief A complete transcode was recorded */
+    bool        m_cpu_shared    = false;                /**< @brief m_cpu_time includes other transcodes running at the same time */
+} OBJECT;
+
+typedef std::unordered_map<uint64_t, OBJECT> OBJECT_MAP;   /**< @brief Objects by key */
+
+/**
+ * @brief Trace statistics
+ */
+typedef struct TRACE_STATS
+{
+    uint64_t    m_records       = 0;                    /**< @brief Total number of records */
+    uint64_t    m_first_time    = 0;                    /**< @brief Time of first record */
+    uint64_t    m_last_time     = 0;                    /**< @brief Time of last record */
+    uint64_t    m_opens         = 0;                    /**< @brief Number of OPEN events */
+    uint64_t    m_reads         = 0;                    /**< @brief Number of READ events */
+    uint64_t    m_read_hits     = 0;                    /**< @brief Number of READ events served from the cache */
+    uint64_t    m_read_bytes    = 0;                    /**< @brief Bytes read */
+    uint64_t    m_hit_bytes     = 0;                    /**< @brief Bytes read from the cache */
+    uint64_t    m_transcodes    = 0;                    /**< @brief Number of TRANSCODE events */
+    uint64_t    m_cpu_time      = 0;                    /**< @brief CPU time of all transcodes in milliseconds */
+    uint64_t    m_prunes        = 0;                    /**< @brief Number of PRUNE events */
+    uint64_t    m_working_set   = 0;                    /**< @brief Total size of all objects */
+    uint64_t    m_estimated     = 0;                    /**< @brief Number of objects with estimated cost */
+} TRACE_STATS;
+
+/**
+ * @brief Simulated cache
+ */
+class Simulator
+{
+public:
+    /**
+     * @brief Construct a simulated cache.
+     * @param[in] policy - Eviction policy.
+     * @param[in] capacity - Size in bytes.
+     * @param[in] expiry - Expire entries not accessed for this many seconds, 0 for never.
+     * @param[in] objects - Size and cost of all entries.
+     */
+    Simulator(POLICY policy, uint64_t capacity, uint64_t expiry, const OBJECT_MAP & objects)
+        : m_policy(policy)
+        , m_capacity(capacity)
+        , m_expiry(expiry * 1000000)
+        , m_objects(objects)
+    {
+    }
+
+    /**
+     * @brief Replay a trace record.
+     * @param[in] record - Record to replay.
+     */
+    void replay(const TRACE_RECORD & record)
+    {
+        switch (record.m_event)
+        {
+        case TRACE_EVENT::OPEN:
+        {
+            m_requests++;
+            if (access(record.m_key, record.m_time, true))
+            {
+                m_request_hits++;
+                m_cpu_saved += m_objects.at(record.m_key).m_cpu_time;
+            }
+            break;
+        }
+        case TRACE_EVENT::READ:
+        {
+            // Entry may have been open before the trace started
+            m_read_bytes += record.m_size;
+            if (access(record.m_key, record.m_time, false))
+            {
+                m_hit_bytes += record.m_size;
+            }
+            break;
+        }
+        default:
+        {
+            break;
+        }
+        }
+    }
+
+    POLICY      m_policy;                               /**< @brief Eviction policy */
+    uint64_t    m_capacity;                             /**< @brief Size in bytes */
+    uint64_t    m_requests      = 0;                    /**< @brief Number of requests */
+    uint64_t    m_request_hits  = 0;                    /**< @brief Number of requests served from the cache */
+    uint64_t    m_read_bytes    = 0;                    /**< @brief Bytes read */
+    uint64_t    m_hit_bytes     = 0;                    /**< @brief Bytes read from the cache */
+    uint64_t    m_cpu_saved     = 0;                    /**< @brief CPU time saved by hits in milliseconds */
+    uint64_t    m_cpu_spent     = 0;                    /**< @brief CPU time spent on misses in milliseconds */
+    uint64_t    m_evictions     = 0;                    /**< @brief Number of entries evicted */
+
+protected:
+    typedef std::tuple<double, uint64_t, uint64_t> PRIORITY;    /**< @brief Eviction order: priority, last access time, key */
+
+    /**
+     * @brief Simulated cache entry
+     */
+    typedef struct ENTRY
+    {
+        uint64_t    m_size;                             /**< @brief Size in bytes */
+        uint64_t    m_last_access;                      /**< @brief Time of last access */
+        uint64_t    m_ready;                            /**< @brief Time the transcode is finished */
+        uint64_t    m_hits;                             /**< @brief Number of requests */
+        PRIORITY    m_priority;                         /**< @brief Position in m_order */
+    } ENTRY;
+
+    /**
+     * @brief Access an entry, add it if not resident.
+     * @param[in] key - Key of the entry.
+     * @param[in] now - Time of access.
+     * @param[in] request - True if a request (OPEN), false for reads.
+     * @return Returns true if the entry was resident (for reads: and transcoded); false if not.
+     */
+    bool access(uint64_t key, uint64_t now, bool request)
+    {
+        auto it = m_entries.find(key);
+
+        if (it != m_entries.end() && m_expiry && now - it->second.m_last_access > m_expiry)
+        {
+            remove(it);
+            it = m_entries.end();
+        }
+
+        if (it != m_entries.end())
+        {
+            ENTRY & entry = it->second;
+
+            m_order.erase(entry.m_priority);
+            entry.m_last_access = now;
+            if (request)
+            {
+                entry.m_hits++;
+            }
+            entry.m_priority = priority(key, entry);
+            m_order.insert(entry.m_priority);
+            // A request joins a running transcode, but a read must wait for it
+            return request || now >= entry.m_ready;
+        }
+
+        const OBJECT & object = m_objects.at(key);
+
+        m_cpu_spent += object.m_cpu_time;
+
+        if (object.m_size > m_capacity)
+        {
+            // Never fits, transcode every time
+            return false;
+        }
+
+        while (m_used + object.m_size > m_capacity)
+        {
+            auto victim = m_entries.find(std::get<2>(*m_order.begin()));
+            if (m_policy == POLICY::GDSF)
+            {
+                m_inflation = std::get<0>(victim->second.m_priority);
+            }
+            remove(victim);
+            m_evictions++;
+        }
+
+        ENTRY entry;
+
+        entry.m_size        = object.m_size;
+        entry.m_last_access = now;
+        entry.m_ready       = now + object.m_duration;
+        entry.m_hits        = 1;
+        entry.m_priority    = priority(key, entry);
+
+        m_order.insert(entry.m_priority);
+        m_entries.emplace(key, entry);
+        m_used += object.m_size;
+
+        return false;
+    }
+
+    /**
+     * @brief Remove an entry from the cache.
+     * @param[in] it - Entry to remove.
+     */
+    void remove(std::unordered_map<uint64_t, ENTRY>::iterator it)
+    {
+        m_order.erase(it->second.m_priority);
+        m_used -= it->second.m_size;
+        m_entries.erase(it);
+    }
+
+    /**
+     * @brief Calculate the eviction priority of an entry. Lowest is evicted first.
+     * @param[in] key - Key of the entry.
+     * @param[in] entry - Entry.
+     * @return Returns the priority.
+     */
+    PRIORITY priority(uint64_t key, const ENTRY & entry)
+    {
+        switch (m_policy)
+        {
+        case POLICY::LFU:
+        {
+            return PRIORITY(static_cast<double>(entry.m_hits), entry.m_last_access, key);
+        }
+        case POLICY::FIFO:
+        {
+            // The sequence number does not change on access
+            auto it = m_entries.find(key);
+            return PRIORITY(it != m_entries.end() ? std::get<0>(it->second.m_priority) : static_cast<double>(m_sequence++), entry.m_last_access, key);
+        }
+        case POLICY::GDSF:
+        {
+            const OBJECT & object = m_objects.at(key);
+            double cost = static_cast<double>(object.m_cpu_time ? object.m_cpu_time : 1);
+            return PRIORITY(m_inflation + static_cast<double>(entry.m_hits) * cost / static_cast<double>(entry.m_size ? entry.m_size : 1), entry.m_last_access, key);
+        }
+        case POLICY::LRU:
+        default:
+        {
+            return PRIORITY(0, entry.m_last_access, key);
+        }
+        }
+    }
+
+    uint64_t                                m_expiry;           /**< @brief Expiry time in microseconds, 0 for never */
+    const OBJECT_MAP &                      m_objects;          /**< @brief Size and cost of all entries */
+    std::unordered_map<uint64_t, ENTRY>     m_entries;          /**< @brief Resident entries */
+    std::set<PRIORITY>                      m_order;            /**< @brief Resident entries in eviction order */
+    uint64_t                                m_used      = 0;    /**< @brief Bytes used */
+    uint64_t                                m_sequence  = 0;    /**< @brief FIFO: insertion counter */
+    double                                  m_inflation = 0;    /**< @brief GDSF: priority of the last evicted entry */
+};
+
+/**
+ * @brief Print usage information.
+ * @param[in] name - Program name.
+ */
+static void usage(const char *name)
+{
+    std::printf("Usage: %s [OPTIONS] TRACEFILE\n"
+                "\n"
+                "Replay a cache trace recorded by " PACKAGE_NAME " --cache_trace against simulated\n"
+                "caches and report hit ratios and transcoding CPU time saved.\n"
+                "\n"
+                "Options:\n"
+                "    --size=SIZE[,SIZE...]      Cache sizes to simulate, e.g. 500M,2G,10G. Suffixes\n"
+                "                               K, M, G and T are powers of 1024. Defaults to 10%%,\n"
+                "                               25%%, 50%% and 100%% of the size of all entries.\n"
+                "    --policy=POLICY[,POLICY...] Eviction policies to simulate. One or more of lru\n"
+                "                               (used by " PACKAGE_NAME "), lfu, fifo and gdsf. Defaults to all.\n"
+                "    --expiry=TIME              Expire entries not accessed for TIME, e.g. 3600, 12h,\n"
+                "                               7d or 2w. Defaults to never.\n"
+                "    -h, --help                 Print this help and exit.\n"
+                "    -V, --version              Print version and exit.\n",
+                name);
+}
+
+/**
+ * @brief Parse a size with an optional K, M, G or T suffix.
+ * @param[in] arg - Size to parse.
+ * @param[out] size - Size in bytes.
+ * @return Returns true on success; false if arg is not a valid size.
+ */
+static bool parse_size(const std::string & arg, uint64_t *size)
+{
+    std::smatch match;
+
+    if (!std::regex_match(arg, match, std::regex("^([0-9]+(\\.[0-9]+)?)([KMGT]?)B?$", std::regex::icase)))
+    {
+        return false;
+    }
+
+    double value = std::stod(match[1]);
+
+    switch (std::toupper(static_cast<unsigned char>(match[3].str().empty() ? ' ' : match[3].str()[0])))
+    {
+    case 'T':
+    {
+        value *= 1024;
+        [[fallthrough]];
+    }
+    case 'G':
+    {
+        value *= 1024;
+        [[fallthrough]];
+    }
+    case 'M':
+    {
+        value *= 1024;
+        [[fallthrough]];
+    }
+    case 'K':
+    {
+        value *= 1024;
+        break;
+    }
+    default:
+    {
+        break;
+    }
+    }
+
+    *size = static_cast<uint64_t>(value);
+    return true;
+}
+
+/**
+ * @brief Parse a time with an optional s, m, h, d or w suffix.
+ * @param[in] arg - Time to parse.
+ * @param[out] seconds - Time in seconds.
+ * @return Returns true on success; false if arg is not a valid time.
+ */
+static bool parse_time(const std::string & arg, uint64_t *seconds)
+{
+    std::smatch match;
+
+    if (!std::regex_match(arg, match, std::regex("^([0-9]+)([smhdw]?)$", std::regex::icase)))
+    {
+        return false;
+    }
+
+    *seconds = std::stoull(match[1]);
+
+    switch (std::tolower(static_cast<unsigned char>(match[2].str().empty() ? 's' : match[2].str()[0])))
+    {
+    case 'w':
+    {
+        *seconds *= 7 * 24 * 60 * 60;
+        break;
+    }
+    case 'd':
+    {
+        *seconds *= 24 * 60 * 60;
+        break;
+    }
+    case 'h':
+    {
+        *seconds *= 60 * 60;
+        break;
+    }
+    case 'm':
+    {
+        *seconds *= 60;
+        break;
+    }
+    default:
+    {
+        break;
+    }
+    }
+
+    return true;
+}
+
+/**
+ * @brief Split a comma separated list.
+ * @param[in] arg - List to split.
+ * @return Returns the list items.
+ */
+static std::vector<std::string> split(const std::string & arg)
+{
+    std::vector<std::string> items;
+    size_t start = 0;
+
+    while (start <= arg.size())
+    {
+        size_t end = arg.find(',', start);
+        if (end == std::string::npos)
+        {
+            end = arg.size();
+        }
+        if (end > start)
+        {
+            items.push_back(arg.substr(start, end - start));
+        }
+        start = end + 1;
+    }
+
+    return items;
+}
+
+/**
+ * @brief Format a size for output.
+ * @param[in] size - Size in bytes.
+ * @return Returns the formatted size.
+ */
+static std::string format_size(uint64_t size)
+{
+    static const char *units[] = { "B", "KB", "MB", "GB", "TB" };
+    double value = static_cast<double>(size);
+    size_t unit = 0;
+    char buffer[32];
+
+    while (value >= 1024 && unit < sizeof(units) / sizeof(units[0]) - 1)
+    {
+        value /= 1024;
+        unit++;
+    }
+
+    std::snprintf(buffer, sizeof(buffer), unit ? "%.1f %s" : "%.0f %s", value, units[unit]);
+
+    return buffer;
+}
+
+/**
+ * @brief Get the name of a policy.
+ * @param[in] policy - Policy.
+ * @return Returns the name.
+ */
+static const char * policy_name(POLICY policy)
+{
+    switch (policy)
+    {
+    case POLICY::LFU:
+    {
+        return "lfu";
+    }
+    case POLICY::FIFO:
+    {
+        return "fifo";
+    }
+    case POLICY::GDSF:
+    {
+        return "gdsf";
+    }
+    case POLICY::LRU:
+    default:
+    {
+        return "lru";
+    }
+    }
+}
+
+/**
+ * @brief Calculate a ratio in percent.
+ * @param[in] part - Part.
+ * @param[in] total - Total.
+ * @return Returns part in percent of total, 0 if total is 0.
+ */
+static double percent(uint64_t part, uint64_t total)
+{
+    return total ? 100.0 * static_cast<double>(part) / static_cast<double>(total) : 0;
+}
+
+/**
+ * @brief Trace file reader
+ */
+class Trace_Reader
+{
+public:
+    /**
+     * @brief Open a trace file and check its header.
+     * @param[in] filename - Name of the trace file.
+     * @return Returns true on success; false on error, a message has been printed.
+     */
+    bool open(const std::string & filename)
+    {
+        TRACE_HEADER header;
+
+        m_filename = filename;
+        m_file.reset(std::fopen(filename.c_str(), "rb"));
+        if (m_file == nullptr)
+        {
+            std::fprintf(stderr, "%s: %s\n", filename.c_str(), strerror(errno));
+            return false;
+        }
+
+        if (std::fread(&header, sizeof(header), 1, m_file.get()) != 1 || std::memcmp(header.m_magic, TRACE_MAGIC, sizeof(header.m_magic)))
+        {
+            std::fprintf(stderr, "%s: Not a cache trace file.\n", filename.c_str());
+            return false;
+        }
+
+        if (header.m_bom != TRACE_BOM)
+        {
+            std::fprintf(stderr, "%s: The trace was recorded on a machine with a different byte order.\n", filename.c_str());
+            return false;
+        }
+
+        if (header.m_version != TRACE_VERSION || header.m_record_size != sizeof(TRACE_RECORD))
+        {
+            std::fprintf(stderr, "%s: Unsupported trace file version %u.\n", filename.c_str(), header.m_version);
+            return false;
+        }
+
+        m_data_start = std::ftell(m_file.get());
+
+        return true;
+    }
+
+    /**
+     * @brief Go back to the first record.
+     */
+    void rewind()
+    {
+        std::fseek(m_file.get(), m_data_start, SEEK_SET);
+    }
+
+    /**
+     * @brief Read the next records.
+     * @param[out] records - Records read, empty at end of file.
+     * @return Returns true on success; false on error.
+     */
+    bool read(std::vector<TRACE_RECORD> *records)
+    {
+        records->resize(READ_CHUNK);
+
+        size_t count = std::fread(records->data(), sizeof(TRACE_RECORD), records->size(), m_file.get());
+
+        records->resize(count);
+
+        if (std::ferror(m_file.get()))
+        {
+            std::fprintf(stderr, "%s: %s\n", m_filename.c_str(), strerror(errno));
+            return false;
+        }
+
+        return true;
+    }
+
+protected:
+    /**
+     * @brief Deleter for FILE pointers
+     */
+    struct FILE_CLOSER
+    {
+        /**
+         * @brief Close file.
+         * @param[in] file - File to close.
+         */
+        void operator()(FILE *file) const
+        {
+            std::fclose(file);
+        }
+    };
+
+    std::string                             m_filename;     /**< @brief Name of the trace file */
+    std::unique_ptr<FILE, FILE_CLOSER>      m_file;         /**< @brief Trace file */
+    long                                    m_data_start = 0;   /**< @brief Offset of the first record */
+};
+
+/**
+ * @brief Collect object sizes, costs and statistics from the trace.
+ * @param[in] reader - Trace to read.
+ * @param[out] objects - Size and cost of all entries.
+ * @param[out] stats - Trace statistics.
+ * @return Returns true on success; false on error.
+ */
+static bool scan_trace(Trace_Reader *reader, OBJECT_MAP *objects, TRACE_STATS *stats)
+{
+    std::vector<TRACE_RECORD> records;
+    uint64_t transcoded_bytes = 0;
+    uint64_t transcoded_cpu = 0;
+    uint64_t transcoded_duration = 0;
+    bool success;
+
+    while ((success = reader->read(&records)) && !records.empty())
+    {
+        for (const TRACE_RECORD & record : records)
+        {
+            OBJECT & object = (*objects)[record.m_key];
+
+            if (!stats->m_records++)
+            {
+                stats->m_first_time = record.m_time;
+            }
+            stats->m_last_time = record.m_time;
+
+            switch (record.m_event)
+            {
+            case TRACE_EVENT::OPEN:
+            {
+                stats->m_opens++;
+                if (!object.m_transcoded && record.m_size > object.m_size)
+                {
+                    object.m_size = record.m_size;
+                }
+                break;
+            }
+            case TRACE_EVENT::READ:
+            {
+                stats->m_reads++;
+                stats->m_read_bytes += record.m_size;
+                if (record.m_flags & TRACE_FLAG_HIT)
+                {
+                    stats->m_read_hits++;
+                    stats->m_hit_bytes += record.m_size;
+                }
+                if (!object.m_transcoded && record.m_offset + record.m_size > object.m_size)
+                {
+                    object.m_size = record.m_offset + record.m_size;
+                }
+                break;
+            }
+            case TRACE_EVENT::TRANSCODE:
+            {
+                stats->m_transcodes++;
+                stats->m_cpu_time += record.m_cpu_time;
+                if (record.m_flags & TRACE_FLAG_COMPLETE)
+                {
+                    // The last complete transcode is the best guess, but CPU time
+                    // shared with other transcodes is only used if nothing better is known.
+                    if (!(record.m_flags & TRACE_FLAG_SHARED) || !object.m_transcoded || object.m_cpu_shared)
+                    {
+                        object.m_cpu_time   = record.m_cpu_time;
+                        object.m_cpu_shared = (record.m_flags & TRACE_FLAG_SHARED) ? true : false;
+                    }
+                    object.m_size       = record.m_size;
+                    object.m_duration   = static_cast<uint64_t>(record.m_duration) * 1000;
+                    object.m_transcoded = true;
+                    transcoded_bytes    += record.m_size;
+                    transcoded_cpu      += record.m_cpu_time;
+                    transcoded_duration += object.m_duration;
+                }
+                break;
+            }
+            case TRACE_EVENT::PRUNE:
+            {
+                stats->m_prunes++;
+                if (!object.m_transcoded && record.m_size)
+                {
+                    object.m_size = record.m_size;
+                }
+                break;
+            }
+            default:
+            {
+                break;
+            }
+            }
+        }
+    }
+
+    if (!success)
+    {
+        return false;
+    }
+
+    double cpu_per_byte         = transcoded_bytes ? static_cast<double>(transcoded_cpu) / static_cast<double>(transcoded_bytes) : 0;
+    double duration_per_byte    = transcoded_bytes ? static_cast<double>(transcoded_duration) / static_cast<double>(transcoded_bytes) : 0;
+
+    for (auto & [key, object] : *objects)
+    {
+        if (!object.m_transcoded)
+        {
+            object.m_cpu_time = static_cast<uint64_t>(cpu_per_byte * static_cast<double>(object.m_size));
+            object.m_duration = static_cast<uint64_t>(duration_per_byte * static_cast<double>(object.m_size));
+            stats->m_estimated++;
+        }
+        stats->m_working_set += object.m_size;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Main program entry point.
+ * @param[in] argc - Number of command line arguments.
+ * @param[in] argv - Command line argument array.
+ * @return Return value will be the errorlevel of the executable.
+ * 0 on success, 1 on error.
+ */
+int main(int argc, char *argv[])
+{
+    static const struct option long_options[] =
+    {
+        { "size",       required_argument,  nullptr,    's' },
+        { "policy",     required_argument,  nullptr,    'p' },
+        { "expiry",     required_argument,  nullptr,    'e' },
+        { "help",       no_argument,        nullptr,    'h' },
+        { "version",    no_argument,        nullptr,    'V' },
+        { nullptr,      0,                  nullptr,    0 }
+    };
+    std::vector<uint64_t> sizes;
+    std::vector<POLICY> policies;
+    uint64_t expiry = 0;
+    int opt;
+
+    while ((opt = getopt_long(argc, argv, "hV", long_options, nullptr)) != -1)
+    {
+        switch (opt)
+        {
+        case 's':
+        {
+            for (const std::string & item : split(optarg))
+            {
+                uint64_t size;
+                if (!parse_size(item, &size) || !size)
+                {
+                    std::fprintf(stderr, "Invalid cache size: %s\n", item.c_str());
+                    return 1;
+                }
+                sizes.push_back(size);
+            }
+            break;
+        }
+        case 'p':
+        {
+            for (const std::string & item : split(optarg))
+            {
+                if (!strcasecmp(item.c_str(), "lru"))
+                {
+                    policies.push_back(POLICY::LRU);
+                }
+                else if (!strcasecmp(item.c_str(), "lfu"))
+                {
+                    policies.push_back(POLICY::LFU);
+                }
+                else if (!strcasecmp(item.c_str(), "fifo"))
+                {
+                    policies.push_back(POLICY::FIFO);
+                }
+                else if (!strcasecmp(item.c_str(), "gdsf"))
+                {
+                    policies.push_back(POLICY::GDSF);
+                }
+                else
+                {
+                    std::fprintf(stderr, "Invalid policy: %s\n", item.c_str());
+                    return 1;
+                }
+            }
+            break;
+        }
+        case 'e':
+        {
+            if (!parse_time(optarg, &expiry))
+            {
+                std::fprintf(stderr, "Invalid expiry time: %s\n", optarg);
+                return 1;
+            }
+            break;
+        }
+        case 'h':
+        {
+            usage(argv[0]);
+            return 0;
+        }
+        case 'V':
+        {
+            std::printf("%s_tracesim V%s\n", PACKAGE_NAME, PACKAGE_VERSION);
+            return 0;
+        }
+        default:
+        {
+            usage(argv[0]);
+            return 1;
+        }
+        }
+    }
+
+    if (optind != argc - 1)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    Trace_Reader reader;
+    OBJECT_MAP objects;
+    TRACE_STATS stats;
+
+    if (!reader.open(argv[optind]) || !scan_trace(&reader, &objects, &stats))
+    {
+        return 1;
+    }
+
+    if (!stats.m_records)
+    {
+        std::fprintf(stderr, "%s: The trace is empty.\n", argv[optind]);
+        return 1;
+    }
+
+    if (sizes.empty())
+    {
+        static const uint64_t percentages[] = { 10, 25, 50, 100 };
+
+        for (uint64_t pct : percentages)
+        {
+            uint64_t size = stats.m_working_set * pct / 100;
+            if (size)
+            {
+                sizes.push_back(size);
+            }
+        }
+    }
+
+    if (policies.empty())
+    {
+        policies = { POLICY::LRU, POLICY::LFU, POLICY::FIFO, POLICY::GDSF };
+    }
+
+    std::vector<Simulator> simulators;
+
+    for (POLICY policy : policies)
+    {
+        for (uint64_t size : sizes)
+        {
+            simulators.emplace_back(policy, size, expiry, objects);
+        }
+    }
+
+    std::vector<TRACE_RECORD> records;
+    bool success;
+
+    reader.rewind();
+    while ((success = reader.read(&records)) && !records.empty())
+    {
+        for (const TRACE_RECORD & record : records)
+        {
+            for (Simulator & simulator : simulators)
+            {
+                simulator.replay(record);
+            }
+        }
+    }
+
+    if (!success)
+    {
+        return 1;
+    }
+
+    std::printf("Trace             : %s\n", argv[optind]);
+    std::printf("Records           : %" PRIu64 " over %.1f hours\n", stats.m_records, static_cast<double>(stats.m_last_time - stats.m_first_time) / 3600000000.0);
+    std::printf("Entries           : %zu, %s total", objects.size(), format_size(stats.m_working_set).c_str());
+    if (stats.m_estimated)
+    {
+        std::printf(", CPU time of %" PRIu64 " estimated", stats.m_estimated);
+    }
+    std::printf("\n");
+    std::printf("Requests          : %" PRIu64 "\n", stats.m_opens);
+    std::printf("Reads             : %" PRIu64 ", %.1f%% hits, %.1f%% bytes from cache\n", stats.m_reads, percent(stats.m_read_hits, stats.m_reads), percent(stats.m_hit_bytes, stats.m_read_bytes));
+    std::printf("Transcodes        : %" PRIu64 ", %.1f CPU seconds\n", stats.m_transcodes, static_cast<double>(stats.m_cpu_time) / 1000);
+    std::printf("Prunes            : %" PRIu64 "\n", stats.m_prunes);
+    std::printf("Expiry            : %s\n", expiry ? (std::to_string(expiry) + " seconds").c_str() : "never");
+    std::printf("\n");
+    std::printf("%-6s %12s %10s %10s %14s %14s %10s\n", "Policy", "Size", "Hit ratio", "Byte hits", "CPU s saved", "CPU s spent", "Evictions");
+
+    for (const Simulator & simulator : simulators)
+    {
+        std::printf("%-6s %12s %9.1f%% %9.1f%% %14.1f %14.1f %10" PRIu64 "\n",
+                    policy_name(simulator.m_policy),
+                    format_size(simulator.m_capacity).c_str(),
+                    percent(simulator.m_request_hits, simulator.m_requests),
+                    percent(simulator.m_hit_bytes, simulator.m_read_bytes),
+                    static_cast<double>(simulator.m_cpu_saved) / 1000,
+                    static_cast<double>(simulator.m_cpu_spent) / 1000,
+                    simulator.m_evictions);
+    }
+
+    return 0;
+}
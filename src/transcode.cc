@@ -40,16 +40,23 @@
 #include "cache.h"
 #include "logging.h"
 #include "cache_entry.h"
+#include "cache_archive.h"
+#include "cache_ram.h"
+#include "cache_trace.h"
 #include "thread_pool.h"
 
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/resource.h>
 #include <atomic>
 #include <chrono>
 #include <cstdio>
+#include <ctime>
 
 const int GRANULARITY = 250;                                /**< @brief Image frame conversion: ms between checks if a picture frame is available */
 const int FRAME_TIMEOUT = 60;                               /**< @brief Image frame conversion: timout seconds to wait if a picture frame is available */
 const int TOTAL_RETRIES = FRAME_TIMEOUT*1000/GRANULARITY;   /**< @brief Number of retries */
+const int RESUME_SAVE_INTERVAL = 10;                        /**< @brief Seconds between saving resume points to the cache index */
 /**
   * @brief THREAD_DATA struct to pass data from parent to child thread
   */
@@ -64,6 +71,8 @@ typedef struct THREAD_DATA
 
 static std::unique_ptr<Cache>   cache;                      /**< @brief Global cache manager object */
 static std::atomic_bool         thread_exit;                /**< @brief Used for shutdown: if true, forcibly exit all threads */
+static std::atomic_uint32_t     transcoders_running;        /**< @brief Number of transcoder threads running */
+static std::atomic_uint64_t     transcoders_started;        /**< @brief Number of transcoder threads started so far */
 
 static bool transcode(std::shared_ptr<THREAD_DATA> thread_data, Cache_Entry *cache_entry, FFmpeg_Transcoder & transcoder, bool *timeout);
 static int  transcoder_thread(std::shared_ptr<THREAD_DATA> thread_data);
@@ -74,6 +83,8 @@ static void reopen_finished_incomplete_cache(Cache_Entry* cache_entry, uint32_t
 static bool cached_item_available(Cache_Entry* cache_entry, size_t offset, size_t len, uint32_t segment_no);
 static bool invalidate_stale_cache_file(Cache_Entry* cache_entry, uint32_t segment_no, uint32_t item_no, const char* item_name);
 static void wait_for_active_transcoder(Cache_Entry* cache_entry, uint32_t item_no, const char* item_name);
+static bool read_remote(Cache_Entry* cache_entry, char* buff, size_t offset, size_t *len, uint32_t segment_no);
+static void save_resume_point(Cache_Entry* cache_entry, std::chrono::steady_clock::time_point *last_saved);
 
 /**
  * @brief Transcode the buffer until the buffer has enough or until an error occurs.
@@ -171,6 +182,56 @@ static bool transcode_until(Cache_Entry* cache_entry, size_t offset, size_t len,
     return success;
 }
 
+/**
+ * @brief Save the resume point of a running transcode in the cache index.
+ *
+ * Done at most every RESUME_SAVE_INTERVAL seconds. The cache file is flushed
+ * first, so the index never points behind what has been written.
+ *
+ * @param[in] cache_entry - corresponding cache entry
+ * @param[inout] last_saved - Time the resume point was last saved.
+ */
+static void save_resume_point(Cache_Entry* cache_entry, std::chrono::steady_clock::time_point *last_saved)
+{
+    if (!params.m_resume_transcode)
+    {
+        return;
+    }
+
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+
+    if (now - *last_saved < std::chrono::seconds(RESUME_SAVE_INTERVAL))
+    {
+        return;
+    }
+
+    Buffer::RESUME_POINT resume_point = cache_entry->m_buffer->resume_point();
+
+    if (resume_point.m_offset == cache_entry->m_cache_info.m_resume.m_offset && resume_point.m_header_size == cache_entry->m_cache_info.m_resume.m_header_size)
+    {
+        return;
+    }
+
+    *last_saved = now;
+
+    // The resume point must never be ahead of what is on disk
+    if (!cache_entry->flush(true))
+    {
+        Logging::warning(cache_entry->virtname(), "Could not save the resume point: (%1) %2", errno, strerror(errno));
+        return;
+    }
+
+    cache_entry->m_cache_info.m_resume = resume_point;
+
+    if (!cache_entry->write_info())
+    {
+        Logging::warning(cache_entry->virtname(), "Could not save the resume point.");
+        return;
+    }
+
+    Logging::trace(cache_entry->virtname(), "Saved the resume point at %1 (offset %2).", format_duration(resume_point.m_time).c_str(), format_size(resume_point.m_offset).c_str());
+}
+
 /**
  * @brief Close the input file and free everything but the initial buffer.
  * @param[in] cache_entry - corresponding cache entry
@@ -185,12 +246,20 @@ static int transcode_finish(Cache_Entry* cache_entry, FFmpeg_Transcoder & transc
         return res;
     }
 
+    if (cache != nullptr && transcoder.keyframe_index_built())
+    {
+        // Read the whole file, keep the key frames for later seeks
+        cache->write_keyframe_index(cache_entry->virtualfile(), transcoder.keyframe_index());
+    }
+
     // Check encoded buffer size. Does not affect HLS segments.
     cache_entry->m_cache_info.m_duration            = transcoder.duration();
     cache_entry->m_cache_info.m_encoded_filesize    = cache_entry->m_buffer->buffer_watermark();
     cache_entry->m_cache_info.m_video_frame_count   = transcoder.video_frame_count();
     cache_entry->m_cache_info.m_segment_count       = transcoder.segment_count();
+    cache_entry->m_cache_info.m_segment_starts      = cache_entry->virtualfile()->get_segment_starts();
     cache_entry->m_cache_info.m_result              = !transcoder.have_seeked() ? RESULTCODE::FINISHED_SUCCESS : RESULTCODE::FINISHED_INCOMPLETE;
+    cache_entry->m_cache_info.m_resume              = Buffer::RESUME_POINT();
     cache_entry->m_is_decoding                      = false;
     cache_entry->m_cache_info.m_errno               = 0;
     cache_entry->m_cache_info.m_averror             = 0;
@@ -202,6 +271,12 @@ static int transcode_finish(Cache_Entry* cache_entry, FFmpeg_Transcoder & transc
         Logging::debug(transcoder.virtname(), "Unable to truncate the buffer.");
     }
 
+    if (!transcoder.is_multiformat())
+    {
+        // HLS segments are completed by the transcoder, record checksum of single file
+        cache_entry->m_buffer->finished_segment();
+    }
+
     if (!transcoder.is_multiformat())
     {
         Logging::debug(transcoder.virtname(), "Predicted size: %1 Final: %2 Diff: %3 (%4%).",
@@ -404,6 +479,80 @@ static bool cached_item_available(Cache_Entry* cache_entry, size_t offset, size_
                                        segment_no ? "segment" : "file");
 }
 
+/**
+ * @brief Read from a cache entry that another process is transcoding.
+ *
+ * Waits until the other process has published that the requested data has
+ * been written, and reads it straight from its cache files. When the other
+ * process releases its claim, because it has finished or gone away, the entry
+ * is reloaded from the cache index and the caller continues as usual.
+ *
+ * @param[inout] cache_entry Cache entry followed.
+ * @param[out] buff Buffer to read data to.
+ * @param[in] offset Requested byte offset.
+ * @param[inout] len In: Requested byte count. Out: Number of bytes read.
+ * @param[in] segment_no HLS segment number, or 0 for normal files.
+ * @return Returns true if the read has been served. Returns false if the caller must continue on its own, or on error with errno set.
+ */
+static bool read_remote(Cache_Entry* cache_entry, char* buff, size_t offset, size_t *len, uint32_t segment_no)
+{
+    const uint32_t wanted_segment_no = segment_no ? segment_no : 1;
+    bool reported = false;
+
+    while (!cache_entry->take_over())
+    {
+        if (fuse_interrupted())
+        {
+            Logging::info(cache_entry->virtname(), "The client has gone away.");
+            errno = 0; // No error
+            *len = 0;
+            return true;
+        }
+
+        if (thread_exit)
+        {
+            Logging::warning(cache_entry->virtname(), "Thread exit was received.");
+            errno = EINTR;
+            return false;
+        }
+
+        Cache_Entry::CLAIM_INFO claim_info;
+
+        if (cache_entry->read_claim(&claim_info) &&
+                (wanted_segment_no < claim_info.m_segment_no ||
+                 (wanted_segment_no == claim_info.m_segment_no && offset + *len <= claim_info.m_watermark)))
+        {
+            // Finished segments may be shorter than requested, short reads are fine.
+            int fd = ::open(cache_entry->m_buffer->cachefile(segment_no).c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd != -1)
+            {
+                ssize_t bytes_read = pread(fd, buff, *len, static_cast<off_t>(offset));
+
+                ::close(fd);
+
+                if (bytes_read > 0 || (bytes_read == 0 && wanted_segment_no < claim_info.m_segment_no))
+                {
+                    *len = static_cast<size_t>(bytes_read);
+                    errno = 0;
+                    return true;
+                }
+            }
+            // Segments skipped by a seek do not exist, keep waiting until the other process is done
+        }
+
+        if (!reported)
+        {
+            Logging::trace(cache_entry->virtname(), "Waiting for the other process to reach offset %1 with length %2 for segment no. %3.", offset, *len, wanted_segment_no);
+            reported = true;
+        }
+
+        mssleep(GRANULARITY);
+    }
+
+    errno = 0;
+    return false;
+}
+
 void transcoder_cache_path(std::string * path)
 {
     if (params.m_cachepath.size())
@@ -438,6 +587,40 @@ void transcoder_cache_path(std::string * path)
     append_sep(path);
 }
 
+const CACHEROOT_VEC & transcoder_cache_roots()
+{
+    static const CACHEROOT_VEC roots = []
+    {
+        CACHEROOT_VEC vec;
+        CACHEROOT primary;
+
+        transcoder_cache_path(&primary.m_path);
+        primary.m_weight        = 1;
+        primary.m_min_diskspace = params.m_min_diskspace;
+
+        vec.push_back(primary);
+
+        for (const CACHEROOT & cache_root : *params.m_cache_roots)
+        {
+            CACHEROOT root(cache_root);
+
+            root.m_path += PACKAGE;
+            append_sep(&root.m_path);
+
+            if (!root.m_min_diskspace)
+            {
+                root.m_min_diskspace = params.m_min_diskspace;
+            }
+
+            vec.push_back(root);
+        }
+
+        return vec;
+    }();
+
+    return roots;
+}
+
 bool transcoder_init()
 {
     if (cache == nullptr)
@@ -457,6 +640,12 @@ bool transcoder_init()
             return false;
         }
     }
+
+    if (ram_cache == nullptr && params.m_ram_cache_size)
+    {
+        Logging::debug(nullptr, "Creating memory tier with %1.", format_size(params.m_ram_cache_size).c_str());
+        ram_cache = std::make_unique<Cache_Ram>(params.m_ram_cache_size, params.m_ram_cache_max_item, params.m_ram_cache_min_hits);
+    }
     return true;
 }
 
@@ -468,6 +657,13 @@ void transcoder_free()
 
         Logging::debug(nullptr, "Deleting media file cache.");
     }
+
+    if (ram_cache != nullptr)
+    {
+        ram_cache.reset();
+
+        Logging::debug(nullptr, "Deleting memory tier.");
+    }
 }
 
 bool transcoder_cached_filesize(LPVIRTUALFILE virtualfile, struct stat *stbuf)
@@ -549,6 +745,7 @@ bool transcoder_predict_filesize(LPVIRTUALFILE virtualfile, Cache_Entry* cache_e
             cache_entry->m_cache_info.m_predicted_filesize  = transcoder.predicted_filesize();
             cache_entry->m_cache_info.m_video_frame_count   = transcoder.video_frame_count();
             cache_entry->m_cache_info.m_segment_count       = transcoder.segment_count();
+            cache_entry->m_cache_info.m_segment_starts      = virtualfile->get_segment_starts();
             cache_entry->m_cache_info.m_duration            = transcoder.duration();
         }
 
@@ -601,6 +798,17 @@ static int start_transcoder_thread(Cache_Entry* cache_entry)
         }
     }
 
+    bool rebuild = !cache_entry->m_remote_claim;
+
+    cache_entry->claim_rebuild(&rebuild);
+
+    if (!rebuild)
+    {
+        // Another process is transcoding the file, read_remote() follows it
+        cache_entry->m_is_decoding = false;
+        return 0;
+    }
+
     const FFmpegfs_Format *current_format = params.current_format(cache_entry->virtualfile());
     if (current_format != nullptr &&
             current_format->is_multiformat() &&
@@ -689,9 +897,16 @@ Cache_Entry* transcoder_new(LPVIRTUALFILE virtualfile, bool begin_transcode)
             // Disable cache
             cache_entry->clear();
         }
-        else if (!cache_entry->m_is_decoding && cache_entry->outdated())
+        else if (!cache_entry->m_is_decoding && !cache_entry->m_remote_claim && cache_entry->outdated())
         {
-            cache_entry->clear();
+            bool erase_cache = true;
+
+            cache_entry->claim_rebuild(&erase_cache);
+
+            if (erase_cache)
+            {
+                cache_entry->clear();
+            }
         }
 
         if (cache_entry->m_cache_info.m_duration)
@@ -707,6 +922,22 @@ Cache_Entry* transcoder_new(LPVIRTUALFILE virtualfile, bool begin_transcode)
             virtualfile->m_video_frame_count    = cache_entry->m_cache_info.m_video_frame_count;
         }
 
+        if (params.m_hls_keyframe_segments && (virtualfile->m_flags & VIRTUALFLAG_HLS) && !virtualfile->segment_starts_known())
+        {
+            if (cache_entry->m_cache_info.m_keyframe_segments && cache_entry->m_cache_info.m_segment_count)
+            {
+                // Segment boundaries have been recorded when the input was opened before.
+                // Empty if there were no usable key frames and fixed length segments are used.
+                virtualfile->set_segment_starts(std::vector<int64_t>(cache_entry->m_cache_info.m_segment_starts));
+            }
+            else if (!transcoder_predict_filesize(virtualfile, cache_entry))
+            {
+                // Segment boundaries depend on the key frames of the input, open it even if
+                // everything else is known from the cache.
+                throw static_cast<int>(errno);
+            }
+        }
+
         if (!cache_entry->m_is_decoding && !cache_entry->is_finished_success())
         {
             if (begin_transcode)
@@ -764,16 +995,54 @@ bool transcoder_read(Cache_Entry* cache_entry, char* buff, size_t offset, size_t
     // Update read counter
     cache_entry->update_read_count();
 
+    const bool trace = cache_trace_active();
+    std::chrono::steady_clock::time_point trace_start;
+    uint8_t trace_flags = 0;
+
+    if (trace)
+    {
+        trace_start = std::chrono::steady_clock::now();
+    }
+
     try
     {
+        // Another process is transcoding this file, read what it has written so far
+        if (cache_entry->m_remote_claim)
+        {
+            if (read_remote(cache_entry, buff, offset, &len, segment_no))
+            {
+                throw true;
+            }
+
+            if (errno)
+            {
+                throw false;
+            }
+        }
+
         // For HLS partial/seeked caches, FINISHED_INCOMPLETE must not mark
         // skipped segments as complete.  Only FINISHED_SUCCESS covers all
         // segments; otherwise the per-segment finished flag decides.
         const bool segment_logically_complete = segment_no &&
                 (cache_entry->m_buffer->is_segment_finished(segment_no) || cache_entry->is_finished_success());
+        const bool item_complete = segment_no ? segment_logically_complete : cache_entry->is_finished_success();
         bool segment_complete = segment_logically_complete;
         bool repair_requested = false;
 
+        if (item_complete)
+        {
+            trace_flags |= TRACE_FLAG_HIT;
+        }
+
+        // Hot finished items are served from the memory tier without touching the disk cache.
+        if (ram_cache != nullptr && item_complete &&
+                ram_cache->read(cache_entry->m_buffer->cachefile(segment_no), cache_entry->m_buffer->cachefile(segment_no), reinterpret_cast<uint8_t*>(buff), offset, &len))
+        {
+            trace_flags |= TRACE_FLAG_RAM;
+            errno = 0;
+            throw true;
+        }
+
         if (segment_logically_complete && !cache_entry->m_buffer->cachefile_valid(segment_no))
         {
             wait_for_active_transcoder(cache_entry, segment_no, "segment");
@@ -797,6 +1066,11 @@ bool transcoder_read(Cache_Entry* cache_entry, char* buff, size_t offset, size_t
             }
         }
 
+        if (repair_requested)
+        {
+            trace_flags &= static_cast<uint8_t>(~TRACE_FLAG_HIT);
+        }
+
         const bool segment_missing  = segment_no && !segment_complete;
 
         // For HLS partial caches, an incomplete cache is still usable.  Only
@@ -959,6 +1233,17 @@ bool transcoder_read(Cache_Entry* cache_entry, char* buff, size_t offset, size_t
                 errno = cache_entry->m_cache_info.m_errno ? cache_entry->m_cache_info.m_errno : EIO;
                 throw false;
             }
+
+            // Count reads from the start of finished items, hot ones will be kept in memory
+            if (ram_cache != nullptr && !offset && item_complete)
+            {
+                Buffer * buffer = cache_entry->m_buffer.get();
+
+                ram_cache->access(buffer->cachefile(segment_no), buffer->cachefile(segment_no), buffer->buffer_watermark(segment_no), [buffer, segment_no](uint8_t *data, size_t size)
+                {
+                    return buffer->copy(data, 0, size, segment_no);
+                });
+            }
         }
 
         errno = 0;
@@ -970,6 +1255,21 @@ bool transcoder_read(Cache_Entry* cache_entry, char* buff, size_t offset, size_t
 
     *bytes_read = static_cast<int>(len);
 
+    if (trace && success)
+    {
+        TRACE_RECORD record = {};
+
+        record.m_key        = cache_trace_key(cache_entry->m_cache_info.m_destfile, cache_entry->m_cache_info.m_desttype.data());
+        record.m_offset     = offset;
+        record.m_size       = len;
+        record.m_duration   = static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - trace_start).count());
+        record.m_segment_no = segment_no;
+        record.m_event      = TRACE_EVENT::READ;
+        record.m_flags      = trace_flags;
+
+        cache_trace(record);
+    }
+
     return success;
 }
 
@@ -1002,14 +1302,40 @@ bool transcoder_read_frame(Cache_Entry* cache_entry, char* buff, size_t offset,
         }
 
         std::vector<uint8_t> data;
+        std::string cachefile;
+        std::string frame_key;
 
-        // Try to read the requested frame first.  Frame-set files are opened
-        // through their parent object without starting the transcoder, because
-        // the exact frame number is only known here.  Therefore a cache miss
-        // must start or wake the transcoder from this read path.
-        success = cache_entry->m_buffer->read_frame(&data, frame_no);
-        if (!success)
+        if (ram_cache != nullptr)
         {
+            cachefile = cache_entry->m_buffer->cachefile(0);
+            frame_key = Cache_Ram::frame_key(cachefile, frame_no);
+        }
+
+        // Try the memory tier first, then the requested frame in the disk cache.
+        // Frame-set files are opened through their parent object without starting
+        // the transcoder, because the exact frame number is only known here.
+        // Therefore a cache miss must start or wake the transcoder from this read path.
+        if (ram_cache != nullptr && ram_cache->read(frame_key, cachefile, &data))
+        {
+            success = true;
+        }
+        else if (cache_entry->m_buffer->read_frame(&data, frame_no))
+        {
+            success = true;
+
+            if (ram_cache != nullptr && !offset)
+            {
+                ram_cache->access(frame_key, cachefile, data.size(), [&data](uint8_t *buffer, size_t size)
+                {
+                    std::memcpy(buffer, data.data(), size);
+                    return true;
+                });
+            }
+        }
+        else
+        {
+            success = false;
+
             if (errno != EAGAIN)
             {
                 Logging::error(cache_entry->virtname(), "Reading image frame no. %1: (%2) %3", frame_no, errno, strerror(errno));
@@ -1165,11 +1491,11 @@ void transcoder_exit()
     thread_exit = true;
 }
 
-bool transcoder_cache_maintenance()
+bool transcoder_cache_maintenance(bool throttled)
 {
     if (cache != nullptr)
     {
-        return cache->maintenance();
+        return cache->maintenance(0, std::string(), throttled);
     }
     else
     {
@@ -1177,8 +1503,59 @@ bool transcoder_cache_maintenance()
     }
 }
 
+bool transcoder_start_scrubber()
+{
+    if (cache != nullptr)
+    {
+        return cache->start_scrubber(params.m_cache_scrub);
+    }
+    else
+    {
+        return false;
+    }
+}
+
+bool transcoder_start_sweep()
+{
+    if (cache != nullptr && !params.m_disable_cache)
+    {
+        return cache->start_sweep(params.m_cache_sweep);
+    }
+    else
+    {
+        return false;
+    }
+}
+
+bool transcoder_cached_segment_sizes(LPVIRTUALFILE virtualfile, std::vector<size_t> *sizes)
+{
+    Cache_Entry* cache_entry = cache->openio(virtualfile);
+    if (cache_entry == nullptr)
+    {
+        return false;
+    }
+
+    Buffer::CHECKSUM_VEC checksums(cache_entry->m_cache_info.m_checksums);
+
+    // Prefer the live state if the buffer is open
+    cache_entry->m_buffer->get_checksums(&checksums);
+
+    sizes->resize(checksums.size());
+    for (size_t n = 0; n < checksums.size(); n++)
+    {
+        (*sizes)[n] = static_cast<size_t>(checksums[n].m_size);
+    }
+
+    return !sizes->empty();
+}
+
 bool transcoder_cache_clear()
 {
+    if (ram_cache != nullptr)
+    {
+        ram_cache->clear();
+    }
+
     if (cache != nullptr)
     {
         return cache->clear();
@@ -1189,6 +1566,30 @@ bool transcoder_cache_clear()
     }
 }
 
+bool transcoder_cache_export(const std::string & archive)
+{
+    if (cache == nullptr)
+    {
+        return false;
+    }
+
+    Cache_Archive cache_archive(cache);
+
+    return cache_archive.export_cache(archive);
+}
+
+bool transcoder_cache_import(const std::string & archive)
+{
+    if (cache == nullptr)
+    {
+        return false;
+    }
+
+    Cache_Archive cache_archive(cache);
+
+    return cache_archive.import_cache(archive, std::max(std::thread::hardware_concurrency(), 1u));
+}
+
 /**
  * @brief Actually transcode file
  * @param[inout] thread_data - Thread data with lock objects
@@ -1206,8 +1607,19 @@ static bool transcode(std::shared_ptr<THREAD_DATA> thread_data, Cache_Entry *cac
     const bool partial_multiformat_recode =
             cache_entry->m_seek_to_no != 0 &&
             params.current_format(cache_entry->virtualfile())->is_multiformat();
+    const bool resume_transcode = !partial_multiformat_recode && cache_entry->can_resume();
+
+    if (resume_transcode)
+    {
+        // Interrupted run: keep the file written so far and continue at the
+        // last resume point. The transcoder starts over if that fails.
+        cache_entry->m_cache_info.m_error   = false;
+        cache_entry->m_cache_info.m_errno   = 0;
+        cache_entry->m_cache_info.m_averror = 0;
 
-    if (partial_multiformat_recode)
+        transcoder.set_resume_point(cache_entry->m_cache_info.m_resume);
+    }
+    else if (partial_multiformat_recode)
     {
         // HLS/frame-set repair run: keep existing segments/frames and start
         // directly at the requested item. Existing later items may be
@@ -1230,6 +1642,7 @@ static bool transcode(std::shared_ptr<THREAD_DATA> thread_data, Cache_Entry *cac
     try
     {
         bool unlocked = false;
+        std::chrono::steady_clock::time_point resume_saved = std::chrono::steady_clock::now();
 
         Logging::info(cache_entry->filename(), "Transcoding to %1.", params.current_format(cache_entry->virtualfile())->desttype().c_str());
 
@@ -1244,6 +1657,17 @@ static bool transcode(std::shared_ptr<THREAD_DATA> thread_data, Cache_Entry *cac
             throw (static_cast<int>(errno));
         }
 
+        if (cache != nullptr && transcoder.can_index_keyframes())
+        {
+            // Seek directly to key frames if they have been indexed before
+            FFmpeg_KeyframeIndex keyframe_index;
+
+            if (cache->read_keyframe_index(cache_entry->virtualfile(), &keyframe_index) && transcoder.set_keyframe_index(keyframe_index))
+            {
+                Logging::debug(cache_entry->filename(), "Using key frame index with %1 entries.", keyframe_index.size());
+            }
+        }
+
         if (!cache_entry->m_cache_info.m_duration)
         {
             cache_entry->m_cache_info.m_duration            = transcoder.duration();
@@ -1262,9 +1686,10 @@ static bool transcode(std::shared_ptr<THREAD_DATA> thread_data, Cache_Entry *cac
         if (!cache_entry->m_cache_info.m_segment_count)
         {
             cache_entry->m_cache_info.m_segment_count       = transcoder.segment_count();
+            cache_entry->m_cache_info.m_segment_starts      = cache_entry->virtualfile()->get_segment_starts();
         }
 
-        if (cache != nullptr && !cache->maintenance(transcoder.predicted_filesize()))
+        if (cache != nullptr && !cache->check_watermarks(transcoder.predicted_filesize(), cache_entry->m_cache_info.m_cache_root))
         {
             throw (static_cast<int>(errno));
         }
@@ -1329,6 +1754,9 @@ static bool transcode(std::shared_ptr<THREAD_DATA> thread_data, Cache_Entry *cac
                 cache_entry->update_access(false);
             }
 
+            // Others reading the file would have to read dropped pages back from disk
+            cache_entry->m_buffer->allow_drop_behind(cache_entry->ref_count() <= 1);
+
             if (transcoder.is_frameset())
             {
                 uint32_t frame_no = cache_entry->m_seek_to_no;
@@ -1360,6 +1788,15 @@ static bool transcode(std::shared_ptr<THREAD_DATA> thread_data, Cache_Entry *cac
 
             averror = transcoder.process_single_fr(&status);
 
+            // Let other processes sharing the cache follow
+            cache_entry->publish_claim();
+
+            if (status == DECODER_STATUS::DEC_SUCCESS)
+            {
+                // Remember where to continue if we get interrupted
+                save_resume_point(cache_entry, &resume_saved);
+            }
+
             if (status == DECODER_STATUS::DEC_ERROR)
             {
                 errno = EIO;
@@ -1531,6 +1968,58 @@ static void log_transcoding_result(Cache_Entry* cache_entry,
     }
 }
 
+/**
+ * @brief Get the CPU time used by the process.
+ *
+ * Includes FFmpeg's codec threads, which do most of the work when encoding
+ * video, but also everything else the process does at the same time.
+ * @return Returns the CPU time in milliseconds, or 0 if not available.
+ */
+static uint64_t process_cpu_time_ms()
+{
+    struct rusage usage;
+
+    if (getrusage(RUSAGE_SELF, &usage) == -1)
+    {
+        return 0;
+    }
+
+    return static_cast<uint64_t>(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000 + static_cast<uint64_t>(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1000;
+}
+
+/**
+ * @brief Record the end of a transcode in the cache trace.
+ *
+ * The CPU time is that of the whole process while the transcode ran. If
+ * other transcodes ran at the same time, it includes theirs and the record
+ * is flagged with TRACE_FLAG_SHARED.
+ *
+ * @param[in] cache_entry - Cache entry that was transcoded.
+ * @param[in] start_time - Wall clock time the transcoder thread started.
+ * @param[in] cpu_start - CPU time of the process at start, see process_cpu_time_ms().
+ * @param[in] shared - true if other transcodes ran at the same time.
+ */
+static void trace_transcode(Cache_Entry* cache_entry, const std::chrono::steady_clock::time_point& start_time, uint64_t cpu_start, bool shared)
+{
+    TRACE_RECORD record = {};
+
+    record.m_key        = cache_trace_key(cache_entry->m_cache_info.m_destfile, cache_entry->m_cache_info.m_desttype.data());
+    record.m_size       = cache_entry->m_cache_info.m_encoded_filesize;
+    record.m_duration   = static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start_time).count());
+    record.m_cpu_time   = static_cast<uint32_t>(process_cpu_time_ms() - cpu_start);
+    record.m_event      = TRACE_EVENT::TRANSCODE;
+    if (cache_entry->is_finished_success() && !cache_entry->m_cache_info.m_error)
+    {
+        record.m_flags |= TRACE_FLAG_COMPLETE;
+    }
+    if (shared)
+    {
+        record.m_flags |= TRACE_FLAG_SHARED;
+    }
+
+    cache_trace(record);
+}
+
 /**
  * @brief Transcoding thread
  * @param[in] thread_data - Corresponding thread data object.
@@ -1543,6 +2032,9 @@ static int transcoder_thread(std::shared_ptr<THREAD_DATA> thread_data)
     bool timeout = false;
     bool success = true;
     const auto start_time = std::chrono::steady_clock::now();
+    const uint64_t cpu_start = cache_trace_active() ? process_cpu_time_ms() : 0;
+    const uint64_t started = ++transcoders_started;
+    bool shared = (++transcoders_running > 1);
 
     std::unique_lock<std::recursive_mutex> lock_active_mutex(cache_entry->m_active_mutex);
     std::unique_lock<std::recursive_mutex> lock_restart_mutex(cache_entry->m_restart_mutex);
@@ -1601,8 +2093,24 @@ cache_entry->m_is_decoding = false;
 
 	log_transcoding_result(cache_entry, transcoder, timeout, success, start_time);
 
+    // Others started since or still running from before share the CPU time
+    shared |= (transcoders_started != started);
+    --transcoders_running;
+
+    if (cache_trace_active())
+    {
+        trace_transcode(cache_entry, start_time, cpu_start, shared);
+    }
+
     int _errno = cache_entry->m_cache_info.m_errno;
 
+    if (!cache_entry->m_is_decoding)
+    {
+        // Readers may still have the entry open, but transcoding is done.
+        // Must be done before closeio(), which may delete the entry.
+        cache_entry->release_claim();
+    }
+
     if (cache != nullptr)
     {
         cache->closeio(&cache_entry, timeout ? CACHE_CLOSE_DELETE : CACHE_CLOSE_NOOPT);
@@ -53,6 +53,16 @@
  *         otherwise @c false and @p stbuf is left unchanged.
  */
 bool            transcoder_cached_filesize(LPVIRTUALFILE virtualfile, struct stat *stbuf);
+/**
+ * @brief Get the sizes of finished HLS segments as recorded with their checksums.
+ *
+ * Allows listing segments without a stat() call per segment file.
+ *
+ * @param[in] virtualfile Virtual file of the HLS set.
+ * @param[out] sizes Receives one size per segment, 0 if the segment is not finished.
+ * @return Returns @c true if sizes are available; otherwise @c false.
+ */
+bool            transcoder_cached_segment_sizes(LPVIRTUALFILE virtualfile, std::vector<size_t> *sizes);
 /**
  * @brief Calculate and store the predicted transcoded file size.
  *
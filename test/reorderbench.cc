@@ -0,0 +1,239 @@
+/*
+ * Copyright (C) 2026 Norbert Schlia (nschlia@oblivion-software.de)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+// Times FFmpeg_ReorderBuffer against the std::multimap the transcoder used
+// before, with the same access pattern: frames of an audio and a video stream
+// are added in decoding order, the video frames partly out of order, and taken
+// out once they are more than the buffer delay behind the latest frame.
+// Fails if both do not return the frames in the same order.
+
+#include "ffmpeg_reorderbuffer.h"
+
+#include <chrono>
+#include <cinttypes>
+#include <cstdlib>
+#include <map>
+#include <cstdio>
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wconversion"
+#pragma GCC diagnostic ignored "-Wsign-conversion"
+extern "C" {
+#include <libavutil/frame.h>
+}
+#pragma GCC diagnostic pop
+
+typedef FFmpeg_ReorderBuffer::MULTIFRAME MULTIFRAME;
+typedef std::multimap<int64_t, MULTIFRAME> MULTIFRAME_MAP;
+
+static constexpr int        VIDEO_STREAM    = 0;
+static constexpr int        AUDIO_STREAM    = 1;
+static constexpr int64_t    VIDEO_DURATION  = 40000;    // 25 fps, AV_TIME_BASE units
+static constexpr int64_t    AUDIO_DURATION  = 21333;    // 1024 samples at 48 kHz
+static constexpr int64_t    DELAY           = 2 * AV_TIME_BASE;
+static constexpr int        VIDEO_FRAMES    = 25 * 60 * 10;     // Ten minutes
+static constexpr int        RUNS            = 5;
+
+typedef struct ITEM
+{
+    int64_t m_pos;
+    int     m_stream_idx;
+} ITEM;
+
+/**
+ * @brief Make up the frames in decoding order.
+ * Every third video frame is swapped with the one before, like B-frames.
+ */
+static std::vector<ITEM> make_items()
+{
+    std::vector<ITEM> items;
+    int64_t audio_pos = 0;
+
+    for (int n = 0; n < VIDEO_FRAMES; n++)
+    {
+        int64_t video_pos = n * VIDEO_DURATION;
+
+        if (n % 3 == 1 && n + 1 < VIDEO_FRAMES)
+        {
+            video_pos += VIDEO_DURATION;
+        }
+        else if (n % 3 == 2)
+        {
+            video_pos -= VIDEO_DURATION;
+        }
+
+        items.push_back({ video_pos, VIDEO_STREAM });
+
+        while (audio_pos < (n + 1) * VIDEO_DURATION)
+        {
+            items.push_back({ audio_pos, AUDIO_STREAM });
+            audio_pos += AUDIO_DURATION;
+        }
+    }
+
+    return items;
+}
+
+/**
+ * @brief Make a frame with a small picture, so that it can be cloned.
+ */
+static FFmpeg_Frame make_frame(int stream_idx)
+{
+    FFmpeg_Frame frame(stream_idx);
+
+    frame->format   = AV_PIX_FMT_GRAY8;
+    frame->width    = 16;
+    frame->height   = 16;
+
+    if (av_frame_get_buffer(frame, 0) < 0)
+    {
+        fprintf(stderr, "ERROR: Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    return frame;
+}
+
+static int stream_idx(const MULTIFRAME & multiframe)
+{
+    return std::visit([](const auto & frame) { return frame.m_stream_idx; }, multiframe);
+}
+
+/**
+ * @brief Old code: frames are copied in and out of the map, i.e. cloned.
+ */
+static double run_multimap(const std::vector<ITEM> & items, const FFmpeg_Frame & templ, std::vector<ITEM> *out)
+{
+    MULTIFRAME_MAP frame_map;
+
+    auto start = std::chrono::steady_clock::now();
+
+    for (const ITEM & item : items)
+    {
+        FFmpeg_Frame frame(templ);
+
+        frame.m_stream_idx = item.m_stream_idx;
+
+        frame_map.emplace(item.m_pos, frame);
+
+        while (frame_map.cbegin()->first + DELAY <= frame_map.crbegin()->first)
+        {
+            MULTIFRAME_MAP::const_iterator it = frame_map.cbegin();
+            MULTIFRAME multiframe = it->second;
+            out->push_back({ it->first, stream_idx(multiframe) });
+            frame_map.erase(it);
+        }
+    }
+
+    while (!frame_map.empty())
+    {
+        MULTIFRAME_MAP::const_iterator it = frame_map.cbegin();
+        MULTIFRAME multiframe = it->second;
+        out->push_back({ it->first, stream_idx(multiframe) });
+        frame_map.erase(it);
+    }
+
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+}
+
+/**
+ * @brief New code: frames are moved in and out of the rings.
+ */
+static double run_reorderbuffer(const std::vector<ITEM> & items, const FFmpeg_Frame & templ, std::vector<ITEM> *out)
+{
+    FFmpeg_ReorderBuffer frame_map;
+
+    auto start = std::chrono::steady_clock::now();
+
+    for (const ITEM & item : items)
+    {
+        FFmpeg_Frame frame(templ);
+
+        frame.m_stream_idx = item.m_stream_idx;
+
+        frame_map.push(item.m_pos, std::move(frame));
+
+        while (frame_map.front_pos() + DELAY <= frame_map.back_pos())
+        {
+            int64_t pos = frame_map.front_pos();
+            MULTIFRAME multiframe = frame_map.pop();
+            out->push_back({ pos, stream_idx(multiframe) });
+        }
+    }
+
+    while (!frame_map.empty())
+    {
+        int64_t pos = frame_map.front_pos();
+        MULTIFRAME multiframe = frame_map.pop();
+        out->push_back({ pos, stream_idx(multiframe) });
+    }
+
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main()
+{
+    const std::vector<ITEM> items = make_items();
+    const FFmpeg_Frame templ = make_frame(VIDEO_STREAM);
+    double best_multimap = 0;
+    double best_reorderbuffer = 0;
+
+    for (int run = 0; run < RUNS; run++)
+    {
+        std::vector<ITEM> out_multimap;
+        std::vector<ITEM> out_reorderbuffer;
+
+        out_multimap.reserve(items.size());
+        out_reorderbuffer.reserve(items.size());
+
+        double t_multimap       = run_multimap(items, templ, &out_multimap);
+        double t_reorderbuffer  = run_reorderbuffer(items, templ, &out_reorderbuffer);
+
+        if (out_multimap.size() != items.size() || out_reorderbuffer.size() != items.size())
+        {
+            fprintf(stderr, "ERROR: Frames lost\n");
+            return EXIT_FAILURE;
+        }
+
+        for (size_t n = 0; n < items.size(); n++)
+        {
+            if (out_multimap[n].m_pos != out_reorderbuffer[n].m_pos || out_multimap[n].m_stream_idx != out_reorderbuffer[n].m_stream_idx)
+            {
+                fprintf(stderr, "ERROR: Frame %zu differs: multimap %" PRId64 "/%d, reorder buffer %" PRId64 "/%d\n", n,
+                        out_multimap[n].m_pos, out_multimap[n].m_stream_idx,
+                        out_reorderbuffer[n].m_pos, out_reorderbuffer[n].m_stream_idx);
+                return EXIT_FAILURE;
+            }
+        }
+
+        if (!run || t_multimap < best_multimap)
+        {
+            best_multimap = t_multimap;
+        }
+        if (!run || t_reorderbuffer < best_reorderbuffer)
+        {
+            best_reorderbuffer = t_reorderbuffer;
+        }
+    }
+
+    printf("%zu frames, best of %d runs\n", items.size(), RUNS);
+    printf("std::multimap:        %8.1f ns per frame\n", best_multimap / static_cast<double>(items.size()));
+    printf("FFmpeg_ReorderBuffer: %8.1f ns per frame\n", best_reorderbuffer / static_cast<double>(items.size()));
+
+    return EXIT_SUCCESS;
+}